@@ -7,6 +7,9 @@ cdef extern from "cow.h":
         COW_DISABLE_MPI      =  (1<<1)
         COW_HASNAN           =  (1<<2)
         COW_HASINF           =  (1<<3)
+        COW_ALLOC_POOL       =  (1<<4) # reuse freed blocks on the domain
+        COW_ALLOC_HUGEPAGES  =  (1<<5) # 2MB aligned, transparent huge pages
+        COW_ALLOC_FIRSTTOUCH =  (1<<6) # data first written by its loop threads
 
         COW_ALL_DIMS             = -41
         COW_HIST_SPACING_LINEAR  = -42
@@ -20,16 +23,64 @@ cdef extern from "cow.h":
         COW_SAMPLE_LINEAR        = -50 # use (uni/bi/tri) linear interp
         COW_SAMPLE_ERROR_OUT     = -51 # out-of-bounds sample request
         COW_SAMPLE_ERROR_WRONGD  = -52 # wrong number of dims on sample coords
+        COW_HIST_STORAGE_DENSE   = -53 # one weight and count for every bin
+        COW_HIST_STORAGE_SPARSE  = -54 # hash map holding only populated bins
+        COW_HIST_SEAL_ALLREDUCE  = -55 # every rank holds the whole histogram
+        COW_HIST_SEAL_REDUCE     = -56 # only rank 0 holds the histogram
+        COW_HIST_SEAL_SCATTER    = -57 # each rank holds a block of slices
+        COW_SUM_PLAIN            = -58 # ordinary floating point accumulation
+        COW_SUM_COMPENSATED      = -59 # Kahan-Babuska (Neumaier) summation
+        COW_SUM_REPRODUCIBLE     = -60 # exact, order-independent summation
+        COW_STENCIL_CENTRAL2     = -61 # explicit central differences, 1 guard
+        COW_STENCIL_CENTRAL4     = -62 # " 4th order, 2 guard zones (default)
+        COW_STENCIL_CENTRAL6     = -63 # " 6th order, 3 guard zones
+        COW_STENCIL_CENTRAL8     = -64 # " 8th order, 4 guard zones
+        COW_STENCIL_COMPACT4     = -65 # 4th order Pade scheme, 2 guard zones
+        COW_STENCIL_COMPACT6     = -66 # 6th order Pade scheme, 3 guard zones
+        COW_VGT_Q                = -67 # second invariant of the velocity gradient
+        COW_VGT_R                = -68 # third invariant, -det(A)
+        COW_VGT_QS               = -69 # second invariant of the strain rate
+        COW_VGT_QW               = -70 # second invariant of the rotation rate
+        COW_VGT_LAMBDA1          = -71 # strain rate eigenvalues, largest first
+        COW_VGT_LAMBDA2          = -72
+        COW_VGT_LAMBDA3          = -73
+        COW_VGT_ENSTROPHYPROD    = -74 # vortex stretching, w_i S_ij w_j
+        COW_SYNC_BLOCKING        = -75 # transforms sync their result on return
+        COW_SYNC_OVERLAP         = -76 # overlap guard exchange with computation
+        COW_EXCHANGE_DATATYPE    = -77 # derived datatypes for 26 neighbors
+        COW_EXCHANGE_PERSISTENT  = -78 # persistent requests on pack buffers
+        COW_EXCHANGE_FACES       = -79 # " ", 6 face messages in dimension order
+        COW_SYNC_LAZY            = -80 # guard zones are synced when next read
+        COW_BOUNDARY_PERIODIC    = -81 # guard zones wrap around the domain
+        COW_BOUNDARY_OUTFLOW     = -82 # copies of the zone on the boundary
+        COW_BOUNDARY_REFLECTING  = -83 # mirror image, normal components negated
+        COW_BOUNDARY_SHEARING    = -84 # periodic, shifted along another dimension
+        COW_TOPOLOGY_CART        = -85 # process grid laid out by MPI_Cart_create
+        COW_TOPOLOGY_NODES       = -86 # compact blocks of processes on each node
+        COW_MEMORY_PRIVATE       = -87 # data allocated by each process
+        COW_MEMORY_SHARED        = -88 # " in a window shared on the node
+        COW_LAYOUT_INTERLEAVED   = -89 # members of each zone are adjacent
+        COW_LAYOUT_PLANAR        = -90 # each member is a contiguous array
+        COW_PRECISION_DOUBLE     = -91 # data stored as 64-bit doubles
+        COW_PRECISION_SINGLE     = -92 # " 32-bit floats, computed in double
 
     struct cow_domain
     struct cow_dfield
     struct cow_histogram
+    struct cow_pipeline
     ctypedef void (*cow_transform)(double *result, double **args, int **strides,
                                    void *udata)
+    ctypedef void (*cow_pencil)(double *result, double **args, int **strides,
+                                int *pstrides, int nzones, void *udata)
 
     void cow_init(int argc, char **argv, int modes)
     void cow_finalize()
     int cow_mpirunning()
+    void cow_memory_setbudget(long long bytes)
+    long long cow_memory_getbudget()
+    long long cow_memory_getinuse()
+    long long cow_memory_gethighwater()
+    void cow_memory_resethighwater()
 
     cow_domain *cow_domain_new()
     void cow_domain_commit(cow_domain *d)
@@ -38,17 +89,33 @@ cdef extern from "cow.h":
     void cow_domain_setndim(cow_domain *d, int ndim)
     void cow_domain_setguard(cow_domain *d, int guard)
     void cow_domain_setprocsizes(cow_domain *d, int dim, int size)
+    void cow_domain_settopology(cow_domain *d, int mode)
+    void cow_domain_setnodesize(cow_domain *d, int size)
+    void cow_domain_setcomm(cow_domain *d, void *comm)
+    void cow_domain_setcost(cow_domain *d, int dim, double *weights, int n)
+    void cow_domain_setallocator(cow_domain *d, int flags)
+    void cow_domain_releasepool(cow_domain *d)
     void cow_domain_setcollective(cow_domain *d, int mode)
     void cow_domain_setchunk(cow_domain *d, int mode)
     void cow_domain_setalign(cow_domain *d, int alignthreshold, int diskblocksize)
+    void cow_domain_setnumthreads(cow_domain *d, int nthreads)
+    void cow_domain_setstencil(cow_domain *d, int scheme)
+    void cow_domain_setexchange(cow_domain *d, int mode)
+    void cow_domain_setboundary(cow_domain *d, int dim, int side, int bc)
+    void cow_domain_setshear(cow_domain *d, int dim, int shiftdim, double shift)
     void cow_domain_readsize(cow_domain *d, char *fname, char *dname)
     int cow_domain_getndim(cow_domain *d)
     int cow_domain_getguard(cow_domain *d)
+    int cow_domain_getnumthreads(cow_domain *d)
+    int cow_domain_getallocator(cow_domain *d)
+    int cow_domain_getstencil(cow_domain *d)
+    int cow_domain_getexchange(cow_domain *d)
+    int cow_domain_getboundary(cow_domain *d, int dim, int side)
     long long cow_domain_getnumlocalzonesincguard(cow_domain *d, int dim)
     long long cow_domain_getnumlocalzonesinterior(cow_domain *d, int dim)
     long long cow_domain_getnumglobalzones(cow_domain *d, int dim)
     int cow_domain_getglobalstartindex(cow_domain *d, int dim)
-    int cow_domain_getgridspacing(cow_domain *d, int dim)
+    double cow_domain_getgridspacing(cow_domain *d, int dim)
     int cow_domain_getcartrank(cow_domain *d)
     int cow_domain_getcartsize(cow_domain *d)
     int cow_domain_subgridatposition(cow_domain *d, double x, double y, double z)
@@ -58,15 +125,32 @@ cdef extern from "cow.h":
 
     cow_dfield *cow_dfield_new()
     cow_dfield *cow_dfield_dup(cow_dfield *f)
+    cow_dfield *cow_dfield_redistribute(cow_dfield *f, cow_domain *d)
     void cow_dfield_commit(cow_dfield *f)
     void cow_dfield_del(cow_dfield *f)
     void cow_dfield_setdomain(cow_dfield *f, cow_domain *d)
     void cow_dfield_addmember(cow_dfield *f, char *name)
     void cow_dfield_setname(cow_dfield *f, char *name)
+    void cow_dfield_setcomponent(cow_dfield *f, int member, int dim)
+    void cow_dfield_setmemory(cow_dfield *f, int mode)
+    void cow_dfield_setlayout(cow_dfield *f, int mode)
+    void cow_dfield_setprecision(cow_dfield *f, int precision)
     void cow_dfield_extract(cow_dfield *f, int *I0, int *I1, void *out)
     void cow_dfield_replace(cow_dfield *f, int *I0, int *I1, void *out)
+    void cow_dfield_extractmembers(cow_dfield *f, int *I0, int *I1, void *out,
+                                   int *members, int nmembers)
+    void cow_dfield_replacemembers(cow_dfield *f, int *I0, int *I1, void *out,
+                                   int *members, int nmembers)
+    void *cow_dfield_getview(cow_dfield *f, int member, int *size, int *stride)
     void cow_dfield_loop(cow_dfield *f, cow_transform op, void *udata)
+    void cow_dfield_looppencil(cow_dfield *f, cow_pencil op, void *udata)
+    void cow_dfield_loopthreaded(cow_dfield *f, cow_transform op, void **udata)
+    void cow_dfield_looppencilthreaded(cow_dfield *f, cow_pencil op,
+                                       void **udata)
+    void cow_dfield_setthreadsafe(cow_dfield *f, int safe)
+    int cow_dfield_getnumthreads(cow_dfield *f)
     void cow_dfield_settransform(cow_dfield *f, cow_transform op)
+    void cow_dfield_settransformpencil(cow_dfield *f, cow_pencil op)
     void cow_dfield_clearargs(cow_dfield *f)
     void cow_dfield_pusharg(cow_dfield *f, cow_dfield *arg)
     void cow_dfield_setuserdata(cow_dfield *f, void *userdata)
@@ -80,6 +164,8 @@ cdef extern from "cow.h":
     cow_domain *cow_dfield_getdomain(cow_dfield *f)
     int cow_dfield_getstride(cow_dfield *f, int dim)
     int cow_dfield_getnmembers(cow_dfield *f)
+    int cow_dfield_getlayout(cow_dfield *f)
+    int cow_dfield_getprecision(cow_dfield *f)
     int cow_dfield_getflag(cow_dfield *f, int index)
     size_t cow_dfield_getdatabytes(cow_dfield *f)
     void cow_dfield_setdatabuffer(cow_dfield *f, void *buffer)
@@ -97,15 +183,27 @@ cdef extern from "cow.h":
     int cow_dfield_getownsflag(cow_dfield *f)
     int *cow_dfield_getflagbuffer(cow_dfield *f)
     void cow_dfield_syncguard(cow_dfield *f)
+    void cow_dfield_syncguard_begin(cow_dfield *f)
+    void cow_dfield_syncguard_end(cow_dfield *f)
+    void cow_dfield_syncguard_many(cow_dfield **fs, int n)
+    void cow_dfield_syncguard_partial(cow_dfield *f, int dims, int depth)
+    void cow_dfield_setsyncmode(cow_dfield *f, int mode)
+    void cow_dfield_settransformstencil(cow_dfield *f, int dims, int depth)
     void cow_dfield_reduce(cow_dfield *f, double x[3])
+    void cow_dfield_setsummode(cow_dfield *f, int mode)
     void cow_dfield_write(cow_dfield *f, char *fname)
     void cow_dfield_read(cow_dfield *f, char *fname)
+    void cow_dfield_readmany(cow_dfield **fs, int n, char *fname)
 
     cow_histogram *cow_histogram_new()
     void cow_histogram_commit(cow_histogram *h)
     void cow_histogram_del(cow_histogram *h)
     void cow_histogram_setbinmode(cow_histogram *h, int binmode)
     void cow_histogram_setspacing(cow_histogram *h, int spacing)
+    void cow_histogram_setstorage(cow_histogram *h, int storage)
+    void cow_histogram_setsealmode(cow_histogram *h, int sealmode)
+    void cow_histogram_setsummode(cow_histogram *h, int summode)
+    void cow_histogram_setndims(cow_histogram *h, int ndims)
     void cow_histogram_setnbins(cow_histogram *h, int dim, int nbinsx)
     void cow_histogram_setlower(cow_histogram *h, int dim, double v0)
     void cow_histogram_setupper(cow_histogram *h, int dim, double v1)
@@ -114,19 +212,40 @@ cdef extern from "cow.h":
     void cow_histogram_setdomaincomm(cow_histogram *h, cow_domain *d)
     void cow_histogram_addsample1(cow_histogram *h, double x, double w)
     void cow_histogram_addsample2(cow_histogram *h, double x, double y, double w)
+    void cow_histogram_addsample(cow_histogram *h, double *x, double w)
     void cow_histogram_dumpascii(cow_histogram *h, char *fn)
     void cow_histogram_dumphdf5(cow_histogram *h, char *fn, char *dn)
     void cow_histogram_seal(cow_histogram *h)
     int cow_histogram_getsealed(cow_histogram *h)
     long cow_histogram_gettotalcounts(cow_histogram *h)
     void cow_histogram_populate(cow_histogram *h, cow_dfield *f, cow_transform op)
+    void cow_histogram_populatepencil(cow_histogram *h, cow_dfield *f,
+                                      cow_pencil op, void *udata)
     void cow_histogram_getbinlocx(cow_histogram *h, double **x, int *n0)
     void cow_histogram_getbinlocy(cow_histogram *h, double **x, int *n0)
     void cow_histogram_getbinval1(cow_histogram *h, double **x, int *n0)
     void cow_histogram_getbinval2(cow_histogram *h, double **x, int *n0, int *n1)
+    int cow_histogram_getndims(cow_histogram *h)
+    void cow_histogram_getbinloc(cow_histogram *h, int dim, double **x, int *n0)
+    void cow_histogram_getbinvals(cow_histogram *h, double **x, long *n0)
+    void cow_histogram_getbinindices(cow_histogram *h, long **I, long *n0)
+    void cow_histogram_getbinrange(cow_histogram *h, long *start, long *stop)
     double cow_histogram_getbinval(cow_histogram *h, int i, int j)
+    double cow_histogram_getbinvaln(cow_histogram *h, int *I)
     char *cow_histogram_getname(cow_histogram *h)
 
+    cow_pipeline *cow_pipeline_new(cow_domain *d)
+    void cow_pipeline_del(cow_pipeline *p)
+    void cow_pipeline_settilesize(cow_pipeline *p, int zones)
+    int cow_pipeline_addinput(cow_pipeline *p, cow_dfield *f)
+    int cow_pipeline_addstage(cow_pipeline *p, cow_transform op, int *args,
+                              int nargs, int nmembers, int stencil, void *udata)
+    int cow_pipeline_addpencilstage(cow_pipeline *p, cow_pencil op, int *args,
+                                    int nargs, int nmembers, int stencil,
+                                    void *udata)
+    void cow_pipeline_setoutput(cow_pipeline *p, int node, cow_dfield *f)
+    void cow_pipeline_execute(cow_pipeline *p)
+
     void cow_fft_pspecscafield(cow_dfield *f, cow_histogram *h)
     void cow_fft_pspecvecfield(cow_dfield *f, cow_histogram *h)
     void cow_fft_helmholtzdecomp(cow_dfield *f, int mode)
@@ -138,6 +257,40 @@ cdef extern from "cow.h":
     void cow_trans_magnitude(double *result, double **args, int **s, void *u)
     void cow_trans_cross(double *result, double **args, int **s, void *u)
     void cow_trans_dot3(double *result, double **args, int **s, void *u)
+    void cow_pencil_divcorner(double *result, double **args, int **s, int *p,
+                              int n, void *u)
+    void cow_pencil_div5(double *result, double **args, int **s, int *p, int n,
+                         void *u)
+    void cow_pencil_rot5(double *result, double **args, int **s, int *p, int n,
+                         void *u)
+    void cow_pencil_component(double *result, double **args, int **s, int *p,
+                              int n, void *u)
+    void cow_pencil_magnitude(double *result, double **args, int **s, int *p,
+                              int n, void *u)
+    void cow_pencil_cross(double *result, double **args, int **s, int *p, int n,
+                          void *u)
+    void cow_pencil_dot3(double *result, double **args, int **s, int *p, int n,
+                         void *u)
+    void cow_deriv_div5(double *result, double **args, int **s, int *p, int n,
+                        void *u)
+    void cow_deriv_rot5(double *result, double **args, int **s, int *p, int n,
+                        void *u)
+    void cow_deriv_divcorner(double *result, double **args, int **s, int *p,
+                             int n, void *u)
+    void cow_deriv_grad(double *result, double **args, int **s, int *p, int n,
+                        void *u)
+    void cow_deriv_lapl(double *result, double **args, int **s, int *p, int n,
+                        void *u)
+    void cow_deriv_div(double *result, double **args, int **s, int *p, int n,
+                       void *u)
+    void cow_deriv_curl(double *result, double **args, int **s, int *p, int n,
+                        void *u)
+    void cow_deriv_strain(double *result, double **args, int **s, int *p, int n,
+                          void *u)
+    int cow_stencil_getguard(int scheme)
+    void cow_dfield_derivative(cow_dfield *result, cow_dfield *f, int dim)
+    void cow_dfield_vgtinvariants(cow_dfield *result, cow_dfield *vel, int *which)
+    void cow_histogram_populatevgt(cow_histogram *h, cow_dfield *vel, int *which)
 
 
 cdef class DistributedDomain(object):
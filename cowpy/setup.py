@@ -12,6 +12,7 @@ config = {
     'COW_HDF5_MPI': 0,
     'COW_FFTW': 0,
     'COW_MPI': 0,
+    'COW_OPENMP': 0,
     'include_dirs': [ ],
     'library_dirs': [ ],
     'libraries': [ ],
@@ -3,8 +3,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #define COW_PRIVATE_DEFS
 #include "cow.h"
+#if (COW_MPI)
+#include "remap_3d.h"
+#endif
+
+#define WIDE_TILE 8 // rows along each axis of a tile widened to double
 
 // -----------------------------------------------------------------------------
 //
@@ -41,14 +47,73 @@ static void _domain_maketags2d(cow_domain *d);
 static void _domain_maketags3d(cow_domain *d);
 static void _domain_alloctags(cow_domain *d);
 static void _domain_freetags(cow_domain *d);
+static int _domain_neighbor(cow_domain *d, int *index);
+static void _domain_procgrid(cow_domain *d);
+static void _domain_makecuts(cow_domain *d, int dim);
+static MPI_Comm _domain_nodecomm(cow_domain *d);
 static void _dfield_maketype1d(cow_dfield *f);
 static void _dfield_maketype2d(cow_dfield *f);
 static void _dfield_maketype3d(cow_dfield *f);
 static void _dfield_alloctype(cow_dfield *f);
 static void _dfield_freetype(cow_dfield *f);
+static int _exchange_boxes(cow_domain *d, int faces, int mask, int depth,
+			  int *box, int *nbr, int *first);
+static int _exchange_zones(int *box);
+static void _dfield_makeexchange(cow_dfield *f);
+static void _dfield_freeexchange(cow_dfield *f);
+static void _exchange_start(cow_dfield *f, int stage);
+static void _exchange_pack(cow_dfield *f, int *box, char *buf, char op);
+static struct cow_synctype *_dfield_synctype(cow_dfield *f, int mask,
+					     int depth);
+static void _dfield_freesynctypes(cow_dfield *f);
+static void _domain_nodeshared(cow_domain *d);
+static void _dfield_allocshared(cow_dfield *f);
+static void _dfield_syncnode(cow_dfield *f, int mask, int depth);
+static void _dfield_loadpeer(cow_dfield *f, int *box, int rank);
+static void _dfield_boxtype(cow_dfield *f, int *sub, int *start,
+			    MPI_Datatype *type);
 #endif
+static void _dfield_freedata(cow_dfield *f);
+static void _dfield_strides(cow_dfield *f, int *N);
+static int _rowblocks(cow_dfield *f);
+static void _dfield_firsttouch(cow_dfield *f);
+static void _dfield_loop(cow_dfield *f, cow_transform op, void **udata,
+			 int nthreads, int halo);
+static void _dfield_pencils(cow_domain *d, cow_dfield *result,
+			    cow_dfield **args, int nargs, cow_pencil op,
+			    void **udata, int nthreads, int halo);
+static void _dfield_pencilsbox(cow_domain *d, cow_dfield *result,
+			       cow_dfield **args, int nargs, cow_pencil op,
+			       void **udata, int nthreads, int lo[3],
+			       int hi[3], int halo);
+static void _transformbox(cow_dfield *f, int lo[3], int hi[3]);
+static void _dfield_fillguard(cow_dfield *f, int mask, int depth);
+static int _guardmask(cow_domain *d, int dims);
+static int _periodic(cow_domain *d, int dim);
+static int _onboundary(cow_domain *d, int dim, int side);
+static void _dfield_fillboundary(cow_dfield *f, int mask, int depth);
+static void _dfield_mirrorslab(cow_dfield *f, int a, int side, int mask,
+			       int depth);
+static void _dfield_shearslab(cow_dfield *f, int a, int side, int mask,
+			      int depth);
+static void _transformstencil(cow_dfield *f, int *mask, int *depth);
+static void _dfield_copybox(cow_dfield *f, int *src, int *dst);
+static void _interior(cow_domain *d, int lo[3], int hi[3]);
+static int _threadnum(void);
+static cow_pencil _builtinpencil(cow_transform op);
+static void _wide_tiling(cow_domain *d, int lo[3], int hi[3], int rows,
+			 int tile[3], int ntile[3]);
+static struct cow_widen *_widen_new(cow_dfield **fields, int nfields,
+				    int nread, int tile[3], int halo,
+				    int nthreads);
+static struct cow_wide *_widen_tile(struct cow_widen *w, int t, int lo[3],
+				    int hi[3], int tile[3], int T[3],
+				    int t0[3], int t1[3]);
+static void _widen_del(struct cow_widen *w);
+static void _wide_copy(struct cow_wide *v, cow_dfield *f, int lo[3],
+		       int hi[3], int store);
 static void _dfield_extractreplace(cow_dfield *f, int *I0, int *I1, void *out,
-                                   char op);
+				   int *members, int nsel, char op);
 
 void cow_init(int argc, char **argv, int modes)
 {
@@ -120,7 +185,22 @@ struct cow_domain *cow_domain_new()
     .n_ghst = 0,
     .balanced = 1,
     .committed = 0,
+    .n_threads = 0,
+    .stencil = COW_STENCIL_CENTRAL4,
+    .exchange = COW_EXCHANGE_DATATYPE,
+    .boundary = { { COW_BOUNDARY_PERIODIC, COW_BOUNDARY_PERIODIC },
+		  { COW_BOUNDARY_PERIODIC, COW_BOUNDARY_PERIODIC },
+		  { COW_BOUNDARY_PERIODIC, COW_BOUNDARY_PERIODIC } },
+    .shear_dim = { -1, -1, -1 },
+    .shear = { 0.0, 0.0, 0.0 },
+    .topology = COW_TOPOLOGY_CART,
+    .node_size = 0,
+    .cost = { NULL, NULL, NULL },
+    .cost_len = { 0, 0, 0 },
+    .allocator = 0,
+    .pool = NULL,
 #if (COW_MPI)
+    .comm = MPI_COMM_WORLD,
     .comm_rank = 0,
     .comm_size = 1,
     .cart_rank = 0,
@@ -132,6 +212,9 @@ struct cow_domain *cow_domain_new()
     .send_tags = NULL,
     .recv_tags = NULL,
     .mpi_cart = MPI_COMM_NULL,
+    .cuts = { NULL, NULL, NULL },
+    .node_comm = MPI_COMM_NULL,
+    .node_ranks = NULL,
 #endif
   } ;
   *d = dom;
@@ -145,11 +228,22 @@ void cow_domain_del(cow_domain *d)
       MPI_Comm_free(&d->mpi_cart);
       _domain_freetags(d);
     }
+    for (int i=0; i<3; ++i) {
+      free(d->cuts[i]);
+    }
+    if (d->node_comm != MPI_COMM_NULL) {
+      MPI_Comm_free(&d->node_comm);
+    }
+    free(d->node_ranks);
 #endif
 #if (COW_HDF5)
     _io_domain_del(d);
 #endif
   }
+  for (int i=0; i<3; ++i) {
+    free(d->cost[i]);
+  }
+  cow_domain_releasepool(d);
   free(d);
 }
 void cow_domain_setsize(cow_domain *d, int dim, int size)
@@ -175,52 +269,274 @@ int cow_domain_getguard(cow_domain *d)
 {
   return d->n_ghst;
 }
+void cow_domain_setnumthreads(cow_domain *d, int nthreads)
+// -----------------------------------------------------------------------------
+// Sets the number of threads used by loops and transforms over fields on this
+// domain, when compiled with COW_OPENMP. Zero (the default) uses the OpenMP
+// default, which is set by OMP_NUM_THREADS. When several MPI processes share a
+// node, each should be given its share of the cores.
+// -----------------------------------------------------------------------------
+{
+  if (nthreads < 0) return;
+  d->n_threads = nthreads;
+}
+void cow_domain_setstencil(cow_domain *d, int scheme)
+// -----------------------------------------------------------------------------
+// Selects the finite difference scheme used by the cow_deriv_* operators and
+// cow_dfield_derivative on this domain. Before the domain is committed, the
+// guard depth is raised to what the scheme needs; afterwards the guard must
+// already be deep enough.
+// -----------------------------------------------------------------------------
+{
+  int guard = cow_stencil_getguard(scheme);
+  if (guard < 0) {
+    printf("[cow] error: no such stencil scheme\n");
+    return;
+  }
+  if (!d->committed) {
+    if (d->n_ghst < guard) d->n_ghst = guard;
+  }
+  else if (d->n_ghst < guard) {
+    printf("[cow] error: stencil scheme needs %d guard zones, domain has %d\n",
+	   guard, d->n_ghst);
+    return;
+  }
+  d->stencil = scheme;
+}
+int cow_domain_getstencil(cow_domain *d)
+{
+  return d->stencil;
+}
+void cow_domain_setexchange(cow_domain *d, int mode)
+// -----------------------------------------------------------------------------
+// Selects how cow_dfield_syncguard sends guard zones between processes.
+// COW_EXCHANGE_DATATYPE (the default) posts a message to each of the 26
+// neighbors, described by derived datatypes. COW_EXCHANGE_PERSISTENT sends the
+// same messages from contiguous pack buffers, with persistent requests made
+// once for each field. COW_EXCHANGE_FACES sends 6 messages to the face
+// neighbors, a dimension at a time, each one carrying the guard zones already
+// received along the previous dimensions, which fills the edges and corners.
+// Only the first dimension is overlapped by cow_dfield_syncguard_begin.
+// -----------------------------------------------------------------------------
+{
+  switch (mode) {
+  case COW_EXCHANGE_DATATYPE: d->exchange = mode; break;
+  case COW_EXCHANGE_PERSISTENT: d->exchange = mode; break;
+  case COW_EXCHANGE_FACES: d->exchange = mode; break;
+  default: printf("[cow] error: no such exchange mode\n"); break;
+  }
+}
+int cow_domain_getexchange(cow_domain *d)
+{
+  return d->exchange;
+}
+void cow_domain_setboundary(cow_domain *d, int dim, int side, int bc)
+// -----------------------------------------------------------------------------
+// Sets the boundary condition on the lower (side = 0) or upper (side = 1) face
+// of dimension `dim`, or of every dimension with COW_ALL_DIMS. Guard zones on
+// faces which are not periodic are filled locally, from the zones next to the
+// face, and no messages cross them. COW_BOUNDARY_REFLECTING negates the
+// members declared with cow_dfield_setcomponent to be normal to the face.
+// Periodic and shearing faces come in pairs, and must be set on both sides,
+// before the domain is committed.
+// -----------------------------------------------------------------------------
+{
+  if (d->committed) {
+    printf("[cow] error: boundary conditions must be set before commit\n");
+    return;
+  }
+  if (side != 0 && side != 1) {
+    printf("[cow] error: side must be 0 (lower) or 1 (upper)\n");
+    return;
+  }
+  switch (bc) {
+  case COW_BOUNDARY_PERIODIC: break;
+  case COW_BOUNDARY_OUTFLOW: break;
+  case COW_BOUNDARY_REFLECTING: break;
+  case COW_BOUNDARY_SHEARING: break;
+  default: printf("[cow] error: no such boundary condition\n"); return;
+  }
+  if (dim == COW_ALL_DIMS) {
+    for (int n=0; n<3; ++n) {
+      d->boundary[n][side] = bc;
+    }
+  }
+  else if (dim >= 0 && dim < 3) {
+    d->boundary[dim][side] = bc;
+  }
+}
+int cow_domain_getboundary(cow_domain *d, int dim, int side)
+{
+  if (dim < 0 || dim >= 3 || side < 0 || side > 1) return 0;
+  return d->boundary[dim][side];
+}
+void cow_domain_setshear(cow_domain *d, int dim, int shiftdim, double shift)
+// -----------------------------------------------------------------------------
+// Guard zones beyond the lower face of a COW_BOUNDARY_SHEARING dimension `dim`
+// hold the periodic image displaced by +shift along `shiftdim`, and those
+// beyond the upper face the image displaced by -shift. The shift is a
+// physical distance, and is interpolated linearly between zones. It may be
+// changed at any time, but `shiftdim` is fixed when the domain is committed:
+// the subgrids are not split along it, so that each process holds whole lines.
+// -----------------------------------------------------------------------------
+{
+  if (dim < 0 || dim >= 3 || shiftdim < 0 || shiftdim >= 3 || shiftdim == dim) {
+    printf("[cow] error: invalid shearing dimensions %d, %d\n", dim, shiftdim);
+    return;
+  }
+  if (d->committed && d->shear_dim[dim] != shiftdim) {
+    printf("[cow] error: shearing dimension must be set before commit\n");
+    return;
+  }
+  d->shear_dim[dim] = shiftdim;
+  d->shear[dim] = shift;
+}
+int cow_domain_getnumthreads(cow_domain *d)
+{
+#if (COW_OPENMP)
+  return d->n_threads ? d->n_threads : omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
 void cow_domain_setprocsizes(cow_domain *d, int dim, int size)
+// -----------------------------------------------------------------------------
+// Fixes the number of subgrids along `dim`. Dimensions left at zero are chosen
+// by MPI_Dims_create. A grid which does not fit the number of processes is
+// reported at commit, and replaced by one which does.
+// -----------------------------------------------------------------------------
 {
 #if (COW_MPI)
-  if (dim >= 3 || d->committed) return;
+  if (dim < 0 || dim >= 3 || size < 0 || d->committed) return;
   d->proc_sizes[dim] = size;
 #endif
 }
+void cow_domain_settopology(cow_domain *d, int mode)
+// -----------------------------------------------------------------------------
+// With COW_TOPOLOGY_NODES, the processes sharing a node (found with
+// MPI_Comm_split_type, or see cow_domain_setnodesize) are given a compact
+// block of the process grid, shaped to minimize the guard zones crossing
+// between nodes. COW_TOPOLOGY_CART (the default) leaves the placement to
+// MPI_Cart_create. The process grid itself is the same in both.
+// -----------------------------------------------------------------------------
+{
+  switch (mode) {
+  case COW_TOPOLOGY_CART: d->topology = mode; break;
+  case COW_TOPOLOGY_NODES: d->topology = mode; break;
+  default: printf("[cow] error: no such topology mode\n"); break;
+  }
+}
+void cow_domain_setnodesize(cow_domain *d, int size)
+// -----------------------------------------------------------------------------
+// Groups each `size` consecutive ranks as a node for COW_TOPOLOGY_NODES, which
+// may stand for a socket, or a node when the ranks are placed by node. Zero
+// (the default) uses the shared memory nodes. Fields in COW_MEMORY_SHARED are
+// shared within these groups, as far as they lie on one shared memory node.
+// -----------------------------------------------------------------------------
+{
+  if (size < 0) return;
+  d->node_size = size;
+}
+void cow_domain_setcomm(cow_domain *d, void *comm)
+// -----------------------------------------------------------------------------
+// Builds the domain on the processes of the MPI communicator at the address
+// `comm`, rather than MPI_COMM_WORLD, so that disjoint groups of processes may
+// each work on a domain of their own at the same time. It is passed by address
+// so that this header does not need MPI, and NULL restores MPI_COMM_WORLD.
+// Every collective operation on the domain and its fields, and the seal of
+// histograms populated from them, then involves only those processes.
+// -----------------------------------------------------------------------------
+{
+#if (COW_MPI)
+  if (d->committed) return;
+  d->comm = comm ? *((MPI_Comm*) comm) : MPI_COMM_WORLD;
+#endif
+}
+void cow_domain_setcost(cow_domain *d, int dim, double *weights, int n)
+// -----------------------------------------------------------------------------
+// Sets the cost of each slab of zones along dimension dim, which must be given
+// for all n = G_ntot[dim] slabs, and be the same on every process. At commit,
+// the subgrid boundaries along dim are placed so that each subgrid carries
+// close to an equal share of the total cost, rather than an equal number of
+// zones. Pass NULL to return to the uniform split. A callback for the cost
+// may be used by tabulating it over the slabs before the call.
+// -----------------------------------------------------------------------------
+{
+  if (dim == COW_ALL_DIMS) {
+    for (int i=0; i<3; ++i) cow_domain_setcost(d, i, weights, n);
+    return;
+  }
+  if (dim < 0 || dim >= 3 || d->committed) return;
+  free(d->cost[dim]);
+  d->cost[dim] = NULL;
+  d->cost_len[dim] = 0;
+  if (weights == NULL || n <= 0) return;
+  d->cost[dim] = (double*) malloc(n * sizeof(double));
+  d->cost_len[dim] = n;
+  memcpy(d->cost[dim], weights, n * sizeof(double));
+}
 void cow_domain_commit(cow_domain *d)
 {
   if (d->committed) return;
+  for (int i=0; i<d->n_dims; ++i) {
+    int *bc = d->boundary[i];
+    int s = d->shear_dim[i];
+    if ((bc[0] == COW_BOUNDARY_SHEARING) != (bc[1] == COW_BOUNDARY_SHEARING) ||
+	(bc[0] == COW_BOUNDARY_PERIODIC) != (bc[1] == COW_BOUNDARY_PERIODIC)) {
+      printf("[cow] error: dimension %d must be periodic on both faces or "
+	     "neither, using periodic\n", i);
+      bc[0] = bc[1] = COW_BOUNDARY_PERIODIC;
+    }
+    if (bc[0] == COW_BOUNDARY_SHEARING && (s < 0 || s >= d->n_dims ||
+					   !_periodic(d, s))) {
+      printf("[cow] error: shearing dimension %d needs a periodic shift "
+	     "dimension, using periodic\n", i);
+      bc[0] = bc[1] = COW_BOUNDARY_PERIODIC;
+    }
+  }
   if (cow_mpirunning()) {
 #if (COW_MPI)
-    int w[3] = { 1, 1, 1 }; // 'wrap', periodic in all directions
+    int w[3]; // 'wrap', periodic where the boundary conditions are
     int r = 1; // 'reorder' allow MPI to choose a cart_rank != comm_rank
+    for (int i=0; i<3; ++i) {
+      w[i] = _periodic(d, i);
+    }
 
-    MPI_Comm_rank(MPI_COMM_WORLD, &d->comm_rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &d->comm_size);
-    MPI_Dims_create(d->comm_size, d->n_dims, d->proc_sizes);
-    MPI_Cart_create(MPI_COMM_WORLD, d->n_dims, d->proc_sizes, w, r,
-                    &d->mpi_cart);
+    MPI_Comm_rank(d->comm, &d->comm_rank);
+    MPI_Comm_size(d->comm, &d->comm_size);
+    _domain_procgrid(d);
+    MPI_Comm comm = MPI_COMM_NULL;
+    if (d->topology == COW_TOPOLOGY_NODES) {
+      comm = _domain_nodecomm(d);
+    }
+    if (comm == MPI_COMM_NULL) {
+      MPI_Cart_create(d->comm, d->n_dims, d->proc_sizes, w, r,
+		      &d->mpi_cart);
+    }
+    else {
+      // ranks of comm are already in the order of the process grid
+      MPI_Cart_create(comm, d->n_dims, d->proc_sizes, w, 0, &d->mpi_cart);
+      MPI_Comm_free(&comm);
+    }
     MPI_Comm_rank(d->mpi_cart, &d->cart_rank);
     MPI_Comm_size(d->mpi_cart, &d->cart_size);
     MPI_Cart_coords(d->mpi_cart, d->cart_rank, d->n_dims, d->proc_index);
 
     for (int i=0; i<d->n_dims; ++i) {
-      // -----------------------------------------------------------------------
-      // The number of subgrid zones for dimension i needs to be non-uniform if
-      // proc_sizes[i] does not divide the G_ntot[i]. For each dimension, we add
-      // a zone to the first R subgrids , where R is given below:
-      // -----------------------------------------------------------------------
-      int R = d->G_ntot[i] % d->proc_sizes[i];
-      int normal_size = d->G_ntot[i] / d->proc_sizes[i];
-      int augmnt_size = normal_size + 1;
-      int thisdm_size = (d->proc_index[i]<R) ? augmnt_size : normal_size;
+      int *cut = NULL;
+      int p = d->proc_index[i];
       double dx = (d->glb_upper[i] - d->glb_lower[i]) / d->G_ntot[i];
 
-      d->dx[i] = dx;
-      if (R != 0) d->balanced = 0;
-
-      d->L_nint[i] = thisdm_size;
-      d->G_strt[i] = 0;
-      for (int j=0; j<d->proc_index[i]; ++j) {
-        d->G_strt[i] += (j<R) ? augmnt_size : normal_size;
+      _domain_makecuts(d, i);
+      cut = d->cuts[i];
+      for (int j=0; j<d->proc_sizes[i]; ++j) {
+        if (cut[j+1] - cut[j] != cut[1] - cut[0]) d->balanced = 0;
       }
+      d->dx[i] = dx;
+      d->L_nint[i] = cut[p+1] - cut[p];
+      d->G_strt[i] = cut[p];
       d->loc_lower[i] = d->glb_lower[i] + dx *  d->G_strt[i];
-      d->loc_upper[i] = d->glb_upper[i] + dx * (d->G_strt[i] + thisdm_size);
+      d->loc_upper[i] = d->glb_lower[i] + dx * (d->G_strt[i] + d->L_nint[i]);
       d->L_ntot[i] = d->L_nint[i] + 2 * d->n_ghst;
       d->L_strt[i] = d->n_ghst;
     }
@@ -294,7 +610,7 @@ int cow_domain_getglobalstartindex(cow_domain *d, int dim)
   default: return 0;
   }
 }
-int cow_domain_getgridspacing(cow_domain *d, int dim)
+double cow_domain_getgridspacing(cow_domain *d, int dim)
 {
   switch (dim) {
   case 0: return d->dx[0];
@@ -324,10 +640,24 @@ int cow_domain_subgridatposition(cow_domain *d, double x, double y, double z)
 #if (COW_MPI)
   int index[3];
   double r[3] = { x, y, z };
-  double *x0 = d->glb_lower;
-  double *x1 = d->glb_upper;
+  if (!cow_mpirunning()) return 0;
   for (int i=0; i<d->n_dims; ++i) {
-    index[i] = d->proc_sizes[i] * (r[i] - x0[i]) / (x1[i] - x0[i]);
+    // -------------------------------------------------------------------------
+    // Find the global zone holding r[i], wrapped along periodic dimensions and
+    // clamped along the others, then the subgrid whose cuts bracket it.
+    // -------------------------------------------------------------------------
+    int G = d->G_ntot[i];
+    int *cut = d->cuts[i];
+    int n = (int) floor((r[i] - d->glb_lower[i]) / d->dx[i]);
+    int lo = 0, hi = d->proc_sizes[i];
+    if (_periodic(d, i)) n = ((n % G) + G) % G;
+    else n = n < 0 ? 0 : (n >= G ? G - 1 : n);
+    while (hi - lo > 1) {
+      int mid = (lo + hi) / 2;
+      if (cut[mid] <= n) lo = mid;
+      else hi = mid;
+    }
+    index[i] = lo;
   }
   int their_rank;
   if (cow_mpirunning()) {
@@ -386,14 +716,16 @@ cow_dfield *cow_dfield_new(void)
     .name = NULL,
     .members = NULL,
     .n_members = 0,
+    .component = NULL,
     .member_iter = 0,
     .data = NULL,
     .flag = NULL,
-    .stride = { 0, 0, 0 },
+    .stride = { 0, 0, 0, 0 },
     .committed = 0,
     .ownsdata = 0,
     .domain = NULL,
     .transform = NULL,
+    .pencil = NULL,
     .transargs = NULL,
     .transargslen = 0,
     .userdata = NULL,
@@ -401,22 +733,42 @@ cow_dfield *cow_dfield_new(void)
     .sampleresult = NULL,
     .samplecoordslen = 0,
     .samplemode = COW_SAMPLE_LINEAR,
+    .summode = COW_SUM_PLAIN,
+    .threadsafe = 1,
+    .syncmode = COW_SYNC_BLOCKING,
+    .guardmask = 0,
+    .guarddepth = 0,
+    .stencilmask = COW_ALL_DIMS,
+    .stencildepth = -1,
+    .memory = COW_MEMORY_PRIVATE,
+    .layout = COW_LAYOUT_INTERLEAVED,
+    .precision = COW_PRECISION_DOUBLE,
+#if (COW_MPI)
+    .win = MPI_WIN_NULL,
+    .sync_requests = NULL,
+    .exchange = NULL,
+    .synctypes = NULL,
+#endif
   } ;
   *f = field;
   return f;
 }
 void cow_dfield_del(cow_dfield *f)
 {
+  cow_dfield_syncguard_end(f);
 #if (COW_MPI)
   if (f->committed) {
     _dfield_freetype(f);
   }
+  _dfield_freeexchange(f);
+  _dfield_freesynctypes(f);
 #endif
   for (int n=0; n<f->n_members; ++n) free(f->members[n]);
   free(f->members);
+  free(f->component);
   free(f->name);
   if (f->ownsdata) {
-    free(f->data);
+    _dfield_freedata(f);
   }
   if (f->ownsflag) {
     free(f->flag);
@@ -438,11 +790,108 @@ cow_dfield *cow_dfield_dup(cow_dfield *f)
   cow_dfield_setname(g, f->name);
   for (int n=0; n<f->n_members; ++n) {
     cow_dfield_addmember(g, f->members[n]);
+    g->component[n] = f->component[n];
   }
+  g->memory = f->memory;
+  g->layout = f->layout;
+  g->precision = f->precision;
   cow_dfield_commit(g);
+  cow_dfield_syncguard_end(f);
   memcpy(g->data, f->data, cow_dfield_getdatabytes(f));
   g->member_iter = f->member_iter;
   g->transform = f->transform;
+  g->pencil = f->pencil;
+  g->threadsafe = f->threadsafe;
+  g->syncmode = f->syncmode;
+  g->guardmask = f->guardmask;
+  g->guarddepth = f->guarddepth;
+  g->stencilmask = f->stencilmask;
+  g->stencildepth = f->stencildepth;
+  return g;
+}
+cow_dfield *cow_dfield_redistribute(cow_dfield *f, cow_domain *d)
+// -----------------------------------------------------------------------------
+// Returns a new field on the domain `d` with the data of `f`. The domain `d`
+// may differ from f's domain in its process grid, subgrid cuts or guard depth,
+// but it must have the same global size. The interiors are moved between
+// processes with the brick-to-brick remap used by the FFT, all members at
+// once, and the guard zones of the new field are synchronized. Both domains
+// must be committed on the same processes, and they all call this together.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *s = f->domain;
+  if (!f->committed || !d->committed) return NULL;
+  int same = d->n_dims == s->n_dims;
+  for (int n=0; n<s->n_dims; ++n) {
+    same = same && d->G_ntot[n] == s->G_ntot[n];
+  }
+  if (!same) {
+    printf("[cow] error: field %s can only be redistributed onto a domain of "
+	   "the same global size\n", f->name);
+    return NULL;
+  }
+#if (COW_MPI)
+  if (cow_mpirunning()) {
+    int result;
+    MPI_Comm_compare(s->mpi_cart, d->mpi_cart, &result);
+    if (result == MPI_UNEQUAL) {
+      printf("[cow] error: field %s can only be redistributed between domains "
+	     "on the same processes\n", f->name);
+      return NULL;
+    }
+  }
+#endif
+  cow_dfield *g = cow_dfield_new();
+  cow_dfield_setdomain(g, d);
+  cow_dfield_setname(g, f->name);
+  for (int n=0; n<f->n_members; ++n) {
+    cow_dfield_addmember(g, f->members[n]);
+    g->component[n] = f->component[n];
+  }
+  g->memory = f->memory;
+  g->layout = f->layout;
+  g->precision = f->precision;
+  cow_dfield_commit(g);
+  int lo[3], hi[3], LO[3], HI[3];
+  _interior(s, lo, hi);
+  _interior(d, LO, HI);
+  size_t nin = f->n_members, nout = f->n_members;
+  for (int n=0; n<3; ++n) {
+    nin *= hi[n] - lo[n];
+    nout *= HI[n] - LO[n];
+  }
+  double *in = (double*) _mem_alloc(s, nin * sizeof(double));
+  double *out = (double*) _mem_alloc(d, nout * sizeof(double));
+  cow_dfield_extract(f, lo, hi, in);
+  if (cow_mpirunning()) {
+#if (COW_MPI)
+    // -------------------------------------------------------------------------
+    // The remap bounds are inclusive global indices, given from the fastest
+    // varying dimension, which is the last one
+    // -------------------------------------------------------------------------
+    int i0[3], i1[3], o0[3], o1[3];
+    for (int n=0; n<3; ++n) {
+      i0[n] = n < s->n_dims ? s->G_strt[n] : 0;
+      o0[n] = n < d->n_dims ? d->G_strt[n] : 0;
+      i1[n] = i0[n] + hi[n] - lo[n] - 1;
+      o1[n] = o0[n] + HI[n] - LO[n] - 1;
+    }
+    struct remap_plan_3d *plan =
+      remap_3d_create_plan(s->mpi_cart,
+			   i0[2], i1[2], i0[1], i1[1], i0[0], i1[0],
+			   o0[2], o1[2], o0[1], o1[1], o0[0], o1[0],
+			   f->n_members, 0, 1, 2);
+    remap_3d(in, out, NULL, plan);
+    remap_3d_destroy_plan(plan);
+#endif
+  }
+  else {
+    memcpy(out, in, nin * sizeof(double));
+  }
+  cow_dfield_replace(g, LO, HI, out);
+  _mem_free(s, in);
+  _mem_free(d, out);
+  cow_dfield_syncguard(g);
   return g;
 }
 void cow_dfield_setname(cow_dfield *f, char *name)
@@ -452,7 +901,7 @@ void cow_dfield_setname(cow_dfield *f, char *name)
 }
 int cow_dfield_getstride(cow_dfield *f, int dim)
 {
-  if (dim >= 3 || !f->committed) return 0;
+  if (dim >= 4 || !f->committed) return 0;
   return f->stride[dim];
 }
 int cow_dfield_getnmembers(cow_dfield *f)
@@ -471,7 +920,7 @@ size_t cow_dfield_getdatabytes(cow_dfield *f)
 {
   if (!f->committed) return 0;
   return cow_domain_getnumlocalzonesincguard(f->domain, COW_ALL_DIMS) *
-    f->n_members * sizeof(double);
+    f->n_members * _dfield_elemsize(f);
 }
 void cow_dfield_setdatabuffer(cow_dfield *f, void *buffer)
 // -----------------------------------------------------------------------------
@@ -493,7 +942,7 @@ void cow_dfield_setdatabuffer(cow_dfield *f, void *buffer)
     }
     else {
       // (B)
-      free(f->data);
+      _dfield_freedata(f);
       f->data = buffer;
       f->ownsdata = 0;
     }
@@ -502,8 +951,11 @@ void cow_dfield_setdatabuffer(cow_dfield *f, void *buffer)
     if (buffer == NULL) {
       // (C)
       int nz = cow_domain_getnumlocalzonesincguard(f->domain, COW_ALL_DIMS);
-      f->data = malloc(nz * f->n_members * sizeof(double));
+      f->data = _mem_alloc(f->domain, nz * f->n_members * _dfield_elemsize(f));
       f->ownsdata = 1;
+      if (f->domain->allocator & COW_ALLOC_FIRSTTOUCH) {
+	_dfield_firsttouch(f);
+      }
     }
     else {
       // (D)
@@ -558,11 +1010,12 @@ int *cow_dfield_getflagbuffer(cow_dfield *f)
 void cow_dfield_updateflaginfnan(cow_dfield *f)
 {
   int nz = cow_domain_getnumlocalzonesincguard(f->domain, COW_ALL_DIMS);
+  int sz = f->stride[f->domain->n_dims - 1], sm = f->stride[3];
   for (int n=0; n<nz; ++n) {
-    double *x = (double*)f->data + n * f->n_members;
     for (int m=0; m<f->n_members; ++m) {
-      f->flag[n] |= isnan(x[m]) ? COW_HASNAN : 0;
-      f->flag[n] |= isinf(x[m]) ? COW_HASINF : 0;
+      double x = _dfield_load(f, (long) n * sz + m * sm);
+      f->flag[n] |= isnan(x) ? COW_HASNAN : 0;
+      f->flag[n] |= isinf(x) ? COW_HASINF : 0;
     }
   }
 }
@@ -574,6 +1027,87 @@ void cow_dfield_addmember(cow_dfield *f, char *name)
   f->members = (char**) realloc(f->members, f->n_members*sizeof(char*));
   f->members[f->n_members-1] = (char*) malloc(strlen(name)+1);
   strcpy(f->members[f->n_members-1], name);
+  f->component = (int*) realloc(f->component, f->n_members*sizeof(int));
+  f->component[f->n_members-1] = -1;
+}
+void cow_dfield_setcomponent(cow_dfield *f, int member, int dim)
+// -----------------------------------------------------------------------------
+// Declares that `member` is the component along `dim` of a vector, so that it
+// changes sign in the guard zones of reflecting faces normal to `dim`. Members
+// are scalars (dim = -1) by default.
+// -----------------------------------------------------------------------------
+{
+  if (member < 0 || member >= f->n_members || dim < -1 || dim >= 3) {
+    printf("[cow] error: field %s has no member %d, or no dimension %d\n",
+	   f->name, member, dim);
+    return;
+  }
+  f->component[member] = dim;
+}
+void cow_dfield_setmemory(cow_dfield *f, int mode)
+// -----------------------------------------------------------------------------
+// With COW_MEMORY_SHARED, the data buffer is allocated at commit in an MPI
+// shared memory window among the processes on each node. The guard zones from
+// neighbors on the node, and samples on their subgrids, are then loaded from
+// their memory directly, and only those of other nodes go through messages.
+// The field must then be committed, synchronized, sampled and deleted by all
+// processes together. Without MPI the setting has no effect.
+// -----------------------------------------------------------------------------
+{
+  if (f->committed) return;
+  switch (mode) {
+  case COW_MEMORY_PRIVATE: f->memory = mode; break;
+  case COW_MEMORY_SHARED: f->memory = mode; break;
+  default: printf("[cow] error: no such memory mode\n"); break;
+  }
+}
+void cow_dfield_setlayout(cow_dfield *f, int mode)
+// -----------------------------------------------------------------------------
+// With COW_LAYOUT_INTERLEAVED (the default) the members of each zone are
+// adjacent in memory. With COW_LAYOUT_PLANAR each member is stored as a
+// contiguous array over the subgrid, guard zones included, one after another.
+// Either way, cow_dfield_getstride(f, 3) is the distance between the members
+// of a zone, and transforms reading their arguments' members must step by the
+// last of the argument's strides. The result a transform fills holds the
+// members of its zone adjacent, as do extracted and replaced buffers.
+// -----------------------------------------------------------------------------
+{
+  if (f->committed) return;
+  switch (mode) {
+  case COW_LAYOUT_INTERLEAVED: f->layout = mode; break;
+  case COW_LAYOUT_PLANAR: f->layout = mode; break;
+  default: printf("[cow] error: no such layout\n"); break;
+  }
+}
+int cow_dfield_getlayout(cow_dfield *f)
+{
+  return f->layout;
+}
+void cow_dfield_setprecision(cow_dfield *f, int precision)
+// -----------------------------------------------------------------------------
+// With COW_PRECISION_SINGLE the data of `f` is stored as floats, halving its
+// memory, guard exchanges and HDF5 traffic. Transforms, loops, pipelines and
+// derivatives are still computed in double. Each thread widens the floats it
+// reads a tile of rows at a time, together with the zones around the tile
+// within reach of the stencil, into scratch of its own, and computes results
+// into scratch which is rounded back into the field. Changes made by
+// cow_dfield_loop callbacks to the data they read are discarded. Samples and
+// FFTs convert the zones they read one at a time, and reductions and
+// histograms accumulate in double. Buffers given to cow_dfield_setdatabuffer
+// and returned by cow_dfield_getdatabuffer hold floats, while extracted and
+// replaced buffers always hold doubles.
+// -----------------------------------------------------------------------------
+{
+  if (f->committed) return;
+  switch (precision) {
+  case COW_PRECISION_DOUBLE: f->precision = precision; break;
+  case COW_PRECISION_SINGLE: f->precision = precision; break;
+  default: printf("[cow] error: no such precision\n"); break;
+  }
+}
+int cow_dfield_getprecision(cow_dfield *f)
+{
+  return f->precision;
 }
 char *cow_dfield_iteratemembers(cow_dfield *f)
 {
@@ -587,6 +1121,7 @@ char *cow_dfield_nextmember(cow_dfield *f)
 void cow_dfield_commit(cow_dfield *f)
 {
   if (f->committed || f->domain == NULL) return;
+  _dfield_strides(f, f->domain->L_ntot);
 #if (COW_MPI)
   if (cow_mpirunning()) {
     switch (f->domain->n_dims) {
@@ -594,6 +1129,9 @@ void cow_dfield_commit(cow_dfield *f)
     case 2: _dfield_maketype2d(f); break;
     case 3: _dfield_maketype3d(f); break;
     }
+    if (f->memory == COW_MEMORY_SHARED && f->data == NULL) {
+      _dfield_allocshared(f);
+    }
   }
 #endif
   // ---------------------------------------------------------------------------
@@ -609,316 +1147,1516 @@ void cow_dfield_commit(cow_dfield *f)
   // ---------------------------------------------------------------------------
   cow_dfield_setdatabuffer(f, f->data);
   cow_dfield_setflagbuffer(f, f->flag);
-  int *N = f->domain->L_ntot;
-  switch (f->domain->n_dims) {
-  case 1:
-    f->stride[0] = f->n_members;
-    f->stride[1] = 0;
-    f->stride[2] = 0;
-    break;
-  case 2:
-    f->stride[0] = f->n_members * N[1];
-    f->stride[1] = f->n_members;
-    f->stride[2] = 0;
-    break;
-  case 3:
-    f->stride[0] = f->n_members * N[2] * N[1];
-    f->stride[1] = f->n_members * N[2];
-    f->stride[2] = f->n_members;
-    break;
-  }
+  // guard zones are trusted to be current until a lazy transform writes f
+  f->guardmask = _guardmask(f->domain, COW_ALL_DIMS);
+  f->guarddepth = f->domain->n_ghst;
   f->committed = 1;
 }
 void cow_dfield_syncguard(cow_dfield *f)
+{
+  cow_dfield_syncguard_begin(f);
+  cow_dfield_syncguard_end(f);
+}
+void cow_dfield_syncguard_begin(cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Starts filling the guard zones from the neighboring subgrids. The interior
+// zones may be read, but the field must not be modified until
+// cow_dfield_syncguard_end returns. Without MPI the guard zones are filled
+// right away. Library functions which use the field finish the exchange first,
+// but code reading the data buffer directly has to call
+// cow_dfield_syncguard_end itself.
+// -----------------------------------------------------------------------------
 {
   if (f->domain->n_ghst == 0) return;
+  cow_dfield_syncguard_end(f);
+  f->guardmask = _guardmask(f->domain, COW_ALL_DIMS);
+  f->guarddepth = f->domain->n_ghst;
   if (cow_mpirunning()) {
 #if (COW_MPI)
     cow_domain *d = f->domain;
+    if (f->win != MPI_WIN_NULL) {
+      _dfield_syncnode(f, f->guardmask, f->guarddepth); // done right away
+      return;
+    }
+    if (d->exchange != COW_EXCHANGE_DATATYPE) {
+      if (f->exchange == NULL || f->exchange->mode != d->exchange) {
+	_dfield_freeexchange(f);
+	_dfield_makeexchange(f);
+      }
+      _exchange_start(f, 0);
+      return;
+    }
     int N = d->num_neighbors;
     MPI_Request *requests = (MPI_Request*) malloc(2*N*sizeof(MPI_Request));
-    MPI_Status *statuses = (MPI_Status*) malloc(2*N*sizeof(MPI_Status));
     for (int n=0; n<N; ++n) {
       MPI_Request req1, req2;
       int st = d->send_tags[n];
       int rt = d->recv_tags[n];
       int nr = d->neighbors[n];
+      if (nr == MPI_PROC_NULL) { // across a face which is not periodic
+	requests[2*n+0] = requests[2*n+1] = MPI_REQUEST_NULL;
+	continue;
+      }
       MPI_Isend(f->data, 1, f->send_type[n], nr, st, d->mpi_cart, &req1);
       MPI_Irecv(f->data, 1, f->recv_type[n], nr, rt, d->mpi_cart, &req2);
       requests[2*n+0] = req1;
       requests[2*n+1] = req2;
     }
-    MPI_Waitall(2*N, requests, statuses);
-    free(requests);
-    free(statuses);
+    f->sync_requests = requests;
 #endif
   }
   else {
-    double *data = (double*) f->data;
-    int *nint = f->domain->L_nint;
-    int *ntot = f->domain->L_ntot;
-    int *s = f->stride;
-    int nq = f->n_members;
-    int ng = f->domain->n_ghst;
-    switch (f->domain->n_dims) {
-    case 1:
-      for (int i=0; i<ntot[0]; ++i) {
-        int m0 = i*s[0];
-        int m1 = i*s[0];
-        if (i <            ng) m0 += nint[0] * s[0];
-        if (i >= nint[0] + ng) m0 -= nint[0] * s[0];
-        if (m0 != m1) memcpy(data + m1, data + m0, nq * sizeof(double));
-      }
-      break;
-    case 2:
-      for (int i=0; i<ntot[0]; ++i) {
-        for (int j=0; j<ntot[1]; ++j) {
-          int m0 = i*s[0] + j*s[1];
-          int m1 = i*s[0] + j*s[1];
-          if (i <            ng) m0 += nint[0] * s[0];
-          if (i >= nint[0] + ng) m0 -= nint[0] * s[0];
-          if (j <            ng) m0 += nint[1] * s[1];
-          if (j >= nint[1] + ng) m0 -= nint[1] * s[1];
-          if (m0 != m1) memcpy(data + m1, data + m0, nq * sizeof(double));
-        }
+    _dfield_fillguard(f, f->guardmask, f->guarddepth);
+  }
+}
+void cow_dfield_syncguard_end(cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Waits for the guard exchange started by cow_dfield_syncguard_begin, if there
+// is one in flight
+// -----------------------------------------------------------------------------
+{
+#if (COW_MPI)
+  struct cow_exchange *e = f->exchange;
+  if (e && e->stage >= 0) {
+    // finish each stage, and start the next from the zones it received
+    for (int s=e->stage; s<e->n_stages; ++s) {
+      int m0 = e->first[s], m1 = e->first[s+1];
+      MPI_Waitall(2 * (m1 - m0), e->requests + 2 * m0, MPI_STATUSES_IGNORE);
+      for (int m=m0; m<m1; ++m) {
+	_exchange_pack(f, e->box + 12*m + 6, e->recv_buf + e->offset[m], 'u');
       }
-      break;
-    case 3:
-      for (int i=0; i<ntot[0]; ++i) {
-        for (int j=0; j<ntot[1]; ++j) {
-          for (int k=0; k<ntot[2]; ++k) {
-            int m0 = i*s[0] + j*s[1] + k*s[2];
-            int m1 = i*s[0] + j*s[1] + k*s[2];
-            if (i <            ng) m0 += nint[0] * s[0];
-            if (i >= nint[0] + ng) m0 -= nint[0] * s[0];
-            if (j <            ng) m0 += nint[1] * s[1];
-            if (j >= nint[1] + ng) m0 -= nint[1] * s[1];
-            if (k <            ng) m0 += nint[2] * s[2];
-            if (k >= nint[2] + ng) m0 -= nint[2] * s[2];
-            if (m0 != m1) memcpy(data + m1, data + m0, nq * sizeof(double));
-          }
-        }
+      if (s + 1 < e->n_stages) {
+	_exchange_start(f, s + 1);
       }
-      break;
     }
+    e->stage = -1;
+    _dfield_fillboundary(f, f->guardmask, f->guarddepth);
   }
+  if (f->sync_requests == NULL) return;
+  MPI_Waitall(2 * f->domain->num_neighbors, f->sync_requests,
+	      MPI_STATUSES_IGNORE);
+  free(f->sync_requests);
+  f->sync_requests = NULL;
+  _dfield_fillboundary(f, f->guardmask, f->guarddepth);
+#endif
 }
-
-void cow_dfield_extract(cow_dfield *f, int *I0, int *I1, void *out)
+void cow_dfield_syncguard_many(cow_dfield **fs, int n)
+// -----------------------------------------------------------------------------
+// Synchronizes the guard zones of several fields on the same domain. Each
+// message to a neighbor carries the guard data of all the fields, so there are
+// as many messages as for a single field. The domain's exchange mode decides
+// whether these go to all neighbors, or to the face neighbors a dimension at a
+// time (COW_EXCHANGE_FACES).
+// -----------------------------------------------------------------------------
 {
-  _dfield_extractreplace(f, I0, I1, out, 'e');
+  if (n == 0) return;
+  cow_domain *d = fs[0]->domain;
+  for (int q=0; q<n; ++q) {
+    if (fs[q]->domain != d) {
+      printf("[cow] error: fields synchronized together must share a domain\n");
+      return;
+    }
+  }
+  _dfield_syncguardmany(fs, n, COW_ALL_DIMS, d->n_ghst);
 }
-void cow_dfield_replace(cow_dfield *f, int *I0, int *I1, void *out)
+void _dfield_syncguardmany(cow_dfield **fs, int n, int dims, int depth)
+// -----------------------------------------------------------------------------
+// Like cow_dfield_syncguard_many, for the guard zones within `depth` of the
+// interior along the dimensions `dims`, as in cow_dfield_syncguard_partial
+// -----------------------------------------------------------------------------
 {
-  _dfield_extractreplace(f, I0, I1, out, 'r');
-}
-void _dfield_extractreplace(cow_dfield *f, int *I0, int *I1, void *out, char op)
-{
-  int mi = I1[0] - I0[0];
-  int mj = I1[1] - I0[1];
-  int mk = I1[2] - I0[2];
-  int si = cow_dfield_getstride(f, 0);
-  int sj = cow_dfield_getstride(f, 1);
-  int sk = cow_dfield_getstride(f, 2);
-  size_t sz = sizeof(double);
-  double *dst = (double*) f->data;
-  double *src = (double*) out;
-  switch (f->domain->n_dims) {
-  case 1: {
-    int ti = f->n_members;
-    for (int i=0; i<mi; ++i) {
-      int m0 = (i+I0[0])*si;
-      int m1 = i*ti;
-      if (op == 'e') {
-        memcpy(src + m1, dst + m0, f->n_members * sz);
+  if (n == 0) return;
+  cow_domain *d = fs[0]->domain;
+  int mask = _guardmask(d, dims);
+  if (depth > d->n_ghst) depth = d->n_ghst;
+  for (int q=0; q<n; ++q) {
+    cow_dfield_syncguard_end(fs[q]);
+  }
+  if (mask == 0 || depth <= 0) return;
+  for (int q=0; q<n; ++q) {
+    fs[q]->guardmask = mask;
+    fs[q]->guarddepth = depth;
+  }
+  if (!cow_mpirunning()) {
+    for (int q=0; q<n; ++q) {
+      _dfield_fillguard(fs[q], mask, depth);
+    }
+    return;
+  }
+#if (COW_MPI)
+  // fields in a shared window load their neighbors on the node directly, a
+  // field at a time, and the private ones are packed into one exchange
+  int any_shared = 0;
+  for (int q=0; q<n; ++q) {
+    if (fs[q]->win != MPI_WIN_NULL) any_shared = 1;
+  }
+  cow_dfield **ps = NULL;
+  if (any_shared) {
+    ps = (cow_dfield**) malloc(n * sizeof(cow_dfield*));
+    int np = 0;
+    for (int q=0; q<n; ++q) {
+      if (fs[q]->win != MPI_WIN_NULL) {
+	_dfield_syncnode(fs[q], mask, depth);
       }
-      else if (op == 'r') {
-        memcpy(dst + m0, src + m1, f->n_members * sz);
+      else {
+	ps[np++] = fs[q];
       }
     }
-  } break;
-  case 2: {
-    int ti = f->n_members * mj;
-    int tj = f->n_members;
-    for (int i=0; i<mi; ++i) {
-      for (int j=0; j<mj; ++j) {
-        int m0 = (i+I0[0])*si + (j+I0[1])*sj;
-        int m1 = i*ti + j*tj;
-        if (op == 'e') {
-          memcpy(src + m1, dst + m0, f->n_members * sz);
-        }
-        else if (op == 'r') {
-          memcpy(dst + m0, src + m1, f->n_members * sz);
-        }
+    fs = ps;
+    n = np;
+  }
+  if (n == 0) {
+    free(ps);
+    return;
+  }
+  int faces = d->exchange == COW_EXCHANGE_FACES;
+  int nstages = faces ? d->n_dims : 1;
+  int first[4];
+  int *box = (int*) malloc(12 * d->num_neighbors * sizeof(int));
+  int *nbr = (int*) malloc(d->num_neighbors * sizeof(int));
+  int nmsgs = _exchange_boxes(d, faces, mask, depth, box, nbr, first);
+  int zonebytes = 0; // the fields may differ in precision
+  for (int q=0; q<n; ++q) {
+    zonebytes += fs[q]->n_members * _dfield_elemsize(fs[q]);
+  }
+  int *offset = (int*) malloc((nmsgs + 1) * sizeof(int));
+  offset[0] = 0;
+  for (int m=0; m<nmsgs; ++m) {
+    offset[m+1] = offset[m] + _exchange_zones(box + 12*m) * zonebytes;
+  }
+  char *sbuf = (char*) malloc(offset[nmsgs]);
+  char *rbuf = (char*) malloc(offset[nmsgs]);
+  MPI_Request *requests = (MPI_Request*) malloc(2*nmsgs*sizeof(MPI_Request));
+  for (int s=0; s<nstages; ++s) {
+    for (int m=first[s]; m<first[s+1]; ++m) {
+      char *b = sbuf + offset[m];
+      for (int q=0; q<n; ++q) {
+	_exchange_pack(fs[q], box + 12*m, b, 'p');
+	b += _exchange_zones(box + 12*m) * fs[q]->n_members *
+	  _dfield_elemsize(fs[q]);
       }
+      int nr = d->neighbors[nbr[m]];
+      int count = offset[m+1] - offset[m];
+      MPI_Isend(sbuf + offset[m], count, MPI_BYTE, nr, d->send_tags[nbr[m]],
+		d->mpi_cart, &requests[2*m+0]);
+      MPI_Irecv(rbuf + offset[m], count, MPI_BYTE, nr, d->recv_tags[nbr[m]],
+		d->mpi_cart, &requests[2*m+1]);
     }
-  } break;
-  case 3: {
-    int ti = f->n_members * mk * mj;
-    int tj = f->n_members * mk;
-    int tk = f->n_members;
-    for (int i=0; i<mi; ++i) {
-      for (int j=0; j<mj; ++j) {
-        for (int k=0; k<mk; ++k) {
-          int m0 = (i+I0[0])*si + (j+I0[1])*sj + (k+I0[2])*sk;
-          int m1 = i*ti + j*tj + k*tk;
-          if (op == 'e') {
-            memcpy(src + m1, dst + m0, f->n_members * sz);
-          }
-          else if (op == 'r') {
-            memcpy(dst + m0, src + m1, f->n_members * sz);
-          }
-        }
+    MPI_Waitall(2 * (first[s+1] - first[s]), requests + 2 * first[s],
+		MPI_STATUSES_IGNORE);
+    for (int m=first[s]; m<first[s+1]; ++m) {
+      char *b = rbuf + offset[m];
+      for (int q=0; q<n; ++q) {
+	_exchange_pack(fs[q], box + 12*m + 6, b, 'u');
+	b += _exchange_zones(box + 12*m) * fs[q]->n_members *
+	  _dfield_elemsize(fs[q]);
       }
     }
-  } break;
   }
+  for (int q=0; q<n; ++q) {
+    _dfield_fillboundary(fs[q], mask, depth);
+  }
+  free(box);
+  free(nbr);
+  free(offset);
+  free(sbuf);
+  free(rbuf);
+  free(requests);
+  free(ps);
+#endif
 }
-static void _reduce(double *result, double **args, int **strides, void *udata)
-{
-  void **u = (void**) udata;
-  cow_dfield *f = (cow_dfield*) u[0];
-  double *min = &((double*) u[1])[0];
-  double *max = &((double*) u[1])[1];
-  double *sum = &((double*) u[1])[2];
-  double y;
-  f->transform(&y, args, strides, f->userdata);
-  if (y > *max) *max = y;
-  if (y < *min) *min = y;
-  *sum += y;
-}
-void cow_dfield_reduce(cow_dfield *f, double x[3])
+void cow_dfield_syncguard_partial(cow_dfield *f, int dims, int depth)
+// -----------------------------------------------------------------------------
+// Synchronizes only the guard zones within `depth` of the interior along the
+// dimensions in `dims`, a bitwise or of (1 << dim), or COW_ALL_DIMS. The edges
+// and corners between those dimensions are included, and other guard zones
+// are left as they were. A stencil reaching r zones along x alone needs
+// dims = 1 and depth = r. The datatypes for each combination are built on its
+// first use and kept with the field.
+// -----------------------------------------------------------------------------
 {
-  void *udata[2] = { f, x };
-  x[0] = 1e10; // min
-  x[1] =-1e10; // max
-  x[2] = 0.0; // sum
-  cow_dfield_loop(f, _reduce, udata);
-  if (!cow_mpirunning()) return;
-#if (COW_MPI)
   cow_domain *d = f->domain;
-  MPI_Allreduce(MPI_IN_PLACE, &x[0], 1, MPI_DOUBLE, MPI_MIN, d->mpi_cart);
-  MPI_Allreduce(MPI_IN_PLACE, &x[1], 1, MPI_DOUBLE, MPI_MAX, d->mpi_cart);
-  MPI_Allreduce(MPI_IN_PLACE, &x[2], 1, MPI_DOUBLE, MPI_SUM, d->mpi_cart);
+  int mask = _guardmask(d, dims);
+  if (depth > d->n_ghst) depth = d->n_ghst;
+  cow_dfield_syncguard_end(f);
+  if (mask == 0 || depth <= 0) return;
+  if (mask == _guardmask(d, COW_ALL_DIMS) && depth == d->n_ghst) {
+    cow_dfield_syncguard(f);
+    return;
+  }
+  f->guardmask = mask;
+  f->guarddepth = depth;
+  if (cow_mpirunning()) {
+#if (COW_MPI)
+    _dfield_syncnode(f, mask, depth);
 #endif
+  }
+  else {
+    _dfield_fillguard(f, mask, depth);
+  }
 }
-void cow_dfield_loop(cow_dfield *f, cow_transform op, void *udata)
+void _dfield_requireguard(cow_dfield *f, int dims, int depth)
+// -----------------------------------------------------------------------------
+// Used by library functions before reading the guard zones of `f`: finishes
+// any exchange in flight, and synchronizes the zones requested as in
+// cow_dfield_syncguard_partial, unless they are already current
+// -----------------------------------------------------------------------------
 {
-  int *S = f->stride;
-  int ni = cow_domain_getnumlocalzonesinterior(f->domain, 0);
-  int nj = cow_domain_getnumlocalzonesinterior(f->domain, 1);
-  int nk = cow_domain_getnumlocalzonesinterior(f->domain, 2);
-  int ng = cow_domain_getguard(f->domain);
-  switch (f->domain->n_dims) {
-  case 1:
-    for (int i=ng; i<ni+ng; ++i) {
-      double *x = (double*)f->data + (S[0]*i);
-      op(NULL, &x, &S, udata);
-    }
-    break;
-  case 2:
-    for (int i=ng; i<ni+ng; ++i) {
-      for (int j=ng; j<nj+ng; ++j) {
-        double *x = (double*)f->data + (S[0]*i + S[1]*j);
-        op(NULL, &x, &S, udata);
-      }
-    }
-    break;
-  case 3:
-    for (int i=ng; i<ni+ng; ++i) {
-      for (int j=ng; j<nj+ng; ++j) {
-        for (int k=ng; k<nk+ng; ++k) {
-          double *x = (double*)f->data + (S[0]*i + S[1]*j + S[2]*k);
-          op(NULL, &x, &S, udata);
-        }
-      }
-    }
-    break;
-  }
+  int mask = _guardmask(f->domain, dims);
+  if (depth > f->domain->n_ghst) depth = f->domain->n_ghst;
+  cow_dfield_syncguard_end(f);
+  if (mask == 0 || depth <= 0) return;
+  if ((f->guardmask & mask) == mask && f->guarddepth >= depth) return;
+  cow_dfield_syncguard_partial(f, mask, depth);
 }
-void cow_dfield_settransform(cow_dfield *f, cow_transform op)
+void cow_dfield_setsyncmode(cow_dfield *f, int mode)
+// -----------------------------------------------------------------------------
+// With COW_SYNC_OVERLAP, cow_dfield_transformexecute computes the zones which
+// are at least a guard depth inside the subgrid while the exchanges begun on
+// its arguments are in flight, and finishes the boundary shell after they
+// complete. It then only begins the exchange of the result, which the next
+// overlapped transform reading it completes in the same way.
+//
+// With COW_SYNC_LAZY, the result's guard zones are not synchronized at all.
+// Transforms and derivatives reading it later synchronize only the zones their
+// stencil needs (see cow_dfield_settransformstencil), and code reading its
+// data buffer directly must call cow_dfield_syncguard first.
+// -----------------------------------------------------------------------------
 {
-  f->transform = op;
+  switch (mode) {
+  case COW_SYNC_BLOCKING: f->syncmode = mode; break;
+  case COW_SYNC_OVERLAP: f->syncmode = mode; break;
+  case COW_SYNC_LAZY: f->syncmode = mode; break;
+  default: printf("[cow] error: no such sync mode\n"); break;
+  }
 }
-void cow_dfield_clearargs(cow_dfield *f)
+
+void cow_dfield_extract(cow_dfield *f, int *I0, int *I1, void *out)
 {
-  free(f->transargs);
-  f->transargs = NULL;
-  f->transargslen = 0;
+  _dfield_extractreplace(f, I0, I1, out, NULL, 0, 'e');
 }
-void cow_dfield_pusharg(cow_dfield *f, cow_dfield *arg)
+void cow_dfield_replace(cow_dfield *f, int *I0, int *I1, void *out)
 {
-  int N = (f->transargslen += 1);
-  f->transargs = (cow_dfield**) realloc(f->transargs, N * sizeof(cow_dfield*));
-  f->transargs[N - 1] = arg;
+  _dfield_extractreplace(f, I0, I1, out, NULL, 0, 'r');
 }
-void cow_dfield_setuserdata(cow_dfield *f, void *userdata)
+void cow_dfield_extractmembers(cow_dfield *f, int *I0, int *I1, void *out,
+			       int *members, int nmembers)
+// -----------------------------------------------------------------------------
+// Like cow_dfield_extract, but copies only the `nmembers` members listed in
+// `members`, in that order, so that `out` holds nmembers values per zone
+// -----------------------------------------------------------------------------
 {
-  f->userdata = userdata;
+  _dfield_extractreplace(f, I0, I1, out, members, nmembers, 'e');
 }
-void cow_dfield_setiparam(cow_dfield *f, int p)
+void cow_dfield_replacemembers(cow_dfield *f, int *I0, int *I1, void *out,
+			       int *members, int nmembers)
+// -----------------------------------------------------------------------------
+// Like cow_dfield_replace, but writes only the listed members, leaving the
+// others untouched
+// -----------------------------------------------------------------------------
 {
-  f->iparam = p;
+  _dfield_extractreplace(f, I0, I1, out, members, nmembers, 'r');
 }
-void cow_dfield_setfparam(cow_dfield *f, double p)
+void *cow_dfield_getview(cow_dfield *f, int member, int *size, int *stride)
+// -----------------------------------------------------------------------------
+// Describes the interior zones of one member of `f` in place, as an alternative
+// to extracting a copy of them. Returns the address of the first interior zone
+// and fills size[3] with the number of interior zones along each axis and
+// stride[3] with the distance between neighboring zones along it, counted in
+// elements: doubles, or floats for single-precision fields. Axes beyond the
+// domain's dimensions have size 1. Zone (i,j,k) of the interior is then at
+// view[i*stride[0] + j*stride[1] + k*stride[2]], with either layout. Writes
+// through the view go directly into the field.
+// -----------------------------------------------------------------------------
 {
-  f->dparam = p;
+  if (!f->committed || member < 0 || member >= f->n_members) return NULL;
+  cow_dfield_syncguard_end(f);
+  int ng = f->domain->n_ghst;
+  long z = member * f->stride[3];
+  for (int n=0; n<3; ++n) {
+    int inside = n < f->domain->n_dims;
+    size[n] = inside ? f->domain->L_nint[n] : 1;
+    stride[n] = f->stride[n];
+    z += inside ? ng * f->stride[n] : 0;
+  }
+  return (char*) f->data + z * _dfield_elemsize(f);
 }
-void cow_dfield_transformexecute(cow_dfield *f)
+void _dfield_extractreplace(cow_dfield *f, int *I0, int *I1, void *out,
+			    int *members, int nsel, char op)
+// -----------------------------------------------------------------------------
+// Copies the zones I0 <= I < I1 of the selected members of `f` to ('e') or
+// from ('r') `out`, which holds those members of each zone adjacent, in the
+// order given, with the zones in C order. A NULL `members` selects them all.
+// The copy goes a row along the last dimension at a time, spread over the
+// threads of the field, and each row is a single memcpy when it is contiguous
+// in the field as well as in `out`.
+// -----------------------------------------------------------------------------
 {
-  cow_dfield *result = f;
-  cow_dfield **args = f->transargs;
-  int nargs = f->transargslen;
-  cow_transform op = f->transform;
-  void *udata = f->userdata;
-  int ni = cow_domain_getnumlocalzonesinterior(result->domain, 0);
-  int nj = cow_domain_getnumlocalzonesinterior(result->domain, 1);
-  int nk = cow_domain_getnumlocalzonesinterior(result->domain, 2);
-  int ng = cow_domain_getguard(result->domain);
-  int *rs = result->stride;
-  int **S = (int**) malloc(nargs * sizeof(int*));
-  double **x = (double**) malloc(nargs * sizeof(double*));
-  for (int n=0; n<nargs; ++n) {
-    S[n] = args[n]->stride;
+  cow_dfield_syncguard_end(f);
+  int nd = f->domain->n_dims;
+  int lo[3] = { 0, 0, 0 }, M[3] = { 1, 1, 1 }, S[3] = { 0, 0, 0 };
+  for (int n=0; n<nd; ++n) { // the last dimension of the domain goes last
+    lo[n+3-nd] = I0[n];
+    M[n+3-nd] = I1[n] - I0[n];
+    S[n+3-nd] = f->stride[n];
+    if (M[n+3-nd] <= 0) return;
   }
-  switch (result->domain->n_dims) {
-  case 1:
-    for (int i=ng; i<ni+ng; ++i) {
-      for (int n=0; n<nargs; ++n) {
-        x[n] = (double*)args[n]->data + (S[n][0]*i);
-      }
-      int m1 = rs[0]*i;
-      op((double*)result->data + m1, x, S, udata);
-    }
-    break;
-  case 2:
-    for (int i=ng; i<ni+ng; ++i) {
-      for (int j=ng; j<nj+ng; ++j) {
-        for (int n=0; n<nargs; ++n) {
-          x[n] = (double*)args[n]->data + (S[n][0]*i + S[n][1]*j);
-        }
-        int m1 = rs[0]*i + rs[1]*j;
-        op((double*)result->data + m1, x, S, udata);
-      }
+  if (members == NULL) {
+    nsel = f->n_members;
+  }
+  if (nsel <= 0) return;
+  int sm = f->stride[3];
+  int *sel = (int*) malloc(nsel * sizeof(int));
+  for (int q=0; q<nsel; ++q) {
+    sel[q] = members ? members[q] : q;
+    if (sel[q] < 0 || sel[q] >= f->n_members) {
+      printf("[cow] error: no member %d in field %s\n", sel[q], f->name);
+      free(sel);
+      return;
     }
-    break;
-  case 3:
-    for (int i=ng; i<ni+ng; ++i) {
-      for (int j=ng; j<nj+ng; ++j) {
-        for (int k=ng; k<nk+ng; ++k) {
-          for (int n=0; n<nargs; ++n) {
-            x[n] = (double*)args[n]->data + (S[n][0]*i + S[n][1]*j + S[n][2]*k);
-          }
-          int m1 = rs[0]*i + rs[1]*j + rs[2]*k;
-          op((double*)result->data + m1, x, S, udata);
-        }
-      }
+  }
+  int contiguous = S[2] == nsel || M[2] == 1;
+  for (int q=0; q<nsel; ++q) {
+    if (sel[q] * sm != sel[0] * sm + q) contiguous = 0;
+  }
+  long z0 = (long) lo[0]*S[0] + lo[1]*S[1] + lo[2]*S[2];
+  double *b0 = (double*) out;
+  int single = f->precision == COW_PRECISION_SINGLE;
+  int nk = M[2];
+  long row = (long) nk * nsel;
+#if (COW_OPENMP)
+  int nt = cow_dfield_getnumthreads(f);
+#pragma omp parallel for collapse(2) schedule(static) num_threads(nt)
+#endif
+  for (int i=0; i<M[0]; ++i) {
+    for (int j=0; j<M[1]; ++j) {
+      long z = z0 + i*S[0] + j*S[1];
+      double *b = b0 + (i*M[1] + j) * row;
+      if (single) {
+	// floats are converted on the way, a member at a time
+	for (int q=0; q<nsel; ++q) {
+	  float *y = (float*) f->data + z + sel[q]*sm;
+	  if (op == 'e') {
+	    for (int k=0; k<nk; ++k) {
+	      b[k*nsel + q] = y[k*S[2]];
+	    }
+	  }
+	  else {
+	    for (int k=0; k<nk; ++k) {
+	      y[k*S[2]] = (float) b[k*nsel + q];
+	    }
+	  }
+	}
+	continue;
+      }
+      double *x = (double*) f->data + z;
+      if (contiguous) {
+	if (op == 'e') memcpy(b, x + sel[0]*sm, row * sizeof(double));
+	else memcpy(x + sel[0]*sm, b, row * sizeof(double));
+      }
+      else if (op == 'e') {
+	for (int q=0; q<nsel; ++q) {
+	  double *y = x + sel[q]*sm;
+	  for (int k=0; k<nk; ++k) {
+	    b[k*nsel + q] = y[k*S[2]];
+	  }
+	}
+      }
+      else {
+	for (int q=0; q<nsel; ++q) {
+	  double *y = x + sel[q]*sm;
+	  for (int k=0; k<nk; ++k) {
+	    y[k*S[2]] = b[k*nsel + q];
+	  }
+	}
+      }
+    }
+  }
+  free(sel);
+}
+struct reduction
+{
+  cow_dfield *field;
+  double acc[4]; // min, max, sum, correction
+  cow_exactsum exact; // used instead of sum for COW_SUM_REPRODUCIBLE
+  double *row; // results of a pencil transform
+} ;
+static void _reduceadd(struct reduction *r, double y)
+{
+  double *acc = r->acc;
+  if (y < acc[0]) acc[0] = y;
+  if (y > acc[1]) acc[1] = y;
+  switch (r->field->summode) {
+  case COW_SUM_COMPENSATED: _sum_kahanadd(&acc[2], &acc[3], y); break;
+  case COW_SUM_REPRODUCIBLE: _sum_exactadd(&r->exact, y); break;
+  default: acc[2] += y; break;
+  }
+}
+static void _reduce(double *result, double **args, int **strides, void *udata)
+{
+  struct reduction *r = (struct reduction*) udata;
+  cow_dfield *f = r->field;
+  double y;
+  f->transform(&y, args, strides, f->userdata);
+  _reduceadd(r, y);
+}
+static void _reducepencil(double *result, double **args, int **strides,
+			  int *pstrides, int nzones, void *udata)
+{
+  struct reduction *r = (struct reduction*) udata;
+  cow_dfield *f = r->field;
+  int p[2] = { pstrides[0], 1 };
+  f->pencil(r->row, args, strides, p, nzones, f->userdata);
+  for (int q=0; q<nzones; ++q) {
+    _reduceadd(r, r->row[q]);
+  }
+}
+void cow_dfield_setsummode(cow_dfield *f, int mode)
+{
+  switch (mode) {
+  case COW_SUM_PLAIN: f->summode = mode; break;
+  case COW_SUM_COMPENSATED: f->summode = mode; break;
+  case COW_SUM_REPRODUCIBLE: f->summode = mode; break;
+  default: printf("[cow] error: no such sum mode\n"); break;
+  }
+}
+void cow_dfield_reduce(cow_dfield *f, double x[3])
+// -----------------------------------------------------------------------------
+// Computes the min, max, and sum of the transform over the interior zones. The
+// sum is accumulated according to the field's sum mode: COW_SUM_REPRODUCIBLE
+// returns a sum which is bitwise identical for any number of processes.
+// -----------------------------------------------------------------------------
+{
+  int nt = cow_dfield_getnumthreads(f);
+  int nrow = f->domain->L_nint[f->domain->n_dims-1];
+  struct reduction *R = (struct reduction*) malloc(nt * sizeof(struct reduction));
+  void **udata = (void**) malloc(nt * sizeof(void*));
+  for (int t=0; t<nt; ++t) {
+    struct reduction r = {
+      .field = f,
+      .acc = { 1e10, -1e10, 0.0, 0.0 },
+      .row = f->pencil ? (double*) malloc(nrow * sizeof(double)) : NULL,
+    } ;
+    R[t] = r;
+    _sum_exactclear(&R[t].exact);
+    udata[t] = &R[t];
+  }
+  int mask, depth;
+  _transformstencil(f, &mask, &depth);
+  _dfield_requireguard(f, mask, depth);
+  if (f->pencil) {
+    _dfield_pencils(f->domain, NULL, &f, 1, _reducepencil, udata, nt, depth);
+  }
+  else {
+    _dfield_loop(f, _reduce, udata, nt, depth);
+  }
+  double *acc = R[0].acc; // per-thread results are merged into the first
+  cow_exactsum exact = R[0].exact;
+  for (int t=1; t<nt; ++t) {
+    if (R[t].acc[0] < acc[0]) acc[0] = R[t].acc[0];
+    if (R[t].acc[1] > acc[1]) acc[1] = R[t].acc[1];
+    switch (f->summode) {
+    case COW_SUM_COMPENSATED:
+      _sum_kahanadd(&acc[2], &acc[3], R[t].acc[2]);
+      acc[3] += R[t].acc[3];
+      break;
+    case COW_SUM_REPRODUCIBLE: _sum_exactmerge(&exact, &R[t].exact); break;
+    default: acc[2] += R[t].acc[2]; break;
+    }
+  }
+#if (COW_MPI)
+  if (cow_mpirunning()) {
+    MPI_Comm c = f->domain->mpi_cart;
+    MPI_Allreduce(MPI_IN_PLACE, &acc[0], 1, MPI_DOUBLE, MPI_MIN, c);
+    MPI_Allreduce(MPI_IN_PLACE, &acc[1], 1, MPI_DOUBLE, MPI_MAX, c);
+    switch (f->summode) {
+    case COW_SUM_COMPENSATED:
+      {
+	MPI_Datatype type;
+	MPI_Op op;
+	_sum_kahanmpi(&type, &op);
+	MPI_Allreduce(MPI_IN_PLACE, &acc[2], 1, type, op, c);
+	MPI_Type_free(&type);
+	MPI_Op_free(&op);
+      }
+      break;
+    case COW_SUM_REPRODUCIBLE:
+      _sum_exactnorm(&exact);
+      MPI_Allreduce(MPI_IN_PLACE, &exact, sizeof(cow_exactsum) /
+		    sizeof(int64_t), MPI_INT64_T, MPI_SUM, c);
+      break;
+    default:
+      MPI_Allreduce(MPI_IN_PLACE, &acc[2], 1, MPI_DOUBLE, MPI_SUM, c);
+      break;
+    }
+  }
+#endif
+  x[0] = acc[0];
+  x[1] = acc[1];
+  switch (f->summode) {
+  case COW_SUM_COMPENSATED: x[2] = acc[2] + acc[3]; break;
+  case COW_SUM_REPRODUCIBLE: x[2] = _sum_exactvalue(&exact); break;
+  default: x[2] = acc[2]; break;
+  }
+  for (int t=0; t<nt; ++t) {
+    free(R[t].row);
+  }
+  free(R);
+  free(udata);
+}
+void cow_dfield_loop(cow_dfield *f, cow_transform op, void *udata)
+// -----------------------------------------------------------------------------
+// Calls `op` on every interior zone of the field. When compiled with
+// COW_OPENMP, the zones are shared among threads unless the field was declared
+// not thread-safe, so `op` must not modify `udata` without synchronization.
+// Callbacks which accumulate should use cow_dfield_loopthreaded instead.
+// -----------------------------------------------------------------------------
+{
+  int nt = cow_dfield_getnumthreads(f);
+  void **u = (void**) malloc(nt * sizeof(void*));
+  for (int t=0; t<nt; ++t) {
+    u[t] = udata;
+  }
+  _dfield_requireguard(f, COW_ALL_DIMS, f->domain->n_ghst);
+  _dfield_loop(f, op, u, nt, f->domain->n_ghst);
+  free(u);
+}
+void cow_dfield_loopthreaded(cow_dfield *f, cow_transform op, void **udata)
+// -----------------------------------------------------------------------------
+// Like cow_dfield_loop, but each thread passes its own item of `udata`, which
+// has cow_dfield_getnumthreads(f) entries. Callbacks may accumulate into their
+// item without synchronization, and the caller merges the items afterwards.
+// -----------------------------------------------------------------------------
+{
+  _dfield_requireguard(f, COW_ALL_DIMS, f->domain->n_ghst);
+  _dfield_loop(f, op, udata, cow_dfield_getnumthreads(f), f->domain->n_ghst);
+}
+void cow_dfield_looppencil(cow_dfield *f, cow_pencil op, void *udata)
+// -----------------------------------------------------------------------------
+// Like cow_dfield_loop, but `op` is called once for every row of interior
+// zones along the last dimension, with the field as its only argument
+// -----------------------------------------------------------------------------
+{
+  int nt = cow_dfield_getnumthreads(f);
+  void **u = (void**) malloc(nt * sizeof(void*));
+  for (int t=0; t<nt; ++t) {
+    u[t] = udata;
+  }
+  _dfield_requireguard(f, COW_ALL_DIMS, f->domain->n_ghst);
+  _dfield_pencils(f->domain, NULL, &f, 1, op, u, nt, f->domain->n_ghst);
+  free(u);
+}
+void cow_dfield_looppencilthreaded(cow_dfield *f, cow_pencil op, void **udata)
+// -----------------------------------------------------------------------------
+// Like cow_dfield_looppencil, with an item of `udata` for each thread, as in
+// cow_dfield_loopthreaded
+// -----------------------------------------------------------------------------
+{
+  _dfield_requireguard(f, COW_ALL_DIMS, f->domain->n_ghst);
+  _dfield_pencils(f->domain, NULL, &f, 1, op, udata,
+		  cow_dfield_getnumthreads(f), f->domain->n_ghst);
+}
+void cow_dfield_setthreadsafe(cow_dfield *f, int safe)
+// -----------------------------------------------------------------------------
+// Declares whether the callbacks applied to this field (its transform, and
+// those given to cow_dfield_loop or cow_histogram_populate) may be called from
+// several threads at once. Fields are assumed thread-safe by default.
+// -----------------------------------------------------------------------------
+{
+  f->threadsafe = safe;
+}
+int cow_dfield_getnumthreads(cow_dfield *f)
+{
+  return f->threadsafe ? cow_domain_getnumthreads(f->domain) : 1;
+}
+void cow_dfield_settransform(cow_dfield *f, cow_transform op)
+// -----------------------------------------------------------------------------
+// Sets a transform which is evaluated a zone at a time. Member m of argument n
+// is found at args[n][m*strides[n][3]], and of the result at result[m].
+// -----------------------------------------------------------------------------
+{
+  f->transform = op;
+  f->pencil = _builtinpencil(op);
+  f->stencildepth = -1;
+}
+void cow_dfield_settransformpencil(cow_dfield *f, cow_pencil op)
+// -----------------------------------------------------------------------------
+// Sets a transform which is evaluated a pencil (row of zones along the last
+// dimension) at a time. Zone q of the pencil is found at args[n] +
+// q*pstrides[n] for each argument, and at result + q*pstrides[nargs] for the
+// result. The strides along every dimension are also given, for stencils.
+// -----------------------------------------------------------------------------
+{
+  f->transform = NULL;
+  f->pencil = op;
+  f->stencildepth = -1;
+}
+void cow_dfield_settransformstencil(cow_dfield *f, int dims, int depth)
+// -----------------------------------------------------------------------------
+// Declares the guard zones which the transform reads from its arguments, along
+// the dimensions `dims` to `depth` zones from the interior (see
+// cow_dfield_syncguard_partial). Pointwise transforms have depth 0. Only these
+// zones are synchronized on arguments whose guard zones are out of date. The
+// built-in transforms and cow_deriv_* kernels are recognized, other transforms
+// are assumed to read every guard zone. Setting the transform clears this.
+// -----------------------------------------------------------------------------
+{
+  f->stencilmask = dims;
+  f->stencildepth = depth;
+}
+void cow_dfield_clearargs(cow_dfield *f)
+{
+  free(f->transargs);
+  f->transargs = NULL;
+  f->transargslen = 0;
+}
+void cow_dfield_pusharg(cow_dfield *f, cow_dfield *arg)
+{
+  int N = (f->transargslen += 1);
+  f->transargs = (cow_dfield**) realloc(f->transargs, N * sizeof(cow_dfield*));
+  f->transargs[N - 1] = arg;
+}
+void cow_dfield_setuserdata(cow_dfield *f, void *userdata)
+{
+  f->userdata = userdata;
+}
+void cow_dfield_setiparam(cow_dfield *f, int p)
+{
+  f->iparam = p;
+}
+void cow_dfield_setfparam(cow_dfield *f, double p)
+{
+  f->dparam = p;
+}
+void cow_dfield_transformexecute(cow_dfield *f)
+{
+  cow_domain *d = f->domain;
+  int lo[3], hi[3], smask, sdepth;
+  _interior(d, lo, hi);
+  _transformstencil(f, &smask, &sdepth);
+  cow_dfield_syncguard_end(f);
+  if (f->syncmode == COW_SYNC_OVERLAP) {
+    // zones at least a guard depth inside the subgrid need no guard data
+    int ng = d->n_ghst;
+    int in0[3], in1[3], empty = 0;
+    for (int n=0; n<3; ++n) {
+      in0[n] = n < d->n_dims ? lo[n] + ng : lo[n];
+      in1[n] = n < d->n_dims ? hi[n] - ng : hi[n];
+      if (in1[n] <= in0[n]) empty = 1;
+    }
+    if (!empty) {
+      _transformbox(f, in0, in1);
+    }
+    for (int n=0; n<f->transargslen; ++n) {
+      _dfield_requireguard(f->transargs[n], smask, sdepth);
+    }
+    if (empty) {
+      _transformbox(f, lo, hi);
+    }
+    else {
+      // the shell, as the slabs outside the inner box along each axis in turn
+      for (int n=0; n<d->n_dims; ++n) {
+	int b0[3], b1[3];
+	for (int m=0; m<3; ++m) {
+	  b0[m] = m < n ? in0[m] : lo[m];
+	  b1[m] = m < n ? in1[m] : hi[m];
+	}
+	b1[n] = in0[n];
+	_transformbox(f, b0, b1);
+	b0[n] = in1[n];
+	b1[n] = hi[n];
+	_transformbox(f, b0, b1);
+      }
+    }
+    cow_dfield_syncguard_begin(f);
+    return;
+  }
+  for (int n=0; n<f->transargslen; ++n) {
+    _dfield_requireguard(f->transargs[n], smask, sdepth);
+  }
+  _transformbox(f, lo, hi);
+  if (f->syncmode == COW_SYNC_LAZY) {
+    f->guardmask = 0;
+    f->guarddepth = 0;
+  }
+  else {
+    cow_dfield_syncguard(f);
+  }
+}
+void _transformbox(cow_dfield *f, int lo[3], int hi[3])
+// -----------------------------------------------------------------------------
+// Applies the field's transform to the zones lo <= (i,j,k) < hi
+// -----------------------------------------------------------------------------
+{
+  int nt = cow_dfield_getnumthreads(f);
+  int smask, sdepth;
+  _transformstencil(f, &smask, &sdepth);
+  if (f->pencil) {
+    void **u = (void**) malloc(nt * sizeof(void*));
+    for (int t=0; t<nt; ++t) {
+      u[t] = f->userdata;
+    }
+    _dfield_pencilsbox(f->domain, f, f->transargs, f->transargslen, f->pencil,
+		       u, nt, lo, hi, sdepth);
+    free(u);
+    return;
+  }
+  cow_dfield *result = f;
+  cow_dfield **args = f->transargs;
+  int nargs = f->transargslen;
+  cow_transform op = f->transform;
+  void *udata = f->userdata;
+  int nm = result->n_members;
+  int tile[3], ntile[3];
+  _wide_tiling(f->domain, lo, hi, 0, tile, ntile);
+  cow_dfield **fields = (cow_dfield**) malloc((nargs + 1) *
+					      sizeof(cow_dfield*));
+  for (int n=0; n<nargs; ++n) {
+    fields[n] = args[n];
+  }
+  fields[nargs] = result;
+  struct cow_widen *w = _widen_new(fields, nargs + 1, nargs, tile, sdepth, nt);
+  struct cow_wide *v = w->views;
+  int *rs = v[nargs].stride;
+  int **S = (int**) malloc(nargs * sizeof(int*));
+  double **X = (double**) malloc(nt * nargs * sizeof(double*));
+  double *Y = (double*) malloc(nt * nm * sizeof(double));
+  for (int n=0; n<nargs; ++n) {
+    S[n] = v[n].stride;
+  }
+#if (COW_OPENMP)
+#pragma omp parallel for collapse(3) schedule(static) num_threads(nt)
+#endif
+  for (int a=0; a<ntile[0]; ++a) {
+    for (int b=0; b<ntile[1]; ++b) {
+      for (int c=0; c<ntile[2]; ++c) {
+	int t0[3], t1[3], T[3] = { a, b, c };
+	struct cow_wide *wt = _widen_tile(w, _threadnum(), lo, hi, tile, T,
+					  t0, t1);
+	double **x = X + _threadnum() * nargs; // per-thread argument pointers
+	double *y = Y + _threadnum() * nm; // and result, for planar members
+	for (int i=t0[0]; i<t1[0]; ++i) {
+	  for (int j=t0[1]; j<t1[1]; ++j) {
+	    for (int k=t0[2]; k<t1[2]; ++k) {
+	      for (int n=0; n<nargs; ++n) {
+		x[n] = _wide_zone(&wt[n], i, j, k);
+	      }
+	      double *r = _wide_zone(&wt[nargs], i, j, k);
+	      if (rs[3] == 1) {
+		op(r, x, S, udata);
+		continue;
+	      }
+	      op(y, x, S, udata);
+	      for (int m=0; m<nm; ++m) {
+		r[m*rs[3]] = y[m];
+	      }
+	    }
+	  }
+	}
+	_wide_store(&wt[nargs], result, t0, t1);
+      }
+    }
+  }
+  _widen_del(w);
+  free(fields);
+  free(S);
+  free(X);
+  free(Y);
+}
+
+void _dfield_loop(cow_dfield *f, cow_transform op, void **udata, int nthreads,
+		  int halo)
+// -----------------------------------------------------------------------------
+// Calls `op` on every interior zone, using `nthreads` threads. Thread t passes
+// udata[t] to the callback, which may read `halo` zones around its own.
+// -----------------------------------------------------------------------------
+{
+  int lo[3], hi[3], tile[3], ntile[3];
+  _interior(f->domain, lo, hi);
+  _wide_tiling(f->domain, lo, hi, 0, tile, ntile);
+  cow_dfield_syncguard_end(f);
+  struct cow_widen *w = _widen_new(&f, 1, 1, tile, halo, nthreads);
+  int *S = w->views[0].stride;
+#if (COW_OPENMP)
+#pragma omp parallel for collapse(3) schedule(static) num_threads(nthreads)
+#endif
+  for (int a=0; a<ntile[0]; ++a) {
+    for (int b=0; b<ntile[1]; ++b) {
+      for (int c=0; c<ntile[2]; ++c) {
+	int t0[3], t1[3], T[3] = { a, b, c };
+	struct cow_wide *wt = _widen_tile(w, _threadnum(), lo, hi, tile, T,
+					  t0, t1);
+	void *u = udata[_threadnum()];
+	for (int i=t0[0]; i<t1[0]; ++i) {
+	  for (int j=t0[1]; j<t1[1]; ++j) {
+	    for (int k=t0[2]; k<t1[2]; ++k) {
+	      double *x = _wide_zone(wt, i, j, k);
+	      op(NULL, &x, &S, u);
+	    }
+	  }
+	}
+      }
+    }
+  }
+  _widen_del(w);
+}
+void _dfield_pencils(cow_domain *d, cow_dfield *result, cow_dfield **args,
+		     int nargs, cow_pencil op, void **udata, int nthreads,
+		     int halo)
+// -----------------------------------------------------------------------------
+// Calls `op` once for every row of interior zones along the last dimension.
+// The pencil strides of the arguments are followed by that of the result,
+// which is zero when there is no result field. Rows are shared among
+// `nthreads` threads, and thread t passes udata[t] to the callback. The
+// callback may read `halo` zones around the row from the arguments.
+// -----------------------------------------------------------------------------
+{
+  int lo[3], hi[3];
+  _interior(d, lo, hi);
+  for (int n=0; n<nargs; ++n) {
+    cow_dfield_syncguard_end(args[n]);
+  }
+  if (result) {
+    cow_dfield_syncguard_end(result);
+  }
+  _dfield_pencilsbox(d, result, args, nargs, op, udata, nthreads, lo, hi,
+		     halo);
+}
+void _dfield_pencilsbox(cow_domain *d, cow_dfield *result, cow_dfield **args,
+			int nargs, cow_pencil op, void **udata, int nthreads,
+			int lo[3], int hi[3], int halo)
+// -----------------------------------------------------------------------------
+// Like _dfield_pencils, for the rows of the zones lo <= (i,j,k) < hi
+// -----------------------------------------------------------------------------
+{
+  int pdim = d->n_dims - 1;
+  int nzones = hi[pdim] - lo[pdim];
+  if (nzones <= 0) return;
+  int tile[3], ntile[3];
+  _wide_tiling(d, lo, hi, 1, tile, ntile);
+  cow_dfield **fields = (cow_dfield**) malloc((nargs + 1) *
+					      sizeof(cow_dfield*));
+  for (int n=0; n<nargs; ++n) {
+    fields[n] = args[n];
+  }
+  fields[nargs] = result;
+  struct cow_widen *w = _widen_new(fields, nargs + 1, nargs, tile, halo,
+				   nthreads);
+  struct cow_wide *v = w->views;
+  int **S = (int**) malloc(nargs * sizeof(int*));
+  int *P = (int*) malloc((nargs + 1) * sizeof(int));
+  double **X = (double**) malloc(nthreads * nargs * sizeof(double*));
+  int nm = result ? result->n_members : 0;
+  int *rs = result ? v[nargs].stride : NULL;
+  int planar = result && rs[3] != 1;
+  double *Y = planar ? (double*) malloc(nthreads * nzones * nm *
+					sizeof(double)) : NULL;
+  for (int n=0; n<nargs; ++n) {
+    S[n] = v[n].stride;
+    P[n] = v[n].stride[pdim];
+  }
+  P[nargs] = planar ? nm : result ? rs[pdim] : 0;
+#if (COW_OPENMP)
+#pragma omp parallel for collapse(3) schedule(static) num_threads(nthreads)
+#endif
+  for (int a=0; a<ntile[0]; ++a) {
+    for (int b=0; b<ntile[1]; ++b) {
+      for (int c=0; c<ntile[2]; ++c) {
+	int t = _threadnum();
+	int t0[3], t1[3], T[3] = { a, b, c };
+	struct cow_wide *wt = _widen_tile(w, t, lo, hi, tile, T, t0, t1);
+	int h[3] = { t1[0], t1[1], t1[2] };
+	h[pdim] = t0[pdim] + 1; // loop over the first zone of each row
+	double **x = X + t * nargs; // per-thread argument pointers
+	for (int i=t0[0]; i<h[0]; ++i) {
+	  for (int j=t0[1]; j<h[1]; ++j) {
+	    for (int k=t0[2]; k<h[2]; ++k) {
+	      for (int n=0; n<nargs; ++n) {
+		x[n] = _wide_zone(&wt[n], i, j, k);
+	      }
+	      double *y = result ? _wide_zone(&wt[nargs], i, j, k) : NULL;
+	      if (!planar) {
+		op(y, x, S, P, nzones, udata[t]);
+		continue;
+	      }
+	      // planar results are written to a row buffer, then moved to the
+	      // planes
+	      double *row = Y + t * nzones * nm;
+	      op(row, x, S, P, nzones, udata[t]);
+	      for (int m=0; m<nm; ++m) {
+		for (int q=0; q<nzones; ++q) {
+		  y[m*rs[3] + q*rs[pdim]] = row[q*nm + m];
+		}
+	      }
+	    }
+	  }
+	}
+	if (result) {
+	  _wide_store(&wt[nargs], result, t0, t1);
+	}
+      }
+    }
+  }
+  _widen_del(w);
+  free(fields);
+  free(S);
+  free(P);
+  free(X);
+  free(Y);
+}
+void _dfield_fillguard(cow_dfield *f, int mask, int depth)
+// -----------------------------------------------------------------------------
+// Periodic guard fill on a single process, of the guard zones within `depth`
+// of the interior along the dimensions in `mask`. The guard slabs are copied
+// from the opposite side of the interior a dimension at a time. Slabs along
+// dimension a span the filled guard zones of the dimensions before a, so the
+// edges and corners are filled along the way, and the interior is never
+// visited.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  int ng = d->n_ghst;
+  for (int a=0; a<d->n_dims; ++a) {
+    int N = d->L_nint[a];
+    if (!(mask & (1 << a)) || !_periodic(d, a)) continue;
+    for (int side=0; side<2; ++side) {
+      int src[6], dst[6];
+      for (int b=0; b<3; ++b) {
+	int w = b < a && (mask & (1 << b)) ? depth : 0;
+	int lo = b >= d->n_dims ? 0 : ng - w;
+	int hi = b >= d->n_dims ? 1 : ng + d->L_nint[b] + w;
+	src[b] = dst[b] = lo;
+	src[b+3] = dst[b+3] = hi;
+      }
+      src[a] = side ? ng : N + ng - depth;
+      dst[a] = side ? N + ng : ng - depth;
+      src[a+3] = src[a] + depth;
+      dst[a+3] = dst[a] + depth;
+      _dfield_copybox(f, src, dst);
+    }
+  }
+  _dfield_fillboundary(f, mask, depth);
+}
+void _dfield_copybox(cow_dfield *f, int *src, int *dst)
+// -----------------------------------------------------------------------------
+// Copies the zones of the box src (lo[3] then hi[3]) to the box of the same
+// shape at dst, a row along the last dimension at a time. The boxes must not
+// overlap.
+// -----------------------------------------------------------------------------
+{
+  int *S = f->stride;
+  int pdim = f->domain->n_dims - 1;
+  int h[3] = { src[3], src[4], src[5] };
+  h[pdim] = src[pdim] + 1;
+  int nb = _rowblocks(f);
+  size_t es = _dfield_elemsize(f);
+  size_t row = (src[pdim+3] - src[pdim]) * (f->n_members / nb) * es;
+  int shift = (S[0] * (dst[0] - src[0]) + S[1] * (dst[1] - src[1]) +
+	       S[2] * (dst[2] - src[2]));
+  char *data = (char*) f->data;
+#if (COW_OPENMP)
+  int nt = cow_dfield_getnumthreads(f);
+#pragma omp parallel for collapse(2) schedule(static) num_threads(nt)
+#endif
+  for (int i=src[0]; i<h[0]; ++i) {
+    for (int j=src[1]; j<h[1]; ++j) {
+      for (int k=src[2]; k<h[2]; ++k) {
+	for (int b=0; b<nb; ++b) {
+	  size_t m = (S[0]*i + S[1]*j + S[2]*k + b*S[3]) * es;
+	  memcpy(data + m + shift * es, data + m, row);
+	}
+      }
+    }
+  }
+}
+void _dfield_freedata(cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Releases the data buffer owned by `f`, from its shared window if it has one
+// -----------------------------------------------------------------------------
+{
+#if (COW_MPI)
+  if (f->win != MPI_WIN_NULL) {
+    MPI_Win_unlock_all(f->win);
+    MPI_Win_free(&f->win);
+    f->data = NULL;
+    return;
+  }
+#endif
+  _mem_free(f->domain, f->data);
+}
+void _dfield_firsttouch(cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Zeros newly allocated data one row at a time, with the threads and static
+// schedule of the loops over the domain, so that each page is placed on the
+// NUMA node of the thread which will work on it
+// -----------------------------------------------------------------------------
+{
+  int *N = f->domain->L_ntot;
+  int nb = _rowblocks(f);
+  int nrow = N[2] * (f->n_members / nb);
+  size_t plane = (size_t) N[0] * N[1] * nrow;
+  size_t es = _dfield_elemsize(f);
+#if (COW_OPENMP)
+  int nt = cow_dfield_getnumthreads(f);
+#pragma omp parallel for collapse(2) schedule(static) num_threads(nt)
+#endif
+  for (int i=0; i<N[0]; ++i) {
+    for (int j=0; j<N[1]; ++j) {
+      for (int b=0; b<nb; ++b) {
+	char *x = (char*) f->data + (b * plane + (i*N[1] + j) * nrow) * es;
+	memset(x, 0, nrow * es);
+      }
+    }
+  }
+}
+size_t _dfield_elemsize(cow_dfield *f)
+{
+  return f->precision == COW_PRECISION_SINGLE ? sizeof(float) : sizeof(double);
+}
+double _dfield_load(cow_dfield *f, long n)
+// -----------------------------------------------------------------------------
+// Element n of the data of `f`, of either precision
+// -----------------------------------------------------------------------------
+{
+  if (f->precision == COW_PRECISION_SINGLE) return ((float*) f->data)[n];
+  return ((double*) f->data)[n];
+}
+void _dfield_store(cow_dfield *f, long n, double x)
+{
+  if (f->precision == COW_PRECISION_SINGLE) ((float*) f->data)[n] = (float) x;
+  else ((double*) f->data)[n] = x;
+}
+void _wide_init(struct cow_wide *v, cow_dfield *f, int tile[3], int halo)
+// -----------------------------------------------------------------------------
+// Prepares a view of `f` in double over boxes of up to tile[] zones, and
+// `halo` zones around them. A field of doubles is viewed in place. A field of
+// floats needs v->size doubles of scratch, which the boxes are widened into,
+// with strides of their own in the field's layout.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  v->halo = halo;
+  v->offset = 0;
+  for (int n=0; n<3; ++n) {
+    v->start[n] = 0;
+  }
+  if (f->precision != COW_PRECISION_SINGLE) {
+    v->data = (double*) f->data;
+    memcpy(v->stride, f->stride, 4 * sizeof(int));
+    v->size = 0;
+    return;
+  }
+  int planar = f->layout == COW_LAYOUT_PLANAR;
+  int s = planar ? 1 : f->n_members;
+  for (int n=2; n>=0; --n) {
+    int N = n < d->n_dims ? tile[n] + 2 * halo : 1;
+    if (n < d->n_dims && N > d->L_ntot[n]) N = d->L_ntot[n];
+    v->stride[n] = n < d->n_dims ? s : 0;
+    s *= N;
+  }
+  v->stride[3] = planar ? s : 1;
+  v->size = planar ? (long) s * f->n_members : s;
+  v->data = NULL;
+}
+void _wide_box(struct cow_wide *v, cow_dfield *f, int lo[3], int hi[3],
+	       double *scratch)
+// -----------------------------------------------------------------------------
+// Points a view needing scratch at the zones lo <= (i,j,k) < hi and its halo,
+// as far as they are allocated, held in `scratch`
+// -----------------------------------------------------------------------------
+{
+  if (v->size == 0) return;
+  cow_domain *d = f->domain;
+  for (int n=0; n<3; ++n) {
+    v->start[n] = n < d->n_dims ? lo[n] - v->halo : lo[n];
+    v->end[n] = n < d->n_dims ? hi[n] + v->halo : hi[n];
+    if (v->start[n] < 0) v->start[n] = 0;
+    if (n < d->n_dims && v->end[n] > d->L_ntot[n]) v->end[n] = d->L_ntot[n];
+  }
+  v->data = scratch;
+}
+void _wide_load(struct cow_wide *v, cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Widens the floats of the box a view is pointed at into its scratch
+// -----------------------------------------------------------------------------
+{
+  if (v->size == 0) return;
+  _wide_copy(v, f, v->start, v->end, 0);
+}
+void _wide_store(struct cow_wide *v, cow_dfield *f, int lo[3], int hi[3])
+// -----------------------------------------------------------------------------
+// Rounds the zones lo <= (i,j,k) < hi of a view's scratch back into the floats
+// of the field
+// -----------------------------------------------------------------------------
+{
+  if (v->size == 0) return;
+  _wide_copy(v, f, lo, hi, 1);
+}
+void _wide_copy(struct cow_wide *v, cow_dfield *f, int lo[3], int hi[3],
+		int store)
+// -----------------------------------------------------------------------------
+// Copies the zones lo <= (i,j,k) < hi between the floats of the field and a
+// view's scratch, in runs along the rows, which have the same layout in both
+// -----------------------------------------------------------------------------
+{
+  int pdim = f->domain->n_dims - 1;
+  int nb = _rowblocks(f);
+  int run = (hi[pdim] - lo[pdim]) * (nb == 1 ? f->n_members : 1);
+  int *S = f->stride, *W = v->stride;
+  int h[3] = { hi[0], hi[1], hi[2] };
+  h[pdim] = lo[pdim] + 1;
+  for (int i=lo[0]; i<h[0]; ++i) {
+    for (int j=lo[1]; j<h[1]; ++j) {
+      for (int k=lo[2]; k<h[2]; ++k) {
+	for (int b=0; b<nb; ++b) {
+	  float *x = (float*) f->data + (S[0]*i + S[1]*j + S[2]*k + b*S[3]);
+	  double *y = _wide_zone(v, i, j, k) + b*W[3];
+	  if (store) {
+	    for (int q=0; q<run; ++q) x[q] = (float) y[q];
+	  }
+	  else {
+	    for (int q=0; q<run; ++q) y[q] = x[q];
+	  }
+	}
+      }
+    }
+  }
+}
+double *_wide_zone(struct cow_wide *v, int i, int j, int k)
+// -----------------------------------------------------------------------------
+// The first member of zone (i,j,k), in the field's index space, within a view
+// -----------------------------------------------------------------------------
+{
+  int *W = v->stride, *b = v->start;
+  return v->data + (W[0]*(i - b[0]) + W[1]*(j - b[1]) + W[2]*(k - b[2]));
+}
+void _wide_tiling(cow_domain *d, int lo[3], int hi[3], int rows, int tile[3],
+		  int ntile[3])
+// -----------------------------------------------------------------------------
+// Cuts the zones lo <= (i,j,k) < hi into tiles of WIDE_TILE rows along each
+// axis but the last, whose rows are kept whole, giving the tile extents and
+// their number along each axis. Unless `rows` is true, the row of a
+// one-dimensional box is cut as well.
+// -----------------------------------------------------------------------------
+{
+  int pdim = d->n_dims - 1;
+  for (int n=0; n<3; ++n) {
+    int N = hi[n] - lo[n];
+    tile[n] = n >= d->n_dims ? N : WIDE_TILE;
+    if (n == pdim) tile[n] = rows || pdim > 0 ? N : WIDE_TILE * WIDE_TILE;
+    if (tile[n] > N) tile[n] = N;
+    ntile[n] = N > 0 ? (N + tile[n] - 1) / tile[n] : 0;
+  }
+}
+struct cow_widen *_widen_new(cow_dfield **fields, int nfields, int nread,
+			     int tile[3], int halo, int nthreads)
+// -----------------------------------------------------------------------------
+// Views of `fields` in double for each of `nthreads` threads, with scratch
+// drawn from the domain allocator for those of single precision. The first
+// `nread` fields are read, with `halo` zones around each tile; the others are
+// written, and may be NULL.
+// -----------------------------------------------------------------------------
+{
+  struct cow_widen *w = (struct cow_widen*) malloc(sizeof(struct cow_widen));
+  w->domain = NULL;
+  w->fields = fields;
+  w->nfields = nfields;
+  w->nread = nread;
+  w->size = 0;
+  w->views = (struct cow_wide*) malloc(nthreads * nfields *
+				       sizeof(struct cow_wide));
+  for (int n=0; n<nfields; ++n) {
+    struct cow_wide *v = &w->views[n];
+    if (fields[n] == NULL) {
+      v->data = NULL;
+      v->size = 0;
+      continue;
+    }
+    w->domain = fields[n]->domain;
+    _wide_init(v, fields[n], tile, n < nread ? halo : 0);
+    v->offset = w->size;
+    w->size += v->size;
+  }
+  for (int t=1; t<nthreads; ++t) {
+    memcpy(&w->views[t * nfields], w->views, nfields * sizeof(struct cow_wide));
+  }
+  w->scratch = w->size ? (double*)
+    _mem_alloc(w->domain, nthreads * w->size * sizeof(double)) : NULL;
+  return w;
+}
+struct cow_wide *_widen_tile(struct cow_widen *w, int t, int lo[3], int hi[3],
+			     int tile[3], int T[3], int t0[3], int t1[3])
+// -----------------------------------------------------------------------------
+// Finds the zones t0 <= (i,j,k) < t1 of tile T[] of the box lo..hi, points the
+// views of thread t at them, and widens the fields which are read. Returns the
+// views of thread t.
+// -----------------------------------------------------------------------------
+{
+  for (int n=0; n<3; ++n) {
+    t0[n] = lo[n] + T[n] * tile[n];
+    t1[n] = t0[n] + tile[n] < hi[n] ? t0[n] + tile[n] : hi[n];
+  }
+  struct cow_wide *v = &w->views[t * w->nfields];
+  for (int n=0; n<w->nfields; ++n) {
+    if (v[n].size == 0) continue;
+    _wide_box(&v[n], w->fields[n], t0, t1, w->scratch + t * w->size +
+	      v[n].offset);
+    if (n < w->nread) {
+      _wide_load(&v[n], w->fields[n]);
+    }
+  }
+  return v;
+}
+void _widen_del(struct cow_widen *w)
+{
+  _mem_free(w->domain, w->scratch);
+  free(w->views);
+  free(w);
+}
+void _dfield_strides(cow_dfield *f, int *N)
+// -----------------------------------------------------------------------------
+// Sets the strides of `f` on a subgrid of N[] zones, guard zones included. The
+// first three are those of the zone index along each axis, in C order, and the
+// last is that of the member index.
+// -----------------------------------------------------------------------------
+{
+  int planar = f->layout == COW_LAYOUT_PLANAR;
+  int s = planar ? 1 : f->n_members;
+  for (int i=2; i>=0; --i) {
+    if (i >= f->domain->n_dims) {
+      f->stride[i] = 0;
+    }
+    else {
+      f->stride[i] = s;
+      s *= N[i];
+    }
+  }
+  f->stride[3] = planar ? s : 1;
+}
+int _rowblocks(cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Number of contiguous blocks in a row of zones along the last dimension: one
+// for each member in the planar layout, stride[3] apart, or else just one
+// -----------------------------------------------------------------------------
+{
+  return f->layout == COW_LAYOUT_PLANAR ? f->n_members : 1;
+}
+void _interior(cow_domain *d, int lo[3], int hi[3])
+// -----------------------------------------------------------------------------
+// Index range of the interior zones along each axis. Axes beyond the domain's
+// dimensionality have a single zone at index 0, where every stride vanishes.
+// -----------------------------------------------------------------------------
+{
+  for (int n=0; n<3; ++n) {
+    lo[n] = n < d->n_dims ? d->n_ghst : 0;
+    hi[n] = n < d->n_dims ? d->n_ghst + d->L_nint[n] : 1;
+  }
+}
+void _dfield_fillboundary(cow_dfield *f, int mask, int depth)
+// -----------------------------------------------------------------------------
+// Completes a guard fill on the faces of the global domain, after the periodic
+// guard zones have been exchanged. The guard zones of shearing faces are
+// shifted first. Then those of outflow and reflecting faces are filled from
+// the zones inside, a dimension at a time. Each slab spans the guard zones of
+// the other dimensions, so edges and corners shared with a later dimension
+// are overwritten from zones which are filled by then.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  for (int a=0; a<d->n_dims; ++a) {
+    if (!(mask & (1 << a))) continue;
+    for (int side=0; side<2; ++side) {
+      if (d->boundary[a][side] == COW_BOUNDARY_SHEARING &&
+	  _onboundary(d, a, side)) {
+	_dfield_shearslab(f, a, side, mask, depth);
+      }
     }
-    break;
   }
-  free(S);
-  free(x);
-  cow_dfield_syncguard(result);
+  for (int a=0; a<d->n_dims; ++a) {
+    if (!(mask & (1 << a)) || _periodic(d, a)) continue;
+    for (int side=0; side<2; ++side) {
+      if (_onboundary(d, a, side)) {
+	_dfield_mirrorslab(f, a, side, mask, depth);
+      }
+    }
+  }
+}
+void _dfield_mirrorslab(cow_dfield *f, int a, int side, int mask, int depth)
+// -----------------------------------------------------------------------------
+// Fills the guard layers of an outflow face with the zone on the face, or
+// those of a reflecting face with their mirror image
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  int ng = d->n_ghst;
+  int N = d->L_nint[a];
+  int nm = f->n_members;
+  int *S = f->stride;
+  int reflect = d->boundary[a][side] == COW_BOUNDARY_REFLECTING;
+  double *sign = (double*) malloc(nm * sizeof(double));
+  for (int m=0; m<nm; ++m) {
+    sign[m] = reflect && f->component[m] == a ? -1.0 : 1.0;
+  }
+  for (int q=0; q<depth; ++q) {
+    int lo[3], hi[3];
+    for (int b=0; b<3; ++b) {
+      int w = mask & (1 << b) ? depth : 0;
+      lo[b] = b >= d->n_dims ? 0 : ng - w;
+      hi[b] = b >= d->n_dims ? 1 : ng + d->L_nint[b] + w;
+    }
+    int dst = side ? ng + N + q : ng - 1 - q;
+    int src = side ? ng + N - 1 - (reflect ? q : 0) : ng + (reflect ? q : 0);
+    int shift = (dst - src) * S[a];
+    lo[a] = src;
+    hi[a] = src + 1;
+#if (COW_OPENMP)
+    int nt = cow_dfield_getnumthreads(f);
+#pragma omp parallel for collapse(2) schedule(static) num_threads(nt)
+#endif
+    for (int i=lo[0]; i<hi[0]; ++i) {
+      for (int j=lo[1]; j<hi[1]; ++j) {
+	for (int k=lo[2]; k<hi[2]; ++k) {
+	  long x = S[0]*i + S[1]*j + S[2]*k;
+	  for (int m=0; m<nm; ++m) {
+	    _dfield_store(f, x + shift + m*S[3],
+			  sign[m] * _dfield_load(f, x + m*S[3]));
+	  }
+	}
+      }
+    }
+  }
+  free(sign);
+}
+void _dfield_shearslab(cow_dfield *f, int a, int side, int mask, int depth)
+// -----------------------------------------------------------------------------
+// Shifts the periodic guard layers of a shearing face along the shear
+// dimension b. Every line along b is whole on this process, so the values
+// along it, guard zones included, are interpolated from its interior.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  int ng = d->n_ghst;
+  int b = d->shear_dim[a];
+  int Nb = d->L_nint[b];
+  int nm = f->n_members;
+  int *S = f->stride;
+  double s = (side ? -1.0 : 1.0) * d->shear[a] / d->dx[b];
+  int lo[3], hi[3];
+  for (int c=0; c<3; ++c) {
+    int w = mask & (1 << c) ? depth : 0;
+    lo[c] = c >= d->n_dims ? 0 : ng - w;
+    hi[c] = c >= d->n_dims ? 1 : ng + d->L_nint[c] + w;
+  }
+  int jb0 = lo[b], jb1 = hi[b];
+  lo[a] = side ? ng + d->L_nint[a] : ng - depth;
+  hi[a] = lo[a] + depth;
+  lo[b] = 0; // loop over the lines along b
+  hi[b] = 1;
+  double *line = (double*) malloc(Nb * nm * sizeof(double));
+  for (int i=lo[0]; i<hi[0]; ++i) {
+    for (int j=lo[1]; j<hi[1]; ++j) {
+      for (int k=lo[2]; k<hi[2]; ++k) {
+	long x = S[0]*i + S[1]*j + S[2]*k;
+	for (int q=0; q<Nb; ++q) {
+	  for (int m=0; m<nm; ++m) {
+	    line[q*nm + m] = _dfield_load(f, x + (ng + q)*S[b] + m*S[3]);
+	  }
+	}
+	for (int jb=jb0; jb<jb1; ++jb) {
+	  double p = jb - ng + s;
+	  int q0 = (int) floor(p);
+	  double t = p - q0;
+	  q0 = ((q0 % Nb) + Nb) % Nb;
+	  int q1 = (q0 + 1) % Nb;
+	  for (int m=0; m<nm; ++m) {
+	    _dfield_store(f, x + jb*S[b] + m*S[3], ((1.0 - t) * line[q0*nm + m] +
+						     t * line[q1*nm + m]));
+	  }
+	}
+      }
+    }
+  }
+  free(line);
+}
+int _periodic(cow_domain *d, int dim)
+{
+  int bc = d->boundary[dim][0];
+  return bc == COW_BOUNDARY_PERIODIC || bc == COW_BOUNDARY_SHEARING;
+}
+int _onboundary(cow_domain *d, int dim, int side)
+// -----------------------------------------------------------------------------
+// True when the local subgrid touches the lower or upper face of the domain
+// -----------------------------------------------------------------------------
+{
+#if (COW_MPI)
+  if (cow_mpirunning()) {
+    return side ? d->proc_index[dim] == d->proc_sizes[dim] - 1 :
+      d->proc_index[dim] == 0;
+  }
+#endif
+  return 1;
+}
+int _guardmask(cow_domain *d, int dims)
+// -----------------------------------------------------------------------------
+// Bits (1 << dim) of the domain's dimensions in `dims`, or all of them for
+// COW_ALL_DIMS
+// -----------------------------------------------------------------------------
+{
+  int all = (1 << d->n_dims) - 1;
+  return dims == COW_ALL_DIMS ? all : dims & all;
+}
+void _transformstencil(cow_dfield *f, int *mask, int *depth)
+// -----------------------------------------------------------------------------
+// The guard zones read from the arguments by the field's transform: as
+// declared with cow_dfield_settransformstencil, or known for the built-in
+// kernels, or else all of them
+// -----------------------------------------------------------------------------
+{
+  cow_pencil p = f->pencil;
+  *mask = COW_ALL_DIMS;
+  *depth = f->domain->n_ghst;
+  if (f->stencildepth >= 0) {
+    *mask = f->stencilmask;
+    *depth = f->stencildepth;
+  }
+  else if (p == cow_pencil_component || p == cow_pencil_magnitude ||
+	   p == cow_pencil_cross || p == cow_pencil_dot3) {
+    *depth = 0;
+  }
+  else if (p == cow_pencil_divcorner || p == cow_deriv_divcorner) {
+    *depth = 1;
+  }
+  else if (p == cow_pencil_div5 || p == cow_pencil_rot5 ||
+	   p == cow_deriv_div5 || p == cow_deriv_rot5) {
+    *depth = 2;
+  }
+  else if (p == cow_deriv_grad || p == cow_deriv_lapl || p == cow_deriv_div ||
+	   p == cow_deriv_curl || p == cow_deriv_strain) {
+    *depth = cow_stencil_getguard(f->domain->stencil);
+  }
+}
+int _threadnum(void)
+{
+#if (COW_OPENMP)
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+cow_pencil _builtinpencil(cow_transform op)
+// -----------------------------------------------------------------------------
+// Built-in transforms have pencil versions, which are used in their place when
+// the transform is executed over a whole data field
+// -----------------------------------------------------------------------------
+{
+  if (op == cow_trans_divcorner) return cow_pencil_divcorner;
+  if (op == cow_trans_div5) return cow_pencil_div5;
+  if (op == cow_trans_rot5) return cow_pencil_rot5;
+  if (op == cow_trans_component) return cow_pencil_component;
+  if (op == cow_trans_magnitude) return cow_pencil_magnitude;
+  if (op == cow_trans_cross) return cow_pencil_cross;
+  if (op == cow_trans_dot3) return cow_pencil_dot3;
+  return NULL;
 }
 
 void cow_dfield_setflag(cow_dfield *f, int index, int flag)
@@ -942,9 +2680,7 @@ void _domain_maketags1d(cow_domain *d)
     if (i == 0) continue; // don't include self
     int rel_index [] = { i };
     int index[] = { d->proc_index[0] + rel_index[0] };
-    int their_rank;
-    MPI_Cart_rank(d->mpi_cart, index, &their_rank);
-    d->neighbors[n] = their_rank;
+    d->neighbors[n] = _domain_neighbor(d, index);
     d->send_tags[n] = 1*(+i+5);
     d->recv_tags[n] = 1*(-i+5);
     ++n;
@@ -961,9 +2697,7 @@ void _domain_maketags2d(cow_domain *d)
       int rel_index [] = { i, j };
       int index[] = { d->proc_index[0] + rel_index[0],
                       d->proc_index[1] + rel_index[1] };
-      int their_rank;
-      MPI_Cart_rank(d->mpi_cart, index, &their_rank);
-      d->neighbors[n] = their_rank;
+      d->neighbors[n] = _domain_neighbor(d, index);
       d->send_tags[n] = 10*(+i+5) + 1*(+j+5);
       d->recv_tags[n] = 10*(-i+5) + 1*(-j+5);
       ++n;
@@ -983,9 +2717,7 @@ void _domain_maketags3d(cow_domain *d)
         int index[] = { d->proc_index[0] + rel_index[0],
                         d->proc_index[1] + rel_index[1],
                         d->proc_index[2] + rel_index[2] };
-        int their_rank;
-        MPI_Cart_rank(d->mpi_cart, index, &their_rank);
-        d->neighbors[n] = their_rank;
+        d->neighbors[n] = _domain_neighbor(d, index);
         d->send_tags[n] = 100*(+i+5) + 10*(+j+5) + 1*(+k+5);
         d->recv_tags[n] = 100*(-i+5) + 10*(-j+5) + 1*(-k+5);
         ++n;
@@ -993,6 +2725,185 @@ void _domain_maketags3d(cow_domain *d)
     }
   }
 }
+void _domain_makecuts(cow_domain *d, int dim)
+// -----------------------------------------------------------------------------
+// Computes the global index at which each subgrid along dim begins, with a
+// final entry G_ntot[dim]. Without cost weights, the number of subgrid zones
+// needs to be non-uniform if proc_sizes[dim] does not divide G_ntot[dim], and a
+// zone is added to the first R subgrids. With weights, each cut is placed at
+// the slab boundary nearest its share of the cumulative cost, keeping every
+// subgrid at least as thick as the guard zones where the grid allows it.
+// -----------------------------------------------------------------------------
+{
+  int P = d->proc_sizes[dim];
+  int G = d->G_ntot[dim];
+  int *cut = (int*) realloc(d->cuts[dim], (P + 1) * sizeof(int));
+  double *w = d->cost[dim];
+
+  d->cuts[dim] = cut;
+  cut[0] = 0;
+  cut[P] = G;
+  if (w != NULL && d->cost_len[dim] != G) {
+    printf("[cow] error: %d cost weights given for dimension %d of size %d, "
+	   "using a uniform split\n", d->cost_len[dim], dim, G);
+    w = NULL;
+  }
+  if (w == NULL) {
+    int R = G % P;
+    int normal_size = G / P;
+    for (int j=0; j<P; ++j) {
+      cut[j+1] = cut[j] + ((j<R) ? normal_size + 1 : normal_size);
+    }
+    return;
+  }
+  int m = (d->n_ghst > 1 && G >= P * d->n_ghst) ? d->n_ghst : 1;
+  double *W = (double*) malloc((G + 1) * sizeof(double));
+  W[0] = 0.0;
+  for (int n=0; n<G; ++n) {
+    W[n+1] = W[n] + (w[n] > 0.0 ? w[n] : 0.0);
+  }
+  for (int j=1; j<P; ++j) {
+    double target = W[G] * j / P;
+    int c = cut[j-1];
+    while (c < G && W[c] < target) ++c;
+    if (c > 0 && target - W[c-1] < W[c] - target) --c;
+    if (c < cut[j-1] + m) c = cut[j-1] + m;
+    if (c > G - (P - j) * m) c = G - (P - j) * m;
+    cut[j] = c;
+  }
+  free(W);
+}
+void _domain_procgrid(cow_domain *d)
+// -----------------------------------------------------------------------------
+// Completes the process grid from the sizes given by the user, keeping whole
+// lines along shearing shift dimensions
+// -----------------------------------------------------------------------------
+{
+  int *P = d->proc_sizes;
+  int fixed = 1, nfree = 0;
+  for (int i=0; i<d->n_dims; ++i) {
+    if (d->boundary[i][0] == COW_BOUNDARY_SHEARING) {
+      if (P[d->shear_dim[i]] > 1) {
+	printf("[cow] error: subgrids may not be split along the shearing "
+	       "shift dimension %d\n", d->shear_dim[i]);
+      }
+      P[d->shear_dim[i]] = 1;
+    }
+  }
+  for (int i=0; i<d->n_dims; ++i) {
+    if (P[i]) fixed *= P[i];
+    else nfree += 1;
+  }
+  if (d->comm_size % fixed != 0 || (nfree == 0 && fixed != d->comm_size)) {
+    printf("[cow] error: process grid (%d %d %d) does not fit %d processes\n",
+	   P[0], P[1], P[2], d->comm_size);
+    for (int i=0; i<d->n_dims; ++i) {
+      P[i] = 0;
+    }
+    for (int i=0; i<d->n_dims; ++i) {
+      if (d->boundary[i][0] == COW_BOUNDARY_SHEARING) P[d->shear_dim[i]] = 1;
+    }
+  }
+  MPI_Dims_create(d->comm_size, d->n_dims, P);
+}
+MPI_Comm _domain_nodecomm(cow_domain *d)
+// -----------------------------------------------------------------------------
+// Returns the domain's communicator reordered so that the processes of each node hold a
+// block of the process grid, or MPI_COMM_NULL if the nodes are not all the
+// same size, or no block fits. The block shape is the one dividing the
+// process grid whose faces between nodes hold the fewest zones. Processes are
+// ranked along the grid in C order, the blocks in the order of their nodes,
+// and the processes within each block by their rank on the node.
+// -----------------------------------------------------------------------------
+{
+  int nd = d->n_dims;
+  int *P = d->proc_sizes;
+  int node_rank, node_size, smin, smax;
+  MPI_Comm node, leaders;
+  if (d->node_size > 0) {
+    MPI_Comm_split(d->comm, d->comm_rank / d->node_size, d->comm_rank, &node);
+  }
+  else {
+    MPI_Comm_split_type(d->comm, MPI_COMM_TYPE_SHARED, d->comm_rank,
+			MPI_INFO_NULL, &node);
+  }
+  MPI_Comm_rank(node, &node_rank);
+  MPI_Comm_size(node, &node_size);
+  MPI_Allreduce(&node_size, &smin, 1, MPI_INT, MPI_MIN, d->comm);
+  MPI_Allreduce(&node_size, &smax, 1, MPI_INT, MPI_MAX, d->comm);
+  int B[3] = { 1, 1, 1 }, found = 0;
+  double best = 0.0;
+  for (int b0=1; b0<=(nd > 0 ? P[0] : 1); ++b0) {
+    for (int b1=1; b1<=(nd > 1 ? P[1] : 1); ++b1) {
+      for (int b2=1; b2<=(nd > 2 ? P[2] : 1); ++b2) {
+	int b[3] = { b0, b1, b2 };
+	double E[3] = { 1.0, 1.0, 1.0 }, cost = 0.0;
+	if (b0 * b1 * b2 != smin || smin != smax) continue;
+	if (P[0] % b0 || (nd > 1 && P[1] % b1) || (nd > 2 && P[2] % b2)) {
+	  continue;
+	}
+	for (int i=0; i<nd; ++i) {
+	  E[i] = (double) b[i] * d->G_ntot[i] / P[i]; // block extent in zones
+	}
+	for (int i=0; i<nd; ++i) {
+	  if (P[i] == b[i]) continue; // no other node along i
+	  cost += E[0] * E[1] * E[2] / E[i];
+	}
+	if (!found || cost < best) {
+	  memcpy(B, b, 3 * sizeof(int));
+	  best = cost;
+	  found = 1;
+	}
+      }
+    }
+  }
+  if (!found) {
+    printf("[cow] error: no block of the process grid fits the nodes, "
+	   "using the default topology\n");
+    MPI_Comm_free(&node);
+    return MPI_COMM_NULL;
+  }
+  int node_index, num_nodes = d->comm_size / smin;
+  MPI_Comm_split(d->comm, node_rank == 0 ? 0 : MPI_UNDEFINED,
+		 d->comm_rank, &leaders);
+  if (leaders != MPI_COMM_NULL) {
+    MPI_Comm_rank(leaders, &node_index);
+    MPI_Comm_free(&leaders);
+  }
+  MPI_Bcast(&node_index, 1, MPI_INT, 0, node);
+  MPI_Comm_free(&node);
+  int outer = node_index, inner = node_rank, key = 0;
+  int coord[3];
+  for (int i=nd-1; i>=0; --i) {
+    int n = P[i] / B[i];
+    coord[i] = (outer % n) * B[i] + inner % B[i];
+    outer /= n;
+    inner /= B[i];
+  }
+  for (int i=0; i<nd; ++i) {
+    key = key * P[i] + coord[i];
+  }
+  MPI_Comm comm;
+  MPI_Comm_split(d->comm, 0, key, &comm);
+  printf("[cow] node blocks are (%d %d %d) on %d nodes\n", B[0], B[1], B[2],
+	 num_nodes);
+  return comm;
+}
+int _domain_neighbor(cow_domain *d, int *index)
+// -----------------------------------------------------------------------------
+// Cartesian rank of the subgrid at `index`, or MPI_PROC_NULL when it lies
+// beyond a face which is not periodic
+// -----------------------------------------------------------------------------
+{
+  int their_rank;
+  for (int i=0; i<d->n_dims; ++i) {
+    if (!_periodic(d, i) && (index[i] < 0 || index[i] >= d->proc_sizes[i])) {
+      return MPI_PROC_NULL;
+    }
+  }
+  MPI_Cart_rank(d->mpi_cart, index, &their_rank);
+  return their_rank;
+}
 void _domain_alloctags(cow_domain *d)
 {
   int N = d->num_neighbors;
@@ -1011,7 +2922,6 @@ void _dfield_maketype1d(cow_dfield *f)
   _dfield_alloctype(f);
   cow_domain *d = f->domain;
   int ng = d->n_ghst;
-  int c = MPI_ORDER_C;
   int n = 0;
   if (d->n_ghst == 0) return;
   for (int i=-1; i<=1; ++i) {
@@ -1021,13 +2931,9 @@ void _dfield_maketype1d(cow_dfield *f)
     int start_send[] = { Plx[i+1] };
     int start_recv[] = { Qlx[i+1] };
     int sub[] = { (1-abs(i))*d->L_nint[0] + abs(i)*ng };
-    MPI_Datatype send, recv, type;
-    MPI_Type_contiguous(f->n_members, MPI_DOUBLE, &type);
-    MPI_Type_create_subarray(1, d->L_ntot, sub, start_send, c, type, &send);
-    MPI_Type_create_subarray(1, d->L_ntot, sub, start_recv, c, type, &recv);
-    MPI_Type_commit(&send);
-    MPI_Type_commit(&recv);
-    MPI_Type_free(&type);
+    MPI_Datatype send, recv;
+    _dfield_boxtype(f, sub, start_send, &send);
+    _dfield_boxtype(f, sub, start_recv, &recv);
     f->send_type[n] = send;
     f->recv_type[n] = recv;
     ++n;
@@ -1038,7 +2944,6 @@ void _dfield_maketype2d(cow_dfield *f)
   _dfield_alloctype(f);
   cow_domain *d = f->domain;
   int ng = d->n_ghst;
-  int c = MPI_ORDER_C;
   int n = 0;
   if (d->n_ghst == 0) return;
   for (int i=-1; i<=1; ++i) {
@@ -1052,13 +2957,9 @@ void _dfield_maketype2d(cow_dfield *f)
       int start_recv[] = { Qlx[i+1], Qly[j+1] };
       int sub[] = { (1-abs(i))*d->L_nint[0] + abs(i)*ng,
                     (1-abs(j))*d->L_nint[1] + abs(j)*ng };
-      MPI_Datatype send, recv, type;
-      MPI_Type_contiguous(f->n_members, MPI_DOUBLE, &type);
-      MPI_Type_create_subarray(2, d->L_ntot, sub, start_send, c, type, &send);
-      MPI_Type_create_subarray(2, d->L_ntot, sub, start_recv, c, type, &recv);
-      MPI_Type_commit(&send);
-      MPI_Type_commit(&recv);
-      MPI_Type_free(&type);
+      MPI_Datatype send, recv;
+      _dfield_boxtype(f, sub, start_send, &send);
+      _dfield_boxtype(f, sub, start_recv, &recv);
       f->send_type[n] = send;
       f->recv_type[n] = recv;
       ++n;
@@ -1070,7 +2971,6 @@ void _dfield_maketype3d(cow_dfield *f)
   _dfield_alloctype(f);
   cow_domain *d = f->domain;
   int ng = d->n_ghst;
-  int c = MPI_ORDER_C;
   int n = 0;
   if (d->n_ghst == 0) return;
   for (int i=-1; i<=1; ++i) {
@@ -1088,13 +2988,9 @@ void _dfield_maketype3d(cow_dfield *f)
         int sub[] = { (1-abs(i))*d->L_nint[0] + abs(i)*ng,
                       (1-abs(j))*d->L_nint[1] + abs(j)*ng,
                       (1-abs(k))*d->L_nint[2] + abs(k)*ng };
-        MPI_Datatype send, recv, type;
-        MPI_Type_contiguous(f->n_members, MPI_DOUBLE, &type);
-        MPI_Type_create_subarray(3, d->L_ntot, sub, start_send, c, type, &send);
-        MPI_Type_create_subarray(3, d->L_ntot, sub, start_recv, c, type, &recv);
-        MPI_Type_commit(&send);
-        MPI_Type_commit(&recv);
-        MPI_Type_free(&type);
+        MPI_Datatype send, recv;
+        _dfield_boxtype(f, sub, start_send, &send);
+        _dfield_boxtype(f, sub, start_recv, &recv);
         f->send_type[n] = send;
         f->recv_type[n] = recv;
         ++n;
@@ -1104,6 +3000,30 @@ void _dfield_maketype3d(cow_dfield *f)
 }
 
 
+void _dfield_boxtype(cow_dfield *f, int *sub, int *start, MPI_Datatype *type)
+// -----------------------------------------------------------------------------
+// Commits the datatype of all members of the zones in the box of size `sub` at
+// `start`. Planar members are repeated at the distance of a member's subgrid,
+// which is the extent of the subarray.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  int c = MPI_ORDER_C;
+  MPI_Datatype zone, box;
+  MPI_Datatype elem = f->precision == COW_PRECISION_SINGLE ? MPI_FLOAT :
+    MPI_DOUBLE;
+  if (f->layout == COW_LAYOUT_PLANAR) {
+    MPI_Type_create_subarray(d->n_dims, d->L_ntot, sub, start, c, elem, &box);
+    MPI_Type_contiguous(f->n_members, box, type);
+    MPI_Type_free(&box);
+  }
+  else {
+    MPI_Type_contiguous(f->n_members, elem, &zone);
+    MPI_Type_create_subarray(d->n_dims, d->L_ntot, sub, start, c, zone, type);
+    MPI_Type_free(&zone);
+  }
+  MPI_Type_commit(type);
+}
 void _dfield_alloctype(cow_dfield *f)
 {
   if (f->domain->n_ghst == 0) return;
@@ -1122,81 +3042,534 @@ void _dfield_freetype(cow_dfield *f)
   free(f->send_type);
   free(f->recv_type);
 }
+int _exchange_boxes(cow_domain *d, int faces, int mask, int depth,
+		   int *box, int *nbr, int *first)
+// -----------------------------------------------------------------------------
+// Lists the messages of a guard exchange: for each, the send box lo[3] hi[3]
+// then the recv box, and the index of the neighbor it goes to. Neighbors are
+// numbered as in _domain_maketags3d, so their ranks and tags are reused. Only
+// the neighbors lying along the dimensions in `mask` are sent `depth` guard
+// zones. With `faces`, only the face neighbors are sent to, a dimension at a
+// time; messages along dimension a span the guard zones of the dimensions
+// before a, which are filled by then. Stage s sends messages first[s] ...
+// first[s+1]-1. The number of messages is returned; the arrays hold at least
+// num_neighbors of them.
+// -----------------------------------------------------------------------------
+{
+  int nd = d->n_dims;
+  int ng = d->n_ghst;
+  int nstages = faces ? nd : 1;
+  int count[4] = { 0, 0, 0, 0 };
+  int m = 0;
+  for (int n=0; n<nstages*d->num_neighbors; ++n) {
+    // relative index of neighbor nn along each dimension, self skipped
+    int a = n / d->num_neighbors, nn = n % d->num_neighbors;
+    int o[3] = { 0, 0, 0 }, q = nn < d->num_neighbors/2 ? nn : nn + 1;
+    for (int b=nd-1; b>=0; --b) {
+      o[b] = q % 3 - 1;
+      q /= 3;
+    }
+    int nonzero = 0, outside = 0;
+    for (int b=0; b<nd; ++b) {
+      nonzero += o[b] != 0;
+      outside += o[b] != 0 && !(mask & (1 << b));
+    }
+    if (outside || (faces && (nonzero != 1 || o[a] == 0))) continue;
+    if (d->neighbors[nn] == MPI_PROC_NULL) continue; // a physical boundary
+    int *sbox = box + 12*m, *rbox = sbox + 6;
+    for (int b=0; b<3; ++b) {
+      int N = d->L_nint[b];
+      if (b >= nd) {
+	sbox[b] = rbox[b] = 0;
+	sbox[b+3] = rbox[b+3] = 1;
+      }
+      else if (faces && b < a) {
+	int w = mask & (1 << b) ? depth : 0;
+	sbox[b] = rbox[b] = ng - w;
+	sbox[b+3] = rbox[b+3] = ng + N + w;
+      }
+      else {
+	int slo[3] = { ng, ng, N + ng - depth };
+	int rlo[3] = { ng - depth, ng, N + ng };
+	int len = o[b] == 0 ? N : depth;
+	sbox[b] = slo[o[b]+1];
+	rbox[b] = rlo[o[b]+1];
+	sbox[b+3] = sbox[b] + len;
+	rbox[b+3] = rbox[b] + len;
+      }
+    }
+    nbr[m] = nn;
+    count[faces ? a : 0] += 1;
+    ++m;
+  }
+  first[0] = 0;
+  for (int s=0; s<nstages; ++s) {
+    first[s+1] = first[s] + count[s];
+  }
+  return m;
+}
+int _exchange_zones(int *box)
+{
+  return (box[3] - box[0]) * (box[4] - box[1]) * (box[5] - box[2]);
+}
+void _dfield_makeexchange(cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Builds the pack buffers and persistent requests for the domain's exchange
+// mode
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  int faces = d->exchange == COW_EXCHANGE_FACES;
+  int N = d->num_neighbors;
+  struct cow_exchange *e = (struct cow_exchange*) malloc(sizeof(*e));
+  e->mode = d->exchange;
+  e->n_stages = faces ? d->n_dims : 1;
+  e->stage = -1;
+  e->first = (int*) malloc((e->n_stages + 1) * sizeof(int));
+  e->box = (int*) malloc(12 * N * sizeof(int));
+  int *nbr = (int*) malloc(N * sizeof(int));
+  e->n_msgs = _exchange_boxes(d, faces, _guardmask(d, COW_ALL_DIMS), d->n_ghst,
+			      e->box, nbr, e->first);
+  e->offset = (int*) malloc((e->n_msgs + 1) * sizeof(int));
+  e->requests = (MPI_Request*) malloc(2 * e->n_msgs * sizeof(MPI_Request));
+  e->offset[0] = 0;
+  for (int m=0; m<e->n_msgs; ++m) {
+    e->offset[m+1] = e->offset[m] + _exchange_zones(e->box + 12*m) *
+      f->n_members * _dfield_elemsize(f);
+  }
+  e->send_buf = (char*) malloc(e->offset[e->n_msgs]);
+  e->recv_buf = (char*) malloc(e->offset[e->n_msgs]);
+  for (int m=0; m<e->n_msgs; ++m) {
+    int n = nbr[m];
+    int count = e->offset[m+1] - e->offset[m];
+    MPI_Send_init(e->send_buf + e->offset[m], count, MPI_BYTE,
+		  d->neighbors[n], d->send_tags[n], d->mpi_cart,
+		  &e->requests[2*m+0]);
+    MPI_Recv_init(e->recv_buf + e->offset[m], count, MPI_BYTE,
+		  d->neighbors[n], d->recv_tags[n], d->mpi_cart,
+		  &e->requests[2*m+1]);
+  }
+  free(nbr);
+  f->exchange = e;
+}
+void _dfield_freeexchange(cow_dfield *f)
+{
+  struct cow_exchange *e = f->exchange;
+  if (e == NULL) return;
+  for (int m=0; m<2*e->n_msgs; ++m) {
+    MPI_Request_free(&e->requests[m]);
+  }
+  free(e->first);
+  free(e->box);
+  free(e->offset);
+  free(e->send_buf);
+  free(e->recv_buf);
+  free(e->requests);
+  free(e);
+  f->exchange = NULL;
+}
+void _exchange_start(cow_dfield *f, int stage)
+{
+  struct cow_exchange *e = f->exchange;
+  int m0 = e->first[stage], m1 = e->first[stage+1];
+  for (int m=m0; m<m1; ++m) {
+    _exchange_pack(f, e->box + 12*m, e->send_buf + e->offset[m], 'p');
+  }
+  MPI_Startall(2 * (m1 - m0), e->requests + 2 * m0);
+  e->stage = stage;
+}
+struct cow_synctype *_dfield_synctype(cow_dfield *f, int mask, int depth)
+// -----------------------------------------------------------------------------
+// The datatypes for a partial sync of the field, built on first use. There is
+// one subarray type for each box listed by _exchange_boxes, which are kept.
+// -----------------------------------------------------------------------------
+{
+  for (struct cow_synctype *t=f->synctypes; t; t=t->next) {
+    if (t->mask == mask && t->depth == depth) return t;
+  }
+  cow_domain *d = f->domain;
+  int N = d->num_neighbors;
+  int first[4];
+  int *box = (int*) malloc(12 * N * sizeof(int));
+  struct cow_synctype *t = (struct cow_synctype*) malloc(sizeof(*t));
+  t->box = box;
+  t->mask = mask;
+  t->depth = depth;
+  t->nbr = (int*) malloc(N * sizeof(int));
+  t->n_msgs = _exchange_boxes(d, 0, mask, depth, box, t->nbr, first);
+  t->send_type = (MPI_Datatype*) malloc(t->n_msgs * sizeof(MPI_Datatype));
+  t->recv_type = (MPI_Datatype*) malloc(t->n_msgs * sizeof(MPI_Datatype));
+  for (int m=0; m<t->n_msgs; ++m) {
+    int *sbox = box + 12*m, *rbox = sbox + 6;
+    int sub[3];
+    for (int b=0; b<d->n_dims; ++b) {
+      sub[b] = sbox[b+3] - sbox[b];
+    }
+    _dfield_boxtype(f, sub, sbox, &t->send_type[m]);
+    _dfield_boxtype(f, sub, rbox, &t->recv_type[m]);
+  }
+  t->next = f->synctypes;
+  f->synctypes = t;
+  return t;
+}
+void _dfield_freesynctypes(cow_dfield *f)
+{
+  while (f->synctypes) {
+    struct cow_synctype *t = f->synctypes;
+    for (int m=0; m<t->n_msgs; ++m) {
+      MPI_Type_free(&t->send_type[m]);
+      MPI_Type_free(&t->recv_type[m]);
+    }
+    free(t->nbr);
+    free(t->box);
+    free(t->send_type);
+    free(t->recv_type);
+    f->synctypes = t->next;
+    free(t);
+  }
+}
+void _domain_nodeshared(cow_domain *d)
+// -----------------------------------------------------------------------------
+// Builds the communicator of the processes on this node, split into groups of
+// node_size consecutive ranks if it is set, and the rank in it of each process
+// on the cartesian communicator
+// -----------------------------------------------------------------------------
+{
+  MPI_Comm node;
+  MPI_Group cart_group, node_group;
+  MPI_Comm_split_type(d->mpi_cart, MPI_COMM_TYPE_SHARED, d->cart_rank,
+		      MPI_INFO_NULL, &node);
+  if (d->node_size > 0) {
+    MPI_Comm_split(node, d->comm_rank / d->node_size, d->cart_rank,
+		   &d->node_comm);
+    MPI_Comm_free(&node);
+  }
+  else {
+    d->node_comm = node;
+  }
+  int *ranks = (int*) malloc(d->cart_size * sizeof(int));
+  for (int n=0; n<d->cart_size; ++n) {
+    ranks[n] = n;
+  }
+  d->node_ranks = (int*) malloc(d->cart_size * sizeof(int));
+  MPI_Comm_group(d->mpi_cart, &cart_group);
+  MPI_Comm_group(d->node_comm, &node_group);
+  MPI_Group_translate_ranks(cart_group, d->cart_size, ranks, node_group,
+			    d->node_ranks);
+  MPI_Group_free(&cart_group);
+  MPI_Group_free(&node_group);
+  free(ranks);
+}
+void _dfield_allocshared(cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Allocates the data of `f` in a window shared by the processes on the node.
+// Each part is allowed to be placed near the process owning it, and the window
+// is kept open to loads and stores until the field is deleted.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  MPI_Info info;
+  MPI_Aint size = cow_domain_getnumlocalzonesincguard(d, COW_ALL_DIMS) *
+    f->n_members * _dfield_elemsize(f);
+  void *base;
+  if (d->node_comm == MPI_COMM_NULL) {
+    _domain_nodeshared(d);
+  }
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "alloc_shared_noncontig", "true");
+  MPI_Win_allocate_shared(size, _dfield_elemsize(f), info, d->node_comm, &base,
+			  &f->win);
+  MPI_Info_free(&info);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, f->win);
+  f->data = base;
+  f->ownsdata = 1;
+}
+int _dfield_peer(cow_dfield *f, int rank, cow_dfield *view, cow_domain *dview)
+// -----------------------------------------------------------------------------
+// Returns true if the data of cartesian `rank` may be loaded from directly,
+// being in the shared window of `f`. Then unless they are NULL, `dview` is set
+// to describe that subgrid and `view` its data, as shallow copies of the
+// domain and field which are only to be read from.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  if (f->win == MPI_WIN_NULL || d->node_ranks[rank] == MPI_UNDEFINED) return 0;
+  if (view == NULL || dview == NULL) return 1;
+  int ng = d->n_ghst;
+  int nd = d->n_dims;
+  int index[3] = { 0, 0, 0 };
+  int unit;
+  MPI_Aint size;
+  *dview = *d;
+  *view = *f;
+  view->domain = dview;
+  MPI_Win_shared_query(f->win, d->node_ranks[rank], &size, &unit, &view->data);
+  MPI_Cart_coords(d->mpi_cart, rank, nd, index);
+  for (int i=0; i<nd; ++i) {
+    int *cut = d->cuts[i];
+    dview->proc_index[i] = index[i];
+    dview->G_strt[i] = cut[index[i]];
+    dview->L_nint[i] = cut[index[i]+1] - cut[index[i]];
+    dview->L_ntot[i] = dview->L_nint[i] + 2 * ng;
+    dview->loc_lower[i] = d->glb_lower[i] + d->dx[i] * dview->G_strt[i];
+    dview->loc_upper[i] = d->glb_lower[i] + d->dx[i] * cut[index[i]+1];
+  }
+  _dfield_strides(view, dview->L_ntot);
+  return 1;
+}
+void _dfield_syncnode(cow_dfield *f, int mask, int depth)
+// -----------------------------------------------------------------------------
+// Synchronizes the guard zones listed by _exchange_boxes for `mask` and
+// `depth`. Those of neighbors whose data is in the shared window of `f` are
+// loaded from it, and the others are exchanged as subarray types. Processes on
+// the node wait for each other before the loads, so that the interiors have
+// been written, and after, so that none is written while it is being read.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  struct cow_synctype *t = _dfield_synctype(f, mask, depth);
+  MPI_Request *requests = (MPI_Request*) malloc(2 * t->n_msgs *
+						sizeof(MPI_Request));
+  int shared = f->win != MPI_WIN_NULL;
+  if (shared) {
+    MPI_Win_sync(f->win);
+    MPI_Barrier(d->node_comm);
+    MPI_Win_sync(f->win);
+  }
+  for (int m=0; m<t->n_msgs; ++m) {
+    int n = t->nbr[m];
+    int nr = d->neighbors[n];
+    if (_dfield_peer(f, nr, NULL, NULL)) {
+      requests[2*m+0] = requests[2*m+1] = MPI_REQUEST_NULL;
+      continue;
+    }
+    MPI_Isend(f->data, 1, t->send_type[m], nr, d->send_tags[n], d->mpi_cart,
+	      &requests[2*m+0]);
+    MPI_Irecv(f->data, 1, t->recv_type[m], nr, d->recv_tags[n], d->mpi_cart,
+	      &requests[2*m+1]);
+  }
+  for (int m=0; m<t->n_msgs && shared; ++m) {
+    int nr = d->neighbors[t->nbr[m]];
+    if (_dfield_peer(f, nr, NULL, NULL)) {
+      _dfield_loadpeer(f, t->box + 12*m + 6, nr);
+    }
+  }
+  MPI_Waitall(2 * t->n_msgs, requests, MPI_STATUSES_IGNORE);
+  free(requests);
+  _dfield_fillboundary(f, mask, depth);
+  if (shared) {
+    MPI_Win_sync(f->win);
+    MPI_Barrier(d->node_comm);
+  }
+}
+void _dfield_loadpeer(cow_dfield *f, int *box, int rank)
+// -----------------------------------------------------------------------------
+// Fills the guard zones in `box` from the interior of the subgrid `rank` on the
+// node, where they are offset by its extent below, or this one's above
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  cow_domain dv;
+  cow_dfield fv;
+  _dfield_peer(f, rank, &fv, &dv);
+  int ng = d->n_ghst;
+  int pdim = d->n_dims - 1;
+  int *lo = box, *hi = box + 3, *S = f->stride, *T = fv.stride;
+  int o[3] = { 0, 0, 0 };
+  int h[3] = { hi[0], hi[1], hi[2] };
+  for (int b=0; b<d->n_dims; ++b) {
+    if (lo[b] < ng) o[b] = dv.L_nint[b];
+    else if (lo[b] >= ng + d->L_nint[b]) o[b] = -d->L_nint[b];
+  }
+  h[pdim] = lo[pdim] + 1;
+  int nb = _rowblocks(f);
+  size_t es = _dfield_elemsize(f);
+  size_t row = (hi[pdim] - lo[pdim]) * (f->n_members / nb) * es;
+  for (int i=lo[0]; i<h[0]; ++i) {
+    for (int j=lo[1]; j<h[1]; ++j) {
+      for (int k=lo[2]; k<h[2]; ++k) {
+	char *x = (char*) f->data + (S[0]*i + S[1]*j + S[2]*k) * es;
+	char *y = (char*) fv.data + (T[0]*(i + o[0]) + T[1]*(j + o[1]) +
+				     T[2]*(k + o[2])) * es;
+	for (int b=0; b<nb; ++b) {
+	  memcpy(x + b*S[3]*es, y + b*T[3]*es, row);
+	}
+      }
+    }
+  }
+}
+void _exchange_pack(cow_dfield *f, int *box, char *buf, char op)
+// -----------------------------------------------------------------------------
+// Copies the zones lo <= (i,j,k) < hi into ('p') or out of ('u') a contiguous
+// buffer, a row along the last dimension at a time
+// -----------------------------------------------------------------------------
+{
+  int *lo = box, *hi = box + 3, *S = f->stride;
+  int pdim = f->domain->n_dims - 1;
+  int h[3] = { hi[0], hi[1], hi[2] };
+  h[pdim] = lo[pdim] + 1;
+  int nb = _rowblocks(f);
+  size_t es = _dfield_elemsize(f);
+  size_t row = (hi[pdim] - lo[pdim]) * (f->n_members / nb) * es;
+  for (int i=lo[0]; i<h[0]; ++i) {
+    for (int j=lo[1]; j<h[1]; ++j) {
+      for (int k=lo[2]; k<h[2]; ++k) {
+	for (int b=0; b<nb; ++b) {
+	  char *x = (char*) f->data + (S[0]*i + S[1]*j + S[2]*k + b*S[3]) * es;
+	  if (op == 'p') memcpy(buf, x, row);
+	  else memcpy(x, buf, row);
+	  buf += row;
+	}
+      }
+    }
+  }
+}
 #endif
 
 
 // -----------------------------------------------------------------------------
 // Special derivative operators used on vector fields. These do not divide by
-// the grid zone spacing.
+// the grid zone spacing. Each is written as a pencil kernel, which loops over a
+// row of zones with the strides hoisted out, so that it may be vectorized. The
+// cow_trans_* versions apply the same kernel to a single zone.
 // -----------------------------------------------------------------------------
 #include <math.h>
 
-void cow_trans_divcorner(double *result, double **args, int **s, void *u)
+static int _onezone[3] = { 0, 0, 0 }; // pencil strides, unused for one zone
+
+void cow_pencil_divcorner(double *result, double **args, int **s, int *p, int n,
+			  void *u)
 // -----------------------------------------------------------------------------
 // 3d divergence stencil maintained by the constraint transport scheme of Toth
 // (2000). Second order in space, gives the divergence at the upper right corner
 // of cell when the vectors are all given at the cell centers.
 // -----------------------------------------------------------------------------
 {
-#define M(i,j,k) ((i)*s[0][0] + (j)*s[0][1] + (k)*s[0][2])
-  double *fx = &args[0][0];
-  double *fy = &args[0][1];
-  double *fz = &args[0][2];
-  *result = ((fx[M(1,0,0)] + fx[M(1,1,0)] + fx[M(1,0,1)] + fx[M(1,1,1)]) -
-             (fx[M(0,0,0)] + fx[M(0,1,0)] + fx[M(0,0,1)] + fx[M(0,1,1)])) / 4.0
-    +       ((fy[M(0,1,0)] + fy[M(0,1,1)] + fy[M(1,1,0)] + fy[M(1,1,1)]) -
-             (fy[M(0,0,0)] + fy[M(0,0,1)] + fy[M(1,0,0)] + fy[M(1,0,1)])) / 4.0
-    +       ((fz[M(0,0,1)] + fz[M(1,0,1)] + fz[M(0,1,1)] + fz[M(1,1,1)]) -
-             (fz[M(0,0,0)] + fz[M(1,0,0)] + fz[M(0,1,0)] + fz[M(1,1,0)])) / 4.0;
+#define M(i,j,k) ((i)*si + (j)*sj + (k)*sk)
+  int si = s[0][0], sj = s[0][1], sk = s[0][2], sm = s[0][3];
+  int pa = p[0], pr = p[1];
+  for (int q=0; q<n; ++q) {
+    double *fx = &args[0][q*pa + 0*sm];
+    double *fy = &args[0][q*pa + 1*sm];
+    double *fz = &args[0][q*pa + 2*sm];
+    result[q*pr] =
+      ((fx[M(1,0,0)] + fx[M(1,1,0)] + fx[M(1,0,1)] + fx[M(1,1,1)]) -
+       (fx[M(0,0,0)] + fx[M(0,1,0)] + fx[M(0,0,1)] + fx[M(0,1,1)])) / 4.0
+      + ((fy[M(0,1,0)] + fy[M(0,1,1)] + fy[M(1,1,0)] + fy[M(1,1,1)]) -
+	 (fy[M(0,0,0)] + fy[M(0,0,1)] + fy[M(1,0,0)] + fy[M(1,0,1)])) / 4.0
+      + ((fz[M(0,0,1)] + fz[M(1,0,1)] + fz[M(0,1,1)] + fz[M(1,1,1)]) -
+	 (fz[M(0,0,0)] + fz[M(1,0,0)] + fz[M(0,1,0)] + fz[M(1,1,0)])) / 4.0;
+  }
 #undef M
 }
-void cow_trans_div5(double *result, double **args, int **s, void *u)
+void cow_pencil_div5(double *result, double **args, int **s, int *p, int n,
+		     void *u)
 {
 #define diff5(f,s) ((-f[2*s] + 8*f[s] - 8*f[-s] + f[-2*s]) / 12.0)
-  double *f0 = &args[0][0];
-  double *f1 = &args[0][1];
-  double *f2 = &args[0][2];
-  *result = diff5(f0, s[0][0]) + diff5(f1, s[0][1]) + diff5(f2, s[0][2]);
+  int si = s[0][0], sj = s[0][1], sk = s[0][2], sm = s[0][3];
+  int pa = p[0], pr = p[1];
+  for (int q=0; q<n; ++q) {
+    double *f0 = &args[0][q*pa + 0*sm];
+    double *f1 = &args[0][q*pa + 1*sm];
+    double *f2 = &args[0][q*pa + 2*sm];
+    result[q*pr] = diff5(f0, si) + diff5(f1, sj) + diff5(f2, sk);
+  }
 #undef diff5
 }
-void cow_trans_rot5(double *result, double **args, int **s, void *u)
+void cow_pencil_rot5(double *result, double **args, int **s, int *p, int n,
+		     void *u)
 {
   // http://en.wikipedia.org/wiki/Five-point_stencil
 #define diff5(f,s) ((-f[2*s] + 8*f[s] - 8*f[-s] + f[-2*s]) / 12.0)
-  double *f0 = &args[0][0];
-  double *f1 = &args[0][1];
-  double *f2 = &args[0][2];
-  result[0] = diff5(f2, s[0][1]) - diff5(f1, s[0][2]);
-  result[1] = diff5(f0, s[0][2]) - diff5(f2, s[0][0]);
-  result[2] = diff5(f1, s[0][0]) - diff5(f0, s[0][1]);
+  int si = s[0][0], sj = s[0][1], sk = s[0][2], sm = s[0][3];
+  int pa = p[0], pr = p[1];
+  for (int q=0; q<n; ++q) {
+    double *f0 = &args[0][q*pa + 0*sm];
+    double *f1 = &args[0][q*pa + 1*sm];
+    double *f2 = &args[0][q*pa + 2*sm];
+    double *r = &result[q*pr];
+    r[0] = diff5(f2, sj) - diff5(f1, sk);
+    r[1] = diff5(f0, sk) - diff5(f2, si);
+    r[2] = diff5(f1, si) - diff5(f0, sj);
+  }
 #undef diff5
 }
-void cow_trans_component(double *result, double **args, int **s, void *u)
+void cow_pencil_component(double *result, double **args, int **s, int *p, int n,
+			  void *u)
 {
   cow_dfield *f = (cow_dfield*) u;
-  result[0] = args[0][f->iparam];
+  int m = f->iparam;
+  int pa = p[0], pr = p[1];
+  for (int q=0; q<n; ++q) {
+    result[q*pr] = args[0][q*pa + m*s[0][3]];
+  }
 }
-void cow_trans_magnitude(double *result, double **args, int **s, void *u)
+void cow_pencil_magnitude(double *result, double **args, int **s, int *p, int n,
+			  void *u)
 {
   cow_dfield *f = (cow_dfield*) u;
-  double res2 = 0.0;
-  for (int n=0; n<f->n_members; ++n) {
-    res2 += args[0][n] * args[0][n];
+  int nm = f->n_members;
+  int pa = p[0], pr = p[1], sm = s[0][3];
+  for (int q=0; q<n; ++q) {
+    double *a = &args[0][q*pa];
+    double res2 = 0.0;
+    for (int m=0; m<nm; ++m) {
+      res2 += a[m*sm] * a[m*sm];
+    }
+    result[q*pr] = sqrt(res2);
+  }
+}
+void cow_pencil_cross(double *result, double **args, int **s, int *p, int n,
+		      void *u)
+{
+  int pv = p[0], pw = p[1], pr = p[2];
+  int a = s[0][3], b = s[1][3];
+  for (int q=0; q<n; ++q) {
+    double *v = &args[0][q*pv];
+    double *w = &args[1][q*pw];
+    double *r = &result[q*pr];
+    r[0] = v[1*a]*w[2*b] - v[2*a]*w[1*b];
+    r[1] = v[2*a]*w[0*b] - v[0*a]*w[2*b];
+    r[2] = v[0*a]*w[1*b] - v[1*a]*w[0*b];
   }
-  result[0] = sqrt(res2);
+}
+void cow_pencil_dot3(double *result, double **args, int **s, int *p, int n,
+		     void *u)
+{
+  int pv = p[0], pw = p[1], pr = p[2];
+  int a = s[0][3], b = s[1][3];
+  for (int q=0; q<n; ++q) {
+    double *v = &args[0][q*pv];
+    double *w = &args[1][q*pw];
+    result[q*pr] = v[0*a]*w[0*b] + v[1*a]*w[1*b] + v[2*a]*w[2*b];
+  }
+}
+
+void cow_trans_divcorner(double *result, double **args, int **s, void *u)
+{
+  cow_pencil_divcorner(result, args, s, _onezone, 1, u);
+}
+void cow_trans_div5(double *result, double **args, int **s, void *u)
+{
+  cow_pencil_div5(result, args, s, _onezone, 1, u);
+}
+void cow_trans_rot5(double *result, double **args, int **s, void *u)
+{
+  cow_pencil_rot5(result, args, s, _onezone, 1, u);
+}
+void cow_trans_component(double *result, double **args, int **s, void *u)
+{
+  cow_pencil_component(result, args, s, _onezone, 1, u);
+}
+void cow_trans_magnitude(double *result, double **args, int **s, void *u)
+{
+  cow_pencil_magnitude(result, args, s, _onezone, 1, u);
 }
 void cow_trans_cross(double *result, double **args, int **s, void *u)
 {
-  double *v = args[0];
-  double *w = args[1];
-  result[0] = v[1]*w[2] - v[2]*w[1];
-  result[1] = v[2]*w[0] - v[0]*w[2];
-  result[2] = v[0]*w[1] - v[1]*w[0];
+  cow_pencil_cross(result, args, s, _onezone, 1, u);
 }
 void cow_trans_dot3(double *result, double **args, int **s, void *u)
 {
-  double *v = args[0];
-  double *w = args[1];
-  *result = v[0]*w[0] + v[1]*w[1] + v[2]*w[2];
+  cow_pencil_dot3(result, args, s, _onezone, 1, u);
 }
-
@@ -5,12 +5,19 @@
 #include <stdlib.h>
 
 #ifdef COW_PRIVATE_DEFS
+#include <stdint.h>
 #if (COW_MPI)
 #include <mpi.h>
 #endif // COW_MPI
 #if (COW_HDF5)
 #include <hdf5.h>
 #endif // COW_HDF5
+#if (COW_OPENMP)
+#include <omp.h>
+#define COW_SIMD _Pragma("omp simd") // marks loops to be vectorized
+#else
+#define COW_SIMD
+#endif // COW_OPENMP
 #endif // COW_PRIVATE_DEFS
 
 
@@ -18,6 +25,9 @@
 #define COW_DISABLE_MPI       (1<<1)
 #define COW_HASNAN            (1<<2)
 #define COW_HASINF            (1<<3)
+#define COW_ALLOC_POOL        (1<<4) // reuse freed blocks on the domain
+#define COW_ALLOC_HUGEPAGES   (1<<5) // 2MB aligned, transparent huge pages
+#define COW_ALLOC_FIRSTTOUCH  (1<<6) // data first written by its loop threads
 
 #define COW_ALL_DIMS             -41
 #define COW_HIST_SPACING_LINEAR  -42
@@ -31,6 +41,48 @@
 #define COW_SAMPLE_LINEAR        -50 // use (uni/bi/tri) linear interp
 #define COW_SAMPLE_ERROR_OUT     -51 // out-of-bounds sample request
 #define COW_SAMPLE_ERROR_WRONGD  -52 // wrong number of dims on sample coords
+#define COW_HIST_STORAGE_DENSE   -53 // one weight and count for every bin
+#define COW_HIST_STORAGE_SPARSE  -54 // hash map holding only populated bins
+#define COW_HIST_SEAL_ALLREDUCE   -55 // every rank holds the whole histogram
+#define COW_HIST_SEAL_REDUCE      -56 // only rank 0 holds the histogram
+#define COW_HIST_SEAL_SCATTER     -57 // each rank holds a block of slices
+#define COW_SUM_PLAIN            -58 // ordinary floating point accumulation
+#define COW_SUM_COMPENSATED      -59 // Kahan-Babuska (Neumaier) summation
+#define COW_SUM_REPRODUCIBLE     -60 // exact, order-independent summation
+#define COW_STENCIL_CENTRAL2     -61 // explicit central differences
+#define COW_STENCIL_CENTRAL4     -62
+#define COW_STENCIL_CENTRAL6     -63
+#define COW_STENCIL_CENTRAL8     -64
+#define COW_STENCIL_COMPACT4     -65 // compact (Pade) tridiagonal schemes
+#define COW_STENCIL_COMPACT6     -66
+#define COW_VGT_Q                -67 // second invariant of the velocity gradient
+#define COW_VGT_R                -68 // third invariant, -det(A)
+#define COW_VGT_QS               -69 // second invariant of the strain rate
+#define COW_VGT_QW               -70 // second invariant of the rotation rate
+#define COW_VGT_LAMBDA1          -71 // strain rate eigenvalues, largest first
+#define COW_VGT_LAMBDA2          -72
+#define COW_VGT_LAMBDA3          -73
+#define COW_VGT_ENSTROPHYPROD    -74 // vortex stretching, w_i S_ij w_j
+#define COW_SYNC_BLOCKING        -75 // transforms sync their result on return
+#define COW_SYNC_OVERLAP         -76 // overlap guard exchange with computation
+#define COW_EXCHANGE_DATATYPE    -77 // derived datatypes for 26 neighbors
+#define COW_EXCHANGE_PERSISTENT  -78 // persistent requests on pack buffers
+#define COW_EXCHANGE_FACES       -79 // " ", 6 face messages in dimension order
+#define COW_SYNC_LAZY            -80 // guard zones are synced when next read
+#define COW_BOUNDARY_PERIODIC    -81 // guard zones wrap around the domain
+#define COW_BOUNDARY_OUTFLOW     -82 // copies of the zone on the boundary
+#define COW_BOUNDARY_REFLECTING  -83 // mirror image, normal components negated
+#define COW_BOUNDARY_SHEARING    -84 // periodic, shifted along another dimension
+#define COW_TOPOLOGY_CART        -85 // process grid laid out by MPI_Cart_create
+#define COW_TOPOLOGY_NODES       -86 // compact blocks of processes on each node
+#define COW_MEMORY_PRIVATE       -87 // data allocated by each process
+#define COW_MEMORY_SHARED        -88 // " in a window shared on the node
+#define COW_LAYOUT_INTERLEAVED   -89 // members of each zone are adjacent
+#define COW_LAYOUT_PLANAR        -90 // each member is a contiguous array
+#define COW_PRECISION_DOUBLE     -91 // data stored as 64-bit doubles
+#define COW_PRECISION_SINGLE     -92 // " 32-bit floats, computed in double
+
+#define COW_HIST_MAXDIMS 6 // maximum number of histogram dimensions
 
 // -----------------------------------------------------------------------------
 //
@@ -39,15 +91,28 @@
 // -----------------------------------------------------------------------------
 struct cow_domain; // forward declarations (for opaque data structure)
 struct cow_dfield;
+struct cow_pipeline;
 typedef struct cow_domain cow_domain;
 typedef struct cow_dfield cow_dfield;
 typedef struct cow_histogram cow_histogram;
+typedef struct cow_pipeline cow_pipeline;
+// Transform and pencil callbacks are given 4 strides for each argument: the
+// distance between zones along each dimension, then in [3] the distance between
+// members of a zone, which is 1 only in the interleaved layout. Members of the
+// result are always adjacent.
 typedef void (*cow_transform)(double *result, double **args, int **strides,
 			      void *udata);
+typedef void (*cow_pencil)(double *result, double **args, int **strides,
+			   int *pstrides, int nzones, void *udata);
 
 void cow_init(int argc, char **argv, int modes);
 void cow_finalize(void);
 int cow_mpirunning(void);
+void cow_memory_setbudget(long long bytes);
+long long cow_memory_getbudget(void);
+long long cow_memory_getinuse(void);
+long long cow_memory_gethighwater(void);
+void cow_memory_resethighwater(void);
 
 cow_domain *cow_domain_new(void);
 void cow_domain_commit(cow_domain *d);
@@ -56,17 +121,33 @@ void cow_domain_setsize(cow_domain *d, int dim, int size);
 void cow_domain_setndim(cow_domain *d, int ndim);
 void cow_domain_setguard(cow_domain *d, int guard);
 void cow_domain_setprocsizes(cow_domain *d, int dim, int size);
+void cow_domain_settopology(cow_domain *d, int mode);
+void cow_domain_setnodesize(cow_domain *d, int size);
+void cow_domain_setcomm(cow_domain *d, void *comm);
+void cow_domain_setcost(cow_domain *d, int dim, double *weights, int n);
+void cow_domain_setallocator(cow_domain *d, int flags);
+void cow_domain_releasepool(cow_domain *d);
 void cow_domain_setcollective(cow_domain *d, int mode);
 void cow_domain_setchunk(cow_domain *d, int mode);
 void cow_domain_setalign(cow_domain *d, int alignthreshold, int diskblocksize);
+void cow_domain_setnumthreads(cow_domain *d, int nthreads);
+void cow_domain_setstencil(cow_domain *d, int scheme);
+void cow_domain_setexchange(cow_domain *d, int mode);
+void cow_domain_setboundary(cow_domain *d, int dim, int side, int bc);
+void cow_domain_setshear(cow_domain *d, int dim, int shiftdim, double shift);
 void cow_domain_readsize(cow_domain *d, char *fname, char *dname);
 int cow_domain_getndim(cow_domain *d);
 int cow_domain_getguard(cow_domain *d);
+int cow_domain_getnumthreads(cow_domain *d);
+int cow_domain_getallocator(cow_domain *d);
+int cow_domain_getstencil(cow_domain *d);
+int cow_domain_getexchange(cow_domain *d);
+int cow_domain_getboundary(cow_domain *d, int dim, int side);
 long long cow_domain_getnumlocalzonesincguard(cow_domain *d, int dim);
 long long cow_domain_getnumlocalzonesinterior(cow_domain *d, int dim);
 long long cow_domain_getnumglobalzones(cow_domain *d, int dim);
 int cow_domain_getglobalstartindex(cow_domain *d, int dim);
-int cow_domain_getgridspacing(cow_domain *d, int dim);
+double cow_domain_getgridspacing(cow_domain *d, int dim);
 int cow_domain_getcartrank(cow_domain *d);
 int cow_domain_getcartsize(cow_domain *d);
 int cow_domain_subgridatposition(cow_domain *d, double x, double y, double z);
@@ -76,15 +157,31 @@ void cow_domain_barrier(cow_domain *d);
 
 cow_dfield *cow_dfield_new(void);
 cow_dfield *cow_dfield_dup(cow_dfield *f);
+cow_dfield *cow_dfield_redistribute(cow_dfield *f, cow_domain *d);
 void cow_dfield_commit(cow_dfield *f);
 void cow_dfield_del(cow_dfield *f);
 void cow_dfield_setdomain(cow_dfield *f, cow_domain *d);
 void cow_dfield_addmember(cow_dfield *f, char *name);
 void cow_dfield_setname(cow_dfield *f, char *name);
+void cow_dfield_setcomponent(cow_dfield *f, int member, int dim);
+void cow_dfield_setmemory(cow_dfield *f, int mode);
+void cow_dfield_setlayout(cow_dfield *f, int mode);
+void cow_dfield_setprecision(cow_dfield *f, int precision);
 void cow_dfield_extract(cow_dfield *f, int *I0, int *I1, void *out);
 void cow_dfield_replace(cow_dfield *f, int *I0, int *I1, void *out);
+void cow_dfield_extractmembers(cow_dfield *f, int *I0, int *I1, void *out,
+			       int *members, int nmembers);
+void cow_dfield_replacemembers(cow_dfield *f, int *I0, int *I1, void *out,
+			       int *members, int nmembers);
+void *cow_dfield_getview(cow_dfield *f, int member, int *size, int *stride);
 void cow_dfield_loop(cow_dfield *f, cow_transform op, void *udata);
+void cow_dfield_looppencil(cow_dfield *f, cow_pencil op, void *udata);
+void cow_dfield_loopthreaded(cow_dfield *f, cow_transform op, void **udata);
+void cow_dfield_looppencilthreaded(cow_dfield *f, cow_pencil op, void **udata);
+void cow_dfield_setthreadsafe(cow_dfield *f, int safe);
+int cow_dfield_getnumthreads(cow_dfield *f);
 void cow_dfield_settransform(cow_dfield *f, cow_transform op);
+void cow_dfield_settransformpencil(cow_dfield *f, cow_pencil op);
 void cow_dfield_clearargs(cow_dfield *f);
 void cow_dfield_pusharg(cow_dfield *f, cow_dfield *arg);
 void cow_dfield_setuserdata(cow_dfield *f, void *userdata);
@@ -98,6 +195,8 @@ char *cow_dfield_getname(cow_dfield *f);
 cow_domain *cow_dfield_getdomain(cow_dfield *f);
 int cow_dfield_getstride(cow_dfield *f, int dim);
 int cow_dfield_getnmembers(cow_dfield *f);
+int cow_dfield_getlayout(cow_dfield *f);
+int cow_dfield_getprecision(cow_dfield *f);
 int cow_dfield_getflag(cow_dfield *f, int index);
 size_t cow_dfield_getdatabytes(cow_dfield *f);
 void cow_dfield_setdatabuffer(cow_dfield *f, void *buffer);
@@ -115,9 +214,17 @@ void *cow_dfield_getdatabuffer(cow_dfield *f);
 int cow_dfield_getownsflag(cow_dfield *f);
 int *cow_dfield_getflagbuffer(cow_dfield *f);
 void cow_dfield_syncguard(cow_dfield *f);
+void cow_dfield_syncguard_begin(cow_dfield *f);
+void cow_dfield_syncguard_end(cow_dfield *f);
+void cow_dfield_syncguard_many(cow_dfield **fs, int n);
+void cow_dfield_syncguard_partial(cow_dfield *f, int dims, int depth);
+void cow_dfield_setsyncmode(cow_dfield *f, int mode);
+void cow_dfield_settransformstencil(cow_dfield *f, int dims, int depth);
 void cow_dfield_reduce(cow_dfield *f, double x[3]);
+void cow_dfield_setsummode(cow_dfield *f, int mode);
 void cow_dfield_write(cow_dfield *f, char *fname);
 void cow_dfield_read(cow_dfield *f, char *fname);
+void cow_dfield_readmany(cow_dfield **fs, int n, char *fname);
 
 cow_histogram *cow_histogram_new(void);
 void cow_histogram_commit(cow_histogram *h);
@@ -125,6 +232,10 @@ void cow_histogram_del(cow_histogram *h);
 void cow_histogram_setbinmode(cow_histogram *h, int binmode);
 void cow_histogram_setspacing(cow_histogram *h, int spacing);
 void cow_histogram_setnbins(cow_histogram *h, int dim, int nbinsx);
+void cow_histogram_setndims(cow_histogram *h, int ndims);
+void cow_histogram_setstorage(cow_histogram *h, int storage);
+void cow_histogram_setsealmode(cow_histogram *h, int sealmode);
+void cow_histogram_setsummode(cow_histogram *h, int summode);
 void cow_histogram_setlower(cow_histogram *h, int dim, double v0);
 void cow_histogram_setupper(cow_histogram *h, int dim, double v1);
 void cow_histogram_setfullname(cow_histogram *h, char *fullname);
@@ -132,23 +243,46 @@ void cow_histogram_setnickname(cow_histogram *h, char *nickname);
 void cow_histogram_setdomaincomm(cow_histogram *h, cow_domain *d);
 void cow_histogram_addsample1(cow_histogram *h, double x, double w);
 void cow_histogram_addsample2(cow_histogram *h, double x, double y, double w);
+void cow_histogram_addsample(cow_histogram *h, double *x, double w);
 void cow_histogram_dumpascii(cow_histogram *h, char *fn);
 void cow_histogram_dumphdf5(cow_histogram *h, char *fn, char *dn);
 void cow_histogram_seal(cow_histogram *h);
 int cow_histogram_getsealed(cow_histogram *h);
+int cow_histogram_getndims(cow_histogram *h);
 long cow_histogram_gettotalcounts(cow_histogram *h);
 void cow_histogram_populate(cow_histogram *h, cow_dfield *f, cow_transform op);
+void cow_histogram_populatepencil(cow_histogram *h, cow_dfield *f, cow_pencil op,
+				  void *udata);
 void cow_histogram_getbinlocx(cow_histogram *h, double **x, int *n0);
 void cow_histogram_getbinlocy(cow_histogram *h, double **x, int *n0);
+void cow_histogram_getbinloc(cow_histogram *h, int dim, double **x, int *n0);
 void cow_histogram_getbinval1(cow_histogram *h, double **x, int *n0);
 void cow_histogram_getbinval2(cow_histogram *h, double **x, int *n0, int *n1);
+void cow_histogram_getbinvals(cow_histogram *h, double **x, long *n0);
+void cow_histogram_getbinindices(cow_histogram *h, long **I, long *n0);
+void cow_histogram_getbinrange(cow_histogram *h, long *start, long *stop);
 double cow_histogram_getbinval(cow_histogram *h, int i, int j);
+double cow_histogram_getbinvaln(cow_histogram *h, int *I);
 char *cow_histogram_getname(cow_histogram *h);
 
+cow_pipeline *cow_pipeline_new(cow_domain *d);
+void cow_pipeline_del(cow_pipeline *p);
+void cow_pipeline_settilesize(cow_pipeline *p, int zones);
+int cow_pipeline_addinput(cow_pipeline *p, cow_dfield *f);
+int cow_pipeline_addstage(cow_pipeline *p, cow_transform op, int *args,
+			  int nargs, int nmembers, int stencil, void *udata);
+int cow_pipeline_addpencilstage(cow_pipeline *p, cow_pencil op, int *args,
+				int nargs, int nmembers, int stencil,
+				void *udata);
+void cow_pipeline_setoutput(cow_pipeline *p, int node, cow_dfield *f);
+void cow_pipeline_execute(cow_pipeline *p);
+
 void cow_fft_pspecscafield(cow_dfield *f, cow_histogram *h);
 void cow_fft_pspecvecfield(cow_dfield *f, cow_histogram *h);
 void cow_fft_helmholtzdecomp(cow_dfield *f, int mode);
 
+// The built-in transforms read members at the stride in s[a][3], so callers
+// invoking them directly must pass 4 strides for each argument
 void cow_trans_divcorner(double *result, double **args, int **s, void *u);
 void cow_trans_div5(double *result, double **args, int **s, void *u);
 void cow_trans_rot5(double *result, double **args, int **s, void *u);
@@ -157,11 +291,82 @@ void cow_trans_magnitude(double *result, double **args, int **s, void *u);
 void cow_trans_cross(double *result, double **args, int **s, void *u);
 void cow_trans_dot3(double *result, double **args, int **s, void *u);
 
+void cow_pencil_divcorner(double *result, double **args, int **s, int *p, int n,
+			  void *u);
+void cow_pencil_div5(double *result, double **args, int **s, int *p, int n,
+		     void *u);
+void cow_pencil_rot5(double *result, double **args, int **s, int *p, int n,
+		     void *u);
+void cow_pencil_component(double *result, double **args, int **s, int *p, int n,
+			  void *u);
+void cow_pencil_magnitude(double *result, double **args, int **s, int *p, int n,
+			  void *u);
+void cow_pencil_cross(double *result, double **args, int **s, int *p, int n,
+		      void *u);
+void cow_pencil_dot3(double *result, double **args, int **s, int *p, int n,
+		     void *u);
+
+void cow_deriv_div5(double *result, double **args, int **s, int *p, int n,
+		    void *u);
+void cow_deriv_rot5(double *result, double **args, int **s, int *p, int n,
+		    void *u);
+void cow_deriv_divcorner(double *result, double **args, int **s, int *p, int n,
+			 void *u);
+void cow_deriv_grad(double *result, double **args, int **s, int *p, int n,
+		    void *u);
+void cow_deriv_lapl(double *result, double **args, int **s, int *p, int n,
+		    void *u);
+void cow_deriv_div(double *result, double **args, int **s, int *p, int n,
+		   void *u);
+void cow_deriv_curl(double *result, double **args, int **s, int *p, int n,
+		    void *u);
+void cow_deriv_strain(double *result, double **args, int **s, int *p, int n,
+		      void *u);
+int cow_stencil_getguard(int scheme);
+void cow_dfield_derivative(cow_dfield *result, cow_dfield *f, int dim);
+void cow_dfield_vgtinvariants(cow_dfield *result, cow_dfield *vel, int *which);
+void cow_histogram_populatevgt(cow_histogram *h, cow_dfield *vel, int *which);
+
 
 #ifdef COW_PRIVATE_DEFS
 
 void _io_domain_commit(cow_domain *d);
 void _io_domain_del(cow_domain *d);
+void _dfield_requireguard(cow_dfield *f, int dims, int depth);
+void _dfield_syncguardmany(cow_dfield **fs, int n, int dims, int depth);
+void *_mem_alloc(cow_domain *d, size_t bytes);
+void _mem_free(cow_domain *d, void *p);
+size_t _dfield_elemsize(cow_dfield *f);
+double _dfield_load(cow_dfield *f, long n);
+void _dfield_store(cow_dfield *f, long n, double x);
+struct cow_wide;
+void _wide_init(struct cow_wide *v, cow_dfield *f, int tile[3], int halo);
+void _wide_box(struct cow_wide *v, cow_dfield *f, int lo[3], int hi[3],
+	       double *scratch);
+void _wide_load(struct cow_wide *v, cow_dfield *f);
+void _wide_store(struct cow_wide *v, cow_dfield *f, int lo[3], int hi[3]);
+double *_wide_zone(struct cow_wide *v, int i, int j, int k);
+
+#define COW_EXACTSUM_NLIMBS 68 // 32-bit limbs spanning every double, plus carry
+typedef struct cow_exactsum
+{
+  int64_t limb[COW_EXACTSUM_NLIMBS]; // fixed-point value, least significant first
+  int64_t nadd; // additions since the limbs were last normalized
+  int64_t nnan; // number of non-finite terms, which are not held in the limbs
+  int64_t nposinf;
+  int64_t nneginf;
+} cow_exactsum;
+
+void _sum_kahanadd(double *s, double *c, double x);
+void _sum_exactclear(cow_exactsum *a);
+void _sum_exactnorm(cow_exactsum *a);
+void _sum_exactadd(cow_exactsum *a, double x);
+void _sum_exactmerge(cow_exactsum *a, cow_exactsum *b);
+double _sum_exactvalue(cow_exactsum *a);
+#if (COW_MPI)
+void _sum_kahanmpi(MPI_Datatype *type, MPI_Op *op);
+int _dfield_peer(cow_dfield *f, int rank, cow_dfield *view, cow_domain *dview);
+#endif
 
 struct cow_domain
 {
@@ -179,8 +384,21 @@ struct cow_domain
   int n_ghst; // number of guard zones: >= 0
   int balanced; // true when all subgrids have the same size
   int committed; // true after cow_domain_commit called, locks out size changes
+  int n_threads; // threads used by loops over the domain, 0 for the default
+  int stencil; // finite difference scheme used by the derivative operators
+  int exchange; // how guard zones are sent between processes
+  int boundary[3][2]; // policy on the lower and upper face of each dimension
+  int shear_dim[3]; // dimension along which shearing guard zones are shifted
+  double shear[3]; // " " by this distance, from the lower face
+  int topology; // how processes are placed on the process grid
+  int node_size; // processes grouped as a node, or 0 for shared memory nodes
+  double *cost[3]; // cost of each slab of zones along a dimension, or NULL
+  int cost_len[3]; // number of " " entries
+  int allocator; // COW_ALLOC_* flags for field data and temporaries
+  struct cow_block *pool; // freed blocks kept for reuse
 #if (COW_MPI)
-  int comm_rank; // rank with respect to MPI_COMM_WORLD communicator
+  MPI_Comm comm; // processes the domain is built on, MPI_COMM_WORLD by default
+  int comm_rank; // rank with respect to that communicator
   int comm_size; // size " "
   int cart_rank; // rank with respect to the cartesian communicator
   int cart_size; // size " "
@@ -191,6 +409,9 @@ struct cow_domain
   int *send_tags; // tag used to on send calls with respective neighbor
   int *recv_tags; // " "            recv " "
   MPI_Comm mpi_cart; // the cartesian communicator
+  int *cuts[3]; // global start of each subgrid along a dimension, and G_ntot
+  MPI_Comm node_comm; // processes sharing memory with this one, or null
+  int *node_ranks; // rank in node_comm of each cartesian rank, or undefined
 #endif
 #if (COW_HDF5)
   hsize_t L_nint_h5[3]; // HDF5 versions of the variables with the same name
@@ -204,20 +425,49 @@ struct cow_domain
 #endif
 } ;
 
+#if (COW_MPI)
+struct cow_exchange
+{
+  int mode; // the domain's exchange mode these were built for
+  int n_msgs; // messages sent, and received, by each process
+  int n_stages; // 1, or the number of dimensions for face exchanges
+  int stage; // stage in flight, or -1
+  int *first; // stage s sends messages first[s] ... first[s+1]-1
+  int *box; // for each message, the send box lo[3] hi[3], then the recv box
+  int *offset; // in bytes, of each message into the pack buffers, n_msgs+1
+  char *send_buf;
+  char *recv_buf;
+  MPI_Request *requests; // send then recv request of each message
+} ;
+struct cow_synctype
+{
+  int mask; // dimensions exchanged, as bits (1 << dim)
+  int depth; // guard zones exchanged along each of them
+  int n_msgs;
+  int *nbr; // neighbor index of each message
+  int *box; // send and recv box of each message, as from _exchange_boxes
+  MPI_Datatype *send_type;
+  MPI_Datatype *recv_type;
+  struct cow_synctype *next; // other combinations used by the field
+} ;
+#endif
+
 struct cow_dfield
 {
   char *name; // name of the data field
   char **members; // list of labels for the data members
   int member_iter; // maintains an index into the last dimension
   int n_members; // size of last dimension
+  int *component; // dimension of the vector component in each member, or -1
   void *data; // data buffer
   int *flag; // container for mapping integer flags to grid zones
-  int stride[3]; // strides describing memory layout: C ordering
+  int stride[4]; // strides describing memory layout: C ordering, then members
   int committed; // true after cow_dfield_commit called, locks out most changes
   int ownsdata; // client code can own the data: see setdatabuffer function
   int ownsflag; // client code can own the flag: see setflagbuffer function
   cow_domain *domain; // pointer to an associated domain
   cow_transform transform; // used only by internal code
+  cow_pencil pencil; // used instead of transform when not NULL
   cow_dfield **transargs; // list of arguments for transform, used internally
   void *userdata; // shallow pointer to user-supplied data item
   int transargslen;
@@ -227,40 +477,110 @@ struct cow_dfield
   double *sampleresult;
   int samplecoordslen;
   int samplemode;
+  int summode; // accumulation used by cow_dfield_reduce
+  int threadsafe; // false if callbacks applied to the field must run serially
+  int syncmode; // how cow_dfield_transformexecute exchanges guard zones
+  int guardmask; // dimensions whose guard zones are current, as bits
+  int guarddepth; // depth to which they are current
+  int stencilmask; // guard zones the transform reads from its arguments,
+  int stencildepth; // or -1 when they are inferred
+  int memory; // COW_MEMORY_PRIVATE, or shared with the processes on the node
+  int layout; // COW_LAYOUT_INTERLEAVED, or members stored one after another
+  int precision; // element type of the data, COW_PRECISION_DOUBLE or _SINGLE
 #if (COW_MPI)
+  MPI_Win win; // shared memory window holding the data, or MPI_WIN_NULL
   MPI_Datatype *send_type; // chunk of data to be sent to respective neighbor
   MPI_Datatype *recv_type; // " "                 received from " "
+  MPI_Request *sync_requests; // guard exchange in flight, or NULL
+  struct cow_exchange *exchange; // persistent requests, built on first use
+  struct cow_synctype *synctypes; // datatypes of partial syncs, cached
 #endif
 } ;
 
 struct cow_histogram
 {
-  int nbinsx;
-  int nbinsy;
-  double x0;
-  double x1;
-  double y0;
-  double y1;
-  double *bedgesx;
-  double *bedgesy;
+  int nbins[COW_HIST_MAXDIMS]; // number of bins along each dimension
+  double lower[COW_HIST_MAXDIMS]; // lower edge of the first bin
+  double upper[COW_HIST_MAXDIMS]; // upper edge of the last bin
+  double *bedges[COW_HIST_MAXDIMS]; // bin edges, nbins+1 along each dimension
+  long nbinstot; // product of nbins over n_dims, the dense array size
   double *weight;
+  double *weightc; // compensation terms, for COW_SUM_COMPENSATED
+  cow_exactsum *weightx; // used instead of weight for COW_SUM_REPRODUCIBLE
   long totcounts;
   long *counts;
+  struct cow_histogram_sparse *sparse; // used instead of weight, counts
   char *nickname;
   char *fullname;
   int binmode;
   int spacing;
-  int n_dims;
+  int storage;
+  int sealmode;
+  int summode;
+  int n_dims; // when zero before commit, inferred from the nbins
   int committed;
   int sealed; // once sealed, is sync'ed and does not accept more samples
   cow_transform transform;
-  double *binlocx; // Pointers to these arrays are returned by the getbinlocx
-  double *binlocy; // getbinlocy, and getbinval functions.
-  double *binvalv;
+  double *binloc[COW_HIST_MAXDIMS]; // Pointers to these arrays are returned by
+  double *binvalv; // the getbinloc and getbinval functions.
+  long *binindv; // linear indices of the populated bins, for sparse storage
+  long nbinsout; // number of entries in binvalv
+  long binstart; // range of linear bin indices held by this rank once
+  long binstop; // sealed, depends on the seal mode
 #if (COW_MPI)
   MPI_Comm comm;
 #endif
 } ;
 
+struct cow_wide
+// -----------------------------------------------------------------------------
+// A field seen as doubles over a box of zones: its own data if it holds
+// doubles, or else the box widened from its floats into scratch
+// -----------------------------------------------------------------------------
+{
+  double *data; // zone `start`
+  int stride[4];
+  int start[3]; // box of zones held, start <= (i,j,k) < end
+  int end[3];
+  int halo; // zones held around the boxes the view is pointed at
+  long size; // doubles of scratch, zero when viewing the field's own data
+  long offset; // of the scratch within that of its thread
+} ;
+struct cow_widen
+{
+  cow_domain *domain;
+  cow_dfield **fields;
+  int nfields;
+  int nread; // fields which are widened, the others are only stored back
+  struct cow_wide *views; // nfields for each thread
+  double *scratch;
+  long size; // doubles of scratch for each thread
+} ;
+
+struct cow_pipeline_node
+{
+  cow_transform op; // NULL for input nodes
+  cow_pencil pencil; // used instead of op for pencil stages
+  void *udata;
+  int *args; // nodes read by the transform
+  int nargs;
+  int n_members; // number of values per zone
+  int stencil; // guard zones read from the arguments, zero for pointwise
+  int phase; // index of the sweep in which the stage is evaluated
+  cow_dfield *field; // input, output, or materialized temporary, may be NULL
+  int ownsfield; // true for temporaries created by the pipeline
+  double *tile; // tile buffer, used when the stage is not materialized
+  struct cow_wide view; // of a single-precision field read by later stages
+  double *wide; // scratch of the view
+} ;
+struct cow_pipeline
+{
+  cow_domain *domain;
+  struct cow_pipeline_node *nodes;
+  int n_nodes;
+  int n_phases; // number of grid sweeps, determined on execute
+  int tilesize; // number of zones in a tile
+} ;
+
 #endif // COW_PRIVATE_DEFS
 #endif // COW_HEADER_INCLUDED
@@ -0,0 +1,669 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#define COW_PRIVATE_DEFS
+#include "cow.h"
+#define MODULE "deriv"
+#define PI (4*atan(1))
+
+// -----------------------------------------------------------------------------
+//
+// Derivative operators on vector fields, scaled by the grid spacing
+//
+// These are pencil kernels (see cow_dfield_settransformpencil), and their user
+// data is the cow_domain whose grid spacing dx[] scales the derivatives. The
+// coefficients and strides are hoisted out of the loop over the pencil, which
+// carries no dependencies, so that it is vectorized. When compiled with
+// COW_OPENMP the loop is marked with `omp simd`. For fields stored with their
+// members interleaved the vectorized loads are strided by the number of
+// members, and for planar fields they are contiguous.
+//
+// -----------------------------------------------------------------------------
+
+// 5-point first derivative, with a = 8/(12 dx) and b = -1/(12 dx)
+#define D5(f,s,a,b) ((a)*((f)[s] - (f)[-(s)]) + (b)*((f)[2*(s)] - (f)[-2*(s)]))
+
+static void _coeff5(cow_domain *d, double a[3], double b[3])
+{
+  for (int n=0; n<3; ++n) {
+    a[n] = +8.0 / (12.0 * d->dx[n]);
+    b[n] = -1.0 / (12.0 * d->dx[n]);
+  }
+}
+
+void cow_deriv_div5(double *result, double **args, int **s, int *p, int n,
+		    void *u)
+{
+  double a[3], b[3];
+  _coeff5((cow_domain*) u, a, b);
+  double a0 = a[0], a1 = a[1], a2 = a[2];
+  double b0 = b[0], b1 = b[1], b2 = b[2];
+  int si = s[0][0], sj = s[0][1], sk = s[0][2], sm = s[0][3];
+  int pa = p[0], pr = p[1];
+  double *f = args[0];
+  COW_SIMD
+  for (int q=0; q<n; ++q) {
+    double *g = f + q*pa;
+    result[q*pr] = D5(g, si, a0, b0) + D5(g+sm, sj, a1, b1) +
+      D5(g+2*sm, sk, a2, b2);
+  }
+}
+void cow_deriv_rot5(double *result, double **args, int **s, int *p, int n,
+		    void *u)
+{
+  double a[3], b[3];
+  _coeff5((cow_domain*) u, a, b);
+  double a0 = a[0], a1 = a[1], a2 = a[2];
+  double b0 = b[0], b1 = b[1], b2 = b[2];
+  int si = s[0][0], sj = s[0][1], sk = s[0][2], sm = s[0][3];
+  int pa = p[0], pr = p[1];
+  double *f = args[0];
+  COW_SIMD
+  for (int q=0; q<n; ++q) {
+    double *g = f + q*pa;
+    double *r = result + q*pr;
+    r[0] = D5(g+2*sm, sj, a1, b1) - D5(g+sm, sk, a2, b2);
+    r[1] = D5(g, sk, a2, b2) - D5(g+2*sm, si, a0, b0);
+    r[2] = D5(g+sm, si, a0, b0) - D5(g, sj, a1, b1);
+  }
+}
+void cow_deriv_divcorner(double *result, double **args, int **s, int *p, int n,
+			 void *u)
+// -----------------------------------------------------------------------------
+// The corner-centered divergence of cow_trans_divcorner, divided by the grid
+// spacing
+// -----------------------------------------------------------------------------
+{
+#define M(i,j,k) ((i)*si + (j)*sj + (k)*sk)
+  cow_domain *d = (cow_domain*) u;
+  double cx = 0.25 / d->dx[0];
+  double cy = 0.25 / d->dx[1];
+  double cz = 0.25 / d->dx[2];
+  int si = s[0][0], sj = s[0][1], sk = s[0][2], sm = s[0][3];
+  int pa = p[0], pr = p[1];
+  double *f = args[0];
+  COW_SIMD
+  for (int q=0; q<n; ++q) {
+    double *fx = f + q*pa;
+    double *fy = f + q*pa + sm;
+    double *fz = f + q*pa + 2*sm;
+    result[q*pr] =
+      cx * ((fx[M(1,0,0)] + fx[M(1,1,0)] + fx[M(1,0,1)] + fx[M(1,1,1)]) -
+	    (fx[M(0,0,0)] + fx[M(0,1,0)] + fx[M(0,0,1)] + fx[M(0,1,1)]))
+      + cy * ((fy[M(0,1,0)] + fy[M(0,1,1)] + fy[M(1,1,0)] + fy[M(1,1,1)]) -
+	      (fy[M(0,0,0)] + fy[M(0,0,1)] + fy[M(1,0,0)] + fy[M(1,0,1)]))
+      + cz * ((fz[M(0,0,1)] + fz[M(1,0,1)] + fz[M(0,1,1)] + fz[M(1,1,1)]) -
+	      (fz[M(0,0,0)] + fz[M(1,0,0)] + fz[M(0,1,0)] + fz[M(1,1,0)]));
+  }
+#undef M
+}
+
+// -----------------------------------------------------------------------------
+//
+// Stencil library
+//
+// The scheme is chosen for each domain with cow_domain_setstencil. Central
+// schemes of order 2, 4, 6 and 8 are explicit, and read order/2 zones on either
+// side. Compact (Pade) schemes couple the derivatives along a whole line of
+// zones through a tridiagonal system (Lele 1992),
+//
+//   alpha f'[i-1] + f'[i] + alpha f'[i+1] = a (f[i+1] - f[i-1]) / 2h
+//                                         + b (f[i+2] - f[i-2]) / 4h
+//
+// which cow_dfield_derivative solves along each line of the local subgrid. A
+// line which spans the periodic domain gives a cyclic system. When the line is
+// split over processes, its first and last zones are closed with the explicit
+// scheme of the same order, so a compact scheme needs as many guard zones as
+// that one, and is only as accurate near subgrid boundaries. The
+// fused operators work on a single row of zones, and cannot solve along the
+// other axes. With a compact scheme they use the explicit one of the same
+// order.
+//
+// -----------------------------------------------------------------------------
+
+static const double D1[4][4] = { // f' = sum_m c[m-1] (f[+m] - f[-m]) / h
+  { 1./2 },
+  { 2./3, -1./12 },
+  { 3./4, -3./20, 1./60 },
+  { 4./5, -1./5, 4./105, -1./280 },
+} ;
+static const double D2[4][5] = { // f'' = (c[0] f + sum_m c[m] (f[+m] + f[-m])) / h^2
+  { -2., 1. },
+  { -5./2, 4./3, -1./12 },
+  { -49./18, 3./2, -3./20, 1./90 },
+  { -205./72, 8./5, -1./5, 8./315, -1./560 },
+} ;
+
+struct stencil
+{
+  int r; // half width of the explicit stencil
+  int ndim;
+  double d1[3][4]; // first derivative coefficients, divided by dx
+  double d2[3][5]; // second derivative coefficients, divided by dx^2
+} ;
+
+static void _stencil(cow_domain *d, struct stencil *st)
+{
+  int r = cow_stencil_getguard(d->stencil);
+  st->r = r;
+  st->ndim = d->n_dims;
+  for (int n=0; n<3; ++n) {
+    for (int m=0; m<r; ++m) {
+      st->d1[n][m] = D1[r-1][m] / d->dx[n];
+    }
+    for (int m=0; m<=r; ++m) {
+      st->d2[n][m] = D2[r-1][m] / (d->dx[n] * d->dx[n]);
+    }
+  }
+}
+static inline double _diff1(double *f, int s, const double *c, int r)
+{
+  double y = 0.0;
+  for (int m=1; m<=r; ++m) {
+    y += c[m-1] * (f[m*s] - f[-m*s]);
+  }
+  return y;
+}
+static inline double _diff2(double *f, int s, const double *c, int r)
+{
+  double y = c[0] * f[0];
+  for (int m=1; m<=r; ++m) {
+    y += c[m] * (f[m*s] + f[-m*s]);
+  }
+  return y;
+}
+
+int cow_stencil_getguard(int scheme)
+// -----------------------------------------------------------------------------
+// Number of guard zones needed by the scheme, or -1 if there is no such scheme
+// -----------------------------------------------------------------------------
+{
+  switch (scheme) {
+  case COW_STENCIL_CENTRAL2: return 1;
+  case COW_STENCIL_CENTRAL4: return 2;
+  case COW_STENCIL_CENTRAL6: return 3;
+  case COW_STENCIL_CENTRAL8: return 4;
+  case COW_STENCIL_COMPACT4: return 2;
+  case COW_STENCIL_COMPACT6: return 3;
+  default: return -1;
+  }
+}
+
+void cow_deriv_grad(double *result, double **args, int **s, int *p, int n,
+		    void *u)
+// -----------------------------------------------------------------------------
+// Gradient of the first member of the argument, 3 members
+// -----------------------------------------------------------------------------
+{
+  struct stencil st;
+  _stencil((cow_domain*) u, &st);
+  int r = st.r;
+  int si = s[0][0], sj = s[0][1], sk = s[0][2];
+  int pa = p[0], pr = p[1];
+  double *f = args[0];
+  COW_SIMD
+  for (int q=0; q<n; ++q) {
+    double *g = f + q*pa;
+    double *y = result + q*pr;
+    y[0] = _diff1(g, si, st.d1[0], r);
+    y[1] = _diff1(g, sj, st.d1[1], r);
+    y[2] = _diff1(g, sk, st.d1[2], r);
+  }
+}
+void cow_deriv_lapl(double *result, double **args, int **s, int *p, int n,
+		    void *u)
+// -----------------------------------------------------------------------------
+// Laplacian of the first member of the argument, 1 member
+// -----------------------------------------------------------------------------
+{
+  struct stencil st;
+  _stencil((cow_domain*) u, &st);
+  int r = st.r;
+  int ndim = st.ndim;
+  int pa = p[0], pr = p[1];
+  double *f = args[0];
+  COW_SIMD
+  for (int q=0; q<n; ++q) {
+    double *g = f + q*pa;
+    double y = 0.0;
+    for (int a=0; a<ndim; ++a) {
+      y += _diff2(g, s[0][a], st.d2[a], r);
+    }
+    result[q*pr] = y;
+  }
+}
+void cow_deriv_div(double *result, double **args, int **s, int *p, int n,
+		   void *u)
+// -----------------------------------------------------------------------------
+// Divergence of a vector argument, 1 member
+// -----------------------------------------------------------------------------
+{
+  struct stencil st;
+  _stencil((cow_domain*) u, &st);
+  int r = st.r;
+  int si = s[0][0], sj = s[0][1], sk = s[0][2], sm = s[0][3];
+  int pa = p[0], pr = p[1];
+  double *f = args[0];
+  COW_SIMD
+  for (int q=0; q<n; ++q) {
+    double *g = f + q*pa;
+    result[q*pr] = (_diff1(g, si, st.d1[0], r) +
+		    _diff1(g+sm, sj, st.d1[1], r) +
+		    _diff1(g+2*sm, sk, st.d1[2], r));
+  }
+}
+void cow_deriv_curl(double *result, double **args, int **s, int *p, int n,
+		    void *u)
+// -----------------------------------------------------------------------------
+// Curl (vorticity) of a vector argument, 3 members
+// -----------------------------------------------------------------------------
+{
+  struct stencil st;
+  _stencil((cow_domain*) u, &st);
+  int r = st.r;
+  int si = s[0][0], sj = s[0][1], sk = s[0][2], sm = s[0][3];
+  int pa = p[0], pr = p[1];
+  double *f = args[0];
+  COW_SIMD
+  for (int q=0; q<n; ++q) {
+    double *g = f + q*pa;
+    double *y = result + q*pr;
+    y[0] = _diff1(g+2*sm, sj, st.d1[1], r) - _diff1(g+sm, sk, st.d1[2], r);
+    y[1] = _diff1(g, sk, st.d1[2], r) - _diff1(g+2*sm, si, st.d1[0], r);
+    y[2] = _diff1(g+sm, si, st.d1[0], r) - _diff1(g, sj, st.d1[1], r);
+  }
+}
+void cow_deriv_strain(double *result, double **args, int **s, int *p, int n,
+		      void *u)
+// -----------------------------------------------------------------------------
+// Strain rate tensor S_ij = (d_i u_j + d_j u_i) / 2 of a vector argument, 6
+// members: Sxx, Syy, Szz, Sxy, Sxz, Syz
+// -----------------------------------------------------------------------------
+{
+  struct stencil st;
+  _stencil((cow_domain*) u, &st);
+  int r = st.r;
+  int si = s[0][0], sj = s[0][1], sk = s[0][2], sm = s[0][3];
+  int pa = p[0], pr = p[1];
+  double *f = args[0];
+  COW_SIMD
+  for (int q=0; q<n; ++q) {
+    double *g = f + q*pa;
+    double *y = result + q*pr;
+    double dxuy = _diff1(g+sm, si, st.d1[0], r);
+    double dxuz = _diff1(g+2*sm, si, st.d1[0], r);
+    double dyux = _diff1(g, sj, st.d1[1], r);
+    double dyuz = _diff1(g+2*sm, sj, st.d1[1], r);
+    double dzux = _diff1(g, sk, st.d1[2], r);
+    double dzuy = _diff1(g+sm, sk, st.d1[2], r);
+    y[0] = _diff1(g, si, st.d1[0], r);
+    y[1] = _diff1(g+sm, sj, st.d1[1], r);
+    y[2] = _diff1(g+2*sm, sk, st.d1[2], r);
+    y[3] = 0.5 * (dxuy + dyux);
+    y[4] = 0.5 * (dxuz + dzux);
+    y[5] = 0.5 * (dyuz + dzuy);
+  }
+}
+
+static void _tridiag(int n, double alpha, double b0, double bn, double *x,
+		     double *cp)
+// -----------------------------------------------------------------------------
+// Solves in place the tridiagonal system with off-diagonals alpha, a diagonal
+// of 1 except for b0 and bn in the first and last rows, and right hand side x
+// -----------------------------------------------------------------------------
+{
+  double w = b0;
+  x[0] /= w;
+  for (int q=1; q<n; ++q) {
+    cp[q-1] = alpha / w;
+    w = (q == n-1 ? bn : 1.0) - alpha * cp[q-1];
+    x[q] = (x[q] - alpha * x[q-1]) / w;
+  }
+  for (int q=n-2; q>=0; --q) {
+    x[q] -= cp[q] * x[q+1];
+  }
+}
+
+static void _compactrhs(double *x, double *g, int sd, int nline, double a,
+			double b)
+// -----------------------------------------------------------------------------
+// Right hand side of the compact scheme along a line of `nline` zones
+// -----------------------------------------------------------------------------
+{
+  for (int q=0; q<nline; ++q) {
+    double *h = g + q*sd;
+    x[q] = a * (h[sd] - h[-sd]) + b * (h[2*sd] - h[-2*sd]);
+  }
+}
+
+void cow_dfield_derivative(cow_dfield *result, cow_dfield *f, int dim)
+// -----------------------------------------------------------------------------
+// Computes the derivative along `dim` of every member of `f`, using the
+// domain's stencil scheme, and synchronizes the guard zones of the result
+// unless its sync mode is COW_SYNC_LAZY. Only the guard zones of `f` along
+// `dim` are read, and synchronized first if they are out of date. Compact
+// schemes are solved along each line of the local subgrid. When the subgrid
+// holds the whole line and both faces along `dim` are periodic the system is
+// cyclic, otherwise its end zones are closed with the explicit scheme of the
+// same order.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = f->domain;
+  if (!f->committed || !result->committed || result->domain != d ||
+      result->n_members != f->n_members) {
+    printf("[%s] error: derivative of %s must go to a committed field on the "
+	   "same domain with %d members\n", MODULE, f->name, f->n_members);
+    return;
+  }
+  if (dim < 0 || dim >= d->n_dims) {
+    printf("[%s] error: domain has no dimension %d\n", MODULE, dim);
+    return;
+  }
+  struct stencil st;
+  _stencil(d, &st);
+  if (d->n_ghst < st.r) {
+    printf("[%s] error: stencil scheme needs %d guard zones, domain has %d\n",
+	   MODULE, st.r, d->n_ghst);
+    return;
+  }
+  _dfield_requireguard(f, 1 << dim, st.r);
+  cow_dfield_syncguard_end(result);
+  double alpha = 0.0, a = 0.0, b = 0.0; // compact scheme coefficients
+  int compact = 0;
+  switch (d->stencil) {
+  case COW_STENCIL_COMPACT4: compact = 1; alpha = 1./4; a = 3./2; b = 0.0; break;
+  case COW_STENCIL_COMPACT6: compact = 1; alpha = 1./3; a = 14./9; b = 1./9; break;
+  }
+  a /= 2.0 * d->dx[dim];
+  b /= 4.0 * d->dx[dim];
+
+  int nm = f->n_members;
+  int nline = d->L_nint[dim];
+  int cyclic = nline == d->G_ntot[dim] &&
+    d->boundary[dim][0] == COW_BOUNDARY_PERIODIC &&
+    d->boundary[dim][1] == COW_BOUNDARY_PERIODIC;
+  int ng = d->n_ghst;
+  int lo[3], hi[3];
+  for (int n=0; n<3; ++n) {
+    lo[n] = n < d->n_dims ? ng : 0;
+    hi[n] = n < d->n_dims ? ng + d->L_nint[n] : 1;
+  }
+  hi[dim] = lo[dim] + 1; // loop over the first zone of each line
+  int *S = f->stride;
+  int *R = result->stride;
+  // lines of single-precision fields are widened into scratch, with the
+  // stencil's reach beyond each end, and results rounded back from scratch
+  int fwide = f->precision == COW_PRECISION_SINGLE;
+  int rwide = result->precision == COW_PRECISION_SINGLE;
+  int sd = fwide ? 1 : S[dim];
+  int rd = rwide ? 1 : R[dim];
+  const double *c = st.d1[dim];
+  int r = st.r;
+  if (nline < 3) compact = 0;
+
+#if (COW_OPENMP)
+  int nt = cow_dfield_getnumthreads(f);
+#pragma omp parallel num_threads(nt)
+#endif
+  {
+    double *x = (double*) malloc((5 * nline + 2 * r) * sizeof(double));
+    double *cp = x + nline; // line scratch
+    double *z = cp + nline;
+    double *gw = z + nline; // widened line, and its reach
+    double *yw = gw + nline + 2 * r;
+    if (compact && cyclic) {
+      // Sherman-Morrison correction for the corners of the cyclic system
+      for (int q=0; q<nline; ++q) z[q] = 0.0;
+      z[0] = -1.0;
+      z[nline-1] = alpha;
+      _tridiag(nline, alpha, 2.0, 1.0 + alpha * alpha, z, cp);
+    }
+#if (COW_OPENMP)
+#pragma omp for collapse(3) schedule(static)
+#endif
+    for (int i=lo[0]; i<hi[0]; ++i) {
+      for (int j=lo[1]; j<hi[1]; ++j) {
+	for (int k=lo[2]; k<hi[2]; ++k) {
+	  for (int m=0; m<nm; ++m) {
+	    long gz = S[0]*i + S[1]*j + S[2]*k + m*S[3];
+	    long yz = R[0]*i + R[1]*j + R[2]*k + m*R[3];
+	    double *g = (double*) f->data + gz;
+	    double *y = (double*) result->data + yz;
+	    if (fwide) {
+	      float *gf = (float*) f->data + gz;
+	      for (int q=-r; q<nline+r; ++q) {
+		gw[q+r] = gf[q*S[dim]];
+	      }
+	      g = gw + r;
+	    }
+	    if (rwide) {
+	      y = yw;
+	    }
+	    if (!compact) {
+	      for (int q=0; q<nline; ++q) {
+		y[q*rd] = _diff1(g + q*sd, sd, c, r);
+	      }
+	    }
+	    else if (cyclic) {
+	      int N = nline - 1;
+	      _compactrhs(x, g, sd, nline, a, b);
+	      _tridiag(nline, alpha, 2.0, 1.0 + alpha * alpha, x, cp);
+	      double fact = (x[0] - alpha * x[N]) / (1.0 + z[0] - alpha * z[N]);
+	      for (int q=0; q<nline; ++q) {
+		y[q*rd] = x[q] - fact * z[q];
+	      }
+	    }
+	    else {
+	      int N = nline - 1;
+	      _compactrhs(x, g, sd, nline, a, b);
+	      y[0] = _diff1(g, sd, c, r);
+	      y[N*rd] = _diff1(g + N*sd, sd, c, r);
+	      x[1] -= alpha * y[0];
+	      x[N-1] -= alpha * y[N*rd];
+	      _tridiag(N-1, alpha, 1.0, 1.0, x+1, cp);
+	      for (int q=1; q<N; ++q) {
+		y[q*rd] = x[q];
+	      }
+	    }
+	    if (rwide) {
+	      float *yf = (float*) result->data + yz;
+	      for (int q=0; q<nline; ++q) {
+		yf[q*R[dim]] = (float) yw[q];
+	      }
+	    }
+	  }
+	}
+      }
+    }
+    free(x);
+  }
+  if (result->syncmode == COW_SYNC_LAZY) {
+    result->guardmask = 0;
+    result->guarddepth = 0;
+  }
+  else {
+    cow_dfield_syncguard(result);
+  }
+}
+
+// -----------------------------------------------------------------------------
+//
+// Velocity gradient tensor invariants
+//
+// The tensor A_ij = d u_i / d x_j is formed in each zone from the domain's
+// stencil scheme, and reduced at once to the quantities requested with the
+// COW_VGT_* constants, so it is never stored. With P = -tr(A), the invariants
+// are Q = (P^2 - tr(A^2)) / 2 and R = -det(A). QS and QW are the second
+// invariants of the strain rate S and rotation rate W, so that Q = QS + QW.
+//
+// -----------------------------------------------------------------------------
+
+#define VGT_MAX 16 // maximum number of quantities written for each zone
+
+struct vgt
+{
+  cow_domain *domain;
+  int n; // number of quantities requested
+  int which[VGT_MAX];
+} ;
+
+static void _symeig3(double S[3][3], double e[3])
+// -----------------------------------------------------------------------------
+// Eigenvalues of a real symmetric 3x3 matrix, largest first (Smith 1961)
+// -----------------------------------------------------------------------------
+{
+  double p1 = S[0][1]*S[0][1] + S[0][2]*S[0][2] + S[1][2]*S[1][2];
+  double q = (S[0][0] + S[1][1] + S[2][2]) / 3.0;
+  double a = S[0][0] - q, b = S[1][1] - q, c = S[2][2] - q;
+  double p = sqrt((a*a + b*b + c*c + 2.0 * p1) / 6.0);
+  if (p == 0.0) {
+    e[0] = e[1] = e[2] = q;
+    return;
+  }
+  double detB = (a * (b*c - S[1][2]*S[1][2]) -
+		 S[0][1] * (S[0][1]*c - S[1][2]*S[0][2]) +
+		 S[0][2] * (S[0][1]*S[1][2] - b*S[0][2])) / (p*p*p);
+  double r = 0.5 * detB;
+  double phi = r <= -1.0 ? PI / 3.0 : (r >= 1.0 ? 0.0 : acos(r) / 3.0);
+  e[0] = q + 2.0 * p * cos(phi);
+  e[2] = q + 2.0 * p * cos(phi + 2.0 * PI / 3.0);
+  e[1] = 3.0 * q - e[0] - e[2];
+}
+static void _vgt(double *result, double **args, int **s, int *p, int n, void *u)
+{
+  struct vgt *v = (struct vgt*) u;
+  struct stencil st;
+  _stencil(v->domain, &st);
+  int r = st.r;
+  int pa = p[0], pr = p[1];
+  for (int q=0; q<n; ++q) {
+    double *g = args[0] + q*pa;
+    double *y = result + q*pr;
+    double A[3][3], S[3][3], w[3], e[3];
+    for (int i=0; i<3; ++i) {
+      for (int j=0; j<3; ++j) {
+	A[i][j] = _diff1(g + i*s[0][3], s[0][j], st.d1[j], r);
+      }
+    }
+    for (int i=0; i<3; ++i) {
+      for (int j=0; j<3; ++j) {
+	S[i][j] = 0.5 * (A[i][j] + A[j][i]);
+      }
+    }
+    w[0] = A[2][1] - A[1][2];
+    w[1] = A[0][2] - A[2][0];
+    w[2] = A[1][0] - A[0][1];
+    int haveeig = 0;
+    for (int m=0; m<v->n; ++m) {
+      double x = 0.0;
+      switch (v->which[m]) {
+      case COW_VGT_Q:
+	{
+	  double P = -(A[0][0] + A[1][1] + A[2][2]);
+	  double trA2 = 0.0;
+	  for (int i=0; i<3; ++i) {
+	    for (int j=0; j<3; ++j) {
+	      trA2 += A[i][j] * A[j][i];
+	    }
+	  }
+	  x = 0.5 * (P*P - trA2);
+	}
+	break;
+      case COW_VGT_R:
+	x = -(A[0][0] * (A[1][1]*A[2][2] - A[1][2]*A[2][1]) -
+	      A[0][1] * (A[1][0]*A[2][2] - A[1][2]*A[2][0]) +
+	      A[0][2] * (A[1][0]*A[2][1] - A[1][1]*A[2][0]));
+	break;
+      case COW_VGT_QS:
+	{
+	  double P = -(S[0][0] + S[1][1] + S[2][2]);
+	  double trS2 = 0.0;
+	  for (int i=0; i<3; ++i) {
+	    for (int j=0; j<3; ++j) {
+	      trS2 += S[i][j] * S[i][j];
+	    }
+	  }
+	  x = 0.5 * (P*P - trS2);
+	}
+	break;
+      case COW_VGT_QW:
+	x = 0.25 * (w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+	break;
+      case COW_VGT_LAMBDA1:
+      case COW_VGT_LAMBDA2:
+      case COW_VGT_LAMBDA3:
+	if (!haveeig) {
+	  _symeig3(S, e);
+	  haveeig = 1;
+	}
+	x = e[v->which[m] == COW_VGT_LAMBDA1 ? 0 :
+	      v->which[m] == COW_VGT_LAMBDA2 ? 1 : 2];
+	break;
+      case COW_VGT_ENSTROPHYPROD:
+	for (int i=0; i<3; ++i) {
+	  for (int j=0; j<3; ++j) {
+	    x += w[i] * S[i][j] * w[j];
+	  }
+	}
+	break;
+      }
+      y[m] = x;
+    }
+  }
+}
+static int _vgtsetup(struct vgt *v, cow_dfield *vel, int *which, int n)
+{
+  cow_domain *d = vel->domain;
+  if (vel->n_members != 3 || d->n_ghst < cow_stencil_getguard(d->stencil)) {
+    printf("[%s] error: velocity gradient needs a 3-member field with %d "
+	   "guard zones\n", MODULE, cow_stencil_getguard(d->stencil));
+    return 1;
+  }
+  if (n > VGT_MAX) {
+    printf("[%s] error: at most %d velocity gradient quantities\n", MODULE,
+	   VGT_MAX);
+    return 1;
+  }
+  for (int m=0; m<n; ++m) {
+    if (which[m] > COW_VGT_Q || which[m] < COW_VGT_ENSTROPHYPROD) {
+      printf("[%s] error: no such velocity gradient quantity\n", MODULE);
+      return 1;
+    }
+    v->which[m] = which[m];
+  }
+  v->domain = d;
+  v->n = n;
+  return 0;
+}
+
+void cow_dfield_vgtinvariants(cow_dfield *result, cow_dfield *vel, int *which)
+// -----------------------------------------------------------------------------
+// Writes the velocity gradient quantity which[m], one of the COW_VGT_*
+// constants, to member m of `result`, computing them all in a single pass over
+// `vel`. The result's transform is replaced, and its guard zones are synced.
+// -----------------------------------------------------------------------------
+{
+  struct vgt v;
+  if (_vgtsetup(&v, vel, which, result->n_members)) return;
+  cow_dfield_clearargs(result);
+  cow_dfield_pusharg(result, vel);
+  cow_dfield_settransformpencil(result, _vgt);
+  cow_dfield_settransformstencil(result, COW_ALL_DIMS,
+				 cow_stencil_getguard(vel->domain->stencil));
+  cow_dfield_setuserdata(result, &v);
+  cow_dfield_transformexecute(result);
+  cow_dfield_setuserdata(result, NULL);
+}
+void cow_histogram_populatevgt(cow_histogram *h, cow_dfield *vel, int *which)
+// -----------------------------------------------------------------------------
+// Bins the velocity gradient quantities which[0 ... n_dims-1] of every zone
+// into the histogram, without storing them in a field. A Q-R joint histogram
+// is populated with which = { COW_VGT_R, COW_VGT_Q }.
+// -----------------------------------------------------------------------------
+{
+  struct vgt v;
+  if (_vgtsetup(&v, vel, which, cow_histogram_getndims(h))) return;
+  _dfield_requireguard(vel, COW_ALL_DIMS,
+		       cow_stencil_getguard(vel->domain->stencil));
+  cow_histogram_populatepencil(h, vel, _vgt, &v);
+}
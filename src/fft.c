@@ -60,8 +60,11 @@ static struct fft_plan_3d *call_fft_plan_3d(cow_domain *d, int *nbuf);
 static double k_at(cow_domain *d, int i, int j, int k, double *khat);
 static double khat_at(cow_domain *d, int i, int j, int k, double *khat);
 static double cnorm(FFT_DATA z);
-static FFT_DATA *_fwd(cow_dfield *f, double *fx, int start, int stride);
-static double *_rev(cow_dfield *f, FFT_DATA *Fk);
+static void _loadmember(cow_dfield *f, int member, FFT_DATA *Fx, int nbuf,
+			double scale);
+static void _storemember(cow_dfield *f, int member, FFT_DATA *Fx);
+static FFT_DATA *_fwd(cow_dfield *f, int member);
+static void _rev(cow_dfield *f, FFT_DATA *Fk, int member);
 #endif // COW_FFTW
 
 void cow_fft_pspecscafield(cow_dfield *f, cow_histogram *hist)
@@ -93,16 +96,8 @@ void cow_fft_pspecscafield(cow_dfield *f, cow_histogram *hist)
   int Nx = cow_domain_getnumglobalzones(f->domain, 0);
   int Ny = cow_domain_getnumglobalzones(f->domain, 1);
   int Nz = cow_domain_getnumglobalzones(f->domain, 2);
-  int ng = cow_domain_getguard(f->domain);
-  int ntot = nx * ny * nz;
-  int I0[3] = { ng, ng, ng };
-  int I1[3] = { nx + ng, ny + ng, nz + ng };
-
-  double *input = (double*) malloc(ntot * sizeof(double));
-  cow_dfield_extract(f, I0, I1, input);
 
-  FFT_DATA *gx = _fwd(f, input, 0, 1); // start, stride
-  free(input);
+  FFT_DATA *gx = _fwd(f, 0);
 
   cow_histogram_setlower(hist, 0, 1.0);
   cow_histogram_setupper(hist, 0, 0.5*sqrt(Nx*Nx + Ny*Ny + Nz*Nz));
@@ -130,7 +125,7 @@ void cow_fft_pspecscafield(cow_dfield *f, cow_histogram *hist)
     }
   }
   cow_histogram_seal(hist);
-  free(gx);
+  _mem_free(f->domain, gx);
   printf("[%s] %s took %3.2f seconds\n",
 	 MODULE, __FUNCTION__, (double) (clock() - start) / CLOCKS_PER_SEC);
 #endif // COW_FFTW
@@ -166,18 +161,10 @@ void cow_fft_pspecvecfield(cow_dfield *f, cow_histogram *hist)
   int Nx = cow_domain_getnumglobalzones(f->domain, 0);
   int Ny = cow_domain_getnumglobalzones(f->domain, 1);
   int Nz = cow_domain_getnumglobalzones(f->domain, 2);
-  int ng = cow_domain_getguard(f->domain);
-  int ntot = nx * ny * nz;
-  int I0[3] = { ng, ng, ng };
-  int I1[3] = { nx + ng, ny + ng, nz + ng };
-
-  double *input = (double*) malloc(3 * ntot * sizeof(double));
-  cow_dfield_extract(f, I0, I1, input);
 
-  FFT_DATA *gx = _fwd(f, input, 0, 3); // start, stride
-  FFT_DATA *gy = _fwd(f, input, 1, 3);
-  FFT_DATA *gz = _fwd(f, input, 2, 3);
-  free(input);
+  FFT_DATA *gx = _fwd(f, 0);
+  FFT_DATA *gy = _fwd(f, 1);
+  FFT_DATA *gz = _fwd(f, 2);
 
   cow_histogram_setlower(hist, 0, 1.0);
   cow_histogram_setupper(hist, 0, 0.5*sqrt(Nx*Nx + Ny*Ny + Nz*Nz));
@@ -205,9 +192,9 @@ void cow_fft_pspecvecfield(cow_dfield *f, cow_histogram *hist)
     }
   }
   cow_histogram_seal(hist);
-  free(gx);
-  free(gy);
-  free(gz);
+  _mem_free(f->domain, gx);
+  _mem_free(f->domain, gy);
+  _mem_free(f->domain, gz);
   printf("[%s] %s took %3.2f seconds\n",
 	 MODULE, __FUNCTION__, (double) (clock() - start) / CLOCKS_PER_SEC);
 #endif // COW_FFTW
@@ -217,6 +204,7 @@ void cow_fft_helmholtzdecomp(cow_dfield *f, int mode)
 {
 #if (COW_FFTW)
   if (!f->committed) return;
+  cow_dfield_syncguard_end(f);
   if (f->n_members != 3) {
     printf("[%s] error: need a 3-component field for pspecvectorfield", MODULE);
     return;
@@ -225,22 +213,15 @@ void cow_fft_helmholtzdecomp(cow_dfield *f, int mode)
   int nx = cow_domain_getnumlocalzonesinterior(f->domain, 0);
   int ny = cow_domain_getnumlocalzonesinterior(f->domain, 1);
   int nz = cow_domain_getnumlocalzonesinterior(f->domain, 2);
-  int ng = cow_domain_getguard(f->domain);
   int ntot = nx * ny * nz;
-  int I0[3] = { ng, ng, ng };
-  int I1[3] = { nx + ng, ny + ng, nz + ng };
 
-  double *input = (double*) malloc(3 * ntot * sizeof(double));
-  cow_dfield_extract(f, I0, I1, input);
+  FFT_DATA *gx = _fwd(f, 0);
+  FFT_DATA *gy = _fwd(f, 1);
+  FFT_DATA *gz = _fwd(f, 2);
 
-  FFT_DATA *gx = _fwd(f, input, 0, 3); // start, stride
-  FFT_DATA *gy = _fwd(f, input, 1, 3);
-  FFT_DATA *gz = _fwd(f, input, 2, 3);
-  free(input);
-
-  FFT_DATA *gx_p = (FFT_DATA*) malloc(ntot * sizeof(FFT_DATA));
-  FFT_DATA *gy_p = (FFT_DATA*) malloc(ntot * sizeof(FFT_DATA));
-  FFT_DATA *gz_p = (FFT_DATA*) malloc(ntot * sizeof(FFT_DATA));
+  FFT_DATA *gx_p = (FFT_DATA*) _mem_alloc(f->domain, ntot * sizeof(FFT_DATA));
+  FFT_DATA *gy_p = (FFT_DATA*) _mem_alloc(f->domain, ntot * sizeof(FFT_DATA));
+  FFT_DATA *gz_p = (FFT_DATA*) _mem_alloc(f->domain, ntot * sizeof(FFT_DATA));
   for (int i=0; i<nx; ++i) {
     for (int j=0; j<ny; ++j) {
       for (int k=0; k<nz; ++k) {
@@ -272,29 +253,16 @@ void cow_fft_helmholtzdecomp(cow_dfield *f, int mode)
       }
     }
   }
-  free(gx);
-  free(gy);
-  free(gz);
-  double *fx_p = _rev(f, gx_p);
-  double *fy_p = _rev(f, gy_p);
-  double *fz_p = _rev(f, gz_p);
-  free(gx_p);
-  free(gy_p);
-  free(gz_p);
-
-  double *res = (double*) malloc(3 * ntot * sizeof(double));
-  for (int i=0; i<ntot; ++i) {
-    res[3*i + 0] = fx_p[i];
-    res[3*i + 1] = fy_p[i];
-    res[3*i + 2] = fz_p[i];
-  }
-  free(fx_p);
-  free(fy_p);
-  free(fz_p);
-
-  cow_dfield_replace(f, I0, I1, res);
+  _mem_free(f->domain, gx);
+  _mem_free(f->domain, gy);
+  _mem_free(f->domain, gz);
+  _rev(f, gx_p, 0);
+  _rev(f, gy_p, 1);
+  _rev(f, gz_p, 2);
+  _mem_free(f->domain, gx_p);
+  _mem_free(f->domain, gy_p);
+  _mem_free(f->domain, gz_p);
   cow_dfield_syncguard(f);
-  free(res);
   printf("[%s] %s took %3.2f seconds\n",
 	 MODULE, __FUNCTION__, (double) (clock() - start) / CLOCKS_PER_SEC);
 #endif // COW_FFTW
@@ -321,7 +289,55 @@ struct fft_plan_3d *call_fft_plan_3d(cow_domain *d, int *nbuf)
 }
 #endif // COW_MPI
 
-FFT_DATA *_fwd(cow_dfield *f, double *fx, int start, int stride)
+void _loadmember(cow_dfield *f, int member, FFT_DATA *Fx, int nbuf,
+		 double scale)
+// -----------------------------------------------------------------------------
+// Loads the interior zones of one member of `f`, times `scale`, into the real
+// parts of Fx in the order of the local brick, reading them through a view of
+// the field's data. Entries past the interior are zeroed. Single-precision
+// data is widened as it is read.
+// -----------------------------------------------------------------------------
+{
+  int N[3], S[3];
+  void *x = cow_dfield_getview(f, member, N, S);
+  int single = f->precision == COW_PRECISION_SINGLE;
+  int n = 0;
+  for (int i=0; i<N[0]; ++i) {
+    for (int j=0; j<N[1]; ++j) {
+      long r = S[0]*i + S[1]*j;
+      for (int k=0; k<N[2]; ++k) {
+	double v = single ? ((float*) x)[r + k*S[2]] : ((double*) x)[r + k*S[2]];
+	Fx[n][0] = v * scale;
+	Fx[n][1] = 0.0;
+	++n;
+      }
+    }
+  }
+  for (; n<nbuf; ++n) {
+    Fx[n][0] = Fx[n][1] = 0.0;
+  }
+}
+void _storemember(cow_dfield *f, int member, FFT_DATA *Fx)
+// -----------------------------------------------------------------------------
+// Writes the real parts of Fx into the interior zones of one member of `f`,
+// rounding them to floats if it has single precision
+// -----------------------------------------------------------------------------
+{
+  int N[3], S[3];
+  void *x = cow_dfield_getview(f, member, N, S);
+  int single = f->precision == COW_PRECISION_SINGLE;
+  int n = 0;
+  for (int i=0; i<N[0]; ++i) {
+    for (int j=0; j<N[1]; ++j) {
+      long r = S[0]*i + S[1]*j;
+      for (int k=0; k<N[2]; ++k) {
+	if (single) ((float*) x)[r + k*S[2]] = Fx[n++][0];
+	else ((double*) x)[r + k*S[2]] = Fx[n++][0];
+      }
+    }
+  }
+}
+FFT_DATA *_fwd(cow_dfield *f, int member)
 {
   FFT_DATA *Fk = NULL;
   FFT_DATA *Fx = NULL;
@@ -330,26 +346,20 @@ FFT_DATA *_fwd(cow_dfield *f, double *fx, int start, int stride)
     int nbuf;
     long long ntot = cow_domain_getnumglobalzones(f->domain, COW_ALL_DIMS);
     struct fft_plan_3d *plan = call_fft_plan_3d(f->domain, &nbuf);
-    Fx = (FFT_DATA*) malloc(nbuf * sizeof(FFT_DATA));
-    Fk = (FFT_DATA*) malloc(nbuf * sizeof(FFT_DATA));
-    for (int n=0; n<nbuf; ++n) {
-      Fx[n][0] = fx[stride * n + start] / ntot;
-      Fx[n][1] = 0.0;
-    }
+    Fx = (FFT_DATA*) _mem_alloc(f->domain, nbuf * sizeof(FFT_DATA));
+    Fk = (FFT_DATA*) _mem_alloc(f->domain, nbuf * sizeof(FFT_DATA));
+    _loadmember(f, member, Fx, nbuf, 1.0 / ntot);
     fft_3d(Fx, Fk, FFT_FWD, plan);
-    free(Fx);
+    _mem_free(f->domain, Fx);
     fft_3d_destroy_plan(plan);
 #endif // COW_MPI
   }
   else {
     int nbuf = cow_domain_getnumlocalzonesinterior(f->domain, COW_ALL_DIMS);
     long long ntot = cow_domain_getnumglobalzones(f->domain, COW_ALL_DIMS);
-    Fx = (FFT_DATA*) malloc(nbuf * sizeof(FFT_DATA));
-    Fk = (FFT_DATA*) malloc(nbuf * sizeof(FFT_DATA));
-    for (int n=0; n<nbuf; ++n) {
-      Fx[n][0] = fx[stride * n + start] / ntot;
-      Fx[n][1] = 0.0;
-    }
+    Fx = (FFT_DATA*) _mem_alloc(f->domain, nbuf * sizeof(FFT_DATA));
+    Fk = (FFT_DATA*) _mem_alloc(f->domain, nbuf * sizeof(FFT_DATA));
+    _loadmember(f, member, Fx, nbuf, 1.0 / ntot);
     int *N = f->domain->L_nint;
     fftw_plan plan = fftw_plan_many_dft(3, N, 1,
 					Fx, NULL, 1, 0,
@@ -357,45 +367,37 @@ FFT_DATA *_fwd(cow_dfield *f, double *fx, int start, int stride)
 					FFTW_FORWARD, FFTW_ESTIMATE);
     fftw_execute(plan);
     fftw_destroy_plan(plan);
-    free(Fx);
+    _mem_free(f->domain, Fx);
   }
   return Fk;
 }
-double *_rev(cow_dfield *f, FFT_DATA *Fk)
+void _rev(cow_dfield *f, FFT_DATA *Fk, int member)
 {
   FFT_DATA *Fx = NULL;
-  double *fx = NULL;
   if (cow_mpirunning()) {
 #if (COW_MPI)
   int nbuf;
   struct fft_plan_3d *plan = call_fft_plan_3d(f->domain, &nbuf);
-  fx = (double*) malloc(nbuf * sizeof(double));
-  Fx = (FFT_DATA*) malloc(nbuf * sizeof(FFT_DATA));
+  Fx = (FFT_DATA*) _mem_alloc(f->domain, nbuf * sizeof(FFT_DATA));
   fft_3d(Fk, Fx, FFT_REV, plan);
-  for (int n=0; n<nbuf; ++n) {
-    fx[n] = Fx[n][0];
-  }
-  free(Fx);
+  _storemember(f, member, Fx);
+  _mem_free(f->domain, Fx);
   fft_3d_destroy_plan(plan);
 #endif // COW_MPI
   }
   else {
     int nbuf = cow_domain_getnumlocalzonesinterior(f->domain, COW_ALL_DIMS);
-    fx = (double*) malloc(nbuf * sizeof(double));
-    Fx = (FFT_DATA*) malloc(nbuf * sizeof(FFT_DATA));
+    Fx = (FFT_DATA*) _mem_alloc(f->domain, nbuf * sizeof(FFT_DATA));
     int *N = f->domain->L_nint;
     fftw_plan plan = fftw_plan_many_dft(3, N, 1,
 					Fk, NULL, 1, 0,
 					Fx, NULL, 1, 0,
 					FFTW_BACKWARD, FFTW_ESTIMATE);
     fftw_execute(plan);
-    for (int n=0; n<nbuf; ++n) {
-      fx[n] = Fx[n][0];
-    }
-    free(Fx);
+    _storemember(f, member, Fx);
+    _mem_free(f->domain, Fx);
     fftw_destroy_plan(plan);
   }
-  return fx;
 }
 
 double k_at(cow_domain *d, int i, int j, int k, double *kvec)
@@ -1,44 +1,95 @@
-
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <math.h>
 #define COW_PRIVATE_DEFS
 #include "cow.h"
 #define MODULE "hist"
 
+// -----------------------------------------------------------------------------
+// Sparse bin storage is an open-addressing hash map keyed by the linear
+// (row-major) bin index. Only populated bins occupy memory, which makes joint
+// PDFs with many dimensions affordable.
+// -----------------------------------------------------------------------------
+struct sparse_entry
+{
+  long index; // linear bin index, or -1 if the slot is empty
+  double weight;
+  double weightc; // compensation term, sparse bins are always compensated
+  long counts;
+} ;
+struct cow_histogram_sparse
+{
+  struct sparse_entry *table;
+  long capacity; // number of slots, always a power of two
+  long size; // number of populated bins
+} ;
+
 #if (COW_HDF5)
 static int H5Lexists_safe(hid_t base, char *path);
+static void _dumphdf5(cow_histogram *h, char *fn, char *gname, long offset);
 #endif
+static void _dumpascii(cow_histogram *h, char *fn, char *mode);
 static void _filloutput(cow_histogram *h);
+static void _addbin(cow_histogram *h, long n, double w);
+static int _binindex(cow_histogram *h, int dim, double x);
+static double _binval(cow_histogram *h, long n, double w, long c);
+static double _binweight(cow_histogram *h, long m);
+static struct cow_histogram_sparse *_sparse_new(long capacity);
+static void _sparse_del(struct cow_histogram_sparse *S);
+static struct sparse_entry *_sparse_find(struct cow_histogram_sparse *S,
+					 long index, int insert);
+static void _sparse_add(struct cow_histogram_sparse *S, long index, double w,
+			double wc, long c);
+static long _sparse_pack(struct cow_histogram_sparse *S,
+			 struct sparse_entry *buf);
+#if (COW_MPI)
+static void _binrange(cow_histogram *h, int rank, int size, long *start,
+		      long *stop);
+static int _binowner(cow_histogram *h, long n, int size);
+static void _dense_merge(cow_histogram *h);
+static void _dense_pack(cow_histogram *h, long n, void *b);
+static void _dense_unpack(cow_histogram *h, long m, void *b);
+static void _dense_packtotal(cow_histogram *h, void *b);
+static void _dense_unpacktotal(cow_histogram *h, void *b);
+static void _sparse_merge(cow_histogram *h);
+#endif
+static void _usecomm(cow_histogram *h, cow_domain *d);
 
 cow_histogram *cow_histogram_new()
 {
   cow_histogram *h = (cow_histogram*) malloc(sizeof(cow_histogram));
   cow_histogram hist = {
-    .nbinsx = 1,
-    .nbinsy = 1,
-    .x0 = 0.0,
-    .x1 = 1.0,
-    .y0 = 0.0,
-    .y1 = 1.0,
-    .bedgesx = NULL,
-    .bedgesy = NULL,
+    .nbins = { 1, 1, 1, 1, 1, 1 },
+    .lower = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 },
+    .upper = { 1.0, 1.0, 1.0, 1.0, 1.0, 1.0 },
+    .bedges = { NULL, NULL, NULL, NULL, NULL, NULL },
+    .nbinstot = 0,
     .weight = NULL,
+    .weightc = NULL,
+    .weightx = NULL,
     .totcounts = 0,
     .counts = NULL,
+    .sparse = NULL,
     .nickname = NULL,
     .fullname = NULL,
     .binmode = COW_HIST_BINMODE_COUNTS,
     .spacing = COW_HIST_SPACING_LINEAR,
+    .storage = COW_HIST_STORAGE_DENSE,
+    .sealmode = COW_HIST_SEAL_ALLREDUCE,
+    .summode = COW_SUM_PLAIN,
     .n_dims = 0,
     .committed = 0,
     .sealed = 0,
     .transform = NULL,
-    .binlocx = NULL,
-    .binlocy = NULL,
+    .binloc = { NULL, NULL, NULL, NULL, NULL, NULL },
     .binvalv = NULL,
+    .binindv = NULL,
+    .nbinsout = 0,
+    .binstart = 0,
+    .binstop = 0,
 #if (COW_MPI)
-    .comm = MPI_COMM_WORLD,
+    .comm = MPI_COMM_NULL,
 #endif
   } ;
   *h = hist;
@@ -49,56 +100,67 @@ cow_histogram *cow_histogram_new()
 void cow_histogram_commit(cow_histogram *h)
 {
   if (h->committed) return;
-  h->n_dims = h->nbinsy > 1 ? 2 : 1;
-  if (h->n_dims == 1) {
-    double dx = (h->x1 - h->x0) / h->nbinsx;
-    h->bedgesx = (double*) malloc((h->nbinsx+1)*sizeof(double));
-    h->weight = (double*) malloc((h->nbinsx)*sizeof(double));
-    h->counts = (long*) malloc((h->nbinsx)*sizeof(long));
-    for (int n=0; n<h->nbinsx+1; ++n) {
-      if (h->spacing == COW_HIST_SPACING_LOG) {
-        h->bedgesx[n] = h->x0 * pow(h->x1 / h->x0, (double)n / h->nbinsx);
-      }
-      else if (h->spacing == COW_HIST_SPACING_LINEAR) {
-        h->bedgesx[n] = h->x0 + n * dx;
-      }
-    }
-    for (int n=0; n<h->nbinsx; ++n) {
-      h->counts[n] = 0;
-      h->weight[n] = 0.0;
+  if (h->n_dims == 0) {
+    // -------------------------------------------------------------------------
+    // If the number of dimensions was not given explicitly, it is inferred
+    // from the last dimension having more than one bin. This keeps the
+    // original behavior, where a histogram is 2d when nbinsy > 1.
+    // -------------------------------------------------------------------------
+    h->n_dims = 1;
+    for (int d=1; d<COW_HIST_MAXDIMS; ++d) {
+      if (h->nbins[d] > 1) h->n_dims = d + 1;
     }
   }
-  else if (h->n_dims == 2) {
-    int nbins = h->nbinsx * h->nbinsy;
-    double dx = (h->y1 - h->y0) / h->nbinsx;
-    double dy = (h->y1 - h->y0) / h->nbinsy;
-    h->bedgesx = (double*) malloc((h->nbinsx+1)*sizeof(double));
-    h->bedgesy = (double*) malloc((h->nbinsy+1)*sizeof(double));
-    h->weight = (double*) malloc(nbins*sizeof(double));
-    h->counts = (long*) malloc(nbins*sizeof(long));
-    for (int n=0; n<h->nbinsx+1; ++n) {
-      if (h->spacing == COW_HIST_SPACING_LOG) {
-        h->bedgesx[n] = h->x0 * pow(h->x1/h->x0, (double)n / h->nbinsx);
-      }
-      else if (h->spacing == COW_HIST_SPACING_LINEAR) {
-        h->bedgesx[n] = h->x0 + n * dx;
-      }
-    }
-    for (int n=0; n<h->nbinsy+1; ++n) {
+  double nbinstot = 1.0;
+  for (int d=0; d<h->n_dims; ++d) {
+    nbinstot *= h->nbins[d];
+  }
+  if (nbinstot > 4e18) {
+    printf("[%s] error: too many bins (%e) for a histogram index\n", MODULE,
+	   nbinstot);
+    return;
+  }
+  h->nbinstot = 1;
+  for (int d=0; d<h->n_dims; ++d) {
+    int N = h->nbins[d];
+    double x0 = h->lower[d];
+    double x1 = h->upper[d];
+    double dx = (x1 - x0) / N;
+    h->bedges[d] = (double*) malloc((N+1)*sizeof(double));
+    for (int n=0; n<N+1; ++n) {
       if (h->spacing == COW_HIST_SPACING_LOG) {
-        h->bedgesy[n] = h->y0 * pow(h->y1/h->y0, (double)n / h->nbinsy);
+        h->bedges[d][n] = x0 * pow(x1 / x0, (double)n / N);
       }
       else if (h->spacing == COW_HIST_SPACING_LINEAR) {
-        h->bedgesy[n] = h->y0 + n * dy;
+        h->bedges[d][n] = x0 + n * dx;
       }
     }
-    for (int n=0; n<nbins; ++n) {
-      h->counts[n] = 0;
-      h->weight[n] = 0.0;
+    h->nbinstot *= N;
+  }
+  if (h->storage == COW_HIST_STORAGE_SPARSE &&
+      h->summode == COW_SUM_REPRODUCIBLE) {
+    printf("[%s] warning: reproducible summation needs dense storage, "
+	   "using compensated summation\n", MODULE);
+    h->summode = COW_SUM_COMPENSATED;
+  }
+  if (h->storage == COW_HIST_STORAGE_SPARSE) {
+    h->sparse = _sparse_new(1024);
+  }
+  else {
+    h->counts = (long*) calloc(h->nbinstot, sizeof(long));
+    switch (h->summode) {
+    case COW_SUM_COMPENSATED:
+      h->weightc = (double*) calloc(h->nbinstot, sizeof(double));
+    case COW_SUM_PLAIN:
+      h->weight = (double*) calloc(h->nbinstot, sizeof(double));
+      break;
+    case COW_SUM_REPRODUCIBLE:
+      h->weightx = (cow_exactsum*) calloc(h->nbinstot, sizeof(cow_exactsum));
+      break;
     }
   }
 #if (COW_MPI)
-  if (cow_mpirunning()) {
+  if (cow_mpirunning() && h->comm != MPI_COMM_NULL) {
     MPI_Comm_dup(h->comm, &h->comm);
   }
 #endif
@@ -107,28 +169,48 @@ void cow_histogram_commit(cow_histogram *h)
 void cow_histogram_del(cow_histogram *h)
 {
 #if (COW_MPI)
-  if (h->committed && cow_mpirunning()) {
+  if (h->committed && cow_mpirunning() && h->comm != MPI_COMM_NULL) {
     MPI_Comm_free(&h->comm);
   }
 #endif
-  free(h->bedgesx);
-  free(h->bedgesy);
+  for (int d=0; d<COW_HIST_MAXDIMS; ++d) {
+    free(h->bedges[d]);
+    free(h->binloc[d]);
+  }
+  if (h->sparse) _sparse_del(h->sparse);
   free(h->weight);
+  free(h->weightc);
+  free(h->weightx);
   free(h->counts);
   free(h->nickname);
   free(h->fullname);
-  free(h->binlocx);
-  free(h->binlocy);
   free(h->binvalv);
+  free(h->binindv);
   free(h);
 }
 void cow_histogram_setdomaincomm(cow_histogram *h, cow_domain *d)
+// -----------------------------------------------------------------------------
+// Seals the histogram over the processes of the domain `d`. Otherwise it is
+// sealed over the domain of the first field it is populated from, or else
+// over MPI_COMM_WORLD.
+// -----------------------------------------------------------------------------
 {
 #if (COW_MPI)
   if (h->committed) return;
   h->comm = d->mpi_cart;
 #endif
 }
+void _usecomm(cow_histogram *h, cow_domain *d)
+// -----------------------------------------------------------------------------
+// Gives the committed histogram a communicator of its own if it has none yet,
+// duplicated from the domain `d`, or from MPI_COMM_WORLD when `d` is NULL
+// -----------------------------------------------------------------------------
+{
+#if (COW_MPI)
+  if (!cow_mpirunning() || h->comm != MPI_COMM_NULL) return;
+  MPI_Comm_dup(d ? d->mpi_cart : MPI_COMM_WORLD, &h->comm);
+#endif
+}
 void cow_histogram_setbinmode(cow_histogram *h, int binmode)
 {
   if (h->committed || h->sealed) return;
@@ -148,34 +230,81 @@ void cow_histogram_setspacing(cow_histogram *h, int spacing)
   default: printf("[%s] error: no such spacing\n", MODULE); break;
   }
 }
+void cow_histogram_setstorage(cow_histogram *h, int storage)
+{
+  if (h->committed || h->sealed) return;
+  switch (storage) {
+  case COW_HIST_STORAGE_DENSE: h->storage = storage; break;
+  case COW_HIST_STORAGE_SPARSE: h->storage = storage; break;
+  default: printf("[%s] error: no such storage\n", MODULE); break;
+  }
+}
+void cow_histogram_setsealmode(cow_histogram *h, int sealmode)
+{
+  if (h->sealed) return;
+  switch (sealmode) {
+  case COW_HIST_SEAL_ALLREDUCE: h->sealmode = sealmode; break;
+  case COW_HIST_SEAL_REDUCE: h->sealmode = sealmode; break;
+  case COW_HIST_SEAL_SCATTER: h->sealmode = sealmode; break;
+  default: printf("[%s] error: no such seal mode\n", MODULE); break;
+  }
+}
+void cow_histogram_setsummode(cow_histogram *h, int summode)
+// -----------------------------------------------------------------------------
+// Selects how bin weights are accumulated. COW_SUM_REPRODUCIBLE gives results
+// which are bitwise identical for any number of ranks, at the cost of an
+// exact accumulator (about 600 bytes) per bin. It requires dense storage.
+// -----------------------------------------------------------------------------
+{
+  if (h->committed || h->sealed) return;
+  switch (summode) {
+  case COW_SUM_PLAIN: h->summode = summode; break;
+  case COW_SUM_COMPENSATED: h->summode = summode; break;
+  case COW_SUM_REPRODUCIBLE: h->summode = summode; break;
+  default: printf("[%s] error: no such sum mode\n", MODULE); break;
+  }
+}
+void cow_histogram_setndims(cow_histogram *h, int ndims)
+{
+  if (h->committed || h->sealed) return;
+  if (ndims < 1 || ndims > COW_HIST_MAXDIMS) {
+    printf("[%s] error: histograms may have 1 to %d dimensions\n", MODULE,
+	   COW_HIST_MAXDIMS);
+    return;
+  }
+  h->n_dims = ndims;
+}
 void cow_histogram_setnbins(cow_histogram *h, int dim, int nbins)
 {
   if (h->committed || h->sealed) return;
-  switch (dim) {
-  case 0: h->nbinsx = nbins; break;
-  case 1: h->nbinsy = nbins; break;
-  case COW_ALL_DIMS: h->nbinsx = h->nbinsy = nbins; break;
-  default: break;
+  if (dim == COW_ALL_DIMS) {
+    int N = h->n_dims ? h->n_dims : 2;
+    for (int d=0; d<N; ++d) h->nbins[d] = nbins;
+  }
+  else if (dim >= 0 && dim < COW_HIST_MAXDIMS) {
+    h->nbins[dim] = nbins;
   }
 }
 void cow_histogram_setlower(cow_histogram *h, int dim, double v0)
 {
   if (h->committed || h->sealed) return;
-  switch (dim) {
-  case 0: h->x0 = v0; break;
-  case 1: h->y0 = v0; break;
-  case COW_ALL_DIMS: h->x0 = h->y0 = v0; break;
-  default: break;
+  if (dim == COW_ALL_DIMS) {
+    int N = h->n_dims ? h->n_dims : 2;
+    for (int d=0; d<N; ++d) h->lower[d] = v0;
+  }
+  else if (dim >= 0 && dim < COW_HIST_MAXDIMS) {
+    h->lower[dim] = v0;
   }
 }
 void cow_histogram_setupper(cow_histogram *h, int dim, double v1)
 {
   if (h->committed || h->sealed) return;
-  switch (dim) {
-  case 0: h->x1 = v1; break;
-  case 1: h->y1 = v1; break;
-  case COW_ALL_DIMS: h->x1 = h->y1 = v1; break;
-  default: break;
+  if (dim == COW_ALL_DIMS) {
+    int N = h->n_dims ? h->n_dims : 2;
+    for (int d=0; d<N; ++d) h->upper[d] = v1;
+  }
+  else if (dim >= 0 && dim < COW_HIST_MAXDIMS) {
+    h->upper[dim] = v1;
   }
 }
 void cow_histogram_setfullname(cow_histogram *h, char *fullname)
@@ -188,32 +317,130 @@ void cow_histogram_setnickname(cow_histogram *h, char *nickname)
   h->nickname = (char*) realloc(h->nickname, strlen(nickname)+1);
   strcpy(h->nickname, nickname);
 }
+struct popbuffer
+{
+  cow_histogram *hist;
+  double *samples; // POPBUFFER_SIZE samples of n_dims coordinates
+  int n_samples;
+  double *row; // samples of a pencil transform, n_dims for each zone
+  cow_pencil pencil;
+  void *udata; // user data of the pencil transform
+} ;
+#define POPBUFFER_SIZE 4096
+static void _popflush(struct popbuffer *b)
+{
+  cow_histogram *h = b->hist;
+  for (int n=0; n<b->n_samples; ++n) {
+    double *y = &b->samples[n * h->n_dims];
+    if (h->n_dims == 1) {
+      cow_histogram_addsample1(h, y[0], 1.0);
+    }
+    else if (h->n_dims == 2) {
+      cow_histogram_addsample2(h, y[0], y[1], 1.0);
+    }
+    else {
+      cow_histogram_addsample(h, y, 1.0);
+    }
+  }
+  b->n_samples = 0;
+}
 static void popcb(double *result, double **args, int **s, void *u)
+// -----------------------------------------------------------------------------
+// Samples are buffered by each thread, and binned a buffer at a time, one
+// thread at a time
+// -----------------------------------------------------------------------------
 {
-  cow_histogram *h = (cow_histogram*) u;
-  double y[2];
-  h->transform(y, args, s, u);
-  if (h->n_dims == 1) {
-    cow_histogram_addsample1(h, y[0], 1.0);
+  struct popbuffer *b = (struct popbuffer*) u;
+  cow_histogram *h = b->hist;
+  double y[COW_HIST_MAXDIMS];
+  h->transform(y, args, s, h);
+  memcpy(&b->samples[b->n_samples * h->n_dims], y, h->n_dims * sizeof(double));
+  if (++b->n_samples == POPBUFFER_SIZE) {
+#if (COW_OPENMP)
+#pragma omp critical (cow_histogram_populate)
+#endif
+    _popflush(b);
   }
-  else if (h->n_dims == 2) {
-    cow_histogram_addsample2(h, y[0], y[1], 1.0);
+}
+static void poppencil(double *result, double **args, int **s, int *p,
+		      int nzones, void *u)
+{
+  struct popbuffer *b = (struct popbuffer*) u;
+  cow_histogram *h = b->hist;
+  int P[2] = { p[0], h->n_dims };
+  b->pencil(b->row, args, s, P, nzones, b->udata);
+  for (int q=0; q<nzones; ++q) {
+    memcpy(&b->samples[b->n_samples * h->n_dims], &b->row[q * h->n_dims],
+	   h->n_dims * sizeof(double));
+    if (++b->n_samples == POPBUFFER_SIZE) {
+#if (COW_OPENMP)
+#pragma omp critical (cow_histogram_populate)
+#endif
+      _popflush(b);
+    }
   }
 }
+void cow_histogram_populatepencil(cow_histogram *h, cow_dfield *f, cow_pencil op,
+				  void *udata)
+// -----------------------------------------------------------------------------
+// Like cow_histogram_populate, but `op` is a pencil transform of `f` which
+// writes the n_dims coordinates of each zone's sample, and is passed `udata`.
+// Stencil transforms of the field are binned without storing them in a field.
+// -----------------------------------------------------------------------------
+{
+  if (!h->committed || h->sealed) return;
+  _usecomm(h, f->domain);
+  int nrow = f->domain->L_nint[f->domain->n_dims-1];
+  int nt = cow_dfield_getnumthreads(f);
+  struct popbuffer *B = (struct popbuffer*) malloc(nt * sizeof(struct popbuffer));
+  void **u = (void**) malloc(nt * sizeof(void*));
+  for (int t=0; t<nt; ++t) {
+    B[t].hist = h;
+    B[t].samples = (double*) malloc(POPBUFFER_SIZE * h->n_dims * sizeof(double));
+    B[t].n_samples = 0;
+    B[t].row = (double*) malloc(nrow * h->n_dims * sizeof(double));
+    B[t].pencil = op;
+    B[t].udata = udata;
+    u[t] = &B[t];
+  }
+  cow_dfield_looppencilthreaded(f, poppencil, u);
+  for (int t=0; t<nt; ++t) {
+    _popflush(&B[t]);
+    free(B[t].samples);
+    free(B[t].row);
+  }
+  free(B);
+  free(u);
+}
 void cow_histogram_populate(cow_histogram *h, cow_dfield *f, cow_transform op)
 {
   if (!h->committed || h->sealed) return;
+  _usecomm(h, f->domain);
   h->transform = op;
-  cow_dfield_loop(f, popcb, h);
+  int nt = cow_dfield_getnumthreads(f);
+  struct popbuffer *B = (struct popbuffer*) malloc(nt * sizeof(struct popbuffer));
+  void **u = (void**) malloc(nt * sizeof(void*));
+  for (int t=0; t<nt; ++t) {
+    B[t].hist = h;
+    B[t].samples = (double*) malloc(POPBUFFER_SIZE * h->n_dims * sizeof(double));
+    B[t].n_samples = 0;
+    u[t] = &B[t];
+  }
+  cow_dfield_loopthreaded(f, popcb, u);
+  for (int t=0; t<nt; ++t) {
+    _popflush(&B[t]);
+    free(B[t].samples);
+  }
+  free(B);
+  free(u);
 }
 void cow_histogram_addsample1(cow_histogram *h, double x, double w)
 {
   if (!h->committed || h->sealed) return;
-  for (int n=0; n<h->nbinsx; ++n) {
-    if (h->bedgesx[n] - 1e-14 < x && x < h->bedgesx[n+1] + 1e-14) {
-      h->weight[n] += w;
-      h->counts[n] += 1;
-      h->totcounts += 1;
+  double *bedgesx = h->bedges[0];
+  for (int n=0; n<h->nbins[0]; ++n) {
+    if (bedgesx[n] - 1e-14 < x && x < bedgesx[n+1] + 1e-14) {
+      _addbin(h, n, w);
       return;
     }
   }
@@ -221,15 +448,17 @@ void cow_histogram_addsample1(cow_histogram *h, double x, double w)
 void cow_histogram_addsample2(cow_histogram *h, double x, double y, double w)
 {
   if (!h->committed || h->sealed) return;
+  double *bedgesx = h->bedges[0];
+  double *bedgesy = h->bedges[1];
   int nx=-1, ny=-1;
-  for (int n=0; n<h->nbinsx; ++n) {
-    if (h->bedgesx[n] < x && x < h->bedgesx[n+1]) {
+  for (int n=0; n<h->nbins[0]; ++n) {
+    if (bedgesx[n] < x && x < bedgesx[n+1]) {
       nx = n;
       break;
     }
   }
-  for (int n=0; n<h->nbinsy; ++n) {
-    if (h->bedgesy[n] < y && y < h->bedgesy[n+1]) {
+  for (int n=0; n<h->nbins[1]; ++n) {
+    if (bedgesy[n] < y && y < bedgesy[n+1]) {
       ny = n;
       break;
     }
@@ -238,22 +467,46 @@ void cow_histogram_addsample2(cow_histogram *h, double x, double y, double w)
     return;
   }
   else {
-    h->counts[nx * h->nbinsy + ny] += 1;
-    h->weight[nx * h->nbinsy + ny] += w;
-    h->totcounts += 1;
+    _addbin(h, (long) nx * h->nbins[1] + ny, w);
     return;
   }
 }
+void cow_histogram_addsample(cow_histogram *h, double *x, double w)
+// -----------------------------------------------------------------------------
+// Adds a sample at the n_dims-dimensional location `x`. Bins are located by
+// bisection, so the cost is logarithmic in the number of bins per dimension.
+// -----------------------------------------------------------------------------
+{
+  if (!h->committed || h->sealed) return;
+  long n = 0;
+  for (int d=0; d<h->n_dims; ++d) {
+    int i = _binindex(h, d, x[d]);
+    if (i == -1) return;
+    n = n * h->nbins[d] + i;
+  }
+  _addbin(h, n, w);
+}
 void cow_histogram_seal(cow_histogram *h)
+// -----------------------------------------------------------------------------
+// Synchronizes the histogram across processes. Depending on the seal mode,
+// afterwards every rank holds all the bins (COW_HIST_SEAL_ALLREDUCE), only
+// rank 0 does (COW_HIST_SEAL_REDUCE), or each rank holds a contiguous block of
+// slices along the first dimension (COW_HIST_SEAL_SCATTER). In every mode the
+// weights, counts and total counts are reduced as a single message.
+// -----------------------------------------------------------------------------
 {
   if (!h->committed || h->sealed) return;
+  _usecomm(h, NULL);
+  h->binstart = 0;
+  h->binstop = h->nbinstot;
 #if (COW_MPI)
   if (cow_mpirunning()) {
-    int nbins = h->nbinsx * h->nbinsy;
-    MPI_Comm c = h->comm;
-    MPI_Allreduce(MPI_IN_PLACE, h->weight, nbins, MPI_DOUBLE, MPI_SUM, c);
-    MPI_Allreduce(MPI_IN_PLACE, h->counts, nbins, MPI_LONG, MPI_SUM, c);
-    MPI_Allreduce(MPI_IN_PLACE, &h->totcounts, 1, MPI_LONG, MPI_SUM, c);
+    if (h->storage == COW_HIST_STORAGE_SPARSE) {
+      _sparse_merge(h);
+    }
+    else {
+      _dense_merge(h);
+    }
   }
 #endif
   h->sealed = 1;
@@ -263,68 +516,116 @@ int cow_histogram_getsealed(cow_histogram *h)
 {
   return h->sealed;
 }
+int cow_histogram_getndims(cow_histogram *h)
+{
+  return h->n_dims;
+}
 long cow_histogram_gettotalcounts(cow_histogram *h)
 {
   return h->totcounts;
 }
-void cow_histogram_getbinlocx(cow_histogram *h, double **x, int *n0)
+void cow_histogram_getbinloc(cow_histogram *h, int dim, double **x, int *n0)
 {
-  if (!(h->committed && h->sealed)) {
-    *x = NULL;
-    *n0 = 0;
+  if (!(h->committed && h->sealed) || dim < 0 || dim >= h->n_dims) {
+    if (n0) *n0 = 0;
+    if (x) *x = NULL;
+    return;
   }
-  if (n0) *n0 = h->nbinsx;
-  if (x) *x = h->binlocx;
+  if (n0) *n0 = h->nbins[dim];
+  if (x) *x = h->binloc[dim];
+}
+void cow_histogram_getbinlocx(cow_histogram *h, double **x, int *n0)
+{
+  cow_histogram_getbinloc(h, 0, x, n0);
 }
 void cow_histogram_getbinlocy(cow_histogram *h, double **x, int *n0)
 {
-  if (!(h->committed && h->sealed)) {
-    *x = NULL;
-    *n0 = 0;
-  }
-  if (n0) *n0 = h->nbinsy;
-  if (x) *x = h->binlocy;
+  cow_histogram_getbinloc(h, 1, x, n0);
 }
 void cow_histogram_getbinval1(cow_histogram *h, double **x, int *n0)
 {
-  if (!(h->committed && h->sealed)) {
-    *x = NULL;
-    *n0 = 0;
+  if (!(h->committed && h->sealed) || h->storage != COW_HIST_STORAGE_DENSE ||
+      h->binstart != 0 || h->binstop != h->nbinstot) {
+    if (n0) *n0 = 0;
+    if (x) *x = NULL;
+    return;
   }
-  if (n0) *n0 = h->nbinsx;
+  if (n0) *n0 = h->nbins[0];
   if (x) *x = h->binvalv;
 }
 void cow_histogram_getbinval2(cow_histogram *h, double **x, int *n0, int *n1)
+{
+  if (!(h->committed && h->sealed) || h->storage != COW_HIST_STORAGE_DENSE ||
+      h->binstart != 0 || h->binstop != h->nbinstot) {
+    if (n0) *n0 = 0;
+    if (n1) *n1 = 0;
+    if (x) *x = NULL;
+    return;
+  }
+  if (n0) *n0 = h->nbins[0];
+  if (n1) *n1 = h->nbins[1];
+  if (x) *x = h->binvalv;
+}
+void cow_histogram_getbinvals(cow_histogram *h, double **x, long *n0)
+// -----------------------------------------------------------------------------
+// Returns the flattened (row-major) array of bin values for dense storage. For
+// sparse storage only populated bins are returned, and their linear indices
+// are given by cow_histogram_getbinindices. With the reduce or scatter seal
+// modes, only the bins in the range given by cow_histogram_getbinrange are
+// held by this rank.
+// -----------------------------------------------------------------------------
 {
   if (!(h->committed && h->sealed)) {
-    *x = NULL;
-    *n0 = 0;
-    *n1 = 0;
+    if (n0) *n0 = 0;
+    if (x) *x = NULL;
+    return;
   }
-  if (n0) *n0 = h->nbinsx;
-  if (n1) *n1 = h->nbinsy;
+  if (n0) *n0 = h->nbinsout;
   if (x) *x = h->binvalv;
 }
+void cow_histogram_getbinindices(cow_histogram *h, long **I, long *n0)
+{
+  if (!(h->committed && h->sealed) || h->storage != COW_HIST_STORAGE_SPARSE) {
+    if (n0) *n0 = 0;
+    if (I) *I = NULL;
+    return;
+  }
+  if (n0) *n0 = h->nbinsout;
+  if (I) *I = h->binindv;
+}
+
+void cow_histogram_getbinrange(cow_histogram *h, long *start, long *stop)
+{
+  if (start) *start = h->binstart;
+  if (stop) *stop = h->binstop;
+}
 
 double cow_histogram_getbinval(cow_histogram *h, int i, int j)
+{
+  int I[2] = { i, j };
+  if (h->n_dims > 2) return 0.0;
+  if (h->n_dims == 1 && j != 0) return 0.0;
+  return cow_histogram_getbinvaln(h, I);
+}
+double cow_histogram_getbinvaln(cow_histogram *h, int *I)
 {
   if (!(h->committed && h->sealed)) {
     return 0.0;
   }
-  if (!h->committed) return 0.0;
-  if (i > h->nbinsx || j > h->nbinsy) return 0.0;
-  int c = h->counts[i*h->nbinsy + j];
-  double w = h->weight[i*h->nbinsy + j];
-  double dx = h->n_dims >= 1 ? h->bedgesx[i+1] - h->bedgesx[i] : 1.0;
-  double dy = h->n_dims >= 2 ? h->bedgesy[j+1] - h->bedgesy[j] : 1.0;
-  switch (h->binmode) {
-  case COW_HIST_BINMODE_AVERAGE:
-    return c == 0 ? 0.0 : w / c;
-  case COW_HIST_BINMODE_DENSITY:
-    return w / (dx*dy);
-  case COW_HIST_BINMODE_COUNTS:
-    return w;
-  default:
+  long n = 0;
+  for (int d=0; d<h->n_dims; ++d) {
+    if (I[d] < 0 || I[d] >= h->nbins[d]) return 0.0;
+    n = n * h->nbins[d] + I[d];
+  }
+  if (h->storage == COW_HIST_STORAGE_SPARSE) {
+    struct sparse_entry *e = _sparse_find(h->sparse, n, 0);
+    return e == NULL ? 0.0 : _binval(h, n, e->weight + e->weightc, e->counts);
+  }
+  else if (h->binstart <= n && n < h->binstop) {
+    long m = n - h->binstart;
+    return _binval(h, n, _binweight(h, m), h->counts[m]);
+  }
+  else {
     return 0.0;
   }
 }
@@ -335,50 +636,49 @@ char *cow_histogram_getname(cow_histogram *h)
 
 void cow_histogram_dumpascii(cow_histogram *h, char *fn)
 // -----------------------------------------------------------------------------
-// Dumps the histogram as ascii to the file named `fn`. Synchronizes it across
-// processes before doing so. The function uses rank 0 to do the write.
+// Dumps the histogram as ascii to the file named `fn`. It must be sealed
+// first. The function uses rank 0 to do the write, except in the scatter seal
+// mode where the ranks append their blocks in turn.
 // -----------------------------------------------------------------------------
 {
   if (!(h->committed && h->sealed)) {
     return;
   }
+  int rank = 0, size = 1;
 #if (COW_MPI)
   if (cow_mpirunning()) {
-    int rank;
     MPI_Comm_rank(h->comm, &rank);
-    if (rank != 0) {
-      return;
-    }
+    MPI_Comm_size(h->comm, &size);
   }
 #endif
-  FILE *file = fopen(fn, "w");
-  if (file == NULL) {
-    printf("[%s] could not open file %s\n", __FILE__, fn);
+  if (h->sealmode != COW_HIST_SEAL_SCATTER) {
+    if (rank == 0) {
+      _dumpascii(h, fn, "w");
+    }
     return;
   }
-  else {
-    printf("[%s] writing histogram as ASCII table to %s\n", MODULE, fn);
-  }
-  if (h->n_dims == 1) {
-    for (int n=0; n<h->nbinsx; ++n) {
-      fprintf(file, "%f %f\n", h->binlocx[n], h->binvalv[n]);
+  for (int r=0; r<size; ++r) {
+    if (r == rank) {
+      _dumpascii(h, fn, r == 0 ? "w" : "a");
     }
-  }
-  else if (h->n_dims == 2) {
-    for (int nx=0; nx<h->nbinsx; ++nx) {
-      for (int ny=0; ny<h->nbinsy; ++ny) {
-	fprintf(file, "%f %f %f\n", h->binlocx[nx], h->binlocy[ny],
-		h->binvalv[nx * h->nbinsy + ny]);
-      }
+#if (COW_MPI)
+    if (size > 1) {
+      MPI_Barrier(h->comm);
     }
+#endif
   }
-  fclose(file);
 }
 
 void cow_histogram_dumphdf5(cow_histogram *h, char *fn, char *gn)
 // -----------------------------------------------------------------------------
 // Dumps the histogram to the HDF5 file named `fn`, under the group
-// `gn`/h->fullname. The function uses rank 0 to do the write.
+// `gn`/h->fullname. The function uses rank 0 to create the group and data
+// sets and to write them, except in the scatter seal mode where the ranks
+// write their blocks in turn.
+//
+// Dense histograms are written as an n_dims-dimensional array `binval`. Sparse
+// ones write `binval` with only the populated bins, and `binindex`, an (nnz x
+// n_dims) array of their integer bin coordinates.
 // -----------------------------------------------------------------------------
 {
 #if (COW_HDF5)
@@ -386,11 +686,18 @@ void cow_histogram_dumphdf5(cow_histogram *h, char *fn, char *gn)
     return;
   }
   char gname[1024];
-  int rank = 0;
+  int rank = 0, size = 1;
+  long offset = 0, nnz = h->nbinsout;
   snprintf(gname, 1024, "%s/%s", gn, h->nickname);
 #if (COW_MPI)
   if (cow_mpirunning()) {
     MPI_Comm_rank(h->comm, &rank);
+    MPI_Comm_size(h->comm, &size);
+    if (h->sealmode == COW_HIST_SEAL_SCATTER) {
+      MPI_Exscan(&h->nbinsout, &offset, 1, MPI_LONG, MPI_SUM, h->comm);
+      MPI_Allreduce(&h->nbinsout, &nnz, 1, MPI_LONG, MPI_SUM, h->comm);
+      if (rank == 0) offset = 0;
+    }
   }
 #endif
   if (rank == 0) {
@@ -417,81 +724,677 @@ void cow_histogram_dumphdf5(cow_histogram *h, char *fn, char *gn)
     }
     hid_t gcpl = H5Pcreate(H5P_LINK_CREATE);
     H5Pset_create_intermediate_group(gcpl, 1);
-    hid_t memb = H5Gcreate(fid, gname, gcpl, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t grp = H5Gcreate(fid, gname, gcpl, H5P_DEFAULT, H5P_DEFAULT);
     H5Pclose(gcpl);
-    H5Gclose(memb);
+    // Create an attribute to name the histogram
+    // -------------------------------------------------------------------------
+    if (h->fullname != NULL) {
+      hid_t aspc = H5Screate(H5S_SCALAR);
+      hid_t strn = H5Tcopy(H5T_C_S1);
+      H5Tset_size(strn, strlen(h->fullname));
+      hid_t attr = H5Acreate(grp, "fullname", strn, aspc, H5P_DEFAULT,
+			     H5P_DEFAULT);
+      H5Awrite(attr, strn, h->fullname); // write the full name
+      H5Aclose(attr);
+      H5Tclose(strn);
+      H5Sclose(aspc);
+    }
+    // Create the data sets in the group: binloc (bin centers) and binval
+    // (values), and binindex for sparse storage
+    // -------------------------------------------------------------------------
+    const char *binlocnames[COW_HIST_MAXDIMS] = {
+      "binlocX", "binlocY", "binlocZ", "binlocU", "binlocV", "binlocW" };
+    for (int d=0; d<h->n_dims; ++d) {
+      hsize_t sizeX[1] = { h->nbins[d] };
+      hid_t fspcX = H5Screate_simple(1, sizeX, NULL);
+      hid_t dsetbinX = H5Dcreate(grp, binlocnames[d], H5T_NATIVE_DOUBLE, fspcX,
+				 H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+      H5Dwrite(dsetbinX, H5T_NATIVE_DOUBLE, fspcX, fspcX, H5P_DEFAULT,
+	       h->binloc[d]);
+      H5Dclose(dsetbinX);
+      H5Sclose(fspcX);
+    }
+    hid_t fspcZ;
+    if (h->storage == COW_HIST_STORAGE_SPARSE) {
+      hsize_t sizeI[2] = { nnz, h->n_dims };
+      hsize_t sizeZ[1] = { nnz };
+      hid_t fspcI = H5Screate_simple(2, sizeI, NULL);
+      H5Dclose(H5Dcreate(grp, "binindex", H5T_NATIVE_INT, fspcI,
+			 H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
+      H5Sclose(fspcI);
+      fspcZ = H5Screate_simple(1, sizeZ, NULL);
+    }
+    else {
+      hsize_t sizeZ[COW_HIST_MAXDIMS];
+      for (int d=0; d<h->n_dims; ++d) {
+	sizeZ[d] = h->nbins[d];
+      }
+      fspcZ = H5Screate_simple(h->n_dims, sizeZ, NULL);
+    }
+    H5Dclose(H5Dcreate(grp, "binval", H5T_NATIVE_DOUBLE, fspcZ,
+		       H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
+    H5Sclose(fspcZ);
+    H5Gclose(grp);
     H5Fclose(fid);
   }
+  if (h->sealmode != COW_HIST_SEAL_SCATTER) {
+    if (rank == 0) {
+      _dumphdf5(h, fn, gname, offset);
+    }
+    return;
+  }
+  for (int r=0; r<size; ++r) {
+#if (COW_MPI)
+    if (size > 1) {
+      MPI_Barrier(h->comm);
+    }
+#endif
+    if (r == rank) {
+      _dumphdf5(h, fn, gname, offset);
+    }
+  }
+#if (COW_MPI)
+  if (size > 1) {
+    MPI_Barrier(h->comm);
+  }
+#endif
+#endif
+}
+
+void _dumpascii(cow_histogram *h, char *fn, char *mode)
+// -----------------------------------------------------------------------------
+// Writes the bins held by this rank to the file `fn`, opened with `mode`
+// -----------------------------------------------------------------------------
+{
+  FILE *file = fopen(fn, mode);
+  if (file == NULL) {
+    printf("[%s] could not open file %s\n", __FILE__, fn);
+    return;
+  }
+  else if (mode[0] == 'w') {
+    printf("[%s] writing histogram as ASCII table to %s\n", MODULE, fn);
+  }
+  int whole = h->binstart == 0 && h->binstop == h->nbinstot;
+  if (h->n_dims == 1 && h->storage == COW_HIST_STORAGE_DENSE && whole) {
+    for (int n=0; n<h->nbins[0]; ++n) {
+      fprintf(file, "%f %f\n", h->binloc[0][n], h->binvalv[n]);
+    }
+  }
+  else if (h->n_dims == 2 && h->storage == COW_HIST_STORAGE_DENSE && whole) {
+    for (int nx=0; nx<h->nbins[0]; ++nx) {
+      for (int ny=0; ny<h->nbins[1]; ++ny) {
+	fprintf(file, "%f %f %f\n", h->binloc[0][nx], h->binloc[1][ny],
+		h->binvalv[nx * h->nbins[1] + ny]);
+      }
+    }
+  }
   else {
+    // -------------------------------------------------------------------------
+    // General case: one line per bin, with the bin center along each dimension
+    // followed by the bin value. Sparse histograms list only populated bins.
+    // -------------------------------------------------------------------------
+    for (long m=0; m<h->nbinsout; ++m) {
+      long n = h->binindv ? h->binindv[m] : h->binstart + m;
+      int I[COW_HIST_MAXDIMS];
+      for (int d=h->n_dims-1; d>=0; --d) {
+	I[d] = n % h->nbins[d];
+	n /= h->nbins[d];
+      }
+      for (int d=0; d<h->n_dims; ++d) {
+	fprintf(file, "%f ", h->binloc[d][I[d]]);
+      }
+      fprintf(file, "%f\n", h->binvalv[m]);
+    }
+  }
+  fclose(file);
+}
+#if (COW_HDF5)
+void _dumphdf5(cow_histogram *h, char *fn, char *gname, long offset)
+// -----------------------------------------------------------------------------
+// Writes the bins held by this rank into the data sets already created under
+// `gname`. Dense blocks are whole slices along the first dimension, sparse
+// ones start at entry `offset`.
+// -----------------------------------------------------------------------------
+{
+  if (h->nbinsout == 0) {
     return;
   }
-  // Create a group to represent this histogram, and an attribute to name it
-  // ---------------------------------------------------------------------------
   hid_t fid = H5Fopen(fn, H5F_ACC_RDWR, H5P_DEFAULT);
   hid_t grp = H5Gopen(fid, gname, H5P_DEFAULT);
-  if (h->fullname != NULL) {
-    hid_t aspc = H5Screate(H5S_SCALAR);
-    hid_t strn = H5Tcopy(H5T_C_S1);
-    H5Tset_size(strn, strlen(h->fullname));
-    hid_t attr = H5Acreate(grp, "fullname", strn, aspc, H5P_DEFAULT, H5P_DEFAULT);
-    H5Awrite(attr, strn, h->fullname); // write the full name
-    H5Aclose(attr);
-    H5Tclose(strn);
-    H5Sclose(aspc);
-  }
-  // Create the data sets in the group: binloc (bin centers) and binval (values)
-  // ---------------------------------------------------------------------------
-  double *binlocX = h->binlocx;
-  double *binlocY = h->binlocy;
-  double *binvalV = h->binvalv;
-  hsize_t sizeX[2] = { h->nbinsx };
-  hsize_t sizeY[2] = { h->nbinsy };
-  hsize_t sizeZ[2] = { h->nbinsx, h->nbinsy };
-  hid_t fspcZ = H5Screate_simple(h->n_dims, sizeZ, NULL);
-  if (h->n_dims >= 1) {
-    hid_t fspcX = H5Screate_simple(1, sizeX, NULL);
-    hid_t dsetbinX = H5Dcreate(grp, "binlocX", H5T_NATIVE_DOUBLE, fspcX,
-			       H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-    H5Dwrite(dsetbinX, H5T_NATIVE_DOUBLE, fspcX, fspcX, H5P_DEFAULT, binlocX);
-    H5Dclose(dsetbinX);
-    H5Sclose(fspcX);
-  }
-  if (h->n_dims >= 2) {
-    hid_t fspcY = H5Screate_simple(1, sizeY, NULL);
-    hid_t dsetbinY = H5Dcreate(grp, "binlocY", H5T_NATIVE_DOUBLE, fspcY,
-			       H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-    H5Dwrite(dsetbinY, H5T_NATIVE_DOUBLE, fspcY, fspcY, H5P_DEFAULT, binlocY);
-    H5Dclose(dsetbinY);
-    H5Sclose(fspcY);
-  }
-  hid_t dsetvalV = H5Dcreate(grp, "binval", H5T_NATIVE_DOUBLE, fspcZ,
-			     H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-  H5Dwrite(dsetvalV, H5T_NATIVE_DOUBLE, fspcZ, fspcZ, H5P_DEFAULT, binvalV);
-  H5Dclose(dsetvalV);
+  hid_t dsetvalV = H5Dopen(grp, "binval", H5P_DEFAULT);
+  hid_t fspcZ = H5Dget_space(dsetvalV);
+  hid_t mspcZ;
+  if (h->storage == COW_HIST_STORAGE_SPARSE) {
+    hsize_t startI[2] = { offset, 0 };
+    hsize_t countI[2] = { h->nbinsout, h->n_dims };
+    int *binind = (int*) malloc(h->nbinsout * h->n_dims * sizeof(int));
+    for (long m=0; m<h->nbinsout; ++m) {
+      long n = h->binindv[m];
+      for (int d=h->n_dims-1; d>=0; --d) {
+	binind[m * h->n_dims + d] = n % h->nbins[d];
+	n /= h->nbins[d];
+      }
+    }
+    hid_t dsetindI = H5Dopen(grp, "binindex", H5P_DEFAULT);
+    hid_t fspcI = H5Dget_space(dsetindI);
+    hid_t mspcI = H5Screate_simple(2, countI, NULL);
+    H5Sselect_hyperslab(fspcI, H5S_SELECT_SET, startI, NULL, countI, NULL);
+    H5Dwrite(dsetindI, H5T_NATIVE_INT, mspcI, fspcI, H5P_DEFAULT, binind);
+    H5Sclose(mspcI);
+    H5Sclose(fspcI);
+    H5Dclose(dsetindI);
+    free(binind);
+    hsize_t startZ[1] = { offset };
+    hsize_t countZ[1] = { h->nbinsout };
+    mspcZ = H5Screate_simple(1, countZ, NULL);
+    H5Sselect_hyperslab(fspcZ, H5S_SELECT_SET, startZ, NULL, countZ, NULL);
+  }
+  else {
+    long slice = h->nbinstot / h->nbins[0];
+    hsize_t startZ[COW_HIST_MAXDIMS] = { h->binstart / slice };
+    hsize_t countZ[COW_HIST_MAXDIMS] = { h->nbinsout / slice };
+    for (int d=1; d<h->n_dims; ++d) {
+      startZ[d] = 0;
+      countZ[d] = h->nbins[d];
+    }
+    mspcZ = H5Screate_simple(h->n_dims, countZ, NULL);
+    H5Sselect_hyperslab(fspcZ, H5S_SELECT_SET, startZ, NULL, countZ, NULL);
+  }
+  H5Dwrite(dsetvalV, H5T_NATIVE_DOUBLE, mspcZ, fspcZ, H5P_DEFAULT, h->binvalv);
+  H5Sclose(mspcZ);
   H5Sclose(fspcZ);
+  H5Dclose(dsetvalV);
   H5Gclose(grp);
   H5Fclose(fid);
+}
 #endif
+void _filloutput(cow_histogram *h)
+{
+  for (int d=0; d<h->n_dims; ++d) {
+    double *bedges = h->bedges[d];
+    h->binloc[d] = (double*) realloc(h->binloc[d], h->nbins[d]*sizeof(double));
+    for (int i=0; i<h->nbins[d]; ++i) {
+      h->binloc[d][i] = 0.5*(bedges[i] + bedges[i+1]);
+    }
+  }
+  if (h->storage == COW_HIST_STORAGE_SPARSE) {
+    long N = h->sparse->size;
+    struct sparse_entry *entries = (struct sparse_entry*)
+      malloc(N * sizeof(struct sparse_entry));
+    _sparse_pack(h->sparse, entries);
+    h->nbinsout = N;
+    h->binindv = (long*) realloc(h->binindv, N * sizeof(long));
+    h->binvalv = (double*) realloc(h->binvalv, N * sizeof(double));
+    for (long m=0; m<N; ++m) {
+      struct sparse_entry *e = &entries[m];
+      h->binindv[m] = e->index;
+      h->binvalv[m] = _binval(h, e->index, e->weight + e->weightc,
+			      e->counts);
+    }
+    free(entries);
+  }
+  else {
+    long N = h->binstop - h->binstart;
+    h->nbinsout = N;
+    h->binvalv = (double*) realloc(h->binvalv, N * sizeof(double));
+    for (long m=0; m<N; ++m) {
+      h->binvalv[m] = _binval(h, h->binstart + m, _binweight(h, m),
+			      h->counts[m]);
+    }
+  }
+}
+void _addbin(cow_histogram *h, long n, double w)
+{
+  if (h->storage == COW_HIST_STORAGE_SPARSE) {
+    _sparse_add(h->sparse, n, w, 0.0, 1);
+  }
+  else {
+    switch (h->summode) {
+    case COW_SUM_PLAIN: h->weight[n] += w; break;
+    case COW_SUM_COMPENSATED: _sum_kahanadd(&h->weight[n], &h->weightc[n], w);
+      break;
+    case COW_SUM_REPRODUCIBLE: _sum_exactadd(&h->weightx[n], w); break;
+    }
+    h->counts[n] += 1;
+  }
+  h->totcounts += 1;
+}
+double _binweight(cow_histogram *h, long m)
+// -----------------------------------------------------------------------------
+// Total weight of the m-th dense bin held by this rank
+// -----------------------------------------------------------------------------
+{
+  switch (h->summode) {
+  case COW_SUM_COMPENSATED: return h->weight[m] + h->weightc[m];
+  case COW_SUM_REPRODUCIBLE: return _sum_exactvalue(&h->weightx[m]);
+  default: return h->weight[m];
+  }
+}
+int _binindex(cow_histogram *h, int dim, double x)
+// -----------------------------------------------------------------------------
+// Returns the bin n for which bedges[n] <= x < bedges[n+1], or -1 if x is out
+// of range (or nan). The upper edge of the last bin is included in that bin.
+// -----------------------------------------------------------------------------
+{
+  double *e = h->bedges[dim];
+  int lo = 0, hi = h->nbins[dim];
+  if (!(e[lo] <= x && x <= e[hi])) return -1;
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    if (x < e[mid]) hi = mid;
+    else lo = mid;
+  }
+  return lo;
+}
+double _binval(cow_histogram *h, long n, double w, long c)
+{
+  double dV = 1.0;
+  for (int d=h->n_dims-1; d>=0; --d) {
+    int i = n % h->nbins[d];
+    n /= h->nbins[d];
+    dV *= h->bedges[d][i+1] - h->bedges[d][i];
+  }
+  switch (h->binmode) {
+  case COW_HIST_BINMODE_AVERAGE:
+    return c == 0 ? 0.0 : w / c;
+  case COW_HIST_BINMODE_DENSITY:
+    return w / dV;
+  case COW_HIST_BINMODE_COUNTS:
+    return w;
+  default:
+    return 0.0;
+  }
 }
 
-void _filloutput(cow_histogram *h)
+struct cow_histogram_sparse *_sparse_new(long capacity)
 {
-  int nbins = h->nbinsx * h->nbinsy;
-  h->binlocx = (double*) realloc(h->binlocx, h->nbinsx * sizeof(double));
-  h->binlocy = (double*) realloc(h->binlocy, h->nbinsy * sizeof(double));
-  h->binvalv = (double*) realloc(h->binvalv, nbins * sizeof(double));
-  if (h->n_dims >= 1) for (int i=0; i<h->nbinsx; ++i) {
-      h->binlocx[i] = 0.5*(h->bedgesx[i] + h->bedgesx[i+1]);
+  struct cow_histogram_sparse *S = (struct cow_histogram_sparse*)
+    malloc(sizeof(struct cow_histogram_sparse));
+  S->capacity = 16;
+  while (S->capacity < capacity) S->capacity *= 2;
+  S->size = 0;
+  S->table = (struct sparse_entry*)
+    malloc(S->capacity * sizeof(struct sparse_entry));
+  for (long m=0; m<S->capacity; ++m) {
+    S->table[m].index = -1;
+  }
+  return S;
+}
+void _sparse_del(struct cow_histogram_sparse *S)
+{
+  free(S->table);
+  free(S);
+}
+struct sparse_entry *_sparse_find(struct cow_histogram_sparse *S, long index,
+				  int insert)
+// -----------------------------------------------------------------------------
+// Linear probing from a Fibonacci hash of the bin index. Returns the entry for
+// `index`, creating it (with zero weight and counts) if `insert` is true, or
+// NULL if it is absent and `insert` is false.
+// -----------------------------------------------------------------------------
+{
+  if (insert && 2 * (S->size + 1) > S->capacity) {
+    struct sparse_entry *old = S->table;
+    long oldcap = S->capacity;
+    S->capacity *= 2;
+    S->size = 0;
+    S->table = (struct sparse_entry*)
+      malloc(S->capacity * sizeof(struct sparse_entry));
+    for (long m=0; m<S->capacity; ++m) {
+      S->table[m].index = -1;
+    }
+    for (long m=0; m<oldcap; ++m) {
+      if (old[m].index != -1) {
+	*_sparse_find(S, old[m].index, 1) = old[m];
+      }
+    }
+    free(old);
+  }
+  unsigned long long z = (unsigned long long) index * 0x9E3779B97F4A7C15ULL;
+  long m = (long) ((z ^ (z >> 29)) & (S->capacity - 1));
+  while (S->table[m].index != -1) {
+    if (S->table[m].index == index) return &S->table[m];
+    m = (m + 1) & (S->capacity - 1);
+  }
+  if (!insert) return NULL;
+  S->table[m].index = index;
+  S->table[m].weight = 0.0;
+  S->table[m].weightc = 0.0;
+  S->table[m].counts = 0;
+  S->size += 1;
+  return &S->table[m];
+}
+void _sparse_add(struct cow_histogram_sparse *S, long index, double w,
+		 double wc, long c)
+{
+  struct sparse_entry *e = _sparse_find(S, index, 1);
+  _sum_kahanadd(&e->weight, &e->weightc, w);
+  e->weightc += wc;
+  e->counts += c;
+}
+static int _sparse_cmp(const void *a, const void *b)
+{
+  long ia = ((const struct sparse_entry*) a)->index;
+  long ib = ((const struct sparse_entry*) b)->index;
+  return (ia > ib) - (ia < ib);
+}
+long _sparse_pack(struct cow_histogram_sparse *S, struct sparse_entry *buf)
+// -----------------------------------------------------------------------------
+// Copies the populated entries into `buf`, sorted by bin index
+// -----------------------------------------------------------------------------
+{
+  long n = 0;
+  for (long m=0; m<S->capacity; ++m) {
+    if (S->table[m].index != -1) {
+      buf[n++] = S->table[m];
+    }
+  }
+  qsort(buf, n, sizeof(struct sparse_entry), _sparse_cmp);
+  return n;
+}
+
+#if (COW_MPI)
+void _binrange(cow_histogram *h, int rank, int size, long *start, long *stop)
+// -----------------------------------------------------------------------------
+// The block of linear bin indices owned by `rank` in the scatter seal mode. It
+// is made of whole slices along the first dimension, so that it maps onto an
+// HDF5 hyperslab.
+// -----------------------------------------------------------------------------
+{
+  long slice = h->nbinstot / h->nbins[0];
+  *start = slice * ((long) h->nbins[0] * rank / size);
+  *stop = slice * ((long) h->nbins[0] * (rank + 1) / size);
+}
+int _binowner(cow_histogram *h, long n, int size)
+{
+  if (h->sealmode == COW_HIST_SEAL_SCATTER) {
+    long i = n / (h->nbinstot / h->nbins[0]);
+    return (int) (((i + 1) * size - 1) / h->nbins[0]);
+  }
+  else {
+    return (int) (n % size);
+  }
+}
+void _dense_merge(cow_histogram *h)
+// -----------------------------------------------------------------------------
+// Each bin is packed as `per` elements, its weight followed by its count, and
+// the total counts follow the last bin. The weights, counts and total are then
+// reduced as a single message. Plain sums use doubles (counts are exact up to
+// 2^53), compensated sums use (sum, correction) pairs combined by a two-sum,
+// and reproducible sums add the integer limbs of the exact accumulators.
+// -----------------------------------------------------------------------------
+{
+  MPI_Comm c = h->comm;
+  int rank, size;
+  MPI_Comm_rank(c, &rank);
+  MPI_Comm_size(c, &size);
+  MPI_Datatype type = MPI_DOUBLE;
+  MPI_Op op = MPI_SUM;
+  int per = 2;
+  size_t esize = sizeof(double);
+  switch (h->summode) {
+  case COW_SUM_COMPENSATED:
+    _sum_kahanmpi(&type, &op);
+    esize = 2 * sizeof(double);
+    break;
+  case COW_SUM_REPRODUCIBLE:
+    type = MPI_INT64_T;
+    per = sizeof(cow_exactsum) / sizeof(int64_t) + 1;
+    esize = sizeof(int64_t);
+    break;
+  }
+  long N = h->nbinstot;
+  char *buf = (char*) malloc((per*N + 1) * esize);
+  char *res = buf;
+  for (long n=0; n<N; ++n) {
+    _dense_pack(h, n, buf + n*per*esize);
+  }
+  _dense_packtotal(h, buf + N*per*esize);
+
+  switch (h->sealmode) {
+  case COW_HIST_SEAL_ALLREDUCE:
+    MPI_Allreduce(MPI_IN_PLACE, buf, per*N + 1, type, op, c);
+    break;
+  case COW_HIST_SEAL_REDUCE:
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : buf, buf, per*N + 1, type, op, 0, c);
+    if (rank != 0) {
+      h->binstop = 0;
+      h->totcounts = 0;
+      _dense_packtotal(h, buf);
+    }
+    break;
+  case COW_HIST_SEAL_SCATTER:
+    {
+      int *rcounts = (int*) malloc(size * sizeof(int));
+      for (int r=0; r<size; ++r) {
+	long start, stop;
+	_binrange(h, r, size, &start, &stop);
+	rcounts[r] = per*(stop - start) + (r == size - 1);
+      }
+      _binrange(h, rank, size, &h->binstart, &h->binstop);
+      res = (char*) malloc((rcounts[rank] + 1) * esize);
+      MPI_Reduce_scatter(buf, res, rcounts, type, op, c);
+      // the total counts land on the last rank, which shares them
+      MPI_Bcast(res + per*(h->binstop - h->binstart)*esize, 1, type,
+		size - 1, c);
+      free(rcounts);
+    }
+    break;
+  }
+  long nloc = h->binstop - h->binstart;
+  h->counts = (long*) realloc(h->counts, nloc * sizeof(long));
+  switch (h->summode) {
+  case COW_SUM_COMPENSATED:
+    h->weightc = (double*) realloc(h->weightc, nloc * sizeof(double));
+  case COW_SUM_PLAIN:
+    h->weight = (double*) realloc(h->weight, nloc * sizeof(double));
+    break;
+  case COW_SUM_REPRODUCIBLE:
+    h->weightx = (cow_exactsum*) realloc(h->weightx,
+					 nloc * sizeof(cow_exactsum));
+    break;
+  }
+  for (long m=0; m<nloc; ++m) {
+    _dense_unpack(h, m, res + m*per*esize);
+  }
+  _dense_unpacktotal(h, res + nloc*per*esize);
+  if (res != buf) free(res);
+  free(buf);
+  if (h->summode == COW_SUM_COMPENSATED) {
+    MPI_Type_free(&type);
+    MPI_Op_free(&op);
+  }
+}
+void _dense_pack(cow_histogram *h, long n, void *b)
+{
+  double *d = (double*) b;
+  int64_t *q = (int64_t*) b;
+  switch (h->summode) {
+  case COW_SUM_PLAIN:
+    d[0] = h->weight[n];
+    d[1] = h->counts[n];
+    break;
+  case COW_SUM_COMPENSATED:
+    d[0] = h->weight[n];
+    d[1] = h->weightc[n];
+    d[2] = h->counts[n];
+    d[3] = 0.0;
+    break;
+  case COW_SUM_REPRODUCIBLE:
+    _sum_exactnorm(&h->weightx[n]);
+    memcpy(q, &h->weightx[n], sizeof(cow_exactsum));
+    q[sizeof(cow_exactsum) / sizeof(int64_t)] = h->counts[n];
+    break;
+  }
+}
+void _dense_unpack(cow_histogram *h, long m, void *b)
+{
+  double *d = (double*) b;
+  int64_t *q = (int64_t*) b;
+  switch (h->summode) {
+  case COW_SUM_PLAIN:
+    h->weight[m] = d[0];
+    h->counts[m] = d[1];
+    break;
+  case COW_SUM_COMPENSATED:
+    h->weight[m] = d[0];
+    h->weightc[m] = d[1];
+    h->counts[m] = d[2] + d[3];
+    break;
+  case COW_SUM_REPRODUCIBLE:
+    memcpy(&h->weightx[m], q, sizeof(cow_exactsum));
+    _sum_exactnorm(&h->weightx[m]);
+    h->counts[m] = q[sizeof(cow_exactsum) / sizeof(int64_t)];
+    break;
+  }
+}
+void _dense_packtotal(cow_histogram *h, void *b)
+{
+  if (h->summode == COW_SUM_REPRODUCIBLE) {
+    ((int64_t*) b)[0] = h->totcounts;
+  }
+  else {
+    ((double*) b)[0] = h->totcounts;
+    if (h->summode == COW_SUM_COMPENSATED) ((double*) b)[1] = 0.0;
+  }
+}
+void _dense_unpacktotal(cow_histogram *h, void *b)
+{
+  if (h->summode == COW_SUM_REPRODUCIBLE) {
+    h->totcounts = ((int64_t*) b)[0];
+  }
+  else if (h->summode == COW_SUM_COMPENSATED) {
+    h->totcounts = ((double*) b)[0] + ((double*) b)[1];
+  }
+  else {
+    h->totcounts = ((double*) b)[0];
+  }
+}
+void _sparse_merge(cow_histogram *h)
+// -----------------------------------------------------------------------------
+// Merge-on-seal for sparse storage. Every populated bin is sent to the rank
+// owning its index, which sums the duplicates. The merged and now unique bins
+// are then gathered to all ranks, to rank 0, or are left where they are,
+// depending on the seal mode. Only populated bins ever go over the wire.
+// -----------------------------------------------------------------------------
+{
+  MPI_Comm c = h->comm;
+  int rank, size;
+  MPI_Comm_rank(c, &rank);
+  MPI_Comm_size(c, &size);
+
+  int blen[4] = { 1, 1, 1, 1 };
+  MPI_Aint disp[4] = { offsetof(struct sparse_entry, index),
+		       offsetof(struct sparse_entry, weight),
+		       offsetof(struct sparse_entry, weightc),
+		       offsetof(struct sparse_entry, counts) };
+  MPI_Datatype types[4] = { MPI_LONG, MPI_DOUBLE, MPI_DOUBLE, MPI_LONG };
+  MPI_Datatype tmp, entry;
+  MPI_Type_create_struct(4, blen, disp, types, &tmp);
+  MPI_Type_create_resized(tmp, 0, sizeof(struct sparse_entry), &entry);
+  MPI_Type_commit(&entry);
+  MPI_Type_free(&tmp);
+
+  long nloc = h->sparse->size;
+  struct sparse_entry *local = (struct sparse_entry*)
+    malloc(nloc * sizeof(struct sparse_entry));
+  struct sparse_entry *sendbuf = (struct sparse_entry*)
+    malloc(nloc * sizeof(struct sparse_entry));
+  int *scounts = (int*) calloc(size, sizeof(int));
+  int *sdispls = (int*) calloc(size, sizeof(int));
+  int *rcounts = (int*) calloc(size, sizeof(int));
+  int *rdispls = (int*) calloc(size, sizeof(int));
+  _sparse_pack(h->sparse, local);
+  for (long m=0; m<nloc; ++m) {
+    scounts[_binowner(h, local[m].index, size)] += 1;
+  }
+  for (int r=1; r<size; ++r) {
+    sdispls[r] = sdispls[r-1] + scounts[r-1];
+  }
+  int *fill = (int*) calloc(size, sizeof(int));
+  for (long m=0; m<nloc; ++m) {
+    int r = _binowner(h, local[m].index, size);
+    sendbuf[sdispls[r] + fill[r]++] = local[m];
+  }
+  free(fill);
+  free(local);
+  MPI_Alltoall(scounts, 1, MPI_INT, rcounts, 1, MPI_INT, c);
+  for (int r=1; r<size; ++r) {
+    rdispls[r] = rdispls[r-1] + rcounts[r-1];
+  }
+  int nrecv = rdispls[size-1] + rcounts[size-1];
+  struct sparse_entry *recvbuf = (struct sparse_entry*)
+    malloc(nrecv * sizeof(struct sparse_entry));
+  MPI_Alltoallv(sendbuf, scounts, sdispls, entry,
+		recvbuf, rcounts, rdispls, entry, c);
+  free(sendbuf);
+
+  // Merge the bins this rank owns, then gather the merged bins if needed
+  // ---------------------------------------------------------------------------
+  struct cow_histogram_sparse *M = _sparse_new(2 * nrecv);
+  for (int m=0; m<nrecv; ++m) {
+    struct sparse_entry *e = &recvbuf[m];
+    _sparse_add(M, e->index, e->weight, e->weightc, e->counts);
+  }
+  free(recvbuf);
+  int nown = M->size;
+  struct sparse_entry *owned = (struct sparse_entry*)
+    malloc(nown * sizeof(struct sparse_entry));
+  _sparse_pack(M, owned);
+  _sparse_del(M);
+
+  int nall = nown;
+  struct sparse_entry *all = owned;
+  switch (h->sealmode) {
+  case COW_HIST_SEAL_ALLREDUCE:
+  case COW_HIST_SEAL_REDUCE:
+    if (h->sealmode == COW_HIST_SEAL_ALLREDUCE) {
+      MPI_Allgather(&nown, 1, MPI_INT, rcounts, 1, MPI_INT, c);
     }
-  if (h->n_dims >= 2) for (int j=0; j<h->nbinsy; ++j) {
-      h->binlocy[j] = 0.5*(h->bedgesy[j] + h->bedgesy[j+1]);
+    else {
+      MPI_Gather(&nown, 1, MPI_INT, rcounts, 1, MPI_INT, 0, c);
+    }
+    rdispls[0] = 0;
+    for (int r=1; r<size; ++r) {
+      rdispls[r] = rdispls[r-1] + rcounts[r-1];
+    }
+    nall = rdispls[size-1] + rcounts[size-1];
+    all = (struct sparse_entry*) malloc(nall * sizeof(struct sparse_entry));
+    if (h->sealmode == COW_HIST_SEAL_ALLREDUCE) {
+      MPI_Allgatherv(owned, nown, entry, all, rcounts, rdispls, entry, c);
     }
-  for (int i=0; i<h->nbinsx; ++i) {
-    for (int j=0; j<h->nbinsy; ++j) {
-      h->binvalv[i*h->nbinsy + j] = cow_histogram_getbinval(h, i, j);
+    else {
+      MPI_Gatherv(owned, nown, entry, all, rcounts, rdispls, entry, 0, c);
+      if (rank != 0) {
+	nall = 0;
+	h->binstop = 0;
+      }
     }
+    free(owned);
+    break;
+  case COW_HIST_SEAL_SCATTER:
+    _binrange(h, rank, size, &h->binstart, &h->binstop);
+    break;
   }
+
+  _sparse_del(h->sparse);
+  h->sparse = _sparse_new(2 * nall);
+  h->totcounts = 0;
+  for (int m=0; m<nall; ++m) {
+    *_sparse_find(h->sparse, all[m].index, 1) = all[m];
+    h->totcounts += all[m].counts;
+  }
+  if (h->sealmode == COW_HIST_SEAL_SCATTER) {
+    MPI_Allreduce(MPI_IN_PLACE, &h->totcounts, 1, MPI_LONG, MPI_SUM, c);
+  }
+  free(all);
+  free(scounts);
+  free(sdispls);
+  free(rcounts);
+  free(rdispls);
+  MPI_Type_free(&entry);
 }
+#endif
 
 #if (COW_HDF5)
 int H5Lexists_safe(hid_t base, char *path)
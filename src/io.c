@@ -175,6 +175,7 @@ void cow_dfield_read(cow_dfield *f, char *fname)
 #if (COW_HDF5)
   if (_io_check_file_exists(fname)) return;
   clock_t start = clock();
+  cow_dfield_syncguard_end(f);
   _io_read(f, fname);
   cow_dfield_syncguard(f);
   double sec = (double)(clock() - start) / CLOCKS_PER_SEC;
@@ -183,6 +184,26 @@ void cow_dfield_read(cow_dfield *f, char *fname)
   fflush(stdout);
 #endif
 }
+void cow_dfield_readmany(cow_dfield **fs, int n, char *fname)
+// -----------------------------------------------------------------------------
+// Reads several fields from the same file, and synchronizes their guard zones
+// together with cow_dfield_syncguard_many
+// -----------------------------------------------------------------------------
+{
+#if (COW_HDF5)
+  if (_io_check_file_exists(fname)) return;
+  clock_t start = clock();
+  for (int q=0; q<n; ++q) {
+    cow_dfield_syncguard_end(fs[q]);
+    _io_read(fs[q], fname);
+  }
+  cow_dfield_syncguard_many(fs, n);
+  double sec = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("[%s] read %d fields from %s took %f minutes\n", MODULE, n, fname,
+	 sec/60.0);
+  fflush(stdout);
+#endif
+}
 
 
 void _io_write(cow_dfield *f, char *fname)
@@ -229,6 +250,14 @@ void _io_write(cow_dfield *f, char *fname)
   l_nint[ndp1 - 1] = 1;
   l_ntot[ndp1 - 1] = n_memb;
   stride[ndp1 - 1] = n_memb;
+  // planar members are each read or written from their own array in memory
+  int planar = f->layout == COW_LAYOUT_PLANAR;
+  hsize_t mdims = planar ? n_dims : ndp1;
+  // single-precision fields are kept as float32 in memory and in the file, so
+  // HDF5 converts only if the file holds another type
+  hid_t mtype = f->precision == COW_PRECISION_SINGLE ?
+    H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
+  size_t msize = _dfield_elemsize(f);
 
   // The loop over processors is needed if COW_MPI support is enabled and
   // COW_HDF5_MPI is not. If either COW_MPI is disabled, or COW_HDF5_MPI is
@@ -240,15 +269,16 @@ void _io_write(cow_dfield *f, char *fname)
 #endif
       hid_t file = H5Fopen(fname, H5F_ACC_RDWR, d->fapl);
       hid_t memb = H5Gopen(file, gname, H5P_DEFAULT);
-      hid_t mspc = H5Screate_simple(ndp1, l_ntot, NULL);
+      hid_t mspc = H5Screate_simple(mdims, l_ntot, NULL);
       hid_t fspc = H5Screate_simple(n_dims, G_ntot, NULL);
       for (int n=0; n<n_memb; ++n) {
-	int dset = H5Dcreate(memb, pnames[n], H5T_NATIVE_DOUBLE, fspc,
-			     H5P_DEFAULT, d->dcpl, H5P_DEFAULT);
+	hid_t dset = H5Dcreate(memb, pnames[n], mtype, fspc,
+			       H5P_DEFAULT, d->dcpl, H5P_DEFAULT);
+	char *x = (char*) data + (planar ? n * f->stride[3] * msize : 0);
 	l_strt[ndp1 - 1] = n;
 	H5Sselect_hyperslab(mspc, H5S_SELECT_SET, l_strt, stride, l_nint, NULL);
 	H5Sselect_hyperslab(fspc, H5S_SELECT_SET, G_strt, NULL, L_nint, NULL);
-	H5Dwrite(dset, H5T_NATIVE_DOUBLE, mspc, fspc, d->dxpl, data);
+	H5Dwrite(dset, mtype, mspc, fspc, d->dxpl, x);
 	H5Dclose(dset);
       }
       H5Sclose(fspc);
@@ -293,6 +323,14 @@ void _io_read(cow_dfield *f, char *fname)
   l_nint[ndp1 - 1] = 1;
   l_ntot[ndp1 - 1] = n_memb;
   stride[ndp1 - 1] = n_memb;
+  // planar members are each read or written from their own array in memory
+  int planar = f->layout == COW_LAYOUT_PLANAR;
+  hsize_t mdims = planar ? n_dims : ndp1;
+  // single-precision fields are kept as float32 in memory and in the file, so
+  // HDF5 converts only if the file holds another type
+  hid_t mtype = f->precision == COW_PRECISION_SINGLE ?
+    H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
+  size_t msize = _dfield_elemsize(f);
 
   // The loop over processors is needed if COW_MPI support is enabled and
   // COW_HDF5_MPI is not. If either COW_MPI is disabled, or COW_HDF5_MPI is
@@ -304,14 +342,15 @@ void _io_read(cow_dfield *f, char *fname)
 #endif
       hid_t file = H5Fopen(fname, H5F_ACC_RDONLY, d->fapl);
       hid_t memb = H5Gopen(file, gname, H5P_DEFAULT);
-      hid_t mspc = H5Screate_simple(ndp1, l_ntot, NULL);
+      hid_t mspc = H5Screate_simple(mdims, l_ntot, NULL);
       hid_t fspc = H5Screate_simple(n_dims, G_ntot, NULL);
       for (int n=0; n<n_memb; ++n) {
 	hid_t dset = H5Dopen(memb, pnames[n], H5P_DEFAULT);
+	char *x = (char*) data + (planar ? n * f->stride[3] * msize : 0);
 	l_strt[ndp1 - 1] = n;
 	H5Sselect_hyperslab(mspc, H5S_SELECT_SET, l_strt, stride, l_nint, NULL);
 	H5Sselect_hyperslab(fspc, H5S_SELECT_SET, G_strt, NULL, L_nint, NULL);
-	H5Dread(dset, H5T_NATIVE_DOUBLE, mspc, fspc, d->dxpl, data);
+	H5Dread(dset, mtype, mspc, fspc, d->dxpl, x);
 	H5Dclose(dset);
       }
       H5Sclose(fspc);
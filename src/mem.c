@@ -0,0 +1,217 @@
+#define _DEFAULT_SOURCE // for madvise
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+#define COW_PRIVATE_DEFS
+#include "cow.h"
+#define MODULE "memory"
+
+// -----------------------------------------------------------------------------
+//
+// Allocator for dfield data and the large temporaries of the FFT and sampling
+// routines
+//
+// Every block carries a header recording its rounded size and the allocator
+// flags of the domain it came from. All blocks count against a per-process
+// budget, which is checked before any memory is requested from the system, so
+// that a run which does not fit is stopped at its first oversized allocation
+// rather than being killed by the OS partway through. With COW_ALLOC_POOL,
+// blocks freed back to a domain are kept on its pool and handed out again to
+// requests of the same rounded size. They remain counted as in use until the
+// pool is released.
+//
+// -----------------------------------------------------------------------------
+
+#define BLOCK_HEADER 64 // keeps the returned pointer cache-line aligned
+#define PAGE_BYTES 4096
+#define HUGEPAGE_BYTES (2 << 20)
+
+struct cow_block
+{
+  size_t bytes; // total size of the block, including this header
+  int flags; // allocator flags in effect when the block was made
+  struct cow_block *next; // next free block on the domain pool
+} ;
+
+static long long _budget = 0; // zero means no limit
+static long long _inuse = 0;
+static long long _highwater = 0;
+
+static void *_block_data(struct cow_block *b)
+{
+  return (char*) b + BLOCK_HEADER;
+}
+static struct cow_block *_block_head(void *p)
+{
+  return (struct cow_block*) ((char*) p - BLOCK_HEADER);
+}
+
+void cow_memory_setbudget(long long bytes)
+// -----------------------------------------------------------------------------
+// Limits the memory this process may hold in fields and temporaries to `bytes`,
+// or removes the limit if `bytes` is zero. Allocations exceeding the budget are
+// fatal.
+// -----------------------------------------------------------------------------
+{
+  _budget = bytes > 0 ? bytes : 0;
+}
+long long cow_memory_getbudget(void)
+{
+  return _budget;
+}
+long long cow_memory_getinuse(void)
+// -----------------------------------------------------------------------------
+// Bytes currently held by this process, including blocks kept on domain pools
+// -----------------------------------------------------------------------------
+{
+  return _inuse;
+}
+long long cow_memory_gethighwater(void)
+// -----------------------------------------------------------------------------
+// Largest value of cow_memory_getinuse since startup or the last reset
+// -----------------------------------------------------------------------------
+{
+  return _highwater;
+}
+void cow_memory_resethighwater(void)
+{
+  _highwater = _inuse;
+}
+
+void cow_domain_setallocator(cow_domain *d, int flags)
+// -----------------------------------------------------------------------------
+// Chooses how the data of fields on `d` and their temporaries are allocated:
+//
+// COW_ALLOC_POOL:       keep freed blocks on `d` and reuse them
+// COW_ALLOC_HUGEPAGES:  align blocks to 2MB and advise the kernel to back them
+//                       with transparent huge pages
+// COW_ALLOC_FIRSTTOUCH: zero field data with the threads that will loop over
+//                       it, so that its pages are placed on their NUMA node
+//
+// Blocks already allocated keep the flags they were made with. Clearing
+// COW_ALLOC_POOL releases the pool.
+// -----------------------------------------------------------------------------
+{
+  d->allocator = flags;
+  if (!(flags & COW_ALLOC_POOL)) {
+    cow_domain_releasepool(d);
+  }
+}
+int cow_domain_getallocator(cow_domain *d)
+{
+  return d->allocator;
+}
+void cow_domain_releasepool(cow_domain *d)
+// -----------------------------------------------------------------------------
+// Returns the blocks held on the pool of `d` to the system
+// -----------------------------------------------------------------------------
+{
+#if (COW_OPENMP)
+#pragma omp critical (cow_memory)
+#endif
+  {
+    while (d->pool != NULL) {
+      struct cow_block *b = d->pool;
+      d->pool = b->next;
+      _inuse -= b->bytes;
+      free(b);
+    }
+  }
+}
+
+void *_mem_alloc(cow_domain *d, size_t bytes)
+// -----------------------------------------------------------------------------
+// Allocates `bytes` with the flags of `d`, which may be NULL for the defaults.
+// The memory is uninitialized.
+// -----------------------------------------------------------------------------
+{
+  int flags = d ? d->allocator : 0;
+  size_t align = (flags & COW_ALLOC_HUGEPAGES) ? HUGEPAGE_BYTES : PAGE_BYTES;
+  size_t total = (bytes + BLOCK_HEADER + align - 1) / align * align;
+  struct cow_block *b = NULL;
+  long long over = 0;
+
+#if (COW_OPENMP)
+#pragma omp critical (cow_memory)
+#endif
+  {
+    if (flags & COW_ALLOC_POOL) {
+      for (struct cow_block **p = &d->pool; *p != NULL; p = &(*p)->next) {
+	if ((*p)->bytes == total && (*p)->flags == flags) {
+	  b = *p;
+	  *p = b->next;
+	  break;
+	}
+      }
+    }
+    if (b == NULL) {
+      if (_budget && _inuse + (long long) total > _budget) {
+	over = 1;
+      }
+      else {
+	_inuse += total;
+	if (_inuse > _highwater) _highwater = _inuse;
+      }
+    }
+  }
+  if (over) {
+    fprintf(stderr, "[%s] error: allocating %zu bytes would exceed the budget "
+	    "of %lld (%lld in use, high-water %lld)\n", MODULE, total, _budget,
+	    _inuse, _highwater);
+#if (COW_MPI)
+    if (cow_mpirunning()) MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
+    exit(1);
+  }
+  if (b != NULL) {
+    return _block_data(b);
+  }
+  void *p = NULL;
+  if (posix_memalign(&p, (flags & COW_ALLOC_HUGEPAGES) ? align : BLOCK_HEADER,
+		     total)) {
+    fprintf(stderr, "[%s] error: out of memory allocating %zu bytes\n",
+	    MODULE, total);
+#if (COW_MPI)
+    if (cow_mpirunning()) MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
+    exit(1);
+  }
+#if defined(MADV_HUGEPAGE)
+  if (flags & COW_ALLOC_HUGEPAGES) {
+    madvise(p, total, MADV_HUGEPAGE);
+  }
+#endif
+  b = (struct cow_block*) p;
+  b->bytes = total;
+  b->flags = flags;
+  b->next = NULL;
+  return _block_data(b);
+}
+void _mem_free(cow_domain *d, void *p)
+// -----------------------------------------------------------------------------
+// Frees a block from _mem_alloc, or keeps it on the pool of `d` if it was
+// allocated for pooling
+// -----------------------------------------------------------------------------
+{
+  if (p == NULL) return;
+  struct cow_block *b = _block_head(p);
+  int pool = d != NULL && (b->flags & COW_ALLOC_POOL) &&
+    (d->allocator & COW_ALLOC_POOL);
+#if (COW_OPENMP)
+#pragma omp critical (cow_memory)
+#endif
+  {
+    if (pool) {
+      b->next = d->pool;
+      d->pool = b;
+    }
+    else {
+      _inuse -= b->bytes;
+    }
+  }
+  if (!pool) {
+    free(b);
+  }
+}
@@ -11,41 +11,6 @@
 #define GETENVINT(a,dflt) (getenv(a) ? atoi(getenv(a)) : dflt)
 #define GETENVDBL(a,dflt) (getenv(a) ? atof(getenv(a)) : dflt)
 
-static void divcorner(double *result, double **args, int **s, void *u)
-{
-#define M(i,j,k) ((i)*s[0][0] + (j)*s[0][1] + (k)*s[0][2])
-  double *fx = &args[0][0];
-  double *fy = &args[0][1];
-  double *fz = &args[0][2];
-  *result = ((fx[M(1,0,0)] + fx[M(1,1,0)] + fx[M(1,0,1)] + fx[M(1,1,1)]) -
-             (fx[M(0,0,0)] + fx[M(0,1,0)] + fx[M(0,0,1)] + fx[M(0,1,1)])) / 4.0
-    +       ((fy[M(0,1,0)] + fy[M(0,1,1)] + fy[M(1,1,0)] + fy[M(1,1,1)]) -
-             (fy[M(0,0,0)] + fy[M(0,0,1)] + fy[M(1,0,0)] + fy[M(1,0,1)])) / 4.0
-    +       ((fz[M(0,0,1)] + fz[M(1,0,1)] + fz[M(0,1,1)] + fz[M(1,1,1)]) -
-             (fz[M(0,0,0)] + fz[M(1,0,0)] + fz[M(0,1,0)] + fz[M(1,1,0)])) / 4.0;
-#undef M
-}
-static void div5(double *result, double **args, int **s, void *u)
-{
-#define diff5(f,s) ((-f[2*s] + 8*f[s] - 8*f[-s] + f[-2*s]) / 12.0)
-  double *f0 = &args[0][0];
-  double *f1 = &args[0][1];
-  double *f2 = &args[0][2];
-  *result = diff5(f0, s[0][0]) + diff5(f1, s[0][1]) + diff5(f2, s[0][2]);
-#undef diff5
-}
-static void curl(double *result, double **args, int **s, void *u)
-{
-  // http://en.wikipedia.org/wiki/Five-point_stencil
-#define diff5(f,s) ((-f[2*s] + 8*f[s] - 8*f[-s] + f[-2*s]) / 12.0)
-  double *f0 = &args[0][0];
-  double *f1 = &args[0][1];
-  double *f2 = &args[0][2];
-  result[0] = diff5(f2, s[0][1]) - diff5(f1, s[0][2]);
-  result[1] = diff5(f0, s[0][2]) - diff5(f2, s[0][0]);
-  result[2] = diff5(f1, s[0][0]) - diff5(f0, s[0][1]);
-#undef diff5
-}
 static void crossprod(double *result, double **args, int **s, void *u)
 {
   double a0 = args[0][0];
@@ -118,17 +83,6 @@ cow_dfield *cow_scalarfield(cow_domain *domain, char *name)
   return f;
 }
 
-void cow_dfield_transform(cow_dfield *f, cow_dfield **args, int narg,
-			  cow_transform op, void *userdata)
-{
-  cow_dfield_clearargs(f);
-  for (int n=0; n<narg; ++n) {
-    cow_dfield_pusharg(f, args[n]);
-  }
-  cow_dfield_settransform(f, op);
-  cow_dfield_setuserdata(f, userdata);
-  cow_dfield_transformexecute(f);
-}
 void cow_dfield_reduce2(cow_dfield *f, cow_transform op, double reduc[3])
 {
   cow_dfield_clearargs(f);
@@ -211,37 +165,61 @@ int main(int argc, char **argv)
   cow_dfield_commit(mag);
   cow_dfield_commit(rho);
   cow_dfield_commit(pre);
-  cow_dfield_read(vel, finp);
-  cow_dfield_read(mag, finp);
-  cow_dfield_read(rho, finp);
-  cow_dfield_read(pre, finp);
+  cow_dfield *fields[4] = { vel, mag, rho, pre };
+  cow_dfield_readmany(fields, 4, finp);
 
   if (derivfields) {
     cow_dfield *divB = cow_scalarfield(domain, "divB");
     cow_dfield *divV = cow_scalarfield(domain, "divV");
     cow_dfield *curlB = cow_vectorfield(domain, "curlB");
     cow_dfield *curlV = cow_vectorfield(domain, "curlV");
-    cow_dfield *vcrossB = cow_vectorfield(domain, "vcrossB");
     cow_dfield *curlBdotvcrossB = cow_scalarfield(domain, "curlBdotvcrossB");
     cow_dfield *curlBdotB = cow_scalarfield(domain, "curlBdotB");
-    cow_dfield *vcrossBcrossB = cow_vectorfield(domain, "vcrossBcrossB");
     cow_dfield *divvcrossBcrossB = cow_scalarfield(domain, "divvcrossBcrossB");
 
-    cow_dfield_transform(divB, &mag, 1, divcorner, NULL);
-    cow_dfield_transform(divV, &vel, 1, div5, NULL);
-    cow_dfield_transform(curlB, &mag, 1, curl, NULL);
-    cow_dfield_transform(curlV, &vel, 1, curl, NULL);
+    // -------------------------------------------------------------------------
+    // The derived fields are evaluated as one pipeline. The cross products
+    // never exist as full fields, except v x B x B, which the divergence
+    // needs. It is synchronized before a second sweep computes its divergence.
+    // -------------------------------------------------------------------------
+    cow_pipeline *pipe = cow_pipeline_new(domain);
+    int nv = cow_pipeline_addinput(pipe, vel);
+    int nB = cow_pipeline_addinput(pipe, mag);
+    int ndivB = cow_pipeline_addpencilstage(pipe, cow_deriv_divcorner, &nB, 1,
+					    1, 1, domain);
+    int ndivV = cow_pipeline_addpencilstage(pipe, cow_deriv_div5, &nv, 1, 1, 2,
+					    domain);
+    int ncurlB = cow_pipeline_addpencilstage(pipe, cow_deriv_rot5, &nB, 1, 3, 2,
+					     domain);
+    int ncurlV = cow_pipeline_addpencilstage(pipe, cow_deriv_rot5, &nv, 1, 3, 2,
+					     domain);
 
-    struct cow_dfield *vcrossBargs[2] = { vel, mag };
-    struct cow_dfield *vcrossBcrossBargs[2] = { vel, vcrossB };
-    struct cow_dfield *curlBdotBargs[2] = { curlB, mag };
-    struct cow_dfield *curlBdotvcrossBargs[2] = { curlB, vcrossB };
+    int vcrossBargs[2] = { nv, nB };
+    int nvcrossB = cow_pipeline_addstage(pipe, crossprod, vcrossBargs, 2, 3, 0,
+					 NULL);
+    int vcrossBcrossBargs[2] = { nv, nvcrossB };
+    int curlBdotBargs[2] = { ncurlB, nB };
+    int curlBdotvcrossBargs[2] = { ncurlB, nvcrossB };
+    int nvcrossBcrossB = cow_pipeline_addstage(pipe, crossprod,
+					       vcrossBcrossBargs, 2, 3, 0, NULL);
+    int ncurlBdotvcrossB = cow_pipeline_addstage(pipe, dotprod,
+						 curlBdotvcrossBargs, 2, 1, 0,
+						 NULL);
+    int ncurlBdotB = cow_pipeline_addstage(pipe, dotprod, curlBdotBargs, 2, 1,
+					   0, NULL);
+    int ndivvcrossBcrossB = cow_pipeline_addpencilstage(pipe, cow_deriv_div5,
+							&nvcrossBcrossB, 1, 1,
+							2, domain);
 
-    cow_dfield_transform(vcrossB, vcrossBargs, 2, crossprod, NULL);
-    cow_dfield_transform(vcrossBcrossB, vcrossBcrossBargs, 2, crossprod, NULL);
-    cow_dfield_transform(curlBdotvcrossB, curlBdotvcrossBargs, 2, dotprod, NULL);
-    cow_dfield_transform(curlBdotB, curlBdotBargs, 2, dotprod, NULL);
-    cow_dfield_transform(divvcrossBcrossB, &vcrossBcrossB, 1, div5, NULL);
+    cow_pipeline_setoutput(pipe, ndivB, divB);
+    cow_pipeline_setoutput(pipe, ndivV, divV);
+    cow_pipeline_setoutput(pipe, ncurlB, curlB);
+    cow_pipeline_setoutput(pipe, ncurlV, curlV);
+    cow_pipeline_setoutput(pipe, ncurlBdotvcrossB, curlBdotvcrossB);
+    cow_pipeline_setoutput(pipe, ncurlBdotB, curlBdotB);
+    cow_pipeline_setoutput(pipe, ndivvcrossBcrossB, divvcrossBcrossB);
+    cow_pipeline_execute(pipe);
+    cow_pipeline_del(pipe);
 
     make_hist(divB, take_elem0, fout, NULL);
     make_hist(divV, take_elem0, fout, NULL);
@@ -256,10 +234,8 @@ int main(int argc, char **argv)
     cow_dfield_del(divV);
     cow_dfield_del(curlB);
     cow_dfield_del(curlV);
-    cow_dfield_del(vcrossB);
     cow_dfield_del(curlBdotvcrossB);
     cow_dfield_del(curlBdotB);
-    cow_dfield_del(vcrossBcrossB);
     cow_dfield_del(divvcrossBcrossB);
   }
 
@@ -268,10 +244,20 @@ int main(int argc, char **argv)
     cow_dfield *magE = cow_scalarfield(domain, "magE");
     cow_dfield *intE = cow_scalarfield(domain, "intE");
 
-    struct cow_dfield *kinEargs[2] = { rho, vel };
-    cow_dfield_transform(kinE, kinEargs, 2, kinEtrans, NULL);
-    cow_dfield_transform(magE, &mag, 1, magEtrans, NULL);
-    cow_dfield_transform(intE, &pre, 1, take_elem0, NULL);
+    cow_pipeline *pipe = cow_pipeline_new(domain);
+    int nrho = cow_pipeline_addinput(pipe, rho);
+    int nv = cow_pipeline_addinput(pipe, vel);
+    int nB = cow_pipeline_addinput(pipe, mag);
+    int npre = cow_pipeline_addinput(pipe, pre);
+    int kinEargs[2] = { nrho, nv };
+    int nkinE = cow_pipeline_addstage(pipe, kinEtrans, kinEargs, 2, 1, 0, NULL);
+    int nmagE = cow_pipeline_addstage(pipe, magEtrans, &nB, 1, 1, 0, NULL);
+    int nintE = cow_pipeline_addstage(pipe, take_elem0, &npre, 1, 1, 0, NULL);
+    cow_pipeline_setoutput(pipe, nkinE, kinE);
+    cow_pipeline_setoutput(pipe, nmagE, magE);
+    cow_pipeline_setoutput(pipe, nintE, intE);
+    cow_pipeline_execute(pipe);
+    cow_pipeline_del(pipe);
 
     make_hist(kinE, take_elem0, fout, NULL);
     make_hist(magE, take_elem0, fout, NULL);
@@ -13,7 +13,7 @@
 */
 
 
-#if (COW_FFTW && COW_MPI)
+#if (COW_MPI)
 #include "pack_3d.h"
 
 #if !defined(PACK_POINTER) && !defined(PACK_MEMCPY)
@@ -739,5 +739,5 @@ void unpack_3d_permute2_n(double *buf, double *data, struct pack_plan_3d *plan)
 
 #else
 void __pack_3d_stub() { }
-#endif // (COW_FFTW && COW_MPI)
+#endif // (COW_MPI)
 
@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <string.h>
+#define COW_PRIVATE_DEFS
+#include "cow.h"
+#define MODULE "pipeline"
+
+// -----------------------------------------------------------------------------
+//
+// Fused transform pipelines
+//
+// A pipeline is a graph of transform stages over a single domain. Each node is
+// either an input (an existing data field), or a stage which applies a
+// cow_transform to earlier nodes. Stages are evaluated together in as few grid
+// sweeps as possible. The interior is visited in tiles of `tilesize` zones, and
+// every stage of the sweep is applied to a tile before moving on, so that
+// pointwise intermediates only ever occupy a tile-sized buffer.
+//
+// A stage which reads neighboring zones of its arguments declares it with
+// `stencil` > 0, the number of guard zones it needs. Stage results consumed by
+// a stencil are materialized as full data fields and have their guard zones
+// synchronized to the deepest stencil reading them, which ends the sweep. Every
+// other intermediate stays in its tile buffer, unless an output field is
+// attached to it. Pointwise stages
+// (stencil = 0) must not read neighboring zones; the strides they are passed
+// for tile-resident arguments are zero.
+//
+// Stages may also be pencil kernels (cow_pencil), which are called on the
+// parts of a tile lying in a single row of zones along the last dimension.
+// Tile-resident arguments of a pencil stage are contiguous, their pencil
+// stride is their number of members. Stages with planar output fields are
+// computed into a tile buffer too, which is then moved into the field.
+//
+// Single-precision fields which are read are widened to double a tile at a
+// time, with the zones around it within reach of the stencils reading them.
+// Single-precision outputs are computed into a tile buffer, and rounded into
+// the field.
+//
+// -----------------------------------------------------------------------------
+
+static int _pipeline_compile(cow_pipeline *p);
+static void _pipeline_sweep(cow_pipeline *p, int phase);
+static void _pencilsweep(cow_pipeline *p, struct cow_pipeline_node *node,
+			 int phase, long z0, long z1, int **S, int *P,
+			 double **x);
+static void _tilescatter(cow_pipeline *p, struct cow_pipeline_node *node,
+			 long z0, long z1, double *tile);
+static void _tilebox(cow_pipeline *p, long z0, long z1, int lo[3], int hi[3]);
+static void _stageargs(cow_pipeline *p, struct cow_pipeline_node *node,
+		       int phase, long z, long z0, int **S, int *P, double **x);
+static int _node_new(cow_pipeline *p);
+static int _node_reach(cow_pipeline *p, int n);
+static int _stage_new(cow_pipeline *p, int *args, int nargs, int nmembers,
+		      int stencil, void *udata);
+
+#define ISINPUT(node) ((node)->op == NULL && (node)->pencil == NULL)
+#define FROMTILE(node, phase) ((node)->tile != NULL && \
+			       ((node)->field == NULL || (node)->phase == (phase)))
+
+cow_pipeline *cow_pipeline_new(cow_domain *d)
+{
+  cow_pipeline *p = (cow_pipeline*) malloc(sizeof(cow_pipeline));
+  cow_pipeline pipe = {
+    .domain = d,
+    .nodes = NULL,
+    .n_nodes = 0,
+    .n_phases = 0,
+    .tilesize = 4096,
+  } ;
+  *p = pipe;
+  return p;
+}
+void cow_pipeline_del(cow_pipeline *p)
+{
+  for (int n=0; n<p->n_nodes; ++n) {
+    free(p->nodes[n].args);
+  }
+  free(p->nodes);
+  free(p);
+}
+void cow_pipeline_settilesize(cow_pipeline *p, int zones)
+{
+  if (zones < 1) {
+    printf("[%s] error: tile size must be positive\n", MODULE);
+    return;
+  }
+  p->tilesize = zones;
+}
+int cow_pipeline_addinput(cow_pipeline *p, cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Adds an existing data field to the pipeline, returning its node. Stencil
+// stages read its guard zones, so they must be valid before execution.
+// -----------------------------------------------------------------------------
+{
+  if (f->domain != p->domain || !f->committed) {
+    printf("[%s] error: input field %s must be committed on the pipeline's "
+	   "domain\n", MODULE, f->name);
+    return -1;
+  }
+  int n = _node_new(p);
+  p->nodes[n].field = f;
+  p->nodes[n].n_members = f->n_members;
+  return n;
+}
+int cow_pipeline_addstage(cow_pipeline *p, cow_transform op, int *args,
+			  int nargs, int nmembers, int stencil, void *udata)
+// -----------------------------------------------------------------------------
+// Adds a stage computing `nmembers` values per zone by applying `op` to the
+// nodes `args`, which must already be in the pipeline. Returns its node.
+// -----------------------------------------------------------------------------
+{
+  int n = _stage_new(p, args, nargs, nmembers, stencil, udata);
+  if (n >= 0) p->nodes[n].op = op;
+  return n;
+}
+int cow_pipeline_addpencilstage(cow_pipeline *p, cow_pencil op, int *args,
+				int nargs, int nmembers, int stencil,
+				void *udata)
+// -----------------------------------------------------------------------------
+// Like cow_pipeline_addstage, but `op` is evaluated on rows of zones
+// -----------------------------------------------------------------------------
+{
+  int n = _stage_new(p, args, nargs, nmembers, stencil, udata);
+  if (n >= 0) p->nodes[n].pencil = op;
+  return n;
+}
+void cow_pipeline_setoutput(cow_pipeline *p, int node, cow_dfield *f)
+// -----------------------------------------------------------------------------
+// Writes the values of `node` into the field `f` when the pipeline executes,
+// and synchronizes its guard zones.
+// -----------------------------------------------------------------------------
+{
+  if (node < 0 || node >= p->n_nodes || ISINPUT(&p->nodes[node])) {
+    printf("[%s] error: only stages may be given an output field\n", MODULE);
+    return;
+  }
+  if (f->domain != p->domain || !f->committed ||
+      f->n_members != p->nodes[node].n_members) {
+    printf("[%s] error: output field %s must be committed on the pipeline's "
+	   "domain with %d members\n", MODULE, f->name,
+	   p->nodes[node].n_members);
+    return;
+  }
+  p->nodes[node].field = f;
+}
+void cow_pipeline_execute(cow_pipeline *p)
+{
+  if (_pipeline_compile(p)) return;
+  for (int n=0; n<p->n_nodes; ++n) {
+    if (p->nodes[n].field) {
+      cow_dfield_syncguard_end(p->nodes[n].field);
+    }
+  }
+  for (int n=0; n<p->n_nodes; ++n) {
+    if (ISINPUT(&p->nodes[n])) {
+      _dfield_requireguard(p->nodes[n].field, COW_ALL_DIMS, _node_reach(p, n));
+    }
+  }
+  cow_dfield **sync = (cow_dfield**) malloc(p->n_nodes * sizeof(cow_dfield*));
+  for (int phase=0; phase<p->n_phases; ++phase) {
+    // the fields written in this phase exchange their guard zones together:
+    // outputs entirely, intermediates as deep as the stencils reading them
+    int nsync = 0;
+    _pipeline_sweep(p, phase);
+    for (int n=0; n<p->n_nodes; ++n) {
+      struct cow_pipeline_node *node = &p->nodes[n];
+      if (!ISINPUT(node) && node->phase == phase && node->field &&
+	  !node->ownsfield) {
+	sync[nsync++] = node->field;
+      }
+    }
+    cow_dfield_syncguard_many(sync, nsync);
+    for (int depth=1; depth<=cow_domain_getguard(p->domain); ++depth) {
+      nsync = 0;
+      for (int n=0; n<p->n_nodes; ++n) {
+	struct cow_pipeline_node *node = &p->nodes[n];
+	if (!ISINPUT(node) && node->phase == phase && node->ownsfield &&
+	    _node_reach(p, n) == depth) {
+	  sync[nsync++] = node->field;
+	}
+      }
+      _dfield_syncguardmany(sync, nsync, COW_ALL_DIMS, depth);
+    }
+  }
+  free(sync);
+  for (int n=0; n<p->n_nodes; ++n) {
+    struct cow_pipeline_node *node = &p->nodes[n];
+    if (node->ownsfield) {
+      cow_dfield_del(node->field);
+      node->field = NULL;
+      node->ownsfield = 0;
+    }
+    free(node->tile);
+    node->tile = NULL;
+    _mem_free(p->domain, node->wide);
+    node->wide = NULL;
+  }
+}
+
+int _node_new(cow_pipeline *p)
+{
+  struct cow_pipeline_node node = {
+    .op = NULL,
+    .pencil = NULL,
+    .udata = NULL,
+    .args = NULL,
+    .nargs = 0,
+    .n_members = 0,
+    .stencil = 0,
+    .phase = 0,
+    .field = NULL,
+    .ownsfield = 0,
+    .tile = NULL,
+    .wide = NULL,
+  } ;
+  p->nodes = (struct cow_pipeline_node*)
+    realloc(p->nodes, (p->n_nodes + 1) * sizeof(struct cow_pipeline_node));
+  p->nodes[p->n_nodes] = node;
+  return p->n_nodes++;
+}
+int _node_reach(cow_pipeline *p, int n)
+// -----------------------------------------------------------------------------
+// The deepest stencil of the stages reading node n, the guard zones it needs
+// -----------------------------------------------------------------------------
+{
+  int reach = 0;
+  for (int m=n+1; m<p->n_nodes; ++m) {
+    struct cow_pipeline_node *node = &p->nodes[m];
+    for (int a=0; a<node->nargs; ++a) {
+      if (node->args[a] == n && node->stencil > reach) reach = node->stencil;
+    }
+  }
+  return reach;
+}
+int _stage_new(cow_pipeline *p, int *args, int nargs, int nmembers,
+	       int stencil, void *udata)
+{
+  for (int a=0; a<nargs; ++a) {
+    if (args[a] < 0 || args[a] >= p->n_nodes) {
+      printf("[%s] error: stage argument %d is not a node\n", MODULE, args[a]);
+      return -1;
+    }
+  }
+  if (stencil > cow_domain_getguard(p->domain)) {
+    printf("[%s] error: stencil of %d zones exceeds the domain guard\n",
+	   MODULE, stencil);
+    return -1;
+  }
+  int n = _node_new(p);
+  struct cow_pipeline_node *node = &p->nodes[n];
+  node->udata = udata;
+  node->n_members = nmembers;
+  node->stencil = stencil;
+  node->nargs = nargs;
+  node->args = (int*) malloc(nargs * sizeof(int));
+  memcpy(node->args, args, nargs * sizeof(int));
+  return n;
+}
+int _pipeline_compile(cow_pipeline *p)
+// -----------------------------------------------------------------------------
+// Assigns each stage to a sweep (phase), and decides which stage results are
+// materialized. A stage runs in the sweep after any stage whose result it
+// reads with a stencil. A stage result lives only in a tile buffer unless it
+// has an output field, is read with a stencil, or is read in a later sweep.
+// -----------------------------------------------------------------------------
+{
+  p->n_phases = 0;
+  for (int n=0; n<p->n_nodes; ++n) {
+    struct cow_pipeline_node *node = &p->nodes[n];
+    if (ISINPUT(node)) continue;
+    node->phase = 0;
+    for (int a=0; a<node->nargs; ++a) {
+      struct cow_pipeline_node *arg = &p->nodes[node->args[a]];
+      if (ISINPUT(arg)) continue;
+      int phase = arg->phase + (node->stencil > 0);
+      if (phase > node->phase) node->phase = phase;
+    }
+    if (node->phase + 1 > p->n_phases) p->n_phases = node->phase + 1;
+  }
+  for (int n=0; n<p->n_nodes; ++n) {
+    struct cow_pipeline_node *node = &p->nodes[n];
+    for (int a=0; a<node->nargs; ++a) {
+      struct cow_pipeline_node *arg = &p->nodes[node->args[a]];
+      if (ISINPUT(arg) || arg->field != NULL) continue;
+      if (node->stencil > 0 || node->phase > arg->phase) {
+	cow_dfield *f = cow_dfield_new();
+	char name[64];
+	snprintf(name, 64, "pipeline-%d", node->args[a]);
+	cow_dfield_setdomain(f, p->domain);
+	cow_dfield_setname(f, name);
+	for (int m=0; m<arg->n_members; ++m) {
+	  snprintf(name, 64, "%d", m);
+	  cow_dfield_addmember(f, name);
+	}
+	cow_dfield_commit(f);
+	arg->field = f;
+	arg->ownsfield = 1;
+      }
+    }
+  }
+  cow_domain *d = p->domain;
+  // the box of zones a tile spans, in which views of single-precision fields
+  // are widened
+  int tile[3] = { 0, d->L_nint[1], d->L_nint[2] };
+  tile[0] = p->tilesize / ((long) d->L_nint[1] * d->L_nint[2]) + 2;
+  if (tile[0] > d->L_nint[0]) tile[0] = d->L_nint[0];
+  for (int n=0; n<p->n_nodes; ++n) {
+    struct cow_pipeline_node *node = &p->nodes[n];
+    cow_dfield *f = node->field;
+    int single = f && f->precision == COW_PRECISION_SINGLE;
+    if (!ISINPUT(node) && (f == NULL || f->layout == COW_LAYOUT_PLANAR ||
+			   single)) {
+      node->tile = (double*)
+	malloc(p->tilesize * node->n_members * sizeof(double));
+    }
+    int read = 0;
+    for (int m=n+1; m<p->n_nodes; ++m) {
+      for (int a=0; a<p->nodes[m].nargs; ++a) {
+	if (p->nodes[m].args[a] == n) read = 1;
+      }
+    }
+    if (single && read) {
+      _wide_init(&node->view, f, tile, _node_reach(p, n));
+      node->wide = (double*) _mem_alloc(d, node->view.size * sizeof(double));
+    }
+  }
+  return 0;
+}
+void _pipeline_sweep(cow_pipeline *p, int phase)
+// -----------------------------------------------------------------------------
+// Applies the stages of `phase` to the interior, one tile at a time. Zones are
+// numbered lexicographically over the interior, and a tile is a range of them.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = p->domain;
+  int ng = d->n_ghst;
+  int ni = d->L_nint[0];
+  int nj = d->L_nint[1];
+  int nk = d->L_nint[2];
+  long ntot = (long) ni * nj * nk;
+  int maxargs = 0;
+  for (int n=0; n<p->n_nodes; ++n) {
+    if (p->nodes[n].nargs > maxargs) maxargs = p->nodes[n].nargs;
+  }
+  int **S = (int**) malloc(maxargs * sizeof(int*));
+  int *P = (int*) malloc((maxargs + 1) * sizeof(int));
+  double **x = (double**) malloc(maxargs * sizeof(double*));
+  int *widen = (int*) calloc(p->n_nodes, sizeof(int));
+  for (int n=0; n<p->n_nodes; ++n) {
+    struct cow_pipeline_node *node = &p->nodes[n];
+    if (ISINPUT(node) || node->phase != phase) continue;
+    for (int a=0; a<node->nargs; ++a) {
+      struct cow_pipeline_node *arg = &p->nodes[node->args[a]];
+      if (arg->wide && !FROMTILE(arg, phase)) widen[node->args[a]] = 1;
+    }
+  }
+
+  for (long z0=0; z0<ntot; z0+=p->tilesize) {
+    long z1 = z0 + p->tilesize < ntot ? z0 + p->tilesize : ntot;
+    int lo[3], hi[3];
+    _tilebox(p, z0, z1, lo, hi);
+    for (int n=0; n<p->n_nodes; ++n) {
+      struct cow_pipeline_node *node = &p->nodes[n];
+      if (widen[n]) {
+	_wide_box(&node->view, node->field, lo, hi, node->wide);
+	_wide_load(&node->view, node->field);
+      }
+    }
+    for (int n=0; n<p->n_nodes; ++n) {
+      struct cow_pipeline_node *node = &p->nodes[n];
+      if (ISINPUT(node) || node->phase != phase) continue;
+      if (node->pencil) {
+	_pencilsweep(p, node, phase, z0, z1, S, P, x);
+	continue;
+      }
+      int i = z0 / ((long) nj * nk);
+      int j = (z0 / nk) % nj;
+      int k = z0 % nk;
+      for (long z=z0; z<z1; ++z) {
+	_stageargs(p, node, phase, z, z0, S, P, x);
+	double *result;
+	if (node->tile == NULL) {
+	  int *s = node->field->stride;
+	  result = (double*) node->field->data +
+	    (s[0]*(i+ng) + s[1]*(j+ng) + s[2]*(k+ng));
+	}
+	else {
+	  result = node->tile + (z - z0) * node->n_members;
+	}
+	node->op(result, x, S, node->udata);
+	if (node->tile && node->field) {
+	  _tilescatter(p, node, z, z + 1, result);
+	}
+	if (++k == nk) {
+	  k = 0;
+	  if (++j == nj) {
+	    j = 0;
+	    ++i;
+	  }
+	}
+      }
+    }
+  }
+  free(S);
+  free(P);
+  free(x);
+  free(widen);
+}
+void _pencilsweep(cow_pipeline *p, struct cow_pipeline_node *node, int phase,
+		  long z0, long z1, int **S, int *P, double **x)
+// -----------------------------------------------------------------------------
+// Applies a pencil stage to the zones [z0, z1) of a tile, one row at a time.
+// The last dimension varies fastest in the zone numbering, so rows are
+// contiguous ranges of zones.
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = p->domain;
+  int pdim = d->n_dims - 1;
+  int ng = d->n_ghst;
+  int nj = d->L_nint[1];
+  int nk = d->L_nint[2];
+  long row = d->L_nint[pdim];
+  P[node->nargs] = node->tile ? node->n_members : node->field->stride[pdim];
+  for (long z=z0; z<z1; ) {
+    long zend = (z / row + 1) * row;
+    if (zend > z1) zend = z1;
+    int i = z / ((long) nj * nk);
+    int j = (z / nk) % nj;
+    int k = z % nk;
+    _stageargs(p, node, phase, z, z0, S, P, x);
+    double *result;
+    if (node->tile == NULL) {
+      int *s = node->field->stride;
+      result = (double*) node->field->data +
+	(s[0]*(i+ng) + s[1]*(j+ng) + s[2]*(k+ng));
+    }
+    else {
+      result = node->tile + (z - z0) * node->n_members;
+    }
+    node->pencil(result, x, S, P, zend - z, node->udata);
+    if (node->tile && node->field) {
+      _tilescatter(p, node, z, zend, result);
+    }
+    z = zend;
+  }
+}
+void _tilescatter(cow_pipeline *p, struct cow_pipeline_node *node, long z0,
+		  long z1, double *tile)
+// -----------------------------------------------------------------------------
+// Moves the values of zones [z0, z1), held with their members adjacent from
+// `tile` on, into the planar or single-precision output field of `node`
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = p->domain;
+  cow_dfield *f = node->field;
+  int *s = f->stride;
+  int ng = d->n_ghst;
+  int nj = d->L_nint[1];
+  int nk = d->L_nint[2];
+  int nm = node->n_members;
+  for (long z=z0; z<z1; ++z) {
+    int i = z / ((long) nj * nk);
+    int j = (z / nk) % nj;
+    int k = z % nk;
+    long y = s[0]*(i+ng) + s[1]*(j+ng) + s[2]*(k+ng);
+    for (int m=0; m<nm; ++m) {
+      _dfield_store(f, y + m*s[3], tile[(z - z0) * nm + m]);
+    }
+  }
+}
+void _tilebox(cow_pipeline *p, long z0, long z1, int lo[3], int hi[3])
+// -----------------------------------------------------------------------------
+// The smallest box of zones, in the indices of the data, holding the zones
+// [z0, z1) of the interior
+// -----------------------------------------------------------------------------
+{
+  cow_domain *d = p->domain;
+  int ng = d->n_ghst;
+  int nj = d->L_nint[1];
+  int nk = d->L_nint[2];
+  long z[2] = { z0, z1 - 1 };
+  int I[2][3];
+  for (int e=0; e<2; ++e) {
+    I[e][0] = z[e] / ((long) nj * nk);
+    I[e][1] = (z[e] / nk) % nj;
+    I[e][2] = z[e] % nk;
+  }
+  // a tile is cut from whole rows of the box once it spans more than one
+  for (int n=0, whole=0; n<3; ++n) {
+    lo[n] = whole ? 0 : I[0][n];
+    hi[n] = whole ? d->L_nint[n] : I[1][n] + 1;
+    if (I[0][n] != I[1][n]) whole = 1;
+    if (n < d->n_dims) {
+      lo[n] += ng;
+      hi[n] += ng;
+    }
+  }
+}
+void _stageargs(cow_pipeline *p, struct cow_pipeline_node *node, int phase,
+		long z, long z0, int **S, int *P, double **x)
+// -----------------------------------------------------------------------------
+// Points x[] at the arguments of `node` in zone z of the tile starting at z0,
+// and sets their strides, and pencil strides for pencil stages. Arguments
+// computed in this sweep are read from their tile buffers, single-precision
+// fields from their views, and others from their data.
+// -----------------------------------------------------------------------------
+{
+  static int tilestride[4] = { 0, 0, 0, 1 };
+  cow_domain *d = p->domain;
+  int pdim = d->n_dims - 1;
+  int ng = d->n_ghst;
+  int nj = d->L_nint[1];
+  int nk = d->L_nint[2];
+  int i = z / ((long) nj * nk) + ng;
+  int j = (z / nk) % nj + (d->n_dims > 1 ? ng : 0);
+  int k = z % nk + (d->n_dims > 2 ? ng : 0);
+  for (int a=0; a<node->nargs; ++a) {
+    struct cow_pipeline_node *arg = &p->nodes[node->args[a]];
+    if (FROMTILE(arg, phase)) {
+      S[a] = tilestride;
+      P[a] = arg->n_members;
+      x[a] = arg->tile + (z - z0) * arg->n_members;
+    }
+    else if (arg->wide) {
+      S[a] = arg->view.stride;
+      P[a] = arg->view.stride[pdim];
+      x[a] = _wide_zone(&arg->view, i, j, k);
+    }
+    else {
+      int *s = arg->field->stride;
+      S[a] = s;
+      P[a] = s[pdim];
+      x[a] = (double*) arg->field->data + (s[0]*i + s[1]*j + s[2]*k);
+    }
+  }
+}
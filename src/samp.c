@@ -9,6 +9,7 @@
 
 #define MODULE "sampling"
 #define EPS 1e-12
+#define A(n) _dfield_load(f, n) // either precision, read as a double
 
 static void _sample1(cow_dfield *f, double *x, double *P, int mode);
 static void _sample2(cow_dfield *f, double *x, double *P, int mode);
@@ -72,7 +73,12 @@ void cow_dfield_sampleexecute(cow_dfield *f)
 // P:    OUT  list of filled samples (N x Q) where Q = f->n_members
 // -----------------------------------------------------------------------------
 {
-  double *xout = (double*) malloc(f->samplecoordslen * 3 * sizeof(double));
+  if (f->samplemode == COW_SAMPLE_LINEAR) {
+    _dfield_requireguard(f, COW_ALL_DIMS, 1); // interpolation reaches a zone
+  }
+  cow_dfield_syncguard_end(f);
+  double *xout = (double*)
+    _mem_alloc(f->domain, f->samplecoordslen * 3 * sizeof(double));
   double *xin = f->samplecoords;
   int N = f->samplecoordslen;
   double *P = f->sampleresult;
@@ -84,7 +90,7 @@ void cow_dfield_sampleexecute(cow_dfield *f)
     _loc(f, xin, N, xout, P, mode);
   }
   memcpy(f->samplecoords, xout, f->samplecoordslen * 3 * sizeof(double));
-  free(xout);
+  _mem_free(f->domain, xout);
 }
 
 void cow_dfield_sampleglobalind(cow_dfield *f, int i, int j, int k, double **x,
@@ -135,18 +141,19 @@ void _sample1(cow_dfield *f, double *x, double *P, int mode)
   cow_domain *d = f->domain;
   int *s = f->stride;
   int i = cow_domain_indexatposition(d, 0, x[0]);
-  double *A = (double*) f->data;
   if (mode == COW_SAMPLE_NEAREST) {
-    memcpy(P, A + M(i), f->n_members * sizeof(double));
+    for (int q=0; q<f->n_members; ++q) {
+      P[q] = A(M(i) + q*s[3]);
+    }
   }
   else if (mode == COW_SAMPLE_LINEAR) {
     double x0 = cow_domain_positionatindex(d, 0, i-1);
-    double *P0 = &A[M(i-1)];
-    double *P1 = &A[M(i+1)];
+    long P0 = M(i-1);
+    long P1 = M(i+1);
     double delx[1] = { 0.5 * (x[0] - x0) / d->dx[0] };
     for (int q=0; q<f->n_members; ++q) {
-      double b1 = P0[q];
-      double b2 = P1[q] - P0[q];
+      double b1 = A(P0 + q*s[3]);
+      double b2 = A(P1 + q*s[3]) - A(P0 + q*s[3]);
       P[q] = b1 + b2*delx[0];
     }
   }
@@ -159,25 +166,28 @@ void _sample2(cow_dfield *f, double *x, double *P, int mode)
   int *s = f->stride;
   int i = cow_domain_indexatposition(d, 0, x[0]);
   int j = cow_domain_indexatposition(d, 1, x[1]);
-  double *A = (double*) f->data;
   if (mode == COW_SAMPLE_NEAREST) {
-    memcpy(P, A + M(i,j), f->n_members * sizeof(double));
+    for (int q=0; q<f->n_members; ++q) {
+      P[q] = A(M(i,j) + q*s[3]);
+    }
   }
   else if (mode == COW_SAMPLE_LINEAR) {
     double x0 = cow_domain_positionatindex(d, 0, i-1);
     double y0 = cow_domain_positionatindex(d, 1, j-1);
-    double *P00 = &A[M(i-1,j-1)];
-    double *P01 = &A[M(i-1,j+1)];
-    double *P10 = &A[M(i+1,j-1)];
-    double *P11 = &A[M(i+1,j+1)];
+    long P00 = M(i-1,j-1);
+    long P01 = M(i-1,j+1);
+    long P10 = M(i+1,j-1);
+    long P11 = M(i+1,j+1);
     double delx[2] = {
       0.5 * (x[0] - x0) / d->dx[0],
       0.5 * (x[1] - y0) / d->dx[1] };
     for (int q=0; q<f->n_members; ++q) {
-      double b1 = P00[q];
-      double b2 = P10[q] - P00[q];
-      double b3 = P01[q] - P00[q];
-      double b4 = P00[q] - P10[q] - P01[q] + P11[q];
+      double a00 = A(P00 + q*s[3]), a01 = A(P01 + q*s[3]);
+      double a10 = A(P10 + q*s[3]), a11 = A(P11 + q*s[3]);
+      double b1 = a00;
+      double b2 = a10 - a00;
+      double b3 = a01 - a00;
+      double b4 = a00 - a10 - a01 + a11;
       P[q] = b1 + b2*delx[0] + b3*delx[1] + b4*delx[0]*delx[1];
     }
   }
@@ -191,9 +201,10 @@ void _sample3(cow_dfield *f, double *x, double *P, int mode)
   int i = cow_domain_indexatposition(d, 0, x[0]);
   int j = cow_domain_indexatposition(d, 1, x[1]);
   int k = cow_domain_indexatposition(d, 2, x[2]);
-  double *A = (double*) f->data;
   if (mode == COW_SAMPLE_NEAREST) {
-    memcpy(P, A + M(i,j,k), f->n_members * sizeof(double));
+    for (int q=0; q<f->n_members; ++q) {
+      P[q] = A(M(i,j,k) + q*s[3]);
+    }
   }
 
   /*
@@ -217,14 +228,14 @@ void _sample3(cow_dfield *f, double *x, double *P, int mode)
     double x0 = cow_domain_positionatindex(d, 0, i-1);
     double y0 = cow_domain_positionatindex(d, 1, j-1);
     double z0 = cow_domain_positionatindex(d, 2, k-1);
-    double *P000 = &A[M(i-1,j-1,k-1)];
-    double *P001 = &A[M(i-1,j-1,k+1)];
-    double *P010 = &A[M(i-1,j+1,k-1)];
-    double *P011 = &A[M(i-1,j+1,k+1)];
-    double *P100 = &A[M(i+1,j-1,k-1)];
-    double *P101 = &A[M(i+1,j-1,k+1)];
-    double *P110 = &A[M(i+1,j+1,k-1)];
-    double *P111 = &A[M(i+1,j+1,k+1)];
+    long P000 = M(i-1,j-1,k-1);
+    long P001 = M(i-1,j-1,k+1);
+    long P010 = M(i-1,j+1,k-1);
+    long P011 = M(i-1,j+1,k+1);
+    long P100 = M(i+1,j-1,k-1);
+    long P101 = M(i+1,j-1,k+1);
+    long P110 = M(i+1,j+1,k-1);
+    long P111 = M(i+1,j+1,k+1);
     double delx[3] = {
       0.5 * (x[0] - x0) / d->dx[0],
       0.5 * (x[1] - y0) / d->dx[1],
@@ -233,10 +244,14 @@ void _sample3(cow_dfield *f, double *x, double *P, int mode)
     // See http://en.wikipedia.org/wiki/Trilinear_interpolation
     // -------------------------------------------------------------------------
     for (int q=0; q<f->n_members; ++q) {
-      double i1 = P000[q] * (1.0 - delx[2]) + P001[q] * delx[2];
-      double i2 = P010[q] * (1.0 - delx[2]) + P011[q] * delx[2];
-      double j1 = P100[q] * (1.0 - delx[2]) + P101[q] * delx[2];
-      double j2 = P110[q] * (1.0 - delx[2]) + P111[q] * delx[2];
+      double a000 = A(P000 + q*s[3]), a001 = A(P001 + q*s[3]);
+      double a010 = A(P010 + q*s[3]), a011 = A(P011 + q*s[3]);
+      double a100 = A(P100 + q*s[3]), a101 = A(P101 + q*s[3]);
+      double a110 = A(P110 + q*s[3]), a111 = A(P111 + q*s[3]);
+      double i1 = a000 * (1.0 - delx[2]) + a001 * delx[2];
+      double i2 = a010 * (1.0 - delx[2]) + a011 * delx[2];
+      double j1 = a100 * (1.0 - delx[2]) + a101 * delx[2];
+      double j2 = a110 * (1.0 - delx[2]) + a111 * delx[2];
       double w1 = i1 * (1.0 - delx[1]) + i2 * delx[1];
       double w2 = j1 * (1.0 - delx[1]) + j2 * delx[1];
       P[q] = w1 * (1.0 - delx[0]) + w2 * delx[0];
@@ -299,11 +314,18 @@ void _rem(cow_dfield *f, double *Ri, int Nsamp, double *Ro, double *Po,
   // dn. That process is referred to as 'lawyer' because they will work for us,
   // obtaining the records we have determined live on their domain. Similarly,
   // we will be the lawyer for process rank-dn, so that process is called
-  // 'client'.
+  // 'client'. If f is in shared memory, the points on subgrids of this node are
+  // sampled from their data directly, once they are done writing it, and no
+  // messages are passed with those processes.
   // ---------------------------------------------------------------------------
   MPI_Status status;
   MPI_Comm comm = f->domain->mpi_cart;
   int queries_satisfied = 0;
+  if (f->win != MPI_WIN_NULL) {
+    MPI_Win_sync(f->win);
+    MPI_Barrier(f->domain->node_comm);
+    MPI_Win_sync(f->win);
+  }
   for (int dn=0; dn<size; ++dn) {
     // -------------------------------------------------------------------------
     // This loop contains three pairs of matching Send/Recv's. For the first
@@ -319,37 +341,59 @@ void _rem(cow_dfield *f, double *Ri, int Nsamp, double *Ro, double *Po,
     int lawyer = (rank + size + dn) % size;
     int client = (rank + size - dn) % size;
     int numlawyer = remote_r1_size[lawyer] / 3;
-    int numclient;
+    int numclient = 0;
+    cow_dfield peer;
+    cow_domain peer_domain;
+    if (_dfield_peer(f, lawyer, &peer, &peer_domain)) {
+      for (int s=0; s<numlawyer; ++s) {
+	double *r_query = &remote_r1[lawyer][3*s];
+	double *Panswer = &remote_P1[lawyer][Q*s];
+	switch (Nd) {
+	case 1: _sample1(&peer, r_query, Panswer, mode); break;
+	case 2: _sample2(&peer, r_query, Panswer, mode); break;
+	case 3: _sample3(&peer, r_query, Panswer, mode); break;
+	}
+      }
+      numlawyer = 0;
+      lawyer = MPI_PROC_NULL;
+    }
+    if (_dfield_peer(f, client, NULL, NULL)) {
+      client = MPI_PROC_NULL;
+    }
     MPI_Sendrecv(&numlawyer, 1, MPI_INT, lawyer, 123,
                  &numclient, 1, MPI_INT, client, 123, comm, &status);
-    double *you_get_for_me_r = remote_r1[lawyer];
-    double *you_get_for_me_P = remote_P1[lawyer];
-    double *I_find_for_you_r = (double*) malloc(numclient * 3 * sizeof(double));
-    double *I_find_for_you_P = (double*) malloc(numclient * Q * sizeof(double));
+    double *you_get_for_me_r = remote_r1[(rank + size + dn) % size];
+    double *you_get_for_me_P = remote_P1[(rank + size + dn) % size];
+    double *I_find_for_you_r = (double*)
+      _mem_alloc(f->domain, numclient * 3 * sizeof(double));
+    double *I_find_for_you_P = (double*)
+      _mem_alloc(f->domain, numclient * Q * sizeof(double));
     MPI_Sendrecv(you_get_for_me_r, numlawyer * 3, MPI_DOUBLE, lawyer, 123,
                  I_find_for_you_r, numclient * 3, MPI_DOUBLE, client, 123,
                  comm, &status);
     for (int s=0; s<numclient; ++s) {
       double *r_query = &I_find_for_you_r[3*s];
-      double *Panswer = (double*) malloc(Q * sizeof(double));
+      double *Panswer = &I_find_for_you_P[s*Q];
       switch (Nd) {
-      case 1: _sample1(f, r_query, Panswer, mode);
-      case 2: _sample2(f, r_query, Panswer, mode);
-      case 3: _sample3(f, r_query, Panswer, mode);
+      case 1: _sample1(f, r_query, Panswer, mode); break;
+      case 2: _sample2(f, r_query, Panswer, mode); break;
+      case 3: _sample3(f, r_query, Panswer, mode); break;
       }
-      memcpy(&I_find_for_you_P[s*Q], &Panswer[0], Q*sizeof(double));
-      free(Panswer);
     }
     MPI_Sendrecv(I_find_for_you_P, numclient*Q, MPI_DOUBLE, client, 123,
                  you_get_for_me_P, numlawyer*Q, MPI_DOUBLE, lawyer, 123,
                  comm, &status);
+    lawyer = (rank + size + dn) % size;
     memcpy(&Ro[queries_satisfied * 3], remote_r1[lawyer],
            remote_r1_size[lawyer] * sizeof(double));
     memcpy(&Po[queries_satisfied * Q], remote_P1[lawyer],
            remote_P1_size[lawyer] * sizeof(double));
-    queries_satisfied += numlawyer;
-    free(I_find_for_you_r);
-    free(I_find_for_you_P);
+    queries_satisfied += remote_r1_size[lawyer] / 3;
+    _mem_free(f->domain, I_find_for_you_r);
+    _mem_free(f->domain, I_find_for_you_P);
+  }
+  if (f->win != MPI_WIN_NULL) {
+    MPI_Barrier(f->domain->node_comm);
   }
   for (int n=0; n<size; ++n) {
     free(remote_r1[n]);
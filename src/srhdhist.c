@@ -15,27 +15,6 @@
 void relative_lorentz_factor(cow_dfield *vel, cow_histogram *hist, int N,
                              char mode);
 
-static void div5(double *result, double **args, int **s, void *u)
-{
-#define diff5(f,s) ((-f[2*s] + 8*f[s] - 8*f[-s] + f[-2*s]) / 12.0)
-  double *f0 = &args[0][0];
-  double *f1 = &args[0][1];
-  double *f2 = &args[0][2];
-  *result = diff5(f0, s[0][0]) + diff5(f1, s[0][1]) + diff5(f2, s[0][2]);
-#undef diff5
-}
-static void rot5(double *result, double **args, int **s, void *u)
-{
-  // http://en.wikipedia.org/wiki/Five-point_stencil
-#define diff5(f,s) ((-f[2*s] + 8*f[s] - 8*f[-s] + f[-2*s]) / 12.0)
-  double *f0 = &args[0][0];
-  double *f1 = &args[0][1];
-  double *f2 = &args[0][2];
-  result[0] = diff5(f2, s[0][1]) - diff5(f1, s[0][2]);
-  result[1] = diff5(f0, s[0][2]) - diff5(f2, s[0][0]);
-  result[2] = diff5(f1, s[0][0]) - diff5(f0, s[0][1]);
-#undef diff5
-}
 static void take_elm0(double *result, double **args, int **s, void *u)
 {
   *result = args[0][0];
@@ -82,14 +61,14 @@ void cow_dfield_reduce2(cow_dfield *f, cow_transform op, double reduc[3])
   cow_dfield_setuserdata(f, NULL);
   cow_dfield_reduce(f, reduc);
 }
-void cow_dfield_transform(cow_dfield *f, cow_dfield **args, int narg,
-			  cow_transform op, void *userdata)
+void cow_dfield_transformpencil(cow_dfield *f, cow_dfield **args, int narg,
+				cow_pencil op, void *userdata)
 {
   cow_dfield_clearargs(f);
   for (int n=0; n<narg; ++n) {
     cow_dfield_pusharg(f, args[n]);
   }
-  cow_dfield_settransform(f, op);
+  cow_dfield_settransformpencil(f, op);
   cow_dfield_setuserdata(f, userdata);
   cow_dfield_transformexecute(f);
 }
@@ -156,8 +135,8 @@ int main(int argc, char **argv)
   cow_dfield_addmember(rho, "rho");
   cow_dfield_commit(vel);
   cow_dfield_commit(rho);
-  cow_dfield_read(vel, finp);
-  cow_dfield_read(rho, finp);
+  cow_dfield *fields[2] = { vel, rho };
+  cow_dfield_readmany(fields, 2, finp);
 
   int dohist = 0;
   int dopair = 1;
@@ -168,8 +147,8 @@ int main(int argc, char **argv)
 
     cow_dfield *divV = cow_scalarfield(domain, "divV");
     cow_dfield *rotV = cow_vectorfield(domain, "rotV");
-    cow_dfield_transform(divV, &vel, 1, div5, NULL);
-    cow_dfield_transform(rotV, &vel, 1, rot5, NULL);
+    cow_dfield_transformpencil(divV, &vel, 1, cow_deriv_div5, domain);
+    cow_dfield_transformpencil(rotV, &vel, 1, cow_deriv_rot5, domain);
 
     make_hist(divV, take_elm0, fout, NULL);
     make_hist(rotV, take_mag3, fout, NULL);
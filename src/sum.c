@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#define COW_PRIVATE_DEFS
+#include "cow.h"
+#define MODULE "sum"
+
+// -----------------------------------------------------------------------------
+//
+// Accurate summation used by the histogram and dfield reductions
+//
+// COW_SUM_COMPENSATED keeps a running (sum, correction) pair, updated with the
+// Kahan-Babuska-Neumaier algorithm. Pairs from different ranks are combined
+// with an exact two-sum, so the error no longer grows with the number of
+// terms, although the result may still depend on the order of summation.
+//
+// COW_SUM_REPRODUCIBLE accumulates the exact sum in a fixed-point integer
+// (a "superaccumulator") spanning the whole range of doubles. Integer addition
+// is associative, so the result is bitwise identical for any order of terms,
+// and therefore for any decomposition or number of ranks.
+//
+// -----------------------------------------------------------------------------
+
+#define LIMB_BITS 32
+#define LIMB_BASE 4294967296LL // 2^LIMB_BITS
+#define LIMB_BIAS 1126 // bit 0 of limb 0 has weight 2^-LIMB_BIAS
+#define NORM_EVERY (1<<30) // limbs take < 2^32 per add, 2^30 adds are safe
+
+void _sum_kahanadd(double *s, double *c, double x)
+{
+  double t = *s + x;
+  if (fabs(*s) >= fabs(x)) {
+    *c += (*s - t) + x;
+  }
+  else {
+    *c += (x - t) + *s;
+  }
+  *s = t;
+}
+
+void _sum_exactclear(cow_exactsum *a)
+{
+  memset(a, 0, sizeof(cow_exactsum));
+}
+void _sum_exactnorm(cow_exactsum *a)
+// -----------------------------------------------------------------------------
+// Propagates carries so that every limb but the last one lies in [0, 2^32).
+// This representation is unique for a given value, so it converts to the same
+// double regardless of how the value was accumulated.
+// -----------------------------------------------------------------------------
+{
+  for (int k=0; k<COW_EXACTSUM_NLIMBS-1; ++k) {
+    int64_t r = a->limb[k] % LIMB_BASE;
+    if (r < 0) r += LIMB_BASE;
+    a->limb[k+1] += (a->limb[k] - r) / LIMB_BASE;
+    a->limb[k] = r;
+  }
+  a->nadd = 0;
+}
+void _sum_exactadd(cow_exactsum *a, double x)
+{
+  if (x == 0.0) {
+    return;
+  }
+  else if (isnan(x)) {
+    a->nnan += 1;
+    return;
+  }
+  else if (isinf(x)) {
+    if (x > 0) a->nposinf += 1;
+    else a->nneginf += 1;
+    return;
+  }
+  if (a->nadd == NORM_EVERY) {
+    _sum_exactnorm(a);
+  }
+  int e;
+  double f = frexp(x, &e); // x = f * 2^e, 0.5 <= |f| < 1
+  int64_t m = (int64_t) ldexp(f, 53); // exact, |m| < 2^53
+  int b = e - 53 + LIMB_BIAS; // bit position of the least significant bit
+  int k = b / LIMB_BITS;
+  int shift = b % LIMB_BITS;
+  int64_t sign = m < 0 ? -1 : 1;
+  uint64_t u = m < 0 ? -m : m;
+  uint64_t lo = (u & ((1ULL << (LIMB_BITS - shift)) - 1)) << shift;
+  uint64_t hi = u >> (LIMB_BITS - shift);
+  a->limb[k+0] += sign * (int64_t) lo;
+  a->limb[k+1] += sign * (int64_t) (hi & (LIMB_BASE - 1));
+  a->limb[k+2] += sign * (int64_t) (hi >> LIMB_BITS);
+  a->nadd += 1;
+}
+void _sum_exactmerge(cow_exactsum *a, cow_exactsum *b)
+// -----------------------------------------------------------------------------
+// a += b, both are normalized first so that no limb can overflow
+// -----------------------------------------------------------------------------
+{
+  _sum_exactnorm(a);
+  _sum_exactnorm(b);
+  for (int k=0; k<COW_EXACTSUM_NLIMBS; ++k) {
+    a->limb[k] += b->limb[k];
+  }
+  a->nnan += b->nnan;
+  a->nposinf += b->nposinf;
+  a->nneginf += b->nneginf;
+  a->nadd = 1;
+}
+double _sum_exactvalue(cow_exactsum *a)
+{
+  if (a->nnan || (a->nposinf && a->nneginf)) {
+    return NAN;
+  }
+  else if (a->nposinf) {
+    return INFINITY;
+  }
+  else if (a->nneginf) {
+    return -INFINITY;
+  }
+  cow_exactsum n = *a;
+  _sum_exactnorm(&n);
+  double s = 0.0;
+  for (int k=COW_EXACTSUM_NLIMBS-1; k>=0; --k) {
+    s += ldexp((double) n.limb[k], k * LIMB_BITS - LIMB_BIAS);
+  }
+  return s;
+}
+
+#if (COW_MPI)
+static void _kahanop(void *in, void *inout, int *len, MPI_Datatype *type)
+// -----------------------------------------------------------------------------
+// Combines (sum, correction) pairs, capturing the rounding error of adding
+// the two sums exactly (Knuth's two-sum)
+// -----------------------------------------------------------------------------
+{
+  double *a = (double*) in;
+  double *b = (double*) inout;
+  for (int n=0; n<*len; ++n) {
+    double s = a[2*n] + b[2*n];
+    double z = s - a[2*n];
+    double e = (a[2*n] - (s - z)) + (b[2*n] - z);
+    b[2*n+1] += a[2*n+1] + e;
+    b[2*n] = s;
+  }
+}
+void _sum_kahanmpi(MPI_Datatype *type, MPI_Op *op)
+// -----------------------------------------------------------------------------
+// Creates the data type (a pair of doubles) and reduction operation for
+// combining compensated sums. The caller frees both when done.
+// -----------------------------------------------------------------------------
+{
+  MPI_Type_contiguous(2, MPI_DOUBLE, type);
+  MPI_Type_commit(type);
+  MPI_Op_create(_kahanop, 1, op);
+}
+#endif
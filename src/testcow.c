@@ -131,6 +131,10 @@ int main(int argc, char **argv)
   cow_dfield_setiparam(prim, 0);
   cow_dfield_reduce(prim, reduction);
   printf("(min max sum): %f %f %f\n", reduction[0], reduction[1], reduction[2]);
+  cow_dfield_setsummode(prim, COW_SUM_REPRODUCIBLE);
+  cow_dfield_reduce(prim, reduction);
+  printf("(min max sum) reproducible: %f %f %a\n", reduction[0], reduction[1],
+	 reduction[2]);
 
   cow_dfield_write(divB_copy, "thefile.h5");
   cow_dfield_write(divB, "thefile.h5");
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "cow.h"
+
+#define PI (4*atan(1))
+#define GETENVINT(a,dflt) (getenv(a) ? atoi(getenv(a)) : dflt)
+
+static void absdiff(double *result, double **args, int **s, void *u)
+{
+  double d = 0.0;
+  int *nm = (int*) u;
+  for (int m=0; m<*nm; ++m) {
+    double e = fabs(args[0][m] - args[1][m]);
+    if (e > d) d = e;
+  }
+  *result = d;
+}
+
+cow_dfield *cow_dfield_new2(cow_domain *domain, char *name, int nmembers)
+{
+  char mname[16];
+  cow_dfield *f = cow_dfield_new();
+  cow_dfield_setdomain(f, domain);
+  cow_dfield_setname(f, name);
+  for (int n=0; n<nmembers; ++n) {
+    snprintf(mname, 16, "%d", n);
+    cow_dfield_addmember(f, mname);
+  }
+  cow_dfield_commit(f);
+  return f;
+}
+
+// u = (sin 2pi y, sin 2pi z, sin 2pi x) and the analytic values of its
+// derivatives, stored as grad, lapl, div, curl, strain, and d/dx, d/dy, d/dz
+// -----------------------------------------------------------------------------
+static void fill(cow_dfield *f, cow_dfield **exact)
+{
+  cow_domain *d = cow_dfield_getdomain(f);
+  int ng = cow_domain_getguard(d);
+  int ni = cow_domain_getnumlocalzonesinterior(d, 0);
+  int nj = cow_domain_getnumlocalzonesinterior(d, 1);
+  int nk = cow_domain_getnumlocalzonesinterior(d, 2);
+  int nmem[8] = { 3, 1, 1, 3, 6, 3, 3, 3 };
+  double *U = (double*) cow_dfield_getdatabuffer(f);
+  double *E[8];
+  for (int n=0; n<8; ++n) {
+    E[n] = (double*) cow_dfield_getdatabuffer(exact[n]);
+  }
+  double k = 2*PI;
+  for (int i=ng; i<ni+ng; ++i) {
+    for (int j=ng; j<nj+ng; ++j) {
+      for (int l=ng; l<nk+ng; ++l) {
+	double x = cow_domain_positionatindex(d, 0, i);
+	double y = cow_domain_positionatindex(d, 1, j);
+	double z = cow_domain_positionatindex(d, 2, l);
+	int m = cow_dfield_getstride(f, 0) * i + cow_dfield_getstride(f, 1) * j +
+	  cow_dfield_getstride(f, 2) * l;
+	int z0 = m / 3;
+	double dx[3][3] = { { 0, 0, k*cos(k*x) },   // d/dx u
+			    { k*cos(k*y), 0, 0 },   // d/dy u
+			    { 0, k*cos(k*z), 0 } }; // d/dz u
+	double v[8][6] = {
+	  { 0, k*cos(k*y), 0 },
+	  { -k*k*sin(k*y) },
+	  { 0 },
+	  { dx[1][2] - dx[2][1], dx[2][0] - dx[0][2], dx[0][1] - dx[1][0] },
+	  { 0, 0, 0, 0.5*(dx[0][1] + dx[1][0]), 0.5*(dx[0][2] + dx[2][0]),
+	    0.5*(dx[1][2] + dx[2][1]) },
+	  { dx[0][0], dx[0][1], dx[0][2] },
+	  { dx[1][0], dx[1][1], dx[1][2] },
+	  { dx[2][0], dx[2][1], dx[2][2] } };
+	U[m + 0] = sin(k*y);
+	U[m + 1] = sin(k*z);
+	U[m + 2] = sin(k*x);
+	for (int n=0; n<8; ++n) {
+	  for (int q=0; q<nmem[n]; ++q) {
+	    E[n][z0*nmem[n] + q] = v[n][q];
+	  }
+	}
+      }
+    }
+  }
+  cow_dfield_syncguard(f);
+}
+
+static double maxerror(cow_dfield *f, cow_dfield *exact, cow_dfield *err)
+{
+  double reduc[3];
+  int nm = cow_dfield_getnmembers(f);
+  cow_dfield_clearargs(err);
+  cow_dfield_pusharg(err, f);
+  cow_dfield_pusharg(err, exact);
+  cow_dfield_settransform(err, absdiff);
+  cow_dfield_setuserdata(err, &nm);
+  cow_dfield_transformexecute(err);
+  cow_dfield_settransform(err, cow_trans_component);
+  cow_dfield_setuserdata(err, err);
+  cow_dfield_setiparam(err, 0);
+  cow_dfield_reduce(err, reduc);
+  return reduc[1];
+}
+
+static void run(int scheme, const char *name, int N, double *errs)
+{
+  cow_domain *domain = cow_domain_new();
+  cow_domain_setndim(domain, 3);
+  cow_domain_setsize(domain, 0, N);
+  cow_domain_setsize(domain, 1, N);
+  cow_domain_setsize(domain, 2, N);
+  cow_domain_setstencil(domain, scheme); // raises the guard depth as needed
+  cow_domain_commit(domain);
+
+  char *names[8] = { "grad", "lapl", "div", "curl", "strain", "ddx", "ddy",
+		     "ddz" };
+  int nmem[8] = { 3, 1, 1, 3, 6, 3, 3, 3 };
+  cow_pencil ops[5] = { cow_deriv_grad, cow_deriv_lapl, cow_deriv_div,
+			cow_deriv_curl, cow_deriv_strain };
+  cow_dfield *vel = cow_dfield_new2(domain, "vel", 3);
+  cow_dfield *err = cow_dfield_new2(domain, "err", 1);
+  cow_dfield *exact[8], *result[8];
+  for (int n=0; n<8; ++n) {
+    exact[n] = cow_dfield_new2(domain, names[n], nmem[n]);
+    result[n] = cow_dfield_new2(domain, names[n], nmem[n]);
+  }
+  fill(vel, exact);
+  for (int n=0; n<5; ++n) {
+    cow_dfield_clearargs(result[n]);
+    cow_dfield_pusharg(result[n], vel);
+    cow_dfield_settransformpencil(result[n], ops[n]);
+    cow_dfield_setuserdata(result[n], domain);
+    cow_dfield_transformexecute(result[n]);
+  }
+  for (int n=0; n<3; ++n) {
+    cow_dfield_derivative(result[5+n], vel, n);
+  }
+  for (int n=0; n<8; ++n) {
+    errs[n] = maxerror(result[n], exact[n], err);
+    cow_dfield_del(exact[n]);
+    cow_dfield_del(result[n]);
+  }
+  printf("%-9s N=%-3d guard=%d", name, N, cow_domain_getguard(domain));
+  for (int n=0; n<8; ++n) {
+    printf(" %s:%8.2e", names[n], errs[n]);
+  }
+  printf("\n");
+  cow_dfield_del(vel);
+  cow_dfield_del(err);
+  cow_domain_del(domain);
+}
+
+// u has Q = 0, and R = -k^3 cos(kx) cos(ky) cos(kz)
+// -----------------------------------------------------------------------------
+static void vgt(int N)
+{
+  cow_domain *domain = cow_domain_new();
+  cow_domain_setndim(domain, 3);
+  cow_domain_setsize(domain, 0, N);
+  cow_domain_setsize(domain, 1, N);
+  cow_domain_setsize(domain, 2, N);
+  cow_domain_setstencil(domain, COW_STENCIL_CENTRAL8);
+  cow_domain_commit(domain);
+
+  char *names[8] = { "grad", "lapl", "div", "curl", "strain", "ddx", "ddy",
+		     "ddz" };
+  int nmem[8] = { 3, 1, 1, 3, 6, 3, 3, 3 };
+  cow_dfield *vel = cow_dfield_new2(domain, "vel", 3);
+  cow_dfield *exact[8];
+  for (int n=0; n<8; ++n) {
+    exact[n] = cow_dfield_new2(domain, names[n], nmem[n]);
+  }
+  fill(vel, exact);
+  for (int n=0; n<8; ++n) {
+    cow_dfield_del(exact[n]);
+  }
+
+  int which[5] = { COW_VGT_Q, COW_VGT_R, COW_VGT_LAMBDA1, COW_VGT_LAMBDA2,
+		   COW_VGT_LAMBDA3 };
+  cow_dfield *inv = cow_dfield_new2(domain, "invariants", 5);
+  cow_dfield *ref = cow_dfield_new2(domain, "reference", 5);
+  cow_dfield *err = cow_dfield_new2(domain, "err", 1);
+  cow_dfield_vgtinvariants(inv, vel, which);
+  int ng = cow_domain_getguard(domain);
+  int ni = cow_domain_getnumlocalzonesinterior(domain, 0);
+  int nj = cow_domain_getnumlocalzonesinterior(domain, 1);
+  int nk = cow_domain_getnumlocalzonesinterior(domain, 2);
+  double *I = (double*) cow_dfield_getdatabuffer(inv);
+  double *E = (double*) cow_dfield_getdatabuffer(ref);
+  double k = 2*PI;
+  for (int i=ng; i<ni+ng; ++i) {
+    for (int j=ng; j<nj+ng; ++j) {
+      for (int l=ng; l<nk+ng; ++l) {
+	double x = cow_domain_positionatindex(domain, 0, i);
+	double y = cow_domain_positionatindex(domain, 1, j);
+	double z = cow_domain_positionatindex(domain, 2, l);
+	int m = cow_dfield_getstride(inv, 0) * i +
+	  cow_dfield_getstride(inv, 1) * j + cow_dfield_getstride(inv, 2) * l;
+	E[m + 0] = 0.0;
+	E[m + 1] = -k*k*k * cos(k*x) * cos(k*y) * cos(k*z);
+	E[m + 2] = I[m + 2]; // eigenvalues are checked by their sum
+	E[m + 3] = I[m + 3];
+	E[m + 4] = -I[m + 2] - I[m + 3];
+      }
+    }
+  }
+  printf("vgt invariants N=%-3d max error of Q, R and tr(S): %8.2e\n", N,
+	 maxerror(inv, ref, err));
+
+  cow_histogram *qr = cow_histogram_new();
+  cow_histogram_setndims(qr, 2);
+  cow_histogram_setlower(qr, COW_ALL_DIMS, -1.1*k*k*k);
+  cow_histogram_setupper(qr, COW_ALL_DIMS, +1.1*k*k*k);
+  cow_histogram_setnbins(qr, COW_ALL_DIMS, 63);
+  cow_histogram_setnickname(qr, "qr");
+  cow_histogram_commit(qr);
+  int rq[2] = { COW_VGT_R, COW_VGT_Q };
+  cow_histogram_populatevgt(qr, vel, rq);
+  cow_histogram_seal(qr);
+  printf("vgt Q-R histogram N=%-3d holds %ld of %d zones\n", N,
+	 cow_histogram_gettotalcounts(qr), N*N*N);
+  cow_histogram_del(qr);
+
+  cow_dfield_del(vel);
+  cow_dfield_del(inv);
+  cow_dfield_del(ref);
+  cow_dfield_del(err);
+  cow_domain_del(domain);
+}
+
+// f = x on a 1d domain closed by `bc` on both faces. The compact scheme must
+// close its end zones on the walls with the explicit scheme of the same order,
+// and not wrap around to the opposite wall, whatever the process count.
+// -----------------------------------------------------------------------------
+static double walls(int scheme, int central, int bc, int N)
+{
+  cow_domain *domain[2];
+  cow_dfield *f[2], *df[2];
+  int schemes[2] = { scheme, central };
+  for (int n=0; n<2; ++n) {
+    domain[n] = cow_domain_new();
+    cow_domain_setndim(domain[n], 1);
+    cow_domain_setsize(domain[n], 0, N);
+    cow_domain_setboundary(domain[n], 0, 0, bc);
+    cow_domain_setboundary(domain[n], 0, 1, bc);
+    cow_domain_setstencil(domain[n], schemes[n]);
+    cow_domain_commit(domain[n]);
+    f[n] = cow_dfield_new2(domain[n], "f", 1);
+    df[n] = cow_dfield_new2(domain[n], "df", 1);
+    int ng = cow_domain_getguard(domain[n]);
+    int ni = cow_domain_getnumlocalzonesinterior(domain[n], 0);
+    double *F = (double*) cow_dfield_getdatabuffer(f[n]);
+    for (int i=ng; i<ni+ng; ++i) {
+      F[i] = cow_domain_positionatindex(domain[n], 0, i);
+    }
+    cow_dfield_syncguard(f[n]);
+    cow_dfield_derivative(df[n], f[n], 0);
+  }
+  // only the zones on the walls are compared, the rest are zeroed
+  int ng = cow_domain_getguard(domain[0]);
+  int ni = cow_domain_getnumlocalzonesinterior(domain[0], 0);
+  int i0 = cow_domain_getglobalstartindex(domain[0], 0);
+  for (int n=0; n<2; ++n) {
+    double *D = (double*) cow_dfield_getdatabuffer(df[n]);
+    for (int i=ng; i<ni+ng; ++i) {
+      int I = i0 + i - ng;
+      if (I != 0 && I != N - 1) D[i] = 0.0;
+    }
+  }
+  // the domains share their guard depth and decomposition, so the explicit
+  // derivative is copied to the first one to be compared there
+  cow_dfield *ref = cow_dfield_new2(domain[0], "ref", 1);
+  cow_dfield *err = cow_dfield_new2(domain[0], "err", 1);
+  double *R = (double*) cow_dfield_getdatabuffer(ref);
+  double *D = (double*) cow_dfield_getdatabuffer(df[1]);
+  for (int i=ng; i<ni+ng; ++i) {
+    R[i] = D[i];
+  }
+  double e = maxerror(df[0], ref, err);
+  cow_dfield_del(ref);
+  cow_dfield_del(err);
+  for (int n=0; n<2; ++n) {
+    cow_dfield_del(f[n]);
+    cow_dfield_del(df[n]);
+    cow_domain_del(domain[n]);
+  }
+  return e;
+}
+
+int main(int argc, char **argv)
+{
+  int modes = 0;
+  modes |= GETENVINT("COW_NOREOPEN_STDOUT", 0) ? COW_NOREOPEN_STDOUT : 0;
+  modes |= GETENVINT("COW_DISABLE_MPI", 0) ? COW_DISABLE_MPI : 0;
+
+  cow_init(argc, argv, modes);
+
+  int schemes[6] = { COW_STENCIL_CENTRAL2, COW_STENCIL_CENTRAL4,
+		     COW_STENCIL_CENTRAL6, COW_STENCIL_CENTRAL8,
+		     COW_STENCIL_COMPACT4, COW_STENCIL_COMPACT6 };
+  char *names[6] = { "central2", "central4", "central6", "central8",
+		     "compact4", "compact6" };
+
+  // The error of each scheme at two resolutions, and the order of convergence
+  // of cow_dfield_derivative it implies
+  // ---------------------------------------------------------------------------
+  for (int s=0; s<6; ++s) {
+    double e0[8], e1[8];
+    run(schemes[s], names[s], 16, e0);
+    run(schemes[s], names[s], 32, e1);
+    printf("%-9s order of convergence: %4.2f\n", names[s],
+	   log(e0[5] / e1[5]) / log(2.0));
+  }
+
+  // Compact schemes on outflow and reflecting walls
+  // ---------------------------------------------------------------------------
+  int bcs[2] = { COW_BOUNDARY_OUTFLOW, COW_BOUNDARY_REFLECTING };
+  char *bcnames[2] = { "outflow", "reflecting" };
+  for (int s=4; s<6; ++s) {
+    for (int b=0; b<2; ++b) {
+      printf("%-9s %-10s walls max difference from %s: %8.2e\n", names[s],
+	     bcnames[b], names[s-3], walls(schemes[s], schemes[s-3], bcs[b], 16));
+    }
+  }
+
+  // The velocity gradient invariants, and a Q-R histogram fed from the stencil
+  // ---------------------------------------------------------------------------
+  vgt(16);
+  vgt(32);
+  cow_finalize();
+  return 0;
+}
@@ -77,6 +77,58 @@ int main(int argc, char **argv)
   cow_histogram_dumphdf5(hist, "thehist.h5", "/G1/G2/G3");
   cow_histogram_del(hist);
 
+  // test a 3d histogram with sparse bin storage
+  cow_histogram *hist3 = cow_histogram_new();
+  cow_histogram_setndims(hist3, 3);
+  cow_histogram_setstorage(hist3, COW_HIST_STORAGE_SPARSE);
+  cow_histogram_setlower(hist3, COW_ALL_DIMS, -1.0);
+  cow_histogram_setupper(hist3, COW_ALL_DIMS, +1.0);
+  cow_histogram_setnbins(hist3, COW_ALL_DIMS, 100);
+  cow_histogram_setnickname(hist3, "myhist3");
+  cow_histogram_commit(hist3);
+  for (int n=0; n<10000; ++n) {
+    double x[3];
+    x[0] = 2.0 * ((double) rand() / RAND_MAX - 0.5);
+    x[1] = 0.1 * x[0];
+    x[2] = x[0] * x[0];
+    cow_histogram_addsample(hist3, x, 1.0);
+  }
+  cow_histogram_seal(hist3);
+  {
+    long nbins;
+    cow_histogram_getbinvals(hist3, NULL, &nbins);
+    printf("3d sparse histogram has %ld populated bins and %ld counts\n",
+	   nbins, cow_histogram_gettotalcounts(hist3));
+  }
+  cow_histogram_dumpascii(hist3, "thehist3.dat");
+  cow_histogram_dumphdf5(hist3, "thehist.h5", "");
+  cow_histogram_del(hist3);
+
+  // test a 2d histogram which is reduce-scattered over the ranks
+  cow_histogram *hist2 = cow_histogram_new();
+  cow_histogram_setsealmode(hist2, COW_HIST_SEAL_SCATTER);
+  cow_histogram_setlower(hist2, COW_ALL_DIMS, -1.0);
+  cow_histogram_setupper(hist2, COW_ALL_DIMS, +1.0);
+  cow_histogram_setnbins(hist2, COW_ALL_DIMS, 50);
+  cow_histogram_setnickname(hist2, "myhist2");
+  cow_histogram_setsummode(hist2, COW_SUM_REPRODUCIBLE);
+  cow_histogram_commit(hist2);
+  for (int n=0; n<10000; ++n) {
+    double x = 2.0 * ((double) rand() / RAND_MAX - 0.5);
+    double y = 2.0 * ((double) rand() / RAND_MAX - 0.5);
+    cow_histogram_addsample2(hist2, x, x * y, 0.1 * y);
+  }
+  cow_histogram_seal(hist2);
+  {
+    long start, stop;
+    cow_histogram_getbinrange(hist2, &start, &stop);
+    printf("2d scattered histogram holds bins [%ld, %ld) of %ld counts\n",
+	   start, stop, cow_histogram_gettotalcounts(hist2));
+  }
+  cow_histogram_dumpascii(hist2, "thehist2.dat");
+  cow_histogram_dumphdf5(hist2, "thehist.h5", "");
+  cow_histogram_del(hist2);
+
   cow_dfield_del(data);
   cow_domain_del(domain);
 
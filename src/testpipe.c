@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <math.h>
+#include "cow.h"
+#if (COW_MPI)
+#include <mpi.h>
+#endif
+
+#define PI (4*atan(1))
+#define GETENVINT(a,dflt) (getenv(a) ? atoi(getenv(a)) : dflt)
+
+static void div5(double *result, double **args, int **s, void *u)
+{
+#define diff5(f,s) ((-f[2*s] + 8*f[s] - 8*f[-s] + f[-2*s]) / 12.0)
+  double *f0 = &args[0][0];
+  double *f1 = &args[0][1];
+  double *f2 = &args[0][2];
+  *result = diff5(f0, s[0][0]) + diff5(f1, s[0][1]) + diff5(f2, s[0][2]);
+#undef diff5
+}
+static void crossprod(double *result, double **args, int **s, void *u)
+{
+  double *a = args[0];
+  double *b = args[1];
+  result[0] = a[1] * b[2] - a[2] * b[1];
+  result[1] = a[2] * b[0] - a[0] * b[2];
+  result[2] = a[0] * b[1] - a[1] * b[0];
+}
+static void dotprod(double *result, double **args, int **s, void *u)
+{
+  double *a = args[0];
+  double *b = args[1];
+  *result = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+static void absdiff(double *result, double **args, int **s, void *u)
+{
+  *result = fabs(args[0][0] - args[1][0]);
+}
+
+cow_dfield *cow_dfield_new2(cow_domain *domain, char *name, int nmembers)
+{
+  char mname[16];
+  cow_dfield *f = cow_dfield_new();
+  cow_dfield_setdomain(f, domain);
+  cow_dfield_setname(f, name);
+  for (int n=0; n<nmembers; ++n) {
+    snprintf(mname, 16, "%d", n);
+    cow_dfield_addmember(f, mname);
+  }
+  cow_dfield_commit(f);
+  return f;
+}
+void cow_dfield_transform(cow_dfield *f, cow_dfield **args, int narg,
+			  cow_transform op)
+{
+  cow_dfield_clearargs(f);
+  for (int n=0; n<narg; ++n) {
+    cow_dfield_pusharg(f, args[n]);
+  }
+  cow_dfield_settransform(f, op);
+  cow_dfield_setuserdata(f, NULL);
+  cow_dfield_transformexecute(f);
+}
+
+int main(int argc, char **argv)
+{
+  int modes = 0;
+  modes |= GETENVINT("COW_NOREOPEN_STDOUT", 0) ? COW_NOREOPEN_STDOUT : 0;
+  modes |= GETENVINT("COW_DISABLE_MPI", 0) ? COW_DISABLE_MPI : 0;
+
+  cow_init(argc, argv, modes);
+
+  cow_domain *domain = cow_domain_new();
+  cow_domain_setndim(domain, 3);
+  cow_domain_setguard(domain, 2);
+  cow_domain_setsize(domain, 0, 24);
+  cow_domain_setsize(domain, 1, 20);
+  cow_domain_setsize(domain, 2, 16);
+  cow_domain_commit(domain);
+
+  cow_dfield *vel = cow_dfield_new2(domain, "vel", 3);
+  cow_dfield *mag = cow_dfield_new2(domain, "mag", 3);
+
+  int si = cow_dfield_getstride(vel, 0);
+  int sj = cow_dfield_getstride(vel, 1);
+  int sk = cow_dfield_getstride(vel, 2);
+  int ng = cow_domain_getguard(domain);
+  int ni = cow_domain_getnumlocalzonesinterior(domain, 0);
+  int nj = cow_domain_getnumlocalzonesinterior(domain, 1);
+  int nk = cow_domain_getnumlocalzonesinterior(domain, 2);
+  double *V = (double*) cow_dfield_getdatabuffer(vel);
+  double *B = (double*) cow_dfield_getdatabuffer(mag);
+  for (int i=ng; i<ni+ng; ++i) {
+    for (int j=ng; j<nj+ng; ++j) {
+      for (int k=ng; k<nk+ng; ++k) {
+	double x = cow_domain_positionatindex(domain, 0, i);
+	double y = cow_domain_positionatindex(domain, 1, j);
+	double z = cow_domain_positionatindex(domain, 2, k);
+	int m = si*i + sj*j + sk*k;
+	V[m + 0] = sin(2*PI*y);
+	V[m + 1] = sin(2*PI*z);
+	V[m + 2] = sin(2*PI*x);
+	B[m + 0] = cos(2*PI*z) * x;
+	B[m + 1] = cos(2*PI*x) * y;
+	B[m + 2] = cos(2*PI*y) * z;
+      }
+    }
+  }
+  cow_dfield_syncguard(vel);
+  cow_dfield_syncguard(mag);
+
+  // One stage at a time, with a full temporary for each intermediate
+  // ---------------------------------------------------------------------------
+  cow_dfield *vcrossB = cow_dfield_new2(domain, "vcrossB", 3);
+  cow_dfield *vcrossBcrossB = cow_dfield_new2(domain, "vcrossBcrossB", 3);
+  cow_dfield *divvcrossBcrossB = cow_dfield_new2(domain, "divvBB", 1);
+  cow_dfield *vdotvcrossBcrossB = cow_dfield_new2(domain, "vdotvBB", 1);
+  cow_dfield *vB[2] = { vel, mag };
+  cow_dfield *vvB[2] = { vel, vcrossB };
+  cow_dfield *vvBB[2] = { vel, vcrossBcrossB };
+  cow_dfield_transform(vcrossB, vB, 2, crossprod);
+  cow_dfield_transform(vcrossBcrossB, vvB, 2, crossprod);
+  cow_dfield_transform(divvcrossBcrossB, &vcrossBcrossB, 1, div5);
+  cow_dfield_transform(vdotvcrossBcrossB, vvBB, 2, dotprod);
+
+  // The same chain as a pipeline: vcrossB only exists in a tile buffer
+  // ---------------------------------------------------------------------------
+  cow_dfield *divvBB = cow_dfield_new2(domain, "divvBB-pipe", 1);
+  cow_dfield *vdotvBB = cow_dfield_new2(domain, "vdotvBB-pipe", 1);
+  cow_pipeline *pipe = cow_pipeline_new(domain);
+  cow_pipeline_settilesize(pipe, 1000);
+  int v = cow_pipeline_addinput(pipe, vel);
+  int b = cow_pipeline_addinput(pipe, mag);
+  int args0[2] = { v, b };
+  int vb = cow_pipeline_addstage(pipe, crossprod, args0, 2, 3, 0, NULL);
+  int args1[2] = { v, vb };
+  int vbb = cow_pipeline_addstage(pipe, crossprod, args1, 2, 3, 0, NULL);
+  int div = cow_pipeline_addstage(pipe, div5, &vbb, 1, 1, 2, NULL);
+  int args2[2] = { v, vbb };
+  int dot = cow_pipeline_addstage(pipe, dotprod, args2, 2, 1, 0, NULL);
+  cow_pipeline_setoutput(pipe, div, divvBB);
+  cow_pipeline_setoutput(pipe, dot, vdotvBB);
+  cow_pipeline_execute(pipe);
+  cow_pipeline_del(pipe);
+
+  double reduc[3];
+  cow_dfield *diff = cow_dfield_new2(domain, "diff", 1);
+  cow_dfield *cmp1[2] = { divvcrossBcrossB, divvBB };
+  cow_dfield *cmp2[2] = { vdotvcrossBcrossB, vdotvBB };
+  cow_dfield_transform(diff, cmp1, 2, absdiff);
+  cow_dfield_settransform(diff, cow_trans_component);
+  cow_dfield_setuserdata(diff, diff);
+  cow_dfield_setiparam(diff, 0);
+  cow_dfield_reduce(diff, reduc);
+  printf("pipeline div(v x B x B) max difference: %e\n", reduc[1]);
+  cow_dfield_transform(diff, cmp2, 2, absdiff);
+  cow_dfield_settransform(diff, cow_trans_component);
+  cow_dfield_setuserdata(diff, diff);
+  cow_dfield_reduce(diff, reduc);
+  printf("pipeline v.(v x B x B) max difference: %e\n", reduc[1]);
+
+  // The built-in pencil kernel, evaluated a row of zones at a time
+  // ---------------------------------------------------------------------------
+  cow_dfield_clearargs(divvBB);
+  cow_dfield_pusharg(divvBB, vcrossBcrossB);
+  cow_dfield_settransformpencil(divvBB, cow_pencil_div5);
+  cow_dfield_transformexecute(divvBB);
+  cow_dfield_transform(diff, cmp1, 2, absdiff);
+  cow_dfield_settransform(diff, cow_trans_component);
+  cow_dfield_setuserdata(diff, diff);
+  cow_dfield_reduce(diff, reduc);
+  printf("pencil div(v x B x B) max difference: %e\n", reduc[1]);
+
+  // The chain with pencil stages, and a divergence scaled by the grid spacing
+  // ---------------------------------------------------------------------------
+  cow_dfield *divvBBdx = cow_dfield_new2(domain, "divvBBdx", 1);
+  cow_dfield_clearargs(divvBBdx);
+  cow_dfield_pusharg(divvBBdx, vcrossBcrossB);
+  cow_dfield_settransformpencil(divvBBdx, cow_deriv_div5);
+  cow_dfield_setuserdata(divvBBdx, domain);
+  cow_dfield_transformexecute(divvBBdx);
+  pipe = cow_pipeline_new(domain);
+  cow_pipeline_settilesize(pipe, 1000);
+  v = cow_pipeline_addinput(pipe, vel);
+  b = cow_pipeline_addinput(pipe, mag);
+  args0[0] = v;
+  args0[1] = b;
+  vb = cow_pipeline_addpencilstage(pipe, cow_pencil_cross, args0, 2, 3, 0,
+				   NULL);
+  args1[0] = v;
+  args1[1] = vb;
+  vbb = cow_pipeline_addpencilstage(pipe, cow_pencil_cross, args1, 2, 3, 0,
+				    NULL);
+  div = cow_pipeline_addpencilstage(pipe, cow_deriv_div5, &vbb, 1, 1, 2,
+				    domain);
+  args2[0] = v;
+  args2[1] = vbb;
+  dot = cow_pipeline_addpencilstage(pipe, cow_pencil_dot3, args2, 2, 1, 0,
+				    NULL);
+  cow_pipeline_setoutput(pipe, div, divvBB);
+  cow_pipeline_setoutput(pipe, dot, vdotvBB);
+  cow_pipeline_execute(pipe);
+  cow_pipeline_del(pipe);
+  cmp1[0] = divvBBdx;
+  cow_dfield_transform(diff, cmp1, 2, absdiff);
+  cow_dfield_settransform(diff, cow_trans_component);
+  cow_dfield_setuserdata(diff, diff);
+  cow_dfield_reduce(diff, reduc);
+  printf("pencil pipeline div(v x B x B) / dx max difference: %e\n", reduc[1]);
+  cow_dfield_transform(diff, cmp2, 2, absdiff);
+  cow_dfield_settransform(diff, cow_trans_component);
+  cow_dfield_setuserdata(diff, diff);
+  cow_dfield_reduce(diff, reduc);
+  printf("pencil pipeline v.(v x B x B) max difference: %e\n", reduc[1]);
+  cow_dfield_del(divvBBdx);
+
+  // The chain with each transform finishing its guard exchange in the next
+  // ---------------------------------------------------------------------------
+  cow_dfield *ovB = cow_dfield_new2(domain, "vcrossB-overlap", 3);
+  cow_dfield *ovBB = cow_dfield_new2(domain, "vcrossBcrossB-overlap", 3);
+  cow_dfield *odiv = cow_dfield_new2(domain, "divvBB-overlap", 1);
+  cow_dfield *ovvB[2] = { vel, ovB };
+  cow_dfield_setsyncmode(ovB, COW_SYNC_OVERLAP);
+  cow_dfield_setsyncmode(ovBB, COW_SYNC_OVERLAP);
+  cow_dfield_setsyncmode(odiv, COW_SYNC_OVERLAP);
+  cow_dfield_transform(ovB, vB, 2, crossprod);
+  cow_dfield_transform(ovBB, ovvB, 2, crossprod);
+  cow_dfield_transform(odiv, &ovBB, 1, div5);
+  cmp1[0] = divvcrossBcrossB;
+  cmp1[1] = odiv;
+  cow_dfield_transform(diff, cmp1, 2, absdiff);
+  cow_dfield_settransform(diff, cow_trans_component);
+  cow_dfield_setuserdata(diff, diff);
+  cow_dfield_reduce(diff, reduc);
+  printf("overlapped div(v x B x B) max difference: %e\n", reduc[1]);
+  cow_dfield_del(ovB);
+  cow_dfield_del(ovBB);
+  cow_dfield_del(odiv);
+
+  // The chain leaving guard zones stale, with the stencil of each stage
+  // declared, so that only vcrossBcrossB is synchronized, when div5 reads it
+  // ---------------------------------------------------------------------------
+  cow_dfield *lvB = cow_dfield_new2(domain, "vcrossB-lazy", 3);
+  cow_dfield *lvBB = cow_dfield_new2(domain, "vcrossBcrossB-lazy", 3);
+  cow_dfield *ldiv = cow_dfield_new2(domain, "divvBB-lazy", 1);
+  cow_dfield_setsyncmode(lvB, COW_SYNC_LAZY);
+  cow_dfield_setsyncmode(lvBB, COW_SYNC_LAZY);
+  cow_dfield_setsyncmode(ldiv, COW_SYNC_LAZY);
+  cow_dfield_transform(lvB, vB, 2, crossprod);
+  cow_dfield_clearargs(lvBB);
+  cow_dfield_pusharg(lvBB, vel);
+  cow_dfield_pusharg(lvBB, lvB);
+  cow_dfield_settransform(lvBB, crossprod);
+  cow_dfield_settransformstencil(lvBB, COW_ALL_DIMS, 0);
+  cow_dfield_transformexecute(lvBB);
+  cow_dfield_clearargs(ldiv);
+  cow_dfield_pusharg(ldiv, lvBB);
+  cow_dfield_settransform(ldiv, div5);
+  cow_dfield_settransformstencil(ldiv, COW_ALL_DIMS, 2);
+  cow_dfield_transformexecute(ldiv);
+  cmp1[0] = divvcrossBcrossB;
+  cmp1[1] = ldiv;
+  cow_dfield_transform(diff, cmp1, 2, absdiff);
+  cow_dfield_settransform(diff, cow_trans_component);
+  cow_dfield_setuserdata(diff, diff);
+  cow_dfield_reduce(diff, reduc);
+  printf("lazy div(v x B x B) max difference: %e\n", reduc[1]);
+  // a reduction over the divergence of a field whose guard zones were never
+  // synchronized, which synchronizes those its stencil reads
+  cow_dfield *rvBB = cow_dfield_new2(domain, "vcrossBcrossB-reduce", 3);
+  double lazyreduc[3];
+  cow_dfield_setsyncmode(rvBB, COW_SYNC_LAZY);
+  cow_dfield_transform(rvBB, vvB, 2, crossprod);
+  cow_dfield_settransform(rvBB, cow_trans_div5);
+  cow_dfield_reduce(rvBB, lazyreduc);
+  cow_dfield_settransform(vcrossBcrossB, cow_trans_div5);
+  cow_dfield_reduce(vcrossBcrossB, reduc);
+  printf("lazy reduce div(v x B x B) max difference: %e\n",
+	 fabs(lazyreduc[2] - reduc[2]) + fabs(lazyreduc[1] - reduc[1]));
+  cow_dfield_del(rvBB);
+  cow_dfield_del(lvB);
+  cow_dfield_del(lvBB);
+  cow_dfield_del(ldiv);
+
+  cow_dfield_del(diff);
+  cow_dfield_del(divvBB);
+  cow_dfield_del(vdotvBB);
+  cow_dfield_del(vcrossB);
+  cow_dfield_del(vcrossBcrossB);
+  cow_dfield_del(divvcrossBcrossB);
+  cow_dfield_del(vdotvcrossBcrossB);
+  cow_dfield_del(vel);
+  cow_dfield_del(mag);
+  cow_domain_del(domain);
+  cow_finalize();
+  return 0;
+}
@@ -0,0 +1,857 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "cow.h"
+#if (COW_MPI)
+#include <mpi.h>
+#endif
+
+#define GETENVINT(a,dflt) (getenv(a) ? atoi(getenv(a)) : dflt)
+
+static int ndim_sizes[3] = { 24, 10, 8 };
+
+cow_dfield *cow_dfield_new4(cow_domain *domain, char *name, int nmembers,
+			    int layout, int precision)
+{
+  char mname[16];
+  cow_dfield *f = cow_dfield_new();
+  cow_dfield_setdomain(f, domain);
+  cow_dfield_setname(f, name);
+  for (int n=0; n<nmembers; ++n) {
+    snprintf(mname, 16, "%d", n);
+    cow_dfield_addmember(f, mname);
+  }
+  cow_dfield_setlayout(f, layout);
+  cow_dfield_setprecision(f, precision);
+  cow_dfield_commit(f);
+  return f;
+}
+cow_dfield *cow_dfield_new3(cow_domain *domain, char *name, int nmembers,
+			    int layout)
+{
+  return cow_dfield_new4(domain, name, nmembers, layout, COW_PRECISION_DOUBLE);
+}
+cow_dfield *cow_dfield_new2(cow_domain *domain, char *name, int nmembers)
+{
+  return cow_dfield_new3(domain, name, nmembers, COW_LAYOUT_INTERLEAVED);
+}
+
+// Every zone holds a code for its periodic global index and member. Interior
+// zones are set, the guard zones are poisoned, and after synchronization
+// every zone is checked. For a partial sync, the reference holds the code only
+// in the guard zones within `depth` of the interior along the dimensions in
+// `mask`. Guard zones beyond faces which are not periodic hold the code of
+// the zone they are filled from, negated for members normal to a reflecting
+// face. Shearing faces are displaced by shear_zones along dimension 1.
+// -----------------------------------------------------------------------------
+static int components[2] = { -1, -1 };
+static int shear_zones = 3;
+static double value(cow_domain *d, int m, int *I)
+{
+  double v = m;
+  double scale = 10.0;
+  double sign = 1.0;
+  int nd = cow_domain_getndim(d);
+  int ng = cow_domain_getguard(d);
+  int g[3];
+  for (int n=0; n<nd; ++n) {
+    g[n] = cow_domain_getglobalstartindex(d, n) + I[n] - ng;
+  }
+  for (int n=0; n<nd; ++n) {
+    int N = cow_domain_getnumglobalzones(d, n);
+    if (cow_domain_getboundary(d, n, 0) == COW_BOUNDARY_SHEARING) {
+      if (g[n] < 0) g[1] += shear_zones;
+      if (g[n] >= N) g[1] -= shear_zones;
+    }
+  }
+  for (int n=0; n<nd; ++n) {
+    int N = cow_domain_getnumglobalzones(d, n);
+    int side = g[n] < 0 ? 0 : (g[n] >= N ? 1 : -1);
+    int bc = side < 0 ? COW_BOUNDARY_PERIODIC : cow_domain_getboundary(d, n, side);
+    switch (bc) {
+    case COW_BOUNDARY_OUTFLOW:
+      g[n] = side ? N - 1 : 0;
+      break;
+    case COW_BOUNDARY_REFLECTING:
+      g[n] = side ? 2 * N - 1 - g[n] : -1 - g[n];
+      if (components[m] == n) sign = -sign;
+      break;
+    default:
+      g[n] = ((g[n] % N) + N) % N;
+      break;
+    }
+    v += scale * g[n];
+    scale *= 100.0;
+  }
+  return sign * v;
+}
+static double get(cow_dfield *f, long n)
+{
+  void *x = cow_dfield_getdatabuffer(f);
+  if (cow_dfield_getprecision(f) == COW_PRECISION_SINGLE) {
+    return ((float*) x)[n];
+  }
+  return ((double*) x)[n];
+}
+static void put(cow_dfield *f, long n, double v)
+{
+  void *x = cow_dfield_getdatabuffer(f);
+  if (cow_dfield_getprecision(f) == COW_PRECISION_SINGLE) {
+    ((float*) x)[n] = v;
+  }
+  else {
+    ((double*) x)[n] = v;
+  }
+}
+static void fill(cow_dfield *f, int mask, int depth)
+{
+  cow_domain *d = cow_dfield_getdomain(f);
+  int nd = cow_domain_getndim(d);
+  int ng = cow_domain_getguard(d);
+  int nm = cow_dfield_getnmembers(f);
+  int N[3] = { 1, 1, 1 };
+  int S[4];
+  for (int n=0; n<nd; ++n) {
+    N[n] = cow_domain_getnumlocalzonesincguard(d, n);
+  }
+  for (int n=0; n<4; ++n) {
+    S[n] = cow_dfield_getstride(f, n);
+  }
+  for (int i=0; i<N[0]; ++i) {
+    for (int j=0; j<N[1]; ++j) {
+      for (int k=0; k<N[2]; ++k) {
+	int I[3] = { i, j, k };
+	int poison = 0;
+	for (int n=0; n<nd; ++n) {
+	  int w = mask & (1 << n) ? depth : 0;
+	  if (I[n] < ng - w || I[n] >= N[n] - ng + w) poison = 1;
+	}
+	int z = i * S[0] + j * S[1] + k * S[2];
+	for (int m=0; m<nm; ++m) {
+	  put(f, z + m * S[3], poison ? -12345.0 : value(d, m, I));
+	}
+      }
+    }
+  }
+}
+static void histcb(double *result, double **args, int **s, void *u)
+{
+  result[0] = args[0][0];
+}
+static double maxerror(cow_dfield *f, cow_dfield *ref)
+// -----------------------------------------------------------------------------
+// Compares every zone and member of `f` and `ref`, whose layouts may differ. If
+// `f` is single precision, `ref` is rounded to floats first.
+// -----------------------------------------------------------------------------
+{
+  long n = cow_domain_getnumlocalzonesincguard(cow_dfield_getdomain(f),
+					       COW_ALL_DIMS);
+  int nm = cow_dfield_getnmembers(f);
+  int sf = cow_dfield_getstride(f, 3), zf = sf == 1 ? nm : 1;
+  int sr = cow_dfield_getstride(ref, 3), zr = sr == 1 ? nm : 1;
+  int single = cow_dfield_getprecision(f) == COW_PRECISION_SINGLE;
+  double err = 0.0;
+  for (long q=0; q<n; ++q) {
+    for (int m=0; m<nm; ++m) {
+      double y = get(ref, q*zr + m*sr);
+      double e = fabs(get(f, q*zf + m*sf) - (single ? (float) y : y));
+      if (e > err) err = e;
+    }
+  }
+  return err;
+}
+
+int main(int argc, char **argv)
+{
+  int modes = 0;
+  modes |= GETENVINT("COW_NOREOPEN_STDOUT", 0) ? COW_NOREOPEN_STDOUT : 0;
+  modes |= GETENVINT("COW_DISABLE_MPI", 0) ? COW_DISABLE_MPI : 0;
+
+  cow_init(argc, argv, modes);
+
+  int exchange[3] = { COW_EXCHANGE_DATATYPE, COW_EXCHANGE_PERSISTENT,
+		      COW_EXCHANGE_FACES };
+  char *names[3] = { "datatype", "persistent", "faces" };
+  for (int nd=1; nd<=3; ++nd) {
+    cow_domain *domain = cow_domain_new();
+    cow_domain_setndim(domain, nd);
+    for (int n=0; n<nd; ++n) {
+      cow_domain_setsize(domain, n, ndim_sizes[n]);
+    }
+    cow_domain_setguard(domain, 2);
+    cow_domain_commit(domain);
+    cow_dfield *f = cow_dfield_new2(domain, "f", 2);
+    cow_dfield *ref = cow_dfield_new2(domain, "ref", 2);
+    fill(ref, 7, 2);
+    for (int e=0; e<3; ++e) {
+      cow_domain_setexchange(domain, exchange[e]);
+      double err = 0.0;
+      for (int rep=0; rep<3; ++rep) { // persistent requests are reused
+	fill(f, 0, 0);
+	cow_dfield_syncguard(f);
+	err += maxerror(f, ref);
+      }
+      fill(f, 0, 0);
+      cow_dfield_syncguard_begin(f);
+      cow_dfield_syncguard_end(f);
+      err += maxerror(f, ref);
+      printf("%dd guard exchange %-10s max error: %e\n", nd, names[e], err);
+    }
+    // fields of 1, 2 and 3 members, sharing each message to a neighbor
+    cow_dfield *many[3], *refs[3];
+    for (int q=0; q<3; ++q) {
+      many[q] = cow_dfield_new2(domain, "many", q + 1);
+      refs[q] = cow_dfield_new2(domain, "refs", q + 1);
+      fill(refs[q], 7, 2);
+    }
+    for (int e=0; e<3; ++e) {
+      cow_domain_setexchange(domain, exchange[e]);
+      double err = 0.0;
+      for (int q=0; q<3; ++q) {
+	fill(many[q], 0, 0);
+      }
+      cow_dfield_syncguard_many(many, 3);
+      for (int q=0; q<3; ++q) {
+	err += maxerror(many[q], refs[q]);
+      }
+      printf("%dd guard exchange %-10s of 3 fields max error: %e\n", nd,
+	     names[e], err);
+    }
+    for (int q=0; q<3; ++q) {
+      cow_dfield_del(many[q]);
+      cow_dfield_del(refs[q]);
+    }
+    // every combination of dimensions, to depth 1 and 2
+    double err = 0.0;
+    for (int mask=1; mask<(1<<nd); ++mask) {
+      for (int depth=1; depth<=2; ++depth) {
+	fill(f, 0, 0);
+	fill(ref, mask, depth);
+	cow_dfield_syncguard_partial(f, mask, depth);
+	err += maxerror(f, ref);
+      }
+    }
+    printf("%dd partial guard sync max error: %e\n", nd, err);
+    cow_dfield_del(f);
+    cow_dfield_del(ref);
+    cow_domain_del(domain);
+  }
+
+  // a process grid given along x, and compact blocks of two processes
+  for (int t=0; t<2; ++t) {
+    cow_domain *domain = cow_domain_new();
+    cow_domain_setndim(domain, 3);
+    for (int n=0; n<3; ++n) {
+      cow_domain_setsize(domain, n, ndim_sizes[n]);
+    }
+    cow_domain_setguard(domain, 2);
+    if (t == 0) {
+      cow_domain_setprocsizes(domain, 0, 1);
+    }
+    else {
+      cow_domain_settopology(domain, COW_TOPOLOGY_NODES);
+      cow_domain_setnodesize(domain, 2);
+    }
+    cow_domain_commit(domain);
+    cow_dfield *f = cow_dfield_new2(domain, "f", 2);
+    cow_dfield *ref = cow_dfield_new2(domain, "ref", 2);
+    fill(f, 0, 0);
+    fill(ref, 7, 2);
+    cow_dfield_syncguard(f);
+    double err = maxerror(f, ref);
+    if (t == 0 && cow_domain_getnumlocalzonesinterior(domain, 0) !=
+	ndim_sizes[0]) {
+      err += 1.0;
+    }
+    printf("3d guard exchange %s max error: %e\n",
+	   t == 0 ? "on a given grid " : "on node blocks  ", err);
+    cow_dfield_del(f);
+    cow_dfield_del(ref);
+    cow_domain_del(domain);
+  }
+
+  // a shearing box, periodic in y, with outflow and reflecting faces along z,
+  // and a 2d box with no periodic dimension
+  for (int nd=3; nd>=2; --nd) {
+    int sizes[3] = { 24, nd == 3 ? 8 : 10, 10 };
+    cow_domain *domain = cow_domain_new();
+    cow_domain_setndim(domain, nd);
+    for (int n=0; n<nd; ++n) {
+      cow_domain_setsize(domain, n, sizes[n]);
+    }
+    cow_domain_setguard(domain, 2);
+    if (nd == 3) {
+      cow_domain_setboundary(domain, 0, 0, COW_BOUNDARY_SHEARING);
+      cow_domain_setboundary(domain, 0, 1, COW_BOUNDARY_SHEARING);
+      cow_domain_setshear(domain, 0, 1, shear_zones / 8.0);
+      cow_domain_setboundary(domain, 2, 0, COW_BOUNDARY_OUTFLOW);
+      cow_domain_setboundary(domain, 2, 1, COW_BOUNDARY_REFLECTING);
+      components[0] = -1;
+      components[1] = 2;
+    }
+    else {
+      cow_domain_setboundary(domain, 0, 0, COW_BOUNDARY_OUTFLOW);
+      cow_domain_setboundary(domain, 0, 1, COW_BOUNDARY_REFLECTING);
+      cow_domain_setboundary(domain, 1, 0, COW_BOUNDARY_REFLECTING);
+      cow_domain_setboundary(domain, 1, 1, COW_BOUNDARY_REFLECTING);
+      components[0] = 1;
+      components[1] = 0;
+    }
+    cow_domain_commit(domain);
+    cow_dfield *f = cow_dfield_new2(domain, "f", 2);
+    cow_dfield *ref = cow_dfield_new2(domain, "ref", 2);
+    for (int m=0; m<2; ++m) {
+      if (components[m] >= 0) cow_dfield_setcomponent(f, m, components[m]);
+    }
+    for (int e=0; e<3; ++e) {
+      cow_domain_setexchange(domain, exchange[e]);
+      fill(f, 0, 0);
+      fill(ref, 7, 2);
+      cow_dfield_syncguard(f);
+      double err = maxerror(f, ref);
+      fill(f, 0, 0);
+      cow_dfield_syncguard_many(&f, 1);
+      err += maxerror(f, ref);
+      for (int mask=1; mask<(1<<nd); ++mask) {
+	fill(f, 0, 0);
+	fill(ref, mask, 1);
+	cow_dfield_syncguard_partial(f, mask, 1);
+	err += maxerror(f, ref);
+      }
+      printf("%dd boundary conditions %-10s max error: %e\n", nd, names[e],
+	     err);
+    }
+    cow_dfield_del(f);
+    cow_dfield_del(ref);
+    cow_domain_del(domain);
+  }
+
+  // subgrids cut by rising cost weights along x, checked by a guard exchange
+  // and by nearest-zone samples, which are routed by the cuts; then the same
+  // with the data in shared memory, on one node and on nodes of two processes,
+  // batched for the guard exchange with a private field
+  for (int t=0; t<3; ++t) {
+    char *names[3] = { "weighted subgrids  ", "shared memory      ",
+		       "shared, node pairs " };
+    double w[24];
+    for (int n=0; n<24; ++n) {
+      w[n] = 1.0 + n;
+    }
+    cow_domain *domain = cow_domain_new();
+    cow_domain_setndim(domain, 3);
+    for (int n=0; n<3; ++n) {
+      cow_domain_setsize(domain, n, ndim_sizes[n]);
+    }
+    cow_domain_setguard(domain, 2);
+    cow_domain_setcost(domain, 0, w, 24);
+    if (t == 2) {
+      cow_domain_setnodesize(domain, 2);
+    }
+    cow_domain_commit(domain);
+    cow_dfield *f = cow_dfield_new();
+    cow_dfield_setdomain(f, domain);
+    cow_dfield_setname(f, "f");
+    cow_dfield_addmember(f, "0");
+    cow_dfield_addmember(f, "1");
+    cow_dfield_setmemory(f, t == 0 ? COW_MEMORY_PRIVATE : COW_MEMORY_SHARED);
+    cow_dfield_commit(f);
+    cow_dfield *ref = cow_dfield_new2(domain, "ref", 2);
+    fill(f, 0, 0);
+    fill(ref, 7, 2);
+    cow_dfield_syncguard(f);
+    double err = maxerror(f, ref);
+    fill(f, 0, 0);
+    fill(ref, 5, 1);
+    cow_dfield_syncguard_partial(f, 5, 1);
+    err += maxerror(f, ref);
+    cow_dfield *g = cow_dfield_new2(domain, "g", 2); // private, batched with f
+    cow_dfield *many[2] = { f, g };
+    fill(f, 0, 0);
+    fill(g, 0, 0);
+    fill(ref, 7, 2);
+    cow_dfield_syncguard_many(many, 2);
+    err += maxerror(f, ref) + maxerror(g, ref);
+    cow_dfield_del(g);
+    double x[3*16];
+    for (int q=0; q<16; ++q) {
+      for (int n=0; n<3; ++n) {
+	x[3*q + n] = (rand() % ndim_sizes[n] + 0.5) / ndim_sizes[n];
+      }
+    }
+    double *r, *s;
+    int ns;
+    cow_dfield_setsamplecoords(f, x, 16, 3);
+    cow_dfield_setsamplemode(f, COW_SAMPLE_NEAREST);
+    cow_dfield_sampleexecute(f);
+    cow_dfield_getsamplecoords(f, &r, &ns, NULL);
+    cow_dfield_getsampleresult(f, &s, NULL, NULL);
+    for (int q=0; q<ns; ++q) {
+      for (int m=0; m<2; ++m) {
+	double v = m, scale = 10.0;
+	for (int n=0; n<3; ++n) {
+	  v += scale * (int) (r[3*q + n] * ndim_sizes[n]);
+	  scale *= 100.0;
+	}
+	if (fabs(s[2*q + m] - v) > err) err = fabs(s[2*q + m] - v);
+      }
+    }
+    if (ns != 16) err += 1.0;
+    printf("3d %s max error: %e\n", names[t], err);
+    cow_dfield_del(f);
+    cow_dfield_del(ref);
+    cow_domain_del(domain);
+  }
+
+  // a field moved from pencils along x with one guard zone onto the default
+  // process grid, cut by cost weights, with two
+  {
+    double w[10] = { 1, 1, 1, 1, 1, 4, 4, 4, 4, 4 };
+    cow_domain *pencils = cow_domain_new();
+    cow_domain *blocks = cow_domain_new();
+    cow_domain_setndim(pencils, 3);
+    cow_domain_setndim(blocks, 3);
+    for (int n=0; n<3; ++n) {
+      cow_domain_setsize(pencils, n, ndim_sizes[n]);
+      cow_domain_setsize(blocks, n, ndim_sizes[n]);
+    }
+    cow_domain_setguard(pencils, 1);
+    cow_domain_setguard(blocks, 2);
+    cow_domain_setprocsizes(pencils, 0, 1);
+    cow_domain_setcost(blocks, 1, w, 10);
+    cow_domain_commit(pencils);
+    cow_domain_commit(blocks);
+    cow_dfield *f = cow_dfield_new2(pencils, "f", 3);
+    cow_dfield *ref = cow_dfield_new2(blocks, "ref", 3);
+    fill(f, 0, 0);
+    fill(ref, 7, 2);
+    cow_dfield *g = cow_dfield_redistribute(f, blocks);
+    double err = maxerror(g, ref);
+    cow_dfield_del(g);
+    fill(ref, 7, 1);
+    g = cow_dfield_redistribute(ref, pencils);
+    cow_dfield_del(ref);
+    ref = cow_dfield_new2(pencils, "ref", 3);
+    fill(ref, 7, 1);
+    err += maxerror(g, ref);
+    printf("3d redistributed field max error: %e\n", err);
+    cow_dfield_del(g);
+    cow_dfield_del(f);
+    cow_dfield_del(ref);
+    cow_domain_del(pencils);
+    cow_domain_del(blocks);
+  }
+
+  // fields drawn from a domain pool under a memory budget: a field committed
+  // after another is deleted gets its block back, and the data of fields is
+  // zeroed by the threads of the loops before it is filled
+  {
+    long long base = cow_memory_getinuse();
+    cow_memory_setbudget(base + (64 << 20));
+    cow_domain *domain = cow_domain_new();
+    cow_domain_setndim(domain, 3);
+    for (int n=0; n<3; ++n) {
+      cow_domain_setsize(domain, n, ndim_sizes[n]);
+    }
+    cow_domain_setguard(domain, 2);
+    cow_domain_setallocator(domain, COW_ALLOC_POOL | COW_ALLOC_FIRSTTOUCH);
+    cow_domain_commit(domain);
+    cow_dfield *f = cow_dfield_new2(domain, "f", 2);
+    cow_dfield *ref = cow_dfield_new2(domain, "ref", 2);
+    double err = 0.0;
+    double *A = (double*) cow_dfield_getdatabuffer(f);
+    long long nd = 2 * cow_domain_getnumlocalzonesincguard(domain, COW_ALL_DIMS);
+    for (long long n=0; n<nd; ++n) {
+      err += fabs(A[n]);
+    }
+    long long used = cow_memory_getinuse();
+    if (used - base < 2 * nd * (long long) sizeof(double)) err += 1.0;
+    fill(f, 0, 0);
+    fill(ref, 7, 2);
+    cow_dfield_syncguard(f);
+    err += maxerror(f, ref);
+    cow_dfield_del(f);
+    if (cow_memory_getinuse() != used) err += 1.0;
+    f = cow_dfield_new2(domain, "f", 2);
+    if (cow_dfield_getdatabuffer(f) != A) err += 1.0;
+    cow_dfield_del(f);
+    cow_dfield_del(ref);
+    if (cow_memory_gethighwater() < used) err += 1.0;
+    cow_domain_releasepool(domain);
+    if (cow_memory_getinuse() != base) err += 1.0;
+    printf("3d pooled fields under a memory budget max error: %e\n", err);
+    cow_domain_del(domain);
+    cow_memory_setbudget(0);
+  }
+
+  // fields with each member stored as a contiguous array: guard exchanges in
+  // every mode, a zone and a pencil transform, samples and a redistribution,
+  // checked against the same operations on interleaved fields
+  {
+    cow_domain *domain = cow_domain_new();
+    cow_domain_setndim(domain, 3);
+    for (int n=0; n<3; ++n) {
+      cow_domain_setsize(domain, n, ndim_sizes[n]);
+    }
+    cow_domain_setguard(domain, 2);
+    cow_domain_commit(domain);
+    cow_dfield *f = cow_dfield_new3(domain, "f", 3, COW_LAYOUT_PLANAR);
+    cow_dfield *ref = cow_dfield_new2(domain, "ref", 3);
+    double err = 0.0;
+    for (int e=0; e<3; ++e) {
+      cow_domain_setexchange(domain, exchange[e]);
+      fill(f, 0, 0);
+      fill(ref, 7, 2);
+      cow_dfield_syncguard(f);
+      err += maxerror(f, ref);
+      fill(f, 0, 0);
+      fill(ref, 5, 1);
+      cow_dfield_syncguard_partial(f, 5, 1);
+      err += maxerror(f, ref);
+    }
+    fill(f, 0, 0);
+    fill(ref, 0, 0);
+    cow_dfield_syncguard(f);
+    cow_dfield_syncguard(ref);
+    cow_transform zone[2] = { cow_trans_rot5, cow_trans_rot5 };
+    cow_pencil pencil[2] = { NULL, cow_deriv_curl };
+    for (int t=0; t<2; ++t) {
+      cow_dfield *g = cow_dfield_new3(domain, "g", 3, COW_LAYOUT_PLANAR);
+      cow_dfield *h = cow_dfield_new2(domain, "h", 3);
+      cow_dfield *out[2] = { g, h };
+      cow_dfield *arg[2] = { f, ref };
+      for (int q=0; q<2; ++q) {
+	fill(out[q], 0, 0);
+	cow_dfield_pusharg(out[q], arg[q]);
+	cow_dfield_setuserdata(out[q], domain);
+	if (pencil[t]) cow_dfield_settransformpencil(out[q], pencil[t]);
+	else cow_dfield_settransform(out[q], zone[t]);
+	cow_dfield_transformexecute(out[q]);
+      }
+      err += maxerror(g, h);
+      cow_dfield_del(g);
+      cow_dfield_del(h);
+    }
+    double x[3*16];
+    for (int q=0; q<16; ++q) {
+      for (int n=0; n<3; ++n) {
+	x[3*q + n] = (rand() % 1000 + 0.5) / 1000.0;
+      }
+    }
+    double *s[2];
+    cow_dfield *sampled[2] = { f, ref };
+    for (int q=0; q<2; ++q) {
+      cow_dfield_setsamplecoords(sampled[q], x, 16, 3);
+      cow_dfield_setsamplemode(sampled[q], COW_SAMPLE_LINEAR);
+      cow_dfield_sampleexecute(sampled[q]);
+      cow_dfield_getsampleresult(sampled[q], &s[q], NULL, NULL);
+    }
+    for (int q=0; q<3*16; ++q) {
+      if (fabs(s[0][q] - s[1][q]) > err) err = fabs(s[0][q] - s[1][q]);
+    }
+    cow_dfield *g = cow_dfield_redistribute(f, domain);
+    err += maxerror(g, ref);
+    if (cow_dfield_getlayout(g) != COW_LAYOUT_PLANAR) err += 1.0;
+    printf("3d planar member layout max error: %e\n", err);
+    // views of the interior of both layouts, against an extracted copy
+    int I0[3], I1[3], N[3], S[3];
+    for (int n=0; n<3; ++n) {
+      I0[n] = cow_domain_getguard(domain);
+      I1[n] = I0[n] + cow_domain_getnumlocalzonesinterior(domain, n);
+    }
+    double *copy = (double*) malloc(3 * cow_domain_getnumlocalzonesinterior
+				    (domain, COW_ALL_DIMS) * sizeof(double));
+    cow_dfield_extract(ref, I0, I1, copy);
+    err = 0.0;
+    for (int q=0; q<2; ++q) {
+      for (int m=0; m<3; ++m) {
+	double *v = cow_dfield_getview(sampled[q], m, N, S);
+	for (int i=0; i<N[0]; ++i) {
+	  for (int j=0; j<N[1]; ++j) {
+	    for (int k=0; k<N[2]; ++k) {
+	      double e = v[i*S[0] + j*S[1] + k*S[2]] -
+		copy[((i*N[1] + j)*N[2] + k)*3 + m];
+	      if (fabs(e) > err) err = fabs(e);
+	    }
+	  }
+	}
+      }
+    }
+    printf("3d interior views max error: %e\n", err);
+    // members 2 and 0 pulled from both layouts, then member 1 put back
+    // alone, over the interior and over a box off the end of the rows
+    double *part = (double*) malloc(3 * cow_domain_getnumlocalzonesinterior
+				    (domain, COW_ALL_DIMS) * sizeof(double));
+    int pick[2] = { 2, 0 };
+    err = 0.0;
+    for (int box=0; box<2; ++box) {
+      int J1[3] = { I1[0], I1[1], box ? I1[2] - 1 : I1[2] };
+      int nk = J1[2] - I0[2];
+      for (int q=0; q<2; ++q) {
+	cow_dfield_extractmembers(sampled[q], I0, J1, part, pick, 2);
+	for (int i=0; i<N[0]; ++i) {
+	  for (int j=0; j<N[1]; ++j) {
+	    for (int k=0; k<nk; ++k) {
+	      int z = (i*N[1] + j)*nk + k, c = (i*N[1] + j)*N[2] + k;
+	      for (int p=0; p<2; ++p) {
+		double e = part[2*z + p] - copy[3*c + pick[p]];
+		if (fabs(e) > err) err = fabs(e);
+	      }
+	    }
+	  }
+	}
+	int one = 1;
+	cow_dfield_extractmembers(sampled[q], I0, J1, part, &one, 1);
+	for (int z=0; z<N[0]*N[1]*nk; ++z) {
+	  part[z] = -part[z];
+	}
+	cow_dfield_replacemembers(sampled[q], I0, J1, part, &one, 1);
+	for (int m=0; m<3; ++m) {
+	  double *v = cow_dfield_getview(sampled[q], m, N, S);
+	  for (int i=0; i<N[0]; ++i) {
+	    for (int j=0; j<N[1]; ++j) {
+	      for (int k=0; k<N[2]; ++k) {
+		double c = copy[((i*N[1] + j)*N[2] + k)*3 + m];
+		double e = v[i*S[0] + j*S[1] + k*S[2]];
+		e -= (m == 1 && k < nk) ? -c : c;
+		if (fabs(e) > err) err = fabs(e);
+	      }
+	    }
+	  }
+	}
+	cow_dfield_replace(sampled[q], I0, I1, copy);
+      }
+    }
+    printf("3d member subsets max error: %e\n", err);
+    free(part);
+    free(copy);
+    cow_dfield_del(g);
+    cow_dfield_del(f);
+    cow_dfield_del(ref);
+    cow_domain_del(domain);
+  }
+
+  // fields stored as floats, in both layouts: guard exchanges in every mode,
+  // a zone and a pencil transform, samples, a reduction, a histogram and a
+  // redistribution, checked against the same operations on a field of doubles
+  {
+    cow_domain *domain = cow_domain_new();
+    cow_domain_setndim(domain, 3);
+    for (int n=0; n<3; ++n) {
+      cow_domain_setsize(domain, n, ndim_sizes[n]);
+    }
+    cow_domain_setguard(domain, 2);
+    cow_domain_commit(domain);
+    cow_dfield *f[2] = {
+      cow_dfield_new4(domain, "f", 3, COW_LAYOUT_INTERLEAVED,
+		      COW_PRECISION_SINGLE),
+      cow_dfield_new4(domain, "p", 3, COW_LAYOUT_PLANAR,
+		      COW_PRECISION_SINGLE) };
+    cow_dfield *ref = cow_dfield_new2(domain, "ref", 3);
+    double err = 0.0;
+    for (int l=0; l<2; ++l) {
+      if (2 * cow_dfield_getdatabytes(f[l]) != cow_dfield_getdatabytes(ref)) {
+	err += 1.0;
+      }
+      for (int e=0; e<3; ++e) {
+	cow_domain_setexchange(domain, exchange[e]);
+	fill(f[l], 0, 0);
+	fill(ref, 7, 2);
+	cow_dfield_syncguard(f[l]);
+	err += maxerror(f[l], ref);
+	fill(f[l], 0, 0);
+	fill(ref, 5, 1);
+	cow_dfield_syncguard_partial(f[l], 5, 1);
+	err += maxerror(f[l], ref);
+      }
+      fill(f[l], 0, 0);
+      cow_dfield_syncguard(f[l]);
+    }
+    fill(ref, 0, 0);
+    cow_dfield_syncguard(ref);
+    cow_transform zone[2] = { cow_trans_rot5, cow_trans_rot5 };
+    cow_pencil pencil[2] = { NULL, cow_deriv_curl };
+    for (int t=0; t<2; ++t) {
+      cow_dfield *g = cow_dfield_new4(domain, "g", 3, COW_LAYOUT_PLANAR,
+				      COW_PRECISION_SINGLE);
+      cow_dfield *h = cow_dfield_new2(domain, "h", 3);
+      cow_dfield *out[2] = { g, h };
+      cow_dfield *arg[2] = { f[t], ref };
+      for (int q=0; q<2; ++q) {
+	fill(out[q], 0, 0);
+	cow_dfield_pusharg(out[q], arg[q]);
+	cow_dfield_setuserdata(out[q], domain);
+	if (pencil[t]) cow_dfield_settransformpencil(out[q], pencil[t]);
+	else cow_dfield_settransform(out[q], zone[t]);
+	cow_dfield_transformexecute(out[q]);
+      }
+      err += maxerror(g, h);
+      cow_dfield_del(g);
+      cow_dfield_del(h);
+    }
+    // derivatives along each axis, and a pipeline of two stencils whose tiles
+    // span rows, planes and their ends, written to single-precision outputs
+    // and read back from the first
+    for (int n=0; n<3; ++n) {
+      cow_dfield *g = cow_dfield_new4(domain, "g", 3, COW_LAYOUT_INTERLEAVED,
+				      COW_PRECISION_SINGLE);
+      cow_dfield *h = cow_dfield_new2(domain, "h", 3);
+      cow_dfield_derivative(g, f[1], n);
+      cow_dfield_derivative(h, ref, n);
+      err += maxerror(g, h);
+      cow_dfield_del(g);
+      cow_dfield_del(h);
+    }
+    {
+      cow_dfield *g[2], *h[2];
+      for (int q=0; q<2; ++q) {
+	g[q] = cow_dfield_new4(domain, "g", 3, q ? COW_LAYOUT_PLANAR :
+			       COW_LAYOUT_INTERLEAVED, COW_PRECISION_SINGLE);
+	h[q] = cow_dfield_new2(domain, "h", 3);
+	cow_dfield_pusharg(h[q], q ? h[0] : ref);
+	cow_dfield_settransform(h[q], cow_trans_rot5);
+	cow_dfield_transformexecute(h[q]);
+      }
+      cow_pipeline *pipe = cow_pipeline_new(domain);
+      cow_pipeline_settilesize(pipe, 37);
+      int in = cow_pipeline_addinput(pipe, f[1]);
+      int rot = cow_pipeline_addpencilstage(pipe, cow_pencil_rot5, &in, 1, 3,
+					    2, NULL);
+      int rot2 = cow_pipeline_addpencilstage(pipe, cow_pencil_rot5, &rot, 1,
+					     3, 2, NULL);
+      cow_pipeline_setoutput(pipe, rot, g[0]);
+      cow_pipeline_setoutput(pipe, rot2, g[1]);
+      cow_pipeline_execute(pipe);
+      cow_pipeline_del(pipe);
+      err += maxerror(g[0], h[0]);
+      // the second stage reads the rounded first
+      cow_dfield_clearargs(h[1]);
+      cow_dfield_pusharg(h[1], g[0]);
+      cow_dfield_transformexecute(h[1]);
+      err += maxerror(g[1], h[1]);
+      for (int q=0; q<2; ++q) {
+	cow_dfield_del(g[q]);
+	cow_dfield_del(h[q]);
+      }
+    }
+    double x[3*16];
+    for (int q=0; q<16; ++q) {
+      for (int n=0; n<3; ++n) {
+	x[3*q + n] = (rand() % 1000 + 0.5) / 1000.0;
+      }
+    }
+    double *s[2];
+    cow_dfield *sampled[2] = { f[1], ref };
+    for (int q=0; q<2; ++q) {
+      cow_dfield_setsamplecoords(sampled[q], x, 16, 3);
+      cow_dfield_setsamplemode(sampled[q], COW_SAMPLE_LINEAR);
+      cow_dfield_sampleexecute(sampled[q]);
+      cow_dfield_getsampleresult(sampled[q], &s[q], NULL, NULL);
+    }
+    for (int q=0; q<3*16; ++q) {
+      err += fabs(s[0][q] - s[1][q]);
+    }
+    double sum[2][3];
+    for (int q=0; q<2; ++q) {
+      cow_dfield_settransform(sampled[q], histcb);
+      cow_dfield_reduce(sampled[q], sum[q]);
+    }
+    for (int n=0; n<3; ++n) {
+      err += fabs(sum[0][n] - sum[1][n]);
+    }
+    cow_histogram *hist[2];
+    double *counts[2];
+    for (int q=0; q<2; ++q) {
+      hist[q] = cow_histogram_new();
+      cow_histogram_setlower(hist[q], 0, 0.0);
+      cow_histogram_setupper(hist[q], 0, 1e6);
+      cow_histogram_setnbins(hist[q], 0, 50);
+      cow_histogram_commit(hist[q]);
+      cow_histogram_populate(hist[q], sampled[q], histcb);
+      cow_histogram_seal(hist[q]);
+      cow_histogram_getbinval1(hist[q], &counts[q], NULL);
+    }
+    for (int b=0; b<50; ++b) {
+      err += fabs(counts[0][b] - counts[1][b]);
+    }
+    cow_histogram_del(hist[0]);
+    cow_histogram_del(hist[1]);
+    cow_dfield *g = cow_dfield_redistribute(f[0], domain);
+    err += maxerror(g, ref);
+    if (cow_dfield_getprecision(g) != COW_PRECISION_SINGLE) err += 1.0;
+    printf("3d single precision max error: %e\n", err);
+    cow_dfield_del(g);
+    cow_dfield_del(f[0]);
+    cow_dfield_del(f[1]);
+    cow_dfield_del(ref);
+    cow_domain_del(domain);
+    // the scratch of a stencil transform between single-precision fields is
+    // far smaller than a double copy of either
+    domain = cow_domain_new();
+    cow_domain_setndim(domain, 3);
+    for (int n=0; n<3; ++n) {
+      cow_domain_setsize(domain, n, 64);
+    }
+    cow_domain_setguard(domain, 2);
+    cow_domain_commit(domain);
+    g = cow_dfield_new4(domain, "g", 3, COW_LAYOUT_INTERLEAVED,
+			COW_PRECISION_SINGLE);
+    cow_dfield *a = cow_dfield_new4(domain, "a", 3, COW_LAYOUT_INTERLEAVED,
+				    COW_PRECISION_SINGLE);
+    fill(a, 0, 0);
+    cow_dfield_pusharg(g, a);
+    cow_dfield_settransform(g, cow_trans_rot5);
+    cow_memory_resethighwater();
+    long long used = cow_memory_getinuse();
+    cow_dfield_transformexecute(g);
+    long long scratch = cow_memory_gethighwater() - used;
+    err = scratch < (long long) cow_dfield_getdatabytes(g) ? 0.0 : 1.0;
+    printf("3d single precision scratch max error: %e\n", err);
+    cow_dfield_del(g);
+    cow_dfield_del(a);
+    cow_domain_del(domain);
+  }
+
+#if (COW_MPI)
+  // two groups of processes, each with a domain of its own, and a histogram
+  // sealed over the group of the field it is populated from
+  if (cow_mpirunning()) {
+    int rank;
+    MPI_Comm group;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_split(MPI_COMM_WORLD, rank % 2, rank, &group);
+    cow_domain *domain = cow_domain_new();
+    cow_domain_setndim(domain, 3);
+    for (int n=0; n<3; ++n) {
+      cow_domain_setsize(domain, n, ndim_sizes[n]);
+    }
+    cow_domain_setguard(domain, 2);
+    cow_domain_setcomm(domain, &group);
+    cow_domain_commit(domain);
+    cow_dfield *f = cow_dfield_new2(domain, "f", 2);
+    cow_dfield *ref = cow_dfield_new2(domain, "ref", 2);
+    fill(f, 0, 0);
+    fill(ref, 7, 2);
+    cow_dfield_syncguard(f);
+    double err = maxerror(f, ref);
+    cow_histogram *hist = cow_histogram_new();
+    cow_histogram_setlower(hist, 0, -1.0);
+    cow_histogram_setupper(hist, 0, 1e6);
+    cow_histogram_setnbins(hist, 0, 10);
+    cow_histogram_commit(hist);
+    cow_histogram_populate(hist, f, histcb);
+    cow_histogram_seal(hist);
+    if (cow_histogram_gettotalcounts(hist) !=
+	cow_domain_getnumglobalzones(domain, COW_ALL_DIMS)) {
+      err += 1.0;
+    }
+    printf("3d domain on a group of processes max error: %e\n", err);
+    cow_histogram_del(hist);
+    cow_dfield_del(f);
+    cow_dfield_del(ref);
+    cow_domain_del(domain);
+    MPI_Comm_free(&group);
+  }
+#endif
+  cow_finalize();
+  return 0;
+}